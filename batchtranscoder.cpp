@@ -0,0 +1,351 @@
+#include "batchtranscoder.h"
+#include "imagehandler.h"
+#include "jpegsaver.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QWaitCondition>
+#include <algorithm>
+#include <cmath>
+#include <deque>
+#include <memory>
+
+namespace {
+
+// Очередь рабочего потока: владелец берёт задания с конца, остальные
+// потоки воруют с начала, где лежат задания, розданные раньше
+class WorkQueue {
+public:
+    void push(int job) {
+        QMutexLocker locker(&mutex);
+        jobs.push_back(job);
+    }
+
+    bool pop(int& job) {
+        QMutexLocker locker(&mutex);
+        if (jobs.empty()) {
+            return false;
+        }
+        job = jobs.back();
+        jobs.pop_back();
+        return true;
+    }
+
+    bool steal(int& job) {
+        QMutexLocker locker(&mutex);
+        if (jobs.empty()) {
+            return false;
+        }
+        job = jobs.front();
+        jobs.pop_front();
+        return true;
+    }
+
+private:
+    QMutex mutex;
+    std::deque<int> jobs;
+};
+
+// Ограничение памяти, занятой файлами в работе. Один файл пропускается
+// всегда, даже если сам по себе не укладывается в бюджет.
+class MemoryGate {
+public:
+    explicit MemoryGate(qint64 budget) : budget(budget) {}
+
+    void acquire(qint64 bytes) {
+        QMutexLocker locker(&mutex);
+        while (inUse > 0 && inUse + bytes > budget) {
+            released.wait(&mutex);
+        }
+        inUse += bytes;
+        peak = qMax(peak, inUse);
+    }
+
+    void release(qint64 bytes) {
+        QMutexLocker locker(&mutex);
+        inUse -= bytes;
+        released.wakeAll();
+    }
+
+    qint64 peakBytes() const {
+        QMutexLocker locker(&mutex);
+        return peak;
+    }
+
+private:
+    mutable QMutex mutex;
+    QWaitCondition released;
+    qint64 budget;
+    qint64 inUse = 0;
+    qint64 peak = 0;
+};
+
+inline double elapsedMs(const QElapsedTimer& timer) {
+    return timer.nsecsElapsed() / 1e6;
+}
+
+// Кадр RGB32, коэффициенты DCT прогрессивного декодера (2 байта на отсчёт,
+// до трёх отсчётов на пиксель), буфер кодировщика и сам файл
+qint64 estimateBytes(const JpegFileIndex& index, qint64 fileSize) {
+    const qint64 pixels = static_cast<qint64>(index.size.width()) * index.size.height();
+    qint64 bytes = pixels * 4 + pixels + fileSize;
+    if (index.isProgressive()) {
+        bytes += pixels * 3 * 2;
+    }
+    return bytes;
+}
+
+// Коэффициенты источника и результата (по 2 байта на отсчёт) и оба файла
+qint64 estimateLosslessBytes(const JpegFileIndex& index, qint64 fileSize) {
+    const qint64 pixels = static_cast<qint64>(index.size.width()) * index.size.height();
+    return pixels * 3 * 2 * 2 + fileSize * 2;
+}
+
+double percentile(const QVector<double>& sorted, double p) {
+    if (sorted.isEmpty()) {
+        return 0.0;
+    }
+    const int rank = static_cast<int>(std::ceil(p / 100.0 * sorted.size()));
+    return sorted[qBound(0, rank - 1, static_cast<int>(sorted.size()) - 1)];
+}
+
+} // namespace
+
+bool BatchTranscoder::collectJobs() {
+    jobs.clear();
+
+    QDir inputDir(options.inputDir);
+    if (!inputDir.exists()) {
+        failures.append("Input directory does not exist: " + options.inputDir);
+        return false;
+    }
+    if (!QDir().mkpath(options.outputDir)) {
+        failures.append("Cannot create output directory: " + options.outputDir);
+        return false;
+    }
+    QDir outputDir(options.outputDir);
+    if (inputDir.canonicalPath() == outputDir.canonicalPath()) {
+        failures.append("Output directory must differ from the input directory");
+        return false;
+    }
+
+    const QFileInfoList entries = inputDir.entryInfoList(QStringList() << "*.jpg" << "*.jpeg",
+                                                         QDir::Files | QDir::Readable);
+    for (const QFileInfo& entry : entries) {
+        Job job;
+        job.input = entry.absoluteFilePath();
+        job.output = outputDir.absoluteFilePath(entry.fileName());
+        job.fileSize = entry.size();
+        jobs.append(job);
+    }
+
+    // Крупные файлы раздаются первыми, чтобы к концу оставалась мелкая работа
+    std::sort(jobs.begin(), jobs.end(), [](const Job& a, const Job& b) {
+        return a.fileSize > b.fileSize;
+    });
+    return true;
+}
+
+bool BatchTranscoder::run() {
+    failures.clear();
+    for (int stage = 0; stage < StageCount; ++stage) {
+        latencies[stage].clear();
+    }
+    done = 0;
+    steals = 0;
+    bytesIn = 0;
+    bytesOut = 0;
+    peakInFlight = 0;
+    wallSeconds = 0.0;
+
+    if (!collectJobs()) {
+        return false;
+    }
+
+    threadCount = options.threads > 0 ? options.threads : QThread::idealThreadCount();
+    threadCount = qBound(1, threadCount, qMax(1, static_cast<int>(jobs.size())));
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+    for (int i = 0; i < threadCount; ++i) {
+        queues.emplace_back(new WorkQueue());
+    }
+    for (int i = 0; i < jobs.size(); ++i) {
+        queues[i % threadCount]->push(i);
+    }
+
+    MemoryGate gate(options.memoryBudget);
+    QVector<WorkerResult> results(threadCount);
+
+    auto worker = [&](int self) {
+        WorkerResult& result = results[self];
+        int index = 0;
+        while (true) {
+            bool found = queues[self]->pop(index);
+            for (int k = 1; !found && k < threadCount; ++k) {
+                found = queues[(self + k) % threadCount]->steal(index);
+                if (found) {
+                    result.steals++;
+                }
+            }
+            if (!found) {
+                break;
+            }
+
+            const Job& job = jobs.at(index);
+            QElapsedTimer total;
+            total.start();
+            QElapsedTimer timer;
+            timer.start();
+
+            QSharedPointer<MappedJpegFile> file(new MappedJpegFile());
+            if (!file->open(job.input) || !file->index().isValid()) {
+                const QString reason = file->index().errorString.isEmpty() ? QString("cannot open file")
+                                                                           : file->index().errorString;
+                result.failures.append(job.input + ": " + reason);
+                continue;
+            }
+            const double readMs = elapsedMs(timer);
+
+            const qint64 reserved = options.lossless ? estimateLosslessBytes(file->index(), file->size())
+                                                     : estimateBytes(file->index(), file->size());
+            gate.acquire(reserved);
+
+            ImageHandler* handler = ImageHandler::createHandler(file);
+            // Полосы JpegRestartDecoder ушли бы в глобальный пул поверх
+            // исполнителей пакета
+            handler->setDecodeThreads(1);
+            QImage image;
+            bool ok = false;
+            if (options.lossless) {
+                // Декодирование - чтение коэффициентов, кодирование - их
+                // перестановка и энтропийное кодирование
+                timer.restart();
+                ok = handler->transformFile(job.input, job.output, options.transform);
+                const double transformMs = elapsedMs(timer);
+                if (ok) {
+                    const JpegTransformStats& stats = handler->lastTransformStats();
+                    const double codingMs = stats.transformMs + stats.encodeMs;
+                    result.latencies[StageRead].append(readMs);
+                    result.latencies[StageDecode].append(stats.readMs);
+                    result.latencies[StageEncode].append(codingMs);
+                    result.latencies[StageWrite].append(qMax(0.0, transformMs - stats.readMs - codingMs));
+                    result.bytesIn += file->size();
+                    result.bytesOut += stats.outputBytes;
+                    result.done++;
+                } else {
+                    result.failures.append(job.input + ": " + handler->lastTransformError());
+                }
+            } else {
+                timer.restart();
+                ok = handler->loadFullResolution(job.input, image);
+                const double decodeMs = elapsedMs(timer);
+
+                if (ok) {
+                    SaveImageCommand saveCommand(handler, job.output, image, options.encode.quality,
+                                                 options.encode.progressive, options.encode.dctMethod,
+                                                 options.encode.optimizeHuffman);
+                    // Файлы и так кодируются параллельно
+                    saveCommand.setEncodeThreads(1);
+                    timer.restart();
+                    ok = saveCommand.execute();
+                    const double saveMs = elapsedMs(timer);
+                    if (ok) {
+                        const JpegEncodeStats& stats = saveCommand.stats();
+                        result.latencies[StageRead].append(readMs);
+                        result.latencies[StageDecode].append(decodeMs);
+                        result.latencies[StageEncode].append(stats.encodeMs);
+                        result.latencies[StageWrite].append(qMax(0.0, saveMs - stats.encodeMs));
+                        result.bytesIn += file->size();
+                        result.bytesOut += stats.outputBytes;
+                        result.done++;
+                    } else {
+                        result.failures.append(job.output + ": " + saveCommand.errorString());
+                    }
+                } else {
+                    result.failures.append(job.input + ": decoding failed");
+                }
+            }
+            image = QImage();
+            delete handler;
+            file.reset();
+            gate.release(reserved);
+
+            if (ok) {
+                result.latencies[StageTotal].append(elapsedMs(total));
+            }
+        }
+    };
+
+    QElapsedTimer wall;
+    wall.start();
+
+    // Рабочие потоки живут всё время пакета, поэтому пул свой
+    QThreadPool pool;
+    pool.setMaxThreadCount(threadCount);
+    QVector<QFuture<void>> futures;
+    for (int i = 0; i < threadCount; ++i) {
+        futures.append(QtConcurrent::run(&pool, worker, i));
+    }
+    for (QFuture<void>& future : futures) {
+        future.waitForFinished();
+    }
+
+    wallSeconds = wall.nsecsElapsed() / 1e9;
+    peakInFlight = gate.peakBytes();
+
+    for (const WorkerResult& result : results) {
+        for (int stage = 0; stage < StageCount; ++stage) {
+            latencies[stage] += result.latencies[stage];
+        }
+        done += result.done;
+        steals += result.steals;
+        bytesIn += result.bytesIn;
+        bytesOut += result.bytesOut;
+        failures += result.failures;
+    }
+    for (int stage = 0; stage < StageCount; ++stage) {
+        std::sort(latencies[stage].begin(), latencies[stage].end());
+    }
+
+    return failures.isEmpty();
+}
+
+void BatchTranscoder::printReport(QTextStream& out) const {
+    static const char* const stageNames[StageCount] = { "read", "decode", "encode", "write", "total" };
+    const double seconds = qMax(wallSeconds, 1e-9);
+    const double megabyte = 1024.0 * 1024.0;
+
+    out << QString("%1 %2 of %3 images with %4 threads in %5 s")
+               .arg(QString(options.lossless ? "Transformed" : "Transcoded"))
+               .arg(done).arg(jobs.size()).arg(threadCount).arg(wallSeconds, 0, 'f', 2) << "\n";
+    out << QString("Throughput: %1 images/s, %2 MB/s in, %3 MB/s out")
+               .arg(done / seconds, 0, 'f', 1)
+               .arg(bytesIn / megabyte / seconds, 0, 'f', 1)
+               .arg(bytesOut / megabyte / seconds, 0, 'f', 1) << "\n";
+    out << QString("Peak in-flight memory: %1 MB of %2 MB budget, %3 steals")
+               .arg(peakInFlight / megabyte, 0, 'f', 1)
+               .arg(options.memoryBudget / megabyte, 0, 'f', 0)
+               .arg(steals) << "\n";
+
+    out << QString("%1%2%3%4%5")
+               .arg(QString("stage"), -8).arg(QString("p50 ms"), 10).arg(QString("p90 ms"), 10)
+               .arg(QString("p99 ms"), 10).arg(QString("max ms"), 10) << "\n";
+    for (int stage = 0; stage < StageCount; ++stage) {
+        const QVector<double>& values = latencies[stage];
+        out << QString("%1%2%3%4%5")
+                   .arg(QString::fromLatin1(stageNames[stage]), -8)
+                   .arg(percentile(values, 50), 10, 'f', 2)
+                   .arg(percentile(values, 90), 10, 'f', 2)
+                   .arg(percentile(values, 99), 10, 'f', 2)
+                   .arg(values.isEmpty() ? 0.0 : values.last(), 10, 'f', 2) << "\n";
+    }
+
+    for (const QString& failure : failures) {
+        out << "Failed: " << failure << "\n";
+    }
+    out.flush();
+}
@@ -0,0 +1,79 @@
+#ifndef BATCHTRANSCODER_H
+#define BATCHTRANSCODER_H
+
+#include "jpegencoder.h"
+#include "jpegtransform.h"
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+
+struct BatchOptions {
+    QString inputDir;
+    QString outputDir;
+    JpegEncodeOptions encode;
+    // Преобразование в коэффициентах DCT вместо декодирования и перекодирования
+    bool lossless = false;
+    JpegTransformOptions transform;
+    int threads = 0;                                // 0 - по числу ядер
+    qint64 memoryBudget = 1024LL * 1024 * 1024;     // на все файлы в работе
+};
+
+// Пакетное перекодирование каталога без GUI: каждый файл проходит
+// ImageHandler (декодирование в полном разрешении) и SaveImageCommand.
+// Файлы раскладываются по очередям рабочих потоков, освободившийся поток
+// забирает работу у соседей. Одновременно в работе не больше файлов,
+// чем помещается в memoryBudget. В режиме lossless файл не декодируется:
+// JpegTransformer поворачивает и перепаковывает его коэффициенты.
+class BatchTranscoder {
+public:
+    enum Stage {
+        StageRead,      // отображение файла и индекс маркеров
+        StageDecode,
+        StageEncode,
+        StageWrite,
+        StageTotal,
+        StageCount
+    };
+
+    explicit BatchTranscoder(const BatchOptions& options) : options(options) {}
+
+    // false, если каталог не найден или хотя бы один файл не перекодирован
+    bool run();
+    void printReport(QTextStream& out) const;
+
+    QStringList errors() const { return failures; }
+
+private:
+    struct Job {
+        QString input;
+        QString output;
+        qint64 fileSize = 0;
+    };
+
+    struct WorkerResult {
+        QVector<double> latencies[StageCount];
+        int done = 0;
+        int steals = 0;
+        qint64 bytesIn = 0;
+        qint64 bytesOut = 0;
+        QStringList failures;
+    };
+
+    BatchOptions options;
+    QVector<Job> jobs;
+    QVector<double> latencies[StageCount];
+    QStringList failures;
+    int threadCount = 0;
+    int done = 0;
+    int steals = 0;
+    qint64 bytesIn = 0;
+    qint64 bytesOut = 0;
+    qint64 peakInFlight = 0;
+    double wallSeconds = 0.0;
+
+    bool collectJobs();
+};
+
+#endif // BATCHTRANSCODER_H
@@ -0,0 +1,165 @@
+#include "allocationbenchmark.h"
+#include "allocationcounter.h"
+#include "benchmarkcorpus.h"
+#include "framepool.h"
+#include "jpegdecoder.h"
+#include "scancache.h"
+#include <QtGui/QImage>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <algorithm>
+#include <utility>
+
+namespace {
+
+struct PassResult {
+    int scans = 0;
+    int frameAllocations = 0;   // новых буферов кадров
+    double ms = 0.0;
+    AllocationCounts allocations;
+    qint64 peakRss = 0;
+};
+
+// Все сканы по очереди; показанный кадр отпускается только после
+// декодирования следующего, как в MainWindow
+bool decodeScans(const QByteArray& jpeg, FramePool* pool, PassResult& result) {
+    AllocationCounter::resetPeakRss();
+    const AllocationCounts before = AllocationCounter::snapshot();
+    QElapsedTimer timer;
+    timer.start();
+
+    JpegDecoder decoder;
+    decoder.setFramePool(pool);
+    if (!decoder.open(jpeg)) {
+        return false;
+    }
+    QImage shown;
+    int scans = 0;
+    while (decoder.hasMoreScans()) {
+        QImage frame;
+        if (!decoder.decodeNextScan(frame)) {
+            return false;
+        }
+        shown = std::move(frame);
+        scans++;
+    }
+
+    result.ms = timer.nsecsElapsed() / 1e6;
+    result.allocations = AllocationCounter::snapshot() - before;
+    result.peakRss = AllocationCounter::peakRss();
+    result.scans = scans;
+    result.frameAllocations = pool ? pool->stats().allocations : scans;
+    return scans > 0;
+}
+
+// Кадр, переданный в ScanCache через std::move и забранный обратно, должен
+// остаться тем же буфером: ни копии пикселей, ни крупного выделения
+bool scanCacheKeepsBuffer(const QSize& size, QString& failure) {
+    FramePool pool;
+    QImage frame = pool.acquire(size, QImage::Format_RGB32);
+    if (frame.isNull()) {
+        failure = "cannot allocate a frame";
+        return false;
+    }
+    const uchar* bits = frame.constBits();
+    ScanCache cache;
+    const AllocationCounts before = AllocationCounter::snapshot();
+    cache.insert(1, std::move(frame));
+    QImage taken;
+    cache.take(1, taken);
+    const AllocationCounts allocations = AllocationCounter::snapshot() - before;
+    if (taken.constBits() != bits) {
+        failure = "ScanCache::insert copied the frame";
+        return false;
+    }
+    if (allocations.largeCalls > 0) {
+        failure = QString("ScanCache insert/take made %1 large allocations").arg(allocations.largeCalls);
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+bool AllocationBenchmark::run() {
+    QTextStream out(stdout);
+    QList<CorpusEntry> corpus = BenchmarkCorpus::generate(sizes);
+    corpus.erase(std::remove_if(corpus.begin(), corpus.end(),
+                                [](const CorpusEntry& entry) { return !entry.progressive; }),
+                 corpus.end());
+    if (corpus.isEmpty()) {
+        QTextStream(stderr) << "Failed to generate the benchmark corpus\n";
+        return false;
+    }
+
+    out << "Scan path allocations, median of " << iterations << " runs";
+    if (!AllocationCounter::isAvailable()) {
+        out << " (malloc counting needs glibc, counts are zero)";
+    }
+    out << "\n";
+    out << qSetFieldWidth(30) << Qt::left << "image" << qSetFieldWidth(8) << "mode"
+        << qSetFieldWidth(7) << Qt::right << "scans" << qSetFieldWidth(11) << "ms/scan"
+        << qSetFieldWidth(12) << "mallocs/scan" << qSetFieldWidth(12) << "large/scan"
+        << qSetFieldWidth(12) << "MB/scan" << qSetFieldWidth(12) << "peak RSS MB"
+        << qSetFieldWidth(0) << "\n";
+
+    bool ok = true;
+    QStringList failures;
+    for (const CorpusEntry& entry : corpus) {
+        for (int pooled = 0; pooled < 2; ++pooled) {
+            QVector<PassResult> passes;
+            for (int i = 0; i < iterations; ++i) {
+                // Новый пул на каждый проход: в счёт входят и первые выделения
+                FramePool pool;
+                PassResult pass;
+                if (!decodeScans(entry.jpeg, pooled ? &pool : nullptr, pass)) {
+                    ok = false;
+                    break;
+                }
+                passes.append(pass);
+            }
+            if (passes.isEmpty()) {
+                out << entry.name << ": decode failed\n";
+                continue;
+            }
+            std::sort(passes.begin(), passes.end(),
+                      [](const PassResult& a, const PassResult& b) { return a.ms < b.ms; });
+            const PassResult& median = passes[passes.size() / 2];
+            const double scans = median.scans;
+            // Число буферов от времени не зависит: проверяется каждый проход
+            int frameAllocations = 0;
+            for (const PassResult& pass : passes) {
+                frameAllocations = qMax(frameAllocations, pass.frameAllocations);
+            }
+            const bool failed = pooled && frameAllocations > AllocationBenchmark::MaxPooledFrames;
+            if (failed) {
+                failures << QString("%1: %2 frame buffers for %3 scans with FramePool, limit %4")
+                                .arg(entry.name).arg(frameAllocations).arg(median.scans)
+                                .arg(AllocationBenchmark::MaxPooledFrames);
+            }
+            out << qSetFieldWidth(30) << Qt::left << entry.name
+                << qSetFieldWidth(8) << (pooled ? "pool" : "new")
+                << qSetFieldWidth(7) << Qt::right << median.scans
+                << qSetFieldWidth(11) << QString::number(median.ms / scans, 'f', 2)
+                << qSetFieldWidth(12) << QString::number(median.allocations.calls / scans, 'f', 1)
+                << qSetFieldWidth(12) << QString::number(median.allocations.largeCalls / scans, 'f', 2)
+                << qSetFieldWidth(12) << QString::number(median.allocations.bytes / scans / (1024.0 * 1024.0), 'f', 2)
+                << qSetFieldWidth(12) << QString::number(median.peakRss / (1024.0 * 1024.0), 'f', 1)
+                << qSetFieldWidth(0) << (failed ? "  FAIL" : "") << "\n";
+        }
+    }
+
+    QString failure;
+    if (!scanCacheKeepsBuffer(corpus.first().size, failure)) {
+        failures << failure;
+    }
+    out << "ScanCache insert without copy: " << (failure.isEmpty() ? "ok" : "FAIL") << "\n";
+
+    for (const QString& message : failures) {
+        QTextStream(stderr) << "Threshold exceeded: " << message << "\n";
+    }
+    return ok && failures.isEmpty();
+}
@@ -0,0 +1,29 @@
+#ifndef ALLOCATIONBENCHMARK_H
+#define ALLOCATIONBENCHMARK_H
+
+#include <QtCore/QList>
+#include <QtCore/QSize>
+
+// Путь сканов прогрессивного JPEG так, как его проходит просмотрщик:
+// кадр очередного скана декодируется, пока на экране держится предыдущий.
+// Сравнивает новый кадр на каждый скан с кадрами из FramePool: выделения
+// памяти на скан (malloc, glibc), время на скан и пиковый RSS (Linux).
+// Проваливается (run() == false), если с FramePool новых буферов больше,
+// чем кадров, живущих одновременно (показанный и декодируемый), или если
+// ScanCache::insert копирует кадр вместо того, чтобы забрать его буфер.
+class AllocationBenchmark {
+public:
+    AllocationBenchmark(const QList<QSize>& sizes, int iterations)
+        : sizes(sizes), iterations(iterations) {}
+
+    // Кадры, которые на пути сканов живут одновременно: показанный и декодируемый
+    static const int MaxPooledFrames = 2;
+
+    bool run();
+
+private:
+    QList<QSize> sizes;
+    int iterations;
+};
+
+#endif // ALLOCATIONBENCHMARK_H
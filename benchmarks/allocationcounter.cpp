@@ -0,0 +1,89 @@
+#include "allocationcounter.h"
+#include <QtCore/QFile>
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <atomic>
+#include <cstddef>
+
+namespace {
+
+std::atomic<qint64> callCount{0};
+std::atomic<qint64> byteCount{0};
+std::atomic<qint64> largeCallCount{0};
+std::atomic<qint64> largeByteCount{0};
+
+inline void count(size_t bytes) {
+    callCount.fetch_add(1, std::memory_order_relaxed);
+    byteCount.fetch_add(static_cast<qint64>(bytes), std::memory_order_relaxed);
+    if (static_cast<qint64>(bytes) >= AllocationCounter::LargeAllocation) {
+        largeCallCount.fetch_add(1, std::memory_order_relaxed);
+        largeByteCount.fetch_add(static_cast<qint64>(bytes), std::memory_order_relaxed);
+    }
+}
+
+} // namespace
+
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t count, size_t size);
+void* __libc_realloc(void* pointer, size_t size);
+
+void* malloc(size_t size) noexcept {
+    count(size);
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t elements, size_t size) noexcept {
+    count(elements * size);
+    return __libc_calloc(elements, size);
+}
+
+void* realloc(void* pointer, size_t size) noexcept {
+    count(size);
+    return __libc_realloc(pointer, size);
+}
+}
+#endif
+
+bool AllocationCounter::isAvailable() {
+#if defined(__GLIBC__)
+    return true;
+#else
+    return false;
+#endif
+}
+
+AllocationCounts AllocationCounter::snapshot() {
+    AllocationCounts counts;
+    counts.calls = callCount.load(std::memory_order_relaxed);
+    counts.bytes = byteCount.load(std::memory_order_relaxed);
+    counts.largeCalls = largeCallCount.load(std::memory_order_relaxed);
+    counts.largeBytes = largeByteCount.load(std::memory_order_relaxed);
+    return counts;
+}
+
+void AllocationCounter::resetPeakRss() {
+#if defined(Q_OS_LINUX)
+    QFile file("/proc/self/clear_refs");
+    if (file.open(QIODevice::WriteOnly)) {
+        file.write("5");
+    }
+#endif
+}
+
+qint64 AllocationCounter::peakRss() {
+#if defined(Q_OS_LINUX)
+    QFile file("/proc/self/status");
+    if (!file.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+    const QList<QByteArray> lines = file.readAll().split('\n');
+    for (const QByteArray& line : lines) {
+        if (line.startsWith("VmHWM:")) {
+            return line.mid(6).trimmed().split(' ').first().toLongLong() * 1024;
+        }
+    }
+#endif
+    return 0;
+}
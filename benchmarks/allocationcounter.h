@@ -0,0 +1,37 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <QtCore/QtGlobal>
+
+// Счётчики malloc/calloc/realloc всего процесса (включая Qt и libjpeg).
+// Работает только с glibc: malloc подменяется обёрткой над __libc_malloc.
+// Кроме общего числа отдельно считаются крупные выделения - кадры и полосы.
+struct AllocationCounts {
+    qint64 calls = 0;
+    qint64 bytes = 0;
+    qint64 largeCalls = 0;
+    qint64 largeBytes = 0;
+};
+
+class AllocationCounter {
+public:
+    static const qint64 LargeAllocation = 256 * 1024;
+
+    static bool isAvailable();
+    static AllocationCounts snapshot();
+
+    // Пиковый RSS процесса (VmHWM) и его сброс через /proc/self/clear_refs; Linux
+    static void resetPeakRss();
+    static qint64 peakRss();
+};
+
+inline AllocationCounts operator-(const AllocationCounts& a, const AllocationCounts& b) {
+    AllocationCounts result;
+    result.calls = a.calls - b.calls;
+    result.bytes = a.bytes - b.bytes;
+    result.largeCalls = a.largeCalls - b.largeCalls;
+    result.largeBytes = a.largeBytes - b.largeBytes;
+    return result;
+}
+
+#endif // ALLOCATIONCOUNTER_H
@@ -0,0 +1,143 @@
+#include "benchmarkcorpus.h"
+#include "jpegencoder.h"
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QRandomGenerator>
+#include <QtCore/QStringList>
+
+QList<QSize> BenchmarkCorpus::defaultSizes() {
+    return QList<QSize>() << QSize(640, 480) << QSize(1920, 1080) << QSize(4000, 3000);
+}
+
+QList<QSize> BenchmarkCorpus::parseSizes(const QString& text) {
+    QList<QSize> sizes;
+    const QStringList items = text.split(',', Qt::SkipEmptyParts);
+    for (const QString& item : items) {
+        const QStringList parts = item.trimmed().split('x');
+        if (parts.size() != 2) {
+            continue;
+        }
+        const QSize size(parts[0].toInt(), parts[1].toInt());
+        if (!size.isEmpty()) {
+            sizes.append(size);
+        }
+    }
+    return sizes;
+}
+
+QList<int> BenchmarkCorpus::parseList(const QString& text) {
+    QList<int> values;
+    const QStringList items = text.split(',', Qt::SkipEmptyParts);
+    for (const QString& item : items) {
+        bool ok = false;
+        const int value = item.trimmed().toInt(&ok);
+        if (ok && value >= 0) {
+            values.append(value);
+        }
+    }
+    return values;
+}
+
+QList<int> BenchmarkCorpus::parseSubsamplings(const QString& text) {
+    QList<int> subsamplings;
+    const QStringList items = text.split(',', Qt::SkipEmptyParts);
+    for (QString item : items) {
+        item = item.trimmed().remove(':');
+        if (item == "444") {
+            subsamplings.append(JpegEncodeOptions::Subsampling444);
+        } else if (item == "422") {
+            subsamplings.append(JpegEncodeOptions::Subsampling422);
+        } else if (item == "420") {
+            subsamplings.append(JpegEncodeOptions::Subsampling420);
+        }
+    }
+    return subsamplings;
+}
+
+CorpusOptions::CorpusOptions()
+    : subsamplings({ JpegEncodeOptions::Subsampling444, JpegEncodeOptions::Subsampling420 }),
+      restartRows({ 0 }) {}
+
+QList<CorpusEntry> BenchmarkCorpus::generate(const QList<QSize>& sizes, int quality) {
+    CorpusOptions options;
+    options.quality = quality;
+    return generate(sizes, options);
+}
+
+QList<CorpusEntry> BenchmarkCorpus::generate(const QList<QSize>& sizes, const CorpusOptions& corpusOptions) {
+    QList<CorpusEntry> corpus;
+    for (const QSize& size : sizes) {
+        const QImage image = makePhotoLikeImage(size);
+        for (int progressive = 0; progressive < 2; ++progressive) {
+            if ((progressive != 0 && !corpusOptions.progressive) || (progressive == 0 && !corpusOptions.baseline)) {
+                continue;
+            }
+            for (int subsampling : corpusOptions.subsamplings) {
+                for (int restartRows : corpusOptions.restartRows) {
+                    JpegEncodeOptions options;
+                    options.quality = corpusOptions.quality;
+                    options.progressive = progressive != 0;
+                    options.subsampling = subsampling;
+                    options.restartRows = restartRows;
+
+                    CorpusEntry entry;
+                    entry.size = size;
+                    entry.progressive = options.progressive;
+                    entry.subsampling = subsampling == JpegEncodeOptions::Subsampling444   ? "4:4:4"
+                                        : subsampling == JpegEncodeOptions::Subsampling422 ? "4:2:2"
+                                                                                           : "4:2:0";
+                    QString digits = entry.subsampling;
+                    digits.remove(':');
+                    entry.restartRows = restartRows;
+                    entry.name = QString("%1x%2-%3-%4")
+                                     .arg(size.width()).arg(size.height())
+                                     .arg(entry.progressive ? "progressive" : "baseline")
+                                     .arg(digits);
+                    if (restartRows > 0) {
+                        entry.name += QString("-rst%1").arg(restartRows);
+                    }
+
+                    JpegEncoder encoder(options);
+                    if (encoder.encode(image, entry.jpeg)) {
+                        corpus.append(entry);
+                    }
+                }
+            }
+        }
+    }
+    return corpus;
+}
+
+bool BenchmarkCorpus::write(const QList<CorpusEntry>& corpus, const QString& directory, QString* error) {
+    if (!QDir().mkpath(directory)) {
+        if (error) {
+            *error = QString("Cannot create %1").arg(directory);
+        }
+        return false;
+    }
+    for (const CorpusEntry& entry : corpus) {
+        QFile file(QDir(directory).filePath(entry.name + ".jpg"));
+        if (!file.open(QIODevice::WriteOnly) || file.write(entry.jpeg) != entry.jpeg.size()) {
+            if (error) {
+                *error = QString("Cannot write %1: %2").arg(file.fileName(), file.errorString());
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+QImage BenchmarkCorpus::makePhotoLikeImage(const QSize& size) {
+    QImage image(size, QImage::Format_RGB32);
+    QRandomGenerator generator(42);
+    for (int y = 0; y < image.height(); ++y) {
+        QRgb* line = reinterpret_cast<QRgb*>(image.scanLine(y));
+        for (int x = 0; x < image.width(); ++x) {
+            const int noise = generator.bounded(32);
+            line[x] = qRgb((x * 255 / image.width() + noise) & 0xFF,
+                           (y * 255 / image.height() + noise) & 0xFF,
+                           ((x + y) / 4 + noise) & 0xFF);
+        }
+    }
+    return image;
+}
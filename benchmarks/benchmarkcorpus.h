@@ -0,0 +1,50 @@
+#ifndef BENCHMARKCORPUS_H
+#define BENCHMARKCORPUS_H
+
+#include <QtGui/QImage>
+#include <QtCore/QByteArray>
+#include <QtCore/QList>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+
+struct CorpusEntry {
+    QString name;           // например 1920x1080-progressive-420 или 1920x1080-baseline-422-rst4
+    QSize size;
+    bool progressive = false;
+    QString subsampling;
+    int restartRows = 0;
+    QByteArray jpeg;
+};
+
+// Варианты кодирования каждого разрешения корпуса
+struct CorpusOptions {
+    QList<int> subsamplings;    // JpegEncodeOptions::Subsampling*
+    QList<int> restartRows;     // интервалы рестарта в строках MCU, 0 - без рестартов
+    bool baseline = true;
+    bool progressive = true;
+    int quality = 85;
+
+    CorpusOptions();
+};
+
+// Набор JPEG, сгенерированный в памяти: каждое разрешение в вариантах
+// baseline/progressive и 4:4:4/4:2:0, чтобы результаты были сравнимы между сборками
+class BenchmarkCorpus {
+public:
+    static QList<QSize> defaultSizes();
+    static QList<QSize> parseSizes(const QString& text);   // "640x480,1920x1080"
+    static QList<int> parseList(const QString& text);      // "0,1,8"
+    // "444,422,420" -> JpegEncodeOptions::Subsampling*; неизвестные пропускаются
+    static QList<int> parseSubsamplings(const QString& text);
+
+    static QList<CorpusEntry> generate(const QList<QSize>& sizes, int quality = 85);
+    static QList<CorpusEntry> generate(const QList<QSize>& sizes, const CorpusOptions& options);
+
+    // Сохраняет корпус в directory как <name>.jpg
+    static bool write(const QList<CorpusEntry>& corpus, const QString& directory, QString* error = nullptr);
+
+    // Плавный градиент с шумом, похожий на фотографию; детерминирован
+    static QImage makePhotoLikeImage(const QSize& size);
+};
+
+#endif // BENCHMARKCORPUS_H
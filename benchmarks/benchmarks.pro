@@ -0,0 +1,62 @@
+QT += core gui concurrent
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+LIBS += -ljpeg
+
+TARGET = jpeg_benchmarks
+TEMPLATE = app
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    main.cpp \
+    blurbenchmark.cpp \
+    encodebenchmark.cpp \
+    fidelitybenchmark.cpp \
+    benchmarkcorpus.cpp \
+    hotpathbenchmark.cpp \
+    allocationbenchmark.cpp \
+    allocationcounter.cpp \
+    ../blurengine.cpp \
+    ../jpegencoder.cpp \
+    ../jpegstripencoder.cpp \
+    ../jpegdecoder.cpp \
+    ../jpegcommon.cpp \
+    ../jpegindex.cpp \
+    ../framepool.cpp \
+    ../memoryaccountant.cpp \
+    ../imagehandler.cpp \
+    ../jpegstrategy.cpp \
+    ../jpegrestartdecoder.cpp \
+    ../jpegtransform.cpp \
+    ../scancache.cpp \
+    ../imagemetrics.cpp \
+    ../qualitysearch.cpp \
+    ../tracing.cpp
+
+HEADERS += \
+    blurbenchmark.h \
+    encodebenchmark.h \
+    fidelitybenchmark.h \
+    benchmarkcorpus.h \
+    hotpathbenchmark.h \
+    allocationbenchmark.h \
+    allocationcounter.h \
+    ../blurengine.h \
+    ../jpegencoder.h \
+    ../jpegstripencoder.h \
+    ../jpegdecoder.h \
+    ../jpegcommon.h \
+    ../jpegindex.h \
+    ../framepool.h \
+    ../memoryaccountant.h \
+    ../imagehandler.h \
+    ../jpegstrategy.h \
+    ../jpegrestartdecoder.h \
+    ../jpegtransform.h \
+    ../scancache.h \
+    ../imagemetrics.h \
+    ../qualitysearch.h \
+    ../tracing.h
@@ -0,0 +1,101 @@
+#include "blurbenchmark.h"
+#include "blurengine.h"
+#include "benchmarkcorpus.h"
+#include <QtGui/QImage>
+#include <QtGui/QColor>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QTextStream>
+#include <QtCore/QtGlobal>
+#include <functional>
+
+namespace {
+
+// Прежняя реализация ProgressiveJPEGStrategy::applyBlur, оставлена как эталон
+QImage referenceBlur(const QImage& image, int radius) {
+    if (radius <= 0 || image.isNull()) {
+        return image;
+    }
+
+    QImage result = QImage(image.size(), image.format());
+
+    int step = qMax(1, radius / 2);
+
+    for (int y = 0; y < result.height(); y += step) {
+        for (int x = 0; x < result.width(); x += step) {
+            int r = 0, g = 0, b = 0, count = 0;
+
+            int yStart = qMax(0, y - radius);
+            int yEnd = qMin(result.height() - 1, y + radius);
+            int xStart = qMax(0, x - radius);
+            int xEnd = qMin(result.width() - 1, x + radius);
+
+            for (int py = yStart; py <= yEnd; py++) {
+                for (int px = xStart; px <= xEnd; px++) {
+                    QColor c = image.pixelColor(px, py);
+                    r += c.red();
+                    g += c.green();
+                    b += c.blue();
+                    count++;
+                }
+            }
+
+            if (count > 0) {
+                r /= count;
+                g /= count;
+                b /= count;
+                QColor avgColor(r, g, b);
+
+                for (int py = y; py < qMin(result.height(), y + step); py++) {
+                    for (int px = x; px < qMin(result.width(), x + step); px++) {
+                        result.setPixelColor(px, py, avgColor);
+                    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+double bestOf(int iterations, const std::function<void()>& body) {
+    double best = 0.0;
+    for (int i = 0; i < iterations; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        body();
+        const double elapsed = timer.nsecsElapsed() / 1e6;
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+} // namespace
+
+bool BlurBenchmark::run() {
+    QTextStream out(stdout);
+    const QImage image = BenchmarkCorpus::makePhotoLikeImage(imageSize);
+
+    out << "Blur benchmark: " << imageSize.width() << "x" << imageSize.height()
+        << ", SIMD: " << BlurEngine::simdName() << ", best of " << iterations << "\n";
+    out << "radius  reference(ms)  engine(ms)  speed-up  identical\n";
+
+    bool allIdentical = true;
+    const int radii[] = {8, 6, 4, 2};
+    for (int radius : radii) {
+        QImage expected;
+        QImage actual;
+        const double referenceMs = bestOf(iterations, [&]() { expected = referenceBlur(image, radius); });
+        const double engineMs = bestOf(iterations, [&]() { actual = BlurEngine::apply(image, radius); });
+        const bool identical = expected == actual;
+        allIdentical = allIdentical && identical;
+
+        out << qSetFieldWidth(6) << radius << qSetFieldWidth(15) << QString::number(referenceMs, 'f', 1)
+            << qSetFieldWidth(12) << QString::number(engineMs, 'f', 1)
+            << qSetFieldWidth(9) << QString::number(referenceMs / qMax(engineMs, 0.001), 'f', 1) + "x"
+            << qSetFieldWidth(11) << (identical ? "yes" : "NO") << qSetFieldWidth(0) << "\n";
+    }
+    out.flush();
+    return allIdentical;
+}
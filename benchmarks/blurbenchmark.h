@@ -0,0 +1,19 @@
+#ifndef BLURBENCHMARK_H
+#define BLURBENCHMARK_H
+
+#include <QtCore/QSize>
+
+class BlurBenchmark {
+public:
+    BlurBenchmark(const QSize& imageSize, int iterations)
+        : imageSize(imageSize), iterations(iterations) {}
+
+    // Сравнивает BlurEngine с прежним applyBlur на радиусах 8/6/4/2
+    bool run();
+
+private:
+    QSize imageSize;
+    int iterations;
+};
+
+#endif // BLURBENCHMARK_H
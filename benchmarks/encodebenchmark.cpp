@@ -0,0 +1,142 @@
+#include "encodebenchmark.h"
+#include "benchmarkcorpus.h"
+#include "imagemetrics.h"
+#include "jpegencoder.h"
+#include "jpegstripencoder.h"
+#include "jpegdecoder.h"
+#include "qualitysearch.h"
+#include <QtGui/QImage>
+#include <QtCore/QBuffer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QList>
+#include <QtCore/QTextStream>
+#include <QtCore/QThread>
+#include <QtCore/QtGlobal>
+#include <functional>
+
+namespace {
+
+double bestOf(int iterations, const std::function<void()>& body) {
+    double best = 0.0;
+    for (int i = 0; i < iterations; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        body();
+        const double elapsed = timer.nsecsElapsed() / 1e6;
+        if (i == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+QImage decode(const QByteArray& jpeg) {
+    JpegDecoder decoder;
+    QImage image;
+    if (!decoder.open(jpeg) || !decoder.decodeFinal(image)) {
+        return QImage();
+    }
+    return image;
+}
+
+} // namespace
+
+bool EncodeBenchmark::run() {
+    QTextStream out(stdout);
+    const QImage image = BenchmarkCorpus::makePhotoLikeImage(imageSize).convertToFormat(QImage::Format_RGB32);
+    JpegEncodeOptions options;
+
+    out << "Encode benchmark: " << imageSize.width() << "x" << imageSize.height()
+        << ", quality " << options.quality << ", best of " << iterations << "\n";
+    if (!JpegStripEncoder::canEncode(image, options)) {
+        out << "Image is too small for strip encoding\n";
+        out.flush();
+        return false;
+    }
+
+    QByteArray saved;
+    const double saveMs = bestOf(iterations, [&]() {
+        saved.clear();
+        QBuffer buffer(&saved);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "JPEG", options.quality);
+    });
+
+    QByteArray serial;
+    JpegEncoder encoder(options);
+    bool ok = true;
+    const double serialMs = bestOf(iterations, [&]() { ok = encoder.encode(image, serial) && ok; });
+    const QImage expected = decode(serial);
+    if (!ok || expected.isNull()) {
+        out << "JpegEncoder failed: " << encoder.errorString() << "\n";
+        out.flush();
+        return false;
+    }
+
+    out << qSetFieldWidth(14) << Qt::left << "path" << Qt::right << qSetFieldWidth(10) << "time(ms)"
+        << qSetFieldWidth(9) << "vs save" << qSetFieldWidth(11) << "vs serial" << qSetFieldWidth(10) << "bytes"
+        << qSetFieldWidth(8) << "strips" << qSetFieldWidth(11) << "identical" << qSetFieldWidth(0) << "\n";
+    auto report = [&](const QString& name, double ms, qint64 bytes, int strips, const QString& identical) {
+        out << qSetFieldWidth(14) << Qt::left << name << Qt::right
+            << qSetFieldWidth(10) << QString::number(ms, 'f', 1)
+            << qSetFieldWidth(9) << QString::number(saveMs / qMax(ms, 0.001), 'f', 2) + "x"
+            << qSetFieldWidth(11) << QString::number(serialMs / qMax(ms, 0.001), 'f', 2) + "x"
+            << qSetFieldWidth(10) << bytes << qSetFieldWidth(8) << strips
+            << qSetFieldWidth(11) << identical << qSetFieldWidth(0) << "\n";
+    };
+    report("QImage::save", saveMs, saved.size(), 0, "-");
+    report("JpegEncoder", serialMs, serial.size(), 0, "-");
+
+    // 1, 2, 4... и число ядер; один поток показывает цену самих рестартов
+    QList<int> threadCounts;
+    const int ideal = qMax(1, QThread::idealThreadCount());
+    for (int threads = 1; threads < ideal; threads *= 2) {
+        threadCounts.append(threads);
+    }
+    threadCounts.append(ideal);
+
+    bool allIdentical = true;
+    for (int threads : threadCounts) {
+        JpegStripEncoder stripEncoder(options);
+        stripEncoder.setThreadCount(threads);
+        QByteArray striped;
+        bool encoded = true;
+        const double stripMs = bestOf(iterations, [&]() { encoded = stripEncoder.encode(image, striped) && encoded; });
+        if (!encoded) {
+            out << "JpegStripEncoder failed: " << stripEncoder.errorString() << "\n";
+            allIdentical = false;
+            continue;
+        }
+        const bool identical = decode(striped) == expected;
+        allIdentical = allIdentical && identical;
+        report(QString("strips x%1").arg(threads), stripMs, striped.size(), stripEncoder.stripCount(),
+               identical ? "yes" : "NO");
+    }
+
+    // Подбор качества под размер файла JpegEncoder: ожидается то же quality
+    QualityTarget target;
+    target.maxBytes = serial.size();
+    out << "Quality search for " << target.maxBytes << " bytes, SSIM/PSNR kernels: " << ImageMetrics::simdName() << "\n";
+    QList<int> searchThreads;
+    searchThreads << 1;
+    if (ideal > 1) {
+        searchThreads << ideal;
+    }
+    bool searchOk = true;
+    for (int threads : searchThreads) {
+        QualitySearch search(options);
+        search.setThreadCount(threads);
+        QualitySearchResult result;
+        if (!search.search(image, target, result)) {
+            out << "QualitySearch failed: " << search.errorString() << "\n";
+            searchOk = false;
+            continue;
+        }
+        searchOk = searchOk && result.targetMet && result.jpeg.size() <= target.maxBytes;
+        out << QString("  %1 thread(s): quality %2, %3 trials in %4 rounds, %5 ms, SSIM %6\n")
+                   .arg(threads).arg(result.options.quality).arg(result.trials).arg(result.rounds)
+                   .arg(result.searchMs, 0, 'f', 1).arg(result.ssim, 0, 'f', 4);
+    }
+    out.flush();
+    return allIdentical && searchOk;
+}
@@ -0,0 +1,21 @@
+#ifndef ENCODEBENCHMARK_H
+#define ENCODEBENCHMARK_H
+
+#include <QtCore/QSize>
+
+class EncodeBenchmark {
+public:
+    EncodeBenchmark(const QSize& imageSize, int iterations)
+        : imageSize(imageSize), iterations(iterations) {}
+
+    // Сравнивает QImage::save и JpegEncoder целиком с кодированием полосами
+    // на 1, 2, 4... потоках; результат полос декодируется и сверяется.
+    // Затем QualitySearch подбирает качество под размер файла JpegEncoder
+    bool run();
+
+private:
+    QSize imageSize;
+    int iterations;
+};
+
+#endif // ENCODEBENCHMARK_H
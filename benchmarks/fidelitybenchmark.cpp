@@ -0,0 +1,280 @@
+#include "fidelitybenchmark.h"
+#include "imagehandler.h"
+#include "imagemetrics.h"
+#include "jpegindex.h"
+#include <QtGui/QImage>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QStringList>
+#include <QtCore/QSysInfo>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QTextStream>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <memory>
+
+namespace {
+
+struct ScanResult {
+    double readyMs = 0.0;   // от начала открытия файла до готового кадра
+    double scanMs = 0.0;    // от предыдущего кадра
+    qint64 bytes = 0;       // байт файла до конца скана
+    double psnr = 0.0;      // относительно последнего кадра
+    double ssim = 0.0;
+};
+
+// Открывает файл, как MainWindow, и забирает все кадры подряд без задержки
+// на показ. readyMs - время готовности каждого кадра; onFrame вызывается
+// после замера
+bool loadAllScans(const QString& filename, QVector<double>& readyMs,
+                  const std::function<void(const QImage&)>& onFrame) {
+    readyMs.clear();
+    QElapsedTimer timer;
+    timer.start();
+    std::unique_ptr<ImageHandler> handler(ImageHandler::createHandler(filename));
+    QImage frame;
+    if (!handler->loadImage(filename, frame)) {
+        return false;
+    }
+    do {
+        readyMs.append(timer.nsecsElapsed() / 1e6);
+        onFrame(frame);
+    } while (handler->hasMoreScans() && handler->loadNextScan(frame));
+    return true;
+}
+
+// Конец каждого скана в байтах файла: сколько нужно получить, чтобы его показать
+QVector<qint64> scanEndOffsets(const QByteArray& jpeg) {
+    QVector<qint64> ends;
+    JpegFileIndex index;
+    if (!index.build(reinterpret_cast<const uchar*>(jpeg.constData()), jpeg.size())) {
+        return ends;
+    }
+    for (int scan = 1; scan < index.scanCount(); ++scan) {
+        ends.append(index.scanOffsets[scan]);
+    }
+    ends.append(jpeg.size());
+    return ends;
+}
+
+double median(QVector<double> samples) {
+    std::sort(samples.begin(), samples.end());
+    return samples[samples.size() / 2];
+}
+
+QString formatDb(double value) {
+    return std::isinf(value) ? QString("inf") : QString::number(value, 'f', 2);
+}
+
+// В JSON бесконечность (совпадение с последним кадром) записывается как null
+QJsonValue jsonDb(double value) {
+    return std::isinf(value) ? QJsonValue() : QJsonValue(value);
+}
+
+} // namespace
+
+bool FidelityBenchmark::run(const QString& jsonPath, const QString& csvPath) {
+    QTextStream out(stdout);
+    const bool jsonToStdout = jsonPath == "-";
+    const QList<CorpusEntry> corpus = BenchmarkCorpus::generate(sizes, corpusOptions);
+    if (corpus.isEmpty()) {
+        QTextStream(stderr) << "Failed to generate the benchmark corpus\n";
+        return false;
+    }
+
+    // Загрузка идёт из файла через отображение в память, как в просмотрщике
+    QTemporaryDir temporaryDirectory;
+    const QString directory = corpusDirectory.isEmpty() ? temporaryDirectory.path() : corpusDirectory;
+    QString writeError;
+    if ((corpusDirectory.isEmpty() && !temporaryDirectory.isValid()) ||
+        !BenchmarkCorpus::write(corpus, directory, &writeError)) {
+        QTextStream(stderr) << "Failed to write the corpus: " << writeError << "\n";
+        return false;
+    }
+
+    if (!jsonToStdout) {
+        out << "Progressive fidelity benchmark, median of " << iterations << " loads, corpus in " << directory << "\n";
+        out << qSetFieldWidth(36) << Qt::left << "image" << Qt::right << qSetFieldWidth(7) << "scans"
+            << qSetFieldWidth(11) << "first(ms)" << qSetFieldWidth(11) << "total(ms)"
+            << qSetFieldWidth(12) << "first PSNR" << qSetFieldWidth(12) << "first SSIM"
+            << qSetFieldWidth(13) << "first bytes" << qSetFieldWidth(0) << "\n";
+    }
+
+    QStringList csv;
+    csv << "image,width,height,mode,subsampling,restart_rows,file_bytes,scan,scans,ready_ms,scan_ms,bytes,psnr,ssim";
+
+    bool ok = true;
+    QStringList failures;
+    QJsonArray results;
+    for (const CorpusEntry& entry : corpus) {
+        const QString filename = QDir(directory).filePath(entry.name + ".jpg");
+
+        // Прогоны с замером; метрики считаются отдельным проходом, чтобы
+        // не давать фоновому декодированию сканов лишнего времени
+        QImage finalFrame;
+        QVector<QVector<double>> samples;
+        bool loaded = true;
+        for (int i = 0; i < iterations && loaded; ++i) {
+            QVector<double> readyMs;
+            loaded = loadAllScans(filename, readyMs, [&](const QImage& frame) { finalFrame = frame; });
+            samples.append(readyMs);
+        }
+        QVector<ScanResult> scans;
+        if (loaded) {
+            int frames = samples.first().size();
+            for (const QVector<double>& readyMs : samples) {
+                frames = qMin(frames, readyMs.size());
+            }
+            const QVector<qint64> ends = scanEndOffsets(entry.jpeg);
+            scans.resize(frames);
+            for (int scan = 0; scan < frames; ++scan) {
+                QVector<double> ready;
+                for (const QVector<double>& readyMs : samples) {
+                    ready.append(readyMs[scan]);
+                }
+                scans[scan].readyMs = median(ready);
+                scans[scan].scanMs = scans[scan].readyMs - (scan > 0 ? scans[scan - 1].readyMs : 0.0);
+                scans[scan].bytes = scan == frames - 1 ? entry.jpeg.size()
+                                                       : ends.value(scan, entry.jpeg.size());
+            }
+
+            int scan = 0;
+            QVector<double> unused;
+            loaded = loadAllScans(filename, unused, [&](const QImage& frame) {
+                if (scan < scans.size()) {
+                    scans[scan].psnr = ImageMetrics::psnr(frame, finalFrame);
+                    scans[scan].ssim = ImageMetrics::ssim(frame, finalFrame);
+                }
+                scan++;
+            });
+        }
+        if (!loaded || scans.isEmpty()) {
+            QTextStream(stderr) << "Failed to load " << filename << "\n";
+            ok = false;
+            continue;
+        }
+
+        const ScanResult& first = scans.first();
+        const double totalMs = scans.last().readyMs;
+        QStringList entryFailures;
+        if (thresholds.maxFirstFrameMs > 0 && first.readyMs > thresholds.maxFirstFrameMs) {
+            entryFailures << QString("first frame %1 ms > %2 ms").arg(first.readyMs, 0, 'f', 1)
+                                                                  .arg(thresholds.maxFirstFrameMs);
+        }
+        if (scans.size() > 1 && thresholds.minFirstScanPsnr > 0 && first.psnr < thresholds.minFirstScanPsnr) {
+            entryFailures << QString("first scan PSNR %1 dB < %2 dB").arg(first.psnr, 0, 'f', 2)
+                                                                     .arg(thresholds.minFirstScanPsnr);
+        }
+        if (scans.size() > 1 && thresholds.minFirstScanSsim > 0 && first.ssim < thresholds.minFirstScanSsim) {
+            entryFailures << QString("first scan SSIM %1 < %2").arg(first.ssim, 0, 'f', 4)
+                                                              .arg(thresholds.minFirstScanSsim);
+        }
+        for (const QString& failure : entryFailures) {
+            failures << entry.name + ": " + failure;
+        }
+
+        const QString mode = entry.progressive ? "progressive" : "baseline";
+        QJsonArray scanArray;
+        for (int scan = 0; scan < scans.size(); ++scan) {
+            const ScanResult& result = scans[scan];
+            QJsonObject scanObject;
+            scanObject["scan"] = scan + 1;
+            scanObject["ready_ms"] = result.readyMs;
+            scanObject["scan_ms"] = result.scanMs;
+            scanObject["bytes"] = result.bytes;
+            scanObject["psnr"] = jsonDb(result.psnr);
+            scanObject["ssim"] = result.ssim;
+            scanArray.append(scanObject);
+
+            csv << QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10,%11,%12,%13,%14")
+                       .arg(entry.name).arg(entry.size.width()).arg(entry.size.height()).arg(mode)
+                       .arg(entry.subsampling).arg(entry.restartRows).arg(entry.jpeg.size())
+                       .arg(scan + 1).arg(scans.size())
+                       .arg(result.readyMs, 0, 'f', 3).arg(result.scanMs, 0, 'f', 3).arg(result.bytes)
+                       .arg(formatDb(result.psnr)).arg(result.ssim, 0, 'f', 5);
+        }
+
+        QJsonObject result;
+        result["image"] = entry.name;
+        result["width"] = entry.size.width();
+        result["height"] = entry.size.height();
+        result["progressive"] = entry.progressive;
+        result["subsampling"] = entry.subsampling;
+        result["restart_rows"] = entry.restartRows;
+        result["file_bytes"] = static_cast<qint64>(entry.jpeg.size());
+        result["first_frame_ms"] = first.readyMs;
+        result["total_ms"] = totalMs;
+        result["scans"] = scanArray;
+        result["failures"] = QJsonArray::fromStringList(entryFailures);
+        results.append(result);
+
+        if (!jsonToStdout) {
+            out << qSetFieldWidth(36) << Qt::left << entry.name << Qt::right << qSetFieldWidth(7) << scans.size()
+                << qSetFieldWidth(11) << QString::number(first.readyMs, 'f', 1)
+                << qSetFieldWidth(11) << QString::number(totalMs, 'f', 1)
+                << qSetFieldWidth(12) << formatDb(first.psnr)
+                << qSetFieldWidth(12) << QString::number(first.ssim, 'f', 4)
+                << qSetFieldWidth(13) << QString::number(100.0 * first.bytes / entry.jpeg.size(), 'f', 1) + "%"
+                << qSetFieldWidth(0) << (entryFailures.isEmpty() ? "" : "  FAIL") << "\n";
+            out.flush();
+        }
+    }
+
+    for (const QString& failure : failures) {
+        QTextStream(stderr) << "Threshold exceeded: " << failure << "\n";
+    }
+    ok = ok && failures.isEmpty();
+
+    if (!csvPath.isEmpty()) {
+        const QByteArray text = csv.join('\n').toUtf8() + '\n';
+        QFile file(csvPath);
+        if (!file.open(QIODevice::WriteOnly) || file.write(text) != text.size()) {
+            QTextStream(stderr) << "Cannot write " << csvPath << "\n";
+            return false;
+        }
+        if (!jsonToStdout) {
+            out << "Per-scan results written to " << csvPath << "\n";
+        }
+    }
+
+    if (jsonPath.isEmpty()) {
+        return ok;
+    }
+
+    QJsonObject limits;
+    limits["max_first_frame_ms"] = thresholds.maxFirstFrameMs;
+    limits["min_first_scan_psnr"] = thresholds.minFirstScanPsnr;
+    limits["min_first_scan_ssim"] = thresholds.minFirstScanSsim;
+
+    QJsonObject root;
+    root["benchmark"] = "fidelity";
+    root["qt_version"] = qVersion();
+    root["cpu"] = QSysInfo::currentCpuArchitecture();
+    root["simd"] = ImageMetrics::simdName();
+    root["iterations"] = iterations;
+    root["quality"] = corpusOptions.quality;
+    root["thresholds"] = limits;
+    root["passed"] = ok;
+    root["results"] = results;
+    const QByteArray json = QJsonDocument(root).toJson(QJsonDocument::Indented);
+
+    if (jsonToStdout) {
+        out << json;
+        out.flush();
+        return ok;
+    }
+    QFile file(jsonPath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+        QTextStream(stderr) << "Cannot write " << jsonPath << "\n";
+        return false;
+    }
+    out << "Results written to " << jsonPath << "\n";
+    return ok;
+}
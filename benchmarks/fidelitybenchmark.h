@@ -0,0 +1,41 @@
+#ifndef FIDELITYBENCHMARK_H
+#define FIDELITYBENCHMARK_H
+
+#include "benchmarkcorpus.h"
+#include <QtCore/QList>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+
+// Пороги регрессии; 0 - не проверяется. PSNR и SSIM первого кадра
+// проверяются только у многоскановых файлов
+struct FidelityThresholds {
+    double maxFirstFrameMs = 0.0;
+    double minFirstScanPsnr = 0.0;
+    double minFirstScanSsim = 0.0;
+};
+
+// Качество прогрессивной загрузки во времени: каждый файл корпуса
+// открывается как в просмотрщике (ImageHandler::createHandler) и проходится
+// через loadNextScan до последнего скана. Время до каждого кадра - медиана
+// по прогонам; PSNR и SSIM каждого скана - относительно последнего кадра
+class FidelityBenchmark {
+public:
+    FidelityBenchmark(const QList<QSize>& sizes, const CorpusOptions& corpusOptions, int iterations)
+        : sizes(sizes), corpusOptions(corpusOptions), iterations(iterations) {}
+
+    void setThresholds(const FidelityThresholds& newThresholds) { thresholds = newThresholds; }
+    // Каталог, куда записывается корпус; пустой - временный каталог
+    void setCorpusDirectory(const QString& directory) { corpusDirectory = directory; }
+
+    // jsonPath "-" - JSON в stdout вместо таблицы; false при ошибке или нарушении порогов
+    bool run(const QString& jsonPath, const QString& csvPath);
+
+private:
+    QList<QSize> sizes;
+    CorpusOptions corpusOptions;
+    int iterations;
+    FidelityThresholds thresholds;
+    QString corpusDirectory;
+};
+
+#endif // FIDELITYBENCHMARK_H
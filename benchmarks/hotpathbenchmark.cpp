@@ -0,0 +1,184 @@
+#include "hotpathbenchmark.h"
+#include "benchmarkcorpus.h"
+#include "blurengine.h"
+#include "jpegdecoder.h"
+#include "jpegencoder.h"
+#include <QtGui/QImage>
+#include <QtGui/QImageReader>
+#include <QtGui/QPixmap>
+#include <QtCore/QBuffer>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QSysInfo>
+#include <QtCore/QTextStream>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <algorithm>
+#include <functional>
+
+namespace {
+
+// Размер области просмотра MainWindow
+const QSize DisplaySize(1000, 700);
+const int BlurRadius = 4;
+
+struct Timing {
+    double best = 0.0;
+    double median = 0.0;
+};
+
+Timing measure(int iterations, const std::function<void()>& body) {
+    QVector<double> samples;
+    samples.reserve(iterations);
+    for (int i = 0; i < iterations; ++i) {
+        QElapsedTimer timer;
+        timer.start();
+        body();
+        samples.append(timer.nsecsElapsed() / 1e6);
+    }
+    std::sort(samples.begin(), samples.end());
+    Timing timing;
+    timing.best = samples.first();
+    timing.median = samples[samples.size() / 2];
+    return timing;
+}
+
+QImage readWithQt(const QByteArray& jpeg) {
+    QBuffer buffer;
+    buffer.setData(jpeg);
+    buffer.open(QIODevice::ReadOnly);
+    QImageReader reader(&buffer, "jpeg");
+    return reader.read();
+}
+
+QImage readWithDecoder(const QByteArray& jpeg) {
+    JpegDecoder decoder;
+    QImage image;
+    if (!decoder.open(jpeg) || !decoder.decodeFinal(image)) {
+        return QImage();
+    }
+    return image;
+}
+
+} // namespace
+
+bool HotPathBenchmark::run(const QString& jsonPath) {
+    QTextStream out(stdout);
+    const bool jsonToStdout = jsonPath == "-";
+    const QList<CorpusEntry> corpus = BenchmarkCorpus::generate(sizes);
+    if (corpus.isEmpty()) {
+        QTextStream(stderr) << "Failed to generate the benchmark corpus\n";
+        return false;
+    }
+
+    static const char* const stageNames[] = {
+        "decode_qt", "decode_libjpeg", "convert_rgb32", "blur", "save_qt", "encode_libjpeg", "display"
+    };
+    const int stageCount = sizeof(stageNames) / sizeof(stageNames[0]);
+
+    if (!jsonToStdout) {
+        out << "Hot path benchmark, median of " << iterations << " (ms), SIMD: " << BlurEngine::simdName() << "\n";
+        out << qSetFieldWidth(32) << Qt::left << "image" << Qt::right;
+        for (int stage = 0; stage < stageCount; ++stage) {
+            out << qSetFieldWidth(16) << stageNames[stage];
+        }
+        out << qSetFieldWidth(0) << "\n";
+    }
+
+    bool ok = true;
+    QJsonArray results;
+    for (const CorpusEntry& entry : corpus) {
+        const QImage decoded = readWithQt(entry.jpeg);
+        if (decoded.isNull()) {
+            QTextStream(stderr) << "Failed to decode " << entry.name << "\n";
+            ok = false;
+            continue;
+        }
+        const QImage rgb888 = decoded.convertToFormat(QImage::Format_RGB888);
+
+        Timing timings[stageCount];
+        timings[0] = measure(iterations, [&]() { readWithQt(entry.jpeg); });
+        timings[1] = measure(iterations, [&]() { readWithDecoder(entry.jpeg); });
+        timings[2] = measure(iterations, [&]() {
+            const QImage converted = rgb888.convertToFormat(QImage::Format_RGB32);
+            Q_UNUSED(converted);
+        });
+        timings[3] = measure(iterations, [&]() { BlurEngine::apply(decoded, BlurRadius); });
+        timings[4] = measure(iterations, [&]() {
+            QBuffer buffer;
+            buffer.open(QIODevice::WriteOnly);
+            decoded.save(&buffer, "JPEG", 75);
+        });
+        timings[5] = measure(iterations, [&]() {
+            JpegEncodeOptions options;
+            options.subsampling = entry.subsampling == "4:4:4" ? JpegEncodeOptions::Subsampling444
+                                                               : JpegEncodeOptions::Subsampling420;
+            options.progressive = entry.progressive;
+            QByteArray jpeg;
+            JpegEncoder(options).encode(decoded, jpeg);
+        });
+        timings[6] = measure(iterations, [&]() {
+            const QPixmap pixmap = QPixmap::fromImage(decoded);
+            const QPixmap scaled = pixmap.scaled(DisplaySize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+            Q_UNUSED(scaled);
+        });
+
+        QJsonObject stages;
+        for (int stage = 0; stage < stageCount; ++stage) {
+            QJsonObject timing;
+            timing["best_ms"] = timings[stage].best;
+            timing["median_ms"] = timings[stage].median;
+            stages[QString::fromLatin1(stageNames[stage])] = timing;
+        }
+        QJsonObject result;
+        result["image"] = entry.name;
+        result["width"] = entry.size.width();
+        result["height"] = entry.size.height();
+        result["progressive"] = entry.progressive;
+        result["subsampling"] = entry.subsampling;
+        result["file_bytes"] = static_cast<qint64>(entry.jpeg.size());
+        result["stages"] = stages;
+        results.append(result);
+
+        if (!jsonToStdout) {
+            out << qSetFieldWidth(32) << Qt::left << entry.name << Qt::right;
+            for (int stage = 0; stage < stageCount; ++stage) {
+                out << qSetFieldWidth(16) << QString::number(timings[stage].median, 'f', 2);
+            }
+            out << qSetFieldWidth(0) << "\n";
+            out.flush();
+        }
+    }
+
+    if (jsonPath.isEmpty()) {
+        return ok;
+    }
+
+    QJsonObject root;
+    root["benchmark"] = "hotpaths";
+    root["qt_version"] = qVersion();
+    root["cpu"] = QSysInfo::currentCpuArchitecture();
+    root["simd"] = BlurEngine::simdName();
+    root["threads"] = QThread::idealThreadCount();
+    root["iterations"] = iterations;
+    root["blur_radius"] = BlurRadius;
+    root["results"] = results;
+    const QByteArray json = QJsonDocument(root).toJson(QJsonDocument::Indented);
+
+    if (jsonToStdout) {
+        out << json;
+        out.flush();
+        return ok;
+    }
+    QFile file(jsonPath);
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+        QTextStream(stderr) << "Cannot write " << jsonPath << "\n";
+        return false;
+    }
+    out << "Results written to " << jsonPath << "\n";
+    return ok;
+}
@@ -0,0 +1,26 @@
+#ifndef HOTPATHBENCHMARK_H
+#define HOTPATHBENCHMARK_H
+
+#include <QtCore/QList>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+
+// Горячие пути приложения на сгенерированном наборе JPEG: декодирование
+// (QImageReader и JpegDecoder), convertToFormat, размытие, сохранение
+// (QImage::save и JpegEncoder) и вывод на экран (QPixmap + плавное масштабирование).
+// Для вывода нужен QGuiApplication.
+class HotPathBenchmark {
+public:
+    HotPathBenchmark(const QList<QSize>& sizes, int iterations)
+        : sizes(sizes), iterations(iterations) {}
+
+    // Таблица в stdout; при непустом jsonPath результаты пишутся туда в JSON
+    // ("-" - в stdout вместо таблицы)
+    bool run(const QString& jsonPath);
+
+private:
+    QList<QSize> sizes;
+    int iterations;
+};
+
+#endif // HOTPATHBENCHMARK_H
@@ -0,0 +1,100 @@
+#include "allocationbenchmark.h"
+#include "blurbenchmark.h"
+#include "encodebenchmark.h"
+#include "fidelitybenchmark.h"
+#include "benchmarkcorpus.h"
+#include "hotpathbenchmark.h"
+#include <QtGui/QGuiApplication>
+#include <QtCore/QCommandLineParser>
+#include <QtCore/QTextStream>
+
+int main(int argc, char *argv[])
+{
+    // QPixmap требует QGuiApplication; без дисплея запускать с -platform offscreen
+    QGuiApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("JPEG viewer hot path benchmarks");
+    parser.addHelpOption();
+    QCommandLineOption suiteOption("suite", "Benchmark to run: hotpaths, blur, allocations, encode, fidelity or all.", "name", "hotpaths");
+    QCommandLineOption sizesOption("sizes", "Corpus resolutions for hotpaths, allocations and fidelity, e.g. 640x480,1920x1080.", "list");
+    QCommandLineOption jsonOption("json", "Write hotpaths results (fidelity with --suite fidelity) as JSON to <file> ('-' for stdout).", "file");
+    QCommandLineOption csvOption("csv", "Write per-scan fidelity results as CSV to <file>.", "file");
+    QCommandLineOption subsamplingsOption("subsamplings", "Fidelity corpus chroma subsamplings.", "list", "444,422,420");
+    QCommandLineOption restartsOption("restarts", "Fidelity corpus restart intervals in MCU rows, 0 for none.", "list", "0,1");
+    QCommandLineOption corpusDirOption("corpus-dir", "Keep the fidelity corpus in <dir> instead of a temporary directory.", "dir");
+    QCommandLineOption maxFirstFrameOption("max-first-frame-ms", "Fail fidelity if any first frame takes longer.", "ms", "0");
+    QCommandLineOption minFirstPsnrOption("min-first-psnr", "Fail fidelity if a progressive first scan has lower PSNR.", "dB", "0");
+    QCommandLineOption minFirstSsimOption("min-first-ssim", "Fail fidelity if a progressive first scan has lower SSIM.", "value", "0");
+    QCommandLineOption widthOption("width", "Blur and encode test image width.", "pixels", "4000");
+    QCommandLineOption heightOption("height", "Blur and encode test image height.", "pixels", "3000");
+    QCommandLineOption iterationsOption("iterations", "Runs per measurement.", "count", "3");
+    parser.addOption(suiteOption);
+    parser.addOption(sizesOption);
+    parser.addOption(jsonOption);
+    parser.addOption(csvOption);
+    parser.addOption(subsamplingsOption);
+    parser.addOption(restartsOption);
+    parser.addOption(corpusDirOption);
+    parser.addOption(maxFirstFrameOption);
+    parser.addOption(minFirstPsnrOption);
+    parser.addOption(minFirstSsimOption);
+    parser.addOption(widthOption);
+    parser.addOption(heightOption);
+    parser.addOption(iterationsOption);
+    parser.process(app);
+
+    const QString suite = parser.value(suiteOption);
+    if (suite != "hotpaths" && suite != "blur" && suite != "allocations" && suite != "encode" &&
+        suite != "fidelity" && suite != "all") {
+        QTextStream(stderr) << "Unknown suite: " << suite << "\n";
+        return 2;
+    }
+    const int iterations = qMax(1, parser.value(iterationsOption).toInt());
+
+    bool ok = true;
+    if (suite == "blur" || suite == "all") {
+        const QSize imageSize(parser.value(widthOption).toInt(), parser.value(heightOption).toInt());
+        BlurBenchmark blurBenchmark(imageSize, iterations);
+        ok = blurBenchmark.run() && ok;
+    }
+    if (suite == "encode" || suite == "all") {
+        const QSize imageSize(parser.value(widthOption).toInt(), parser.value(heightOption).toInt());
+        EncodeBenchmark encodeBenchmark(imageSize, iterations);
+        ok = encodeBenchmark.run() && ok;
+    }
+    QList<QSize> sizes = BenchmarkCorpus::parseSizes(parser.value(sizesOption));
+    if (sizes.isEmpty()) {
+        sizes = BenchmarkCorpus::defaultSizes();
+    }
+    if (suite == "hotpaths" || suite == "all") {
+        HotPathBenchmark hotPathBenchmark(sizes, iterations);
+        ok = hotPathBenchmark.run(parser.value(jsonOption)) && ok;
+    }
+    if (suite == "allocations" || suite == "all") {
+        AllocationBenchmark allocationBenchmark(sizes, iterations);
+        ok = allocationBenchmark.run() && ok;
+    }
+    if (suite == "fidelity" || suite == "all") {
+        CorpusOptions corpusOptions;
+        corpusOptions.subsamplings = BenchmarkCorpus::parseSubsamplings(parser.value(subsamplingsOption));
+        corpusOptions.restartRows = BenchmarkCorpus::parseList(parser.value(restartsOption));
+        if (corpusOptions.subsamplings.isEmpty() || corpusOptions.restartRows.isEmpty()) {
+            QTextStream(stderr) << "Empty --subsamplings or --restarts\n";
+            return 2;
+        }
+        FidelityThresholds thresholds;
+        thresholds.maxFirstFrameMs = parser.value(maxFirstFrameOption).toDouble();
+        thresholds.minFirstScanPsnr = parser.value(minFirstPsnrOption).toDouble();
+        thresholds.minFirstScanSsim = parser.value(minFirstSsimOption).toDouble();
+
+        FidelityBenchmark fidelityBenchmark(sizes, corpusOptions, iterations);
+        fidelityBenchmark.setThresholds(thresholds);
+        fidelityBenchmark.setCorpusDirectory(parser.value(corpusDirOption));
+        // При --suite all JSON уже занят hotpaths
+        ok = fidelityBenchmark.run(suite == "fidelity" ? parser.value(jsonOption) : QString(),
+                                   parser.value(csvOption)) && ok;
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,261 @@
+#include "blurengine.h"
+#include "tracing.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+struct BlurJob {
+    const uchar* src;
+    qsizetype srcStride;
+    uchar* dst;
+    qsizetype dstStride;
+    int width;
+    int height;
+    int radius;
+    int step;
+    int samplesX;
+    const quint32* columnCounts;
+};
+
+struct Band {
+    int firstSampleRow;
+    int lastSampleRow;
+};
+
+void addRow(quint32* dst, const quint32* src, int count) {
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= count; i += 8) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_add_epi32(a, b));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= count; i += 4) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_add_epi32(a, b));
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] += src[i];
+    }
+}
+
+void subtractRow(quint32* dst, const quint32* src, int count) {
+    int i = 0;
+#if defined(__AVX2__)
+    for (; i + 8 <= count; i += 8) {
+        const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_sub_epi32(a, b));
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    for (; i + 4 <= count; i += 4) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_sub_epi32(a, b));
+    }
+#endif
+    for (; i < count; ++i) {
+        dst[i] -= src[i];
+    }
+}
+
+void fillRow(quint32* row, int count, quint32 value) {
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256i v = _mm256_set1_epi32(static_cast<int>(value));
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(row + i), v);
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    const __m128i v = _mm_set1_epi32(static_cast<int>(value));
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(row + i), v);
+    }
+#endif
+    for (; i < count; ++i) {
+        row[i] = value;
+    }
+}
+
+// Точное целочисленное деление через обратную величину с коррекцией
+inline quint32 divide(quint32 sum, quint32 count, double inverse) {
+    quint32 q = static_cast<quint32>(sum * inverse);
+    if (q * count > sum) {
+        --q;
+    } else if ((q + 1) * count <= sum) {
+        ++q;
+    }
+    return q;
+}
+
+// Горизонтальные суммы одной строки в точках x = k * step, по каналам R, G, B
+void horizontalSums(const BlurJob& job, int y, quint32* prefix, quint32* out) {
+    const QRgb* line = reinterpret_cast<const QRgb*>(job.src + y * job.srcStride);
+    quint32* pr = prefix;
+    quint32* pg = prefix + (job.width + 1);
+    quint32* pb = prefix + 2 * (job.width + 1);
+    pr[0] = pg[0] = pb[0] = 0;
+    for (int x = 0; x < job.width; ++x) {
+        const QRgb c = line[x];
+        pr[x + 1] = pr[x] + qRed(c);
+        pg[x + 1] = pg[x] + qGreen(c);
+        pb[x + 1] = pb[x] + qBlue(c);
+    }
+
+    quint32* outR = out;
+    quint32* outG = out + job.samplesX;
+    quint32* outB = out + 2 * job.samplesX;
+    for (int k = 0; k < job.samplesX; ++k) {
+        const int x = k * job.step;
+        const int x0 = qMax(0, x - job.radius);
+        const int x1 = qMin(job.width - 1, x + job.radius) + 1;
+        outR[k] = pr[x1] - pr[x0];
+        outG[k] = pg[x1] - pg[x0];
+        outB[k] = pb[x1] - pb[x0];
+    }
+}
+
+void processBand(const BlurJob& job, const Band& band) {
+    const int planeSize = 3 * job.samplesX;
+    const int ringSize = 2 * job.radius + 1 + job.step;
+
+    std::vector<quint32> prefix(3 * (job.width + 1));
+    std::vector<quint32> ring(static_cast<size_t>(ringSize) * planeSize);
+    std::vector<quint32> window(planeSize, 0);
+    std::vector<quint32> outputRow(job.width);
+
+    auto ringRow = [&](int y) { return ring.data() + static_cast<size_t>(y % ringSize) * planeSize; };
+
+    int windowStart = 0;
+    int windowEnd = -1;
+
+    for (int j = band.firstSampleRow; j <= band.lastSampleRow; ++j) {
+        const int y = j * job.step;
+        const int newStart = qMax(0, y - job.radius);
+        const int newEnd = qMin(job.height - 1, y + job.radius);
+
+        if (windowEnd < windowStart || newStart > windowEnd) {
+            std::fill(window.begin(), window.end(), 0u);
+            windowStart = newStart;
+            windowEnd = newStart - 1;
+        }
+        for (; windowStart < newStart; ++windowStart) {
+            subtractRow(window.data(), ringRow(windowStart), planeSize);
+        }
+        for (int row = windowEnd + 1; row <= newEnd; ++row) {
+            quint32* entering = ringRow(row);
+            horizontalSums(job, row, prefix.data(), entering);
+            addRow(window.data(), entering, planeSize);
+        }
+        windowEnd = newEnd;
+
+        const quint32 rows = static_cast<quint32>(newEnd - newStart + 1);
+        const quint32* sumR = window.data();
+        const quint32* sumG = sumR + job.samplesX;
+        const quint32* sumB = sumG + job.samplesX;
+        for (int k = 0; k < job.samplesX; ++k) {
+            const quint32 count = job.columnCounts[k] * rows;
+            const double inverse = 1.0 / count;
+            const quint32 value = qRgb(divide(sumR[k], count, inverse),
+                                       divide(sumG[k], count, inverse),
+                                       divide(sumB[k], count, inverse));
+            const int x = k * job.step;
+            fillRow(outputRow.data() + x, qMin(job.step, job.width - x), value);
+        }
+
+        const int yEnd = qMin(job.height, y + job.step);
+        for (int py = y; py < yEnd; ++py) {
+            std::memcpy(job.dst + py * job.dstStride, outputRow.data(), job.width * sizeof(quint32));
+        }
+    }
+}
+
+} // namespace
+
+QImage BlurEngine::apply(const QImage& image, int radius) {
+    if (radius <= 0 || image.isNull()) {
+        return image;
+    }
+    TRACE_SCOPE("blur");
+    TRACE_COUNTER("pixels", static_cast<qint64>(image.width()) * image.height());
+
+    QImage source = image;
+    if (source.format() != QImage::Format_RGB32 && source.format() != QImage::Format_ARGB32) {
+        source = source.convertToFormat(QImage::Format_ARGB32);
+    }
+
+    QImage result(source.size(), source.format());
+    if (result.isNull()) {
+        return QImage();
+    }
+
+    BlurJob job;
+    job.src = source.constBits();
+    job.srcStride = source.bytesPerLine();
+    job.dst = result.bits();
+    job.dstStride = result.bytesPerLine();
+    job.width = source.width();
+    job.height = source.height();
+    job.radius = radius;
+    job.step = qMax(1, radius / 2);
+    job.samplesX = (job.width + job.step - 1) / job.step;
+
+    std::vector<quint32> columnCounts(job.samplesX);
+    for (int k = 0; k < job.samplesX; ++k) {
+        const int x = k * job.step;
+        columnCounts[k] = static_cast<quint32>(qMin(job.width - 1, x + radius) - qMax(0, x - radius) + 1);
+    }
+    job.columnCounts = columnCounts.data();
+
+    // Полосы по строкам-отсчётам; каждая полоса заново набирает своё окно,
+    // поэтому полосы не должны быть слишком узкими
+    const int samplesY = (job.height + job.step - 1) / job.step;
+    const int minBandRows = qMax(16, 2 * radius / job.step);
+    const int bandCount = qBound(1, samplesY / minBandRows, QThread::idealThreadCount() * 4);
+    QVector<Band> bands;
+    bands.reserve(bandCount);
+    for (int b = 0; b < bandCount; ++b) {
+        Band band;
+        band.firstSampleRow = static_cast<int>(static_cast<qint64>(samplesY) * b / bandCount);
+        band.lastSampleRow = static_cast<int>(static_cast<qint64>(samplesY) * (b + 1) / bandCount) - 1;
+        if (band.firstSampleRow <= band.lastSampleRow) {
+            bands.append(band);
+        }
+    }
+
+    if (bands.size() == 1) {
+        processBand(job, bands.first());
+    } else {
+        QtConcurrent::blockingMap(bands, [&job](const Band& band) { processBand(job, band); });
+    }
+
+    if (result.format() != image.format()) {
+        result = result.convertToFormat(image.format());
+    }
+    return result;
+}
+
+const char* BlurEngine::simdName() {
+#if defined(__AVX2__)
+    return "AVX2";
+#elif defined(__SSE2__) || defined(_M_X64)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
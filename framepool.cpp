@@ -0,0 +1,145 @@
+#include "framepool.h"
+#include "memoryaccountant.h"
+#include "tracing.h"
+#include <QtCore/QMutex>
+#include <QtCore/QVector>
+#include <cstdlib>
+
+struct FramePool::State {
+    struct Buffer {
+        uchar* data;
+        qsizetype bytes;
+    };
+
+    // Информация для функции очистки QImage: буфер и пул, куда его вернуть
+    struct Lease {
+        std::weak_ptr<State> pool;
+        Buffer buffer;
+    };
+
+    mutable QMutex mutex;
+    QVector<Buffer> idle;
+    int maxIdleFrames;
+    qsizetype currentBytes = 0;     // размер кадров, которые сейчас запрашивают
+    qint64 outstandingBytes = 0;
+    FramePoolStats stats;
+    // Выданные кадры учитывают их владельцы, пул - только свободные буферы
+    MemoryCharge idleCharge{MemoryAccountant::Scans};
+
+    ~State();
+    void release(const Buffer& buffer);
+    void trim();
+};
+
+FramePool::State::~State() {
+    for (const Buffer& buffer : idle) {
+        std::free(buffer.data);
+    }
+}
+
+void FramePool::State::release(const Buffer& buffer) {
+    QMutexLocker locker(&mutex);
+    outstandingBytes -= buffer.bytes;
+    if (buffer.bytes != currentBytes || idle.size() >= maxIdleFrames) {
+        locker.unlock();
+        std::free(buffer.data);
+        return;
+    }
+    idle.append(buffer);
+    stats.idleFrames = idle.size();
+    stats.idleBytes += buffer.bytes;
+    idleCharge.set(stats.idleBytes);
+}
+
+void FramePool::State::trim() {
+    for (int i = idle.size() - 1; i >= 0; --i) {
+        if (idle[i].bytes != currentBytes) {
+            stats.idleBytes -= idle[i].bytes;
+            std::free(idle[i].data);
+            idle.remove(i);
+        }
+    }
+    stats.idleFrames = idle.size();
+    idleCharge.set(stats.idleBytes);
+}
+
+void FramePool::returnBuffer(void* info) {
+    State::Lease* lease = static_cast<State::Lease*>(info);
+    if (std::shared_ptr<State> pool = lease->pool.lock()) {
+        pool->release(lease->buffer);
+    } else {
+        std::free(lease->buffer.data);
+    }
+    delete lease;
+}
+
+FramePool::FramePool(int maxIdleFrames)
+    : state(std::make_shared<State>())
+{
+    state->maxIdleFrames = qMax(0, maxIdleFrames);
+}
+
+FramePool::~FramePool() {
+    clear();
+}
+
+QImage FramePool::acquire(const QSize& size, QImage::Format format) {
+    if (size.isEmpty() || format == QImage::Format_Invalid) {
+        return QImage();
+    }
+    const int depth = QImage::toPixelFormat(format).bitsPerPixel();
+    const qsizetype bytesPerLine = ((static_cast<qsizetype>(size.width()) * depth + 31) / 32) * 4;
+    const qsizetype bytes = bytesPerLine * size.height();
+
+    uchar* data = nullptr;
+    {
+        QMutexLocker locker(&state->mutex);
+        if (state->currentBytes != bytes) {
+            state->currentBytes = bytes;
+            state->trim();
+        }
+        if (!state->idle.isEmpty()) {
+            data = state->idle.last().data;
+            state->idle.removeLast();
+            state->stats.idleFrames = state->idle.size();
+            state->stats.idleBytes -= bytes;
+            state->idleCharge.set(state->stats.idleBytes);
+            state->stats.reuses++;
+        } else {
+            state->stats.allocations++;
+        }
+        state->outstandingBytes += bytes;
+        state->stats.peakBytes = qMax(state->stats.peakBytes, state->outstandingBytes + state->stats.idleBytes);
+    }
+
+    if (!data) {
+        data = static_cast<uchar*>(std::malloc(static_cast<size_t>(bytes)));
+        if (!data) {
+            QMutexLocker locker(&state->mutex);
+            state->outstandingBytes -= bytes;
+            return QImage();
+        }
+        // Счётчик трассировки - только настоящие malloc кадров
+        TRACE_COUNTER("frame_allocations", 1);
+        TRACE_COUNTER("frame_allocated_bytes", bytes);
+    }
+
+    State::Lease* lease = new State::Lease{state, {data, bytes}};
+    return QImage(data, size.width(), size.height(), bytesPerLine, format, returnBuffer, lease);
+}
+
+void FramePool::clear() {
+    QMutexLocker locker(&state->mutex);
+    for (const State::Buffer& buffer : state->idle) {
+        std::free(buffer.data);
+    }
+    state->idle.clear();
+    state->stats.idleFrames = 0;
+    state->stats.idleBytes = 0;
+    state->idleCharge.set(0);
+}
+
+FramePoolStats FramePool::stats() const {
+    QMutexLocker locker(&state->mutex);
+    return state->stats;
+}
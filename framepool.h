@@ -0,0 +1,46 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <QtGui/QImage>
+#include <QtCore/QSize>
+#include <QtCore/QtGlobal>
+#include <memory>
+
+struct FramePoolStats {
+    int allocations = 0;    // новых буферов
+    int reuses = 0;         // кадров на возвращённых буферах
+    int idleFrames = 0;
+    qint64 idleBytes = 0;
+    qint64 peakBytes = 0;   // выданных и свободных буферов одновременно
+};
+
+// Буферы кадров декодера. acquire() отдаёт обычный QImage поверх буфера
+// пула; когда уничтожена последняя копия кадра, буфер возвращается в пул
+// и достаётся следующему кадру того же размера, без malloc и без
+// повторного заполнения страниц. Возвращённые буферы другого размера
+// (прежнее изображение) освобождаются сразу. Потокобезопасен; кадры могут
+// пережить пул, тогда их буферы просто освобождаются.
+class FramePool {
+public:
+    static const int DefaultMaxIdleFrames = 4;
+
+    explicit FramePool(int maxIdleFrames = DefaultMaxIdleFrames);
+    ~FramePool();
+
+    FramePool(const FramePool&) = delete;
+    FramePool& operator=(const FramePool&) = delete;
+
+    // Содержимое кадра не инициализировано
+    QImage acquire(const QSize& size, QImage::Format format);
+    void clear();
+
+    FramePoolStats stats() const;
+
+private:
+    struct State;
+    std::shared_ptr<State> state;
+
+    static void returnBuffer(void* info);
+};
+
+#endif // FRAMEPOOL_H
@@ -0,0 +1,175 @@
+#include "imagecache.h"
+#include "jpegdecoder.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QDateTime>
+#include <QtCore/QFileInfo>
+#include <QtCore/QThread>
+
+ImageCacheKey ImageCacheKey::forFile(const QString& filename) {
+    ImageCacheKey key;
+    const QFileInfo info(filename);
+    if (!info.exists()) {
+        return key;
+    }
+    key.path = info.absoluteFilePath();
+    key.size = info.size();
+    key.modified = info.lastModified().toMSecsSinceEpoch();
+    return key;
+}
+
+QString ImageCacheKey::toString() const {
+    return QString("%1|%2|%3").arg(path).arg(size).arg(modified);
+}
+
+ImageCache::ImageCache(qint64 budget) {
+    entries.setMaxCost(qMax<qint64>(0, budget));
+    trimHandler = MemoryAccountant::instance().addTrimHandler([this]() { clear(); });
+}
+
+ImageCache::~ImageCache() {
+    MemoryAccountant::instance().removeTrimHandler(trimHandler);
+}
+
+void ImageCache::setBudget(qint64 bytes) {
+    QMutexLocker locker(&mutex);
+    entries.setMaxCost(qMax<qint64>(0, bytes));
+    charge.set(entries.totalCost());
+}
+
+bool ImageCache::covers(const CachedImage& entry, const QSize& targetSize) {
+    if (!entry.reduced || targetSize.isEmpty()) {
+        return true;
+    }
+    const QSize needed = entry.image.size().scaled(targetSize, Qt::KeepAspectRatio);
+    return needed.width() <= entry.image.width() && needed.height() <= entry.image.height();
+}
+
+void ImageCache::insert(const ImageCacheKey& key, const CachedImage& entry, bool prefetchedEntry) {
+    if (!key.isValid() || entry.image.isNull()) {
+        return;
+    }
+    QMutexLocker locker(&mutex);
+    entries.insert(key.toString(), new CachedImage(entry), qMax<qint64>(1, entry.image.sizeInBytes()));
+    charge.set(entries.totalCost());
+    if (prefetchedEntry) {
+        prefetched++;
+    }
+}
+
+bool ImageCache::find(const ImageCacheKey& key, const QSize& targetSize, CachedImage& entry) {
+    QMutexLocker locker(&mutex);
+    const CachedImage* cached = key.isValid() ? entries.object(key.toString()) : nullptr;
+    if (!cached || !covers(*cached, targetSize)) {
+        misses++;
+        return false;
+    }
+    hits++;
+    entry = *cached;
+    return true;
+}
+
+bool ImageCache::contains(const ImageCacheKey& key, const QSize& targetSize) const {
+    QMutexLocker locker(&mutex);
+    const CachedImage* cached = key.isValid() ? entries.object(key.toString()) : nullptr;
+    return cached && covers(*cached, targetSize);
+}
+
+void ImageCache::clear() {
+    QMutexLocker locker(&mutex);
+    entries.clear();
+    charge.set(0);
+}
+
+ImageCacheStats ImageCache::stats() const {
+    QMutexLocker locker(&mutex);
+    ImageCacheStats result;
+    result.hits = hits;
+    result.misses = misses;
+    result.entries = entries.count();
+    result.prefetched = prefetched;
+    result.bytesInUse = entries.totalCost();
+    result.budget = entries.maxCost();
+    return result;
+}
+
+ImagePrefetcher::ImagePrefetcher(ImageCache* cache)
+    : cache(cache)
+{
+    // Половина ядер: текущая загрузка не должна ждать упреждающих
+    pool.setMaxThreadCount(qBound(1, QThread::idealThreadCount() / 2, 4));
+}
+
+ImagePrefetcher::~ImagePrefetcher() {
+    cancelAll();
+    pool.waitForDone();
+}
+
+void ImagePrefetcher::cancelAll() {
+    for (const std::shared_ptr<Task>& task : tasks) {
+        task->cancelled = true;
+    }
+    tasks.clear();
+}
+
+void ImagePrefetcher::prefetch(const QStringList& files) {
+    for (auto it = tasks.begin(); it != tasks.end();) {
+        if (!files.contains(it.key()) || it.value()->future.isFinished()) {
+            it.value()->cancelled = true;
+            it = tasks.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    for (const QString& filename : files) {
+        if (tasks.contains(filename) || cache->contains(ImageCacheKey::forFile(filename), targetSize)) {
+            continue;
+        }
+        std::shared_ptr<Task> task = std::make_shared<Task>();
+        ImageCache* target = cache;
+        const QSize size = targetSize;
+        const bool grayscale = grayscaleOutput;
+        const qint64 pixels = maxPixels;
+        task->future = QtConcurrent::run(&pool, [target, filename, size, grayscale, pixels, task]() {
+            decode(target, filename, size, grayscale, pixels, task.get());
+        });
+        tasks.insert(filename, task);
+    }
+}
+
+void ImagePrefetcher::decode(ImageCache* cache, const QString& filename, const QSize& targetSize,
+                             bool grayscale, qint64 maxPixels, Task* task) {
+    if (task->isCancelled()) {
+        return;
+    }
+    const ImageCacheKey key = ImageCacheKey::forFile(filename);
+    MappedJpegFile file;
+    if (!key.isValid() || !file.open(filename) || !file.index().isValid()) {
+        return;
+    }
+    const QSize size = file.index().size;
+    if (maxPixels > 0 && static_cast<qint64>(size.width()) * size.height() >= maxPixels) {
+        return;
+    }
+
+    JpegDecoder decoder;
+    decoder.setAutoTransform(true);
+    decoder.setGrayscaleOutput(grayscale);
+    decoder.setLoadMonitor(task);
+    decoder.setTargetSize(targetSize);
+    if (!decoder.open(file.bytes(), file.index())) {
+        return;
+    }
+    // Упреждающее декодирование не стоит того, чтобы ради него сбрасывать
+    // кэши или уменьшать следующее изображение
+    const qint64 frameBytes = static_cast<qint64>(decoder.size().width()) * decoder.size().height() * 4;
+    if (!MemoryAccountant::instance().fits(frameBytes)) {
+        return;
+    }
+    CachedImage entry;
+    if (!decoder.decodeFinal(entry.image)) {
+        return;
+    }
+    entry.reduced = decoder.scaleDenominator() > 1;
+    cache->insert(key, entry, true);
+}
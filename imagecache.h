@@ -0,0 +1,119 @@
+#ifndef IMAGECACHE_H
+#define IMAGECACHE_H
+
+#include "jpegstrategy.h"
+#include "memoryaccountant.h"
+#include <QtGui/QImage>
+#include <QtCore/QCache>
+#include <QtCore/QFuture>
+#include <QtCore/QMap>
+#include <QtCore/QMutex>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
+#include <QtCore/QtGlobal>
+#include <atomic>
+#include <memory>
+
+// Файл узнаётся по пути, размеру и времени изменения: перезаписанный
+// файл с тем же именем в кэше не найдётся
+struct ImageCacheKey {
+    QString path;
+    qint64 size = -1;
+    qint64 modified = 0;
+
+    static ImageCacheKey forFile(const QString& filename);
+    bool isValid() const { return size >= 0; }
+    QString toString() const;
+};
+
+struct CachedImage {
+    QImage image;
+    bool reduced = false;   // декодировано в уменьшенном масштабе DCT
+};
+
+struct ImageCacheStats {
+    int hits = 0;
+    int misses = 0;
+    int entries = 0;
+    int prefetched = 0;
+    qint64 bytesInUse = 0;
+    qint64 budget = 0;
+};
+
+// Декодированные изображения с вытеснением по давности использования
+// в пределах бюджета памяти. Сбрасывается целиком, когда загрузке не хватает
+// общего бюджета MemoryAccountant. Потокобезопасен.
+class ImageCache {
+public:
+    static const qint64 DefaultBudget = 512LL * 1024 * 1024;
+
+    explicit ImageCache(qint64 budget = DefaultBudget);
+    ~ImageCache();
+
+    ImageCache(const ImageCache&) = delete;
+    ImageCache& operator=(const ImageCache&) = delete;
+
+    void setBudget(qint64 bytes);
+
+    void insert(const ImageCacheKey& key, const CachedImage& entry, bool prefetched = false);
+    // Уменьшенная копия подходит, только если её хватает для области targetSize
+    bool find(const ImageCacheKey& key, const QSize& targetSize, CachedImage& entry);
+    bool contains(const ImageCacheKey& key, const QSize& targetSize) const;
+    void clear();
+
+    ImageCacheStats stats() const;
+
+private:
+    mutable QMutex mutex;
+    QCache<QString, CachedImage> entries;
+    int hits = 0;
+    int misses = 0;
+    int prefetched = 0;
+    MemoryCharge charge{MemoryAccountant::Caches};
+    int trimHandler = 0;
+
+    static bool covers(const CachedImage& entry, const QSize& targetSize);
+};
+
+// Упреждающее декодирование соседних файлов каталога в фоне, в масштабе
+// области просмотра и сразу в окончательном качестве (все сканы)
+class ImagePrefetcher {
+public:
+    explicit ImagePrefetcher(ImageCache* cache);
+    ~ImagePrefetcher();
+
+    ImagePrefetcher(const ImagePrefetcher&) = delete;
+    ImagePrefetcher& operator=(const ImagePrefetcher&) = delete;
+
+    void setTargetSize(const QSize& size) { targetSize = size; }
+    void setGrayscaleOutput(bool enabled) { grayscaleOutput = enabled; }
+    // Файлы крупнее этого открываются тайлами, их не декодируют целиком
+    void setMaxPixels(qint64 pixels) { maxPixels = pixels; }
+
+    // Оставляет в работе только files (в порядке приоритета), остальное отменяет
+    void prefetch(const QStringList& files);
+    void cancelAll();
+
+private:
+    class Task : public LoadMonitor {
+    public:
+        void progress(int percent) override { Q_UNUSED(percent); }
+        bool isCancelled() const override { return cancelled.load(); }
+        std::atomic_bool cancelled{false};
+        QFuture<void> future;
+    };
+
+    ImageCache* cache;
+    QSize targetSize;
+    bool grayscaleOutput = false;
+    qint64 maxPixels = 0;
+    QThreadPool pool;
+    QMap<QString, std::shared_ptr<Task>> tasks;
+
+    static void decode(ImageCache* cache, const QString& filename, const QSize& targetSize,
+                       bool grayscale, qint64 maxPixels, Task* task);
+};
+
+#endif // IMAGECACHE_H
@@ -11,3 +11,17 @@ ImageHandler* ImageHandler::createHandler(HandlerType type) {
     }
 }
 
+ImageHandler* ImageHandler::createHandler(const QString& filename) {
+    QSharedPointer<MappedJpegFile> file(new MappedJpegFile());
+    if (!file->open(filename)) {
+        return createHandler(Progressive);
+    }
+    return createHandler(file);
+}
+
+ImageHandler* ImageHandler::createHandler(const QSharedPointer<MappedJpegFile>& file) {
+    const JpegFileIndex& index = file->index();
+    ImageHandler* handler = createHandler(index.isValid() && !index.isProgressive() ? Standard : Progressive);
+    handler->setMappedFile(file);
+    return handler;
+}
@@ -14,6 +14,9 @@ public:
     };
     
     static ImageHandler* createHandler(HandlerType type);
+    // Тип обработчика выбирается по индексу маркеров файла
+    static ImageHandler* createHandler(const QString& filename);
+    static ImageHandler* createHandler(const QSharedPointer<MappedJpegFile>& file);
     virtual ~ImageHandler() = default;
     
     virtual bool loadImage(const QString& filename, QImage& image) = 0;
@@ -22,8 +25,40 @@ public:
 
     virtual bool loadNextScan(QImage& image) { Q_UNUSED(image); return false; }
     virtual bool hasMoreScans() const { return false; }
+    virtual int currentScan() const { return 0; }
+    virtual int scanCount() const { return 0; }
     virtual void reset() {}
 
+    void setLoadMonitor(LoadMonitor* monitor) { strategy->setLoadMonitor(monitor); }
+    void setTargetSize(const QSize& size) { strategy->setTargetSize(size); }
+    bool isReducedResolution() const { return strategy->isReducedResolution(); }
+    const MemoryDecodePlan& lastMemoryPlan() const { return strategy->lastMemoryPlan(); }
+    void setGrayscaleOutput(bool enabled) { strategy->setGrayscaleOutput(enabled); }
+    void setDecodeThreads(int count) { strategy->setDecodeThreads(count); }
+    bool loadFullResolution(const QString& filename, QImage& image) {
+        return strategy->loadFullResolution(filename, image);
+    }
+    void setMappedFile(const QSharedPointer<MappedJpegFile>& file) { strategy->setMappedFile(file); }
+
+    bool encodeImage(const QString& filename, const QImage& image, const JpegEncodeOptions& options) {
+        return strategy->encodeImage(filename, image, options);
+    }
+    bool searchQuality(const QImage& image, const JpegEncodeOptions& options, const QualityTarget& target,
+                       QualitySearchResult& result) {
+        return strategy->searchQuality(image, options, target, result);
+    }
+    bool writeEncoded(const QString& filename, const QByteArray& jpeg) {
+        return strategy->writeEncoded(filename, jpeg);
+    }
+    const JpegEncodeStats& lastEncodeStats() const { return strategy->lastEncodeStats(); }
+    QString lastEncodeError() const { return strategy->lastEncodeError(); }
+
+    bool transformFile(const QString& filename, const QString& outputFilename, const JpegTransformOptions& options) {
+        return strategy->transformFile(filename, outputFilename, options);
+    }
+    const JpegTransformStats& lastTransformStats() const { return strategy->lastTransformStats(); }
+    QString lastTransformError() const { return strategy->lastTransformError(); }
+
 protected:
     JPEGStrategy* strategy;
     ImageHandler(JPEGStrategy* strategy) : strategy(strategy) {}
@@ -73,6 +108,33 @@ public:
         }
         return false;
     }
+
+    int currentScan() const override {
+        ProgressiveJPEGStrategy* progStrategy = dynamic_cast<ProgressiveJPEGStrategy*>(strategy);
+        return progStrategy ? progStrategy->currentScanIndex() : 0;
+    }
+
+    int scanCount() const override {
+        ProgressiveJPEGStrategy* progStrategy = dynamic_cast<ProgressiveJPEGStrategy*>(strategy);
+        return progStrategy ? progStrategy->scanCount() : 0;
+    }
+    
+    void setScanCacheBudget(qint64 bytes) {
+        ProgressiveJPEGStrategy* progStrategy = dynamic_cast<ProgressiveJPEGStrategy*>(strategy);
+        if (progStrategy) {
+            progStrategy->setScanCacheBudget(bytes);
+        }
+    }
+
+    ScanCacheStats scanCacheStats() const {
+        ProgressiveJPEGStrategy* progStrategy = dynamic_cast<ProgressiveJPEGStrategy*>(strategy);
+        return progStrategy ? progStrategy->scanCacheStats() : ScanCacheStats();
+    }
+
+    FramePoolStats framePoolStats() const {
+        ProgressiveJPEGStrategy* progStrategy = dynamic_cast<ProgressiveJPEGStrategy*>(strategy);
+        return progStrategy ? progStrategy->framePoolStats() : FramePoolStats();
+    }
     
     void reset() override {
         ProgressiveJPEGStrategy* progStrategy = dynamic_cast<ProgressiveJPEGStrategy*>(strategy);
@@ -0,0 +1,263 @@
+#include "imagemetrics.h"
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+QImage toRgb32(const QImage& image) {
+    if (image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32) {
+        return image;
+    }
+    return image.convertToFormat(QImage::Format_RGB32);
+}
+
+// Сумма квадратов разностей R, G, B строки; альфа не учитывается
+quint64 rowSquaredError(const QRgb* p, const QRgb* q, int width) {
+    quint64 total = 0;
+    int x = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i colorMask = _mm_set1_epi32(0x00FFFFFF);
+    while (x + 4 <= width) {
+        // За 4096 шагов 32-битная сумма не переполняется: 4 * 255^2 на шаг в каждой ячейке
+        const int end = qMin(width, x + 4 * 4096);
+        __m128i sum = zero;
+        for (; x + 4 <= end; x += 4) {
+            const __m128i a = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p + x)), colorMask);
+            const __m128i b = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(q + x)), colorMask);
+            const __m128i low = _mm_sub_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+            const __m128i high = _mm_sub_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+            sum = _mm_add_epi32(sum, _mm_add_epi32(_mm_madd_epi16(low, low), _mm_madd_epi16(high, high)));
+        }
+        quint32 lanes[4];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lanes), sum);
+        total += static_cast<quint64>(lanes[0]) + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+    for (; x < width; ++x) {
+        const int dr = qRed(p[x]) - qRed(q[x]);
+        const int dg = qGreen(p[x]) - qGreen(q[x]);
+        const int db = qBlue(p[x]) - qBlue(q[x]);
+        total += static_cast<quint64>(dr * dr + dg * dg + db * db);
+    }
+    return total;
+}
+
+// Яркость BT.601 в целых числах для строки y; Grayscale8 отдаётся без копирования
+const quint8* lumaRow(const QImage& image, int y, quint8* buffer) {
+    if (image.format() == QImage::Format_Grayscale8) {
+        return image.constScanLine(y);
+    }
+    const QRgb* line = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+    const int width = image.width();
+    int x = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i zero = _mm_setzero_si128();
+    // Байты пикселя в памяти: B, G, R, A
+    const __m128i weights = _mm_setr_epi16(29, 150, 77, 0, 29, 150, 77, 0);
+    const __m128i rounding = _mm_set1_epi32(128);
+    for (; x + 4 <= width; x += 4) {
+        const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(line + x));
+        // Пары (B*29 + G*150, R*77) на пиксель, затем их сумма в чётных ячейках
+        __m128i low = _mm_madd_epi16(_mm_unpacklo_epi8(pixels, zero), weights);
+        __m128i high = _mm_madd_epi16(_mm_unpackhi_epi8(pixels, zero), weights);
+        low = _mm_shuffle_epi32(_mm_add_epi32(low, _mm_srli_epi64(low, 32)), _MM_SHUFFLE(3, 1, 2, 0));
+        high = _mm_shuffle_epi32(_mm_add_epi32(high, _mm_srli_epi64(high, 32)), _MM_SHUFFLE(3, 1, 2, 0));
+        __m128i luma = _mm_srli_epi32(_mm_add_epi32(_mm_unpacklo_epi64(low, high), rounding), 8);
+        luma = _mm_packs_epi32(luma, luma);
+        luma = _mm_packus_epi16(luma, luma);
+        const int packed = _mm_cvtsi128_si32(luma);
+        memcpy(buffer + x, &packed, sizeof(packed));
+    }
+#endif
+    for (; x < width; ++x) {
+        buffer[x] = static_cast<quint8>((qRed(line[x]) * 77 + qGreen(line[x]) * 150 + qBlue(line[x]) * 29 + 128) >> 8);
+    }
+    return buffer;
+}
+
+// Суммы по парам соседних пикселей строки: a, b, a*a, b*b, a*b подряд по pairs значений
+void accumulatePairs(const quint8* p, const quint8* q, int pairs, quint32* sums) {
+    quint32* sumA = sums;
+    quint32* sumB = sums + pairs;
+    quint32* sumAA = sums + 2 * pairs;
+    quint32* sumBB = sums + 3 * pairs;
+    quint32* sumAB = sums + 4 * pairs;
+    int i = 0;
+#if defined(__SSE2__) || defined(_M_X64)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i ones = _mm_set1_epi16(1);
+    auto add = [](quint32* dst, __m128i value) {
+        __m128i* target = reinterpret_cast<__m128i*>(dst);
+        _mm_storeu_si128(target, _mm_add_epi32(_mm_loadu_si128(target), value));
+    };
+    for (; i + 4 <= pairs; i += 4) {
+        const __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p + 2 * i)), zero);
+        const __m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(q + 2 * i)), zero);
+        add(sumA + i, _mm_madd_epi16(a, ones));
+        add(sumB + i, _mm_madd_epi16(b, ones));
+        add(sumAA + i, _mm_madd_epi16(a, a));
+        add(sumBB + i, _mm_madd_epi16(b, b));
+        add(sumAB + i, _mm_madd_epi16(a, b));
+    }
+#endif
+    for (; i < pairs; ++i) {
+        const quint32 a0 = p[2 * i];
+        const quint32 a1 = p[2 * i + 1];
+        const quint32 b0 = q[2 * i];
+        const quint32 b1 = q[2 * i + 1];
+        sumA[i] += a0 + a1;
+        sumB[i] += b0 + b1;
+        sumAA[i] += a0 * a0 + a1 * a1;
+        sumBB[i] += b0 * b0 + b1 * b1;
+        sumAB[i] += a0 * b0 + a1 * b1;
+    }
+}
+
+double windowSsim(double n, double sumA, double sumB, double sumAA, double sumBB, double sumAB) {
+    const double c1 = (0.01 * 255) * (0.01 * 255);
+    const double c2 = (0.03 * 255) * (0.03 * 255);
+    const double meanA = sumA / n;
+    const double meanB = sumB / n;
+    const double varianceA = sumAA / n - meanA * meanA;
+    const double varianceB = sumBB / n - meanB * meanB;
+    const double covariance = sumAB / n - meanA * meanB;
+    return (2 * meanA * meanB + c1) * (2 * covariance + c2) /
+           ((meanA * meanA + meanB * meanB + c1) * (varianceA + varianceB + c2));
+}
+
+// Изображение меньше окна: одно окно на всю ширину или высоту
+double smallImageSsim(const QImage& first, const QImage& second) {
+    const int width = first.width();
+    const int height = first.height();
+    const int windowWidth = qMin(8, width);
+    const int windowHeight = qMin(8, height);
+    QVector<quint8> lumaA(width);
+    QVector<quint8> lumaB(width);
+    QVector<quint32> sums(5 * width);
+
+    double total = 0.0;
+    int windows = 0;
+    for (int top = 0; top + windowHeight <= height; top += 4) {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int y = top; y < top + windowHeight; ++y) {
+            const quint8* p = lumaRow(first, y, lumaA.data());
+            const quint8* q = lumaRow(second, y, lumaB.data());
+            for (int x = 0; x < width; ++x) {
+                sums[x] += p[x];
+                sums[width + x] += q[x];
+                sums[2 * width + x] += p[x] * p[x];
+                sums[3 * width + x] += q[x] * q[x];
+                sums[4 * width + x] += p[x] * q[x];
+            }
+        }
+        for (int left = 0; left + windowWidth <= width; left += 4) {
+            double window[5] = {};
+            for (int k = 0; k < 5; ++k) {
+                for (int x = left; x < left + windowWidth; ++x) {
+                    window[k] += sums[k * width + x];
+                }
+            }
+            total += windowSsim(windowWidth * windowHeight, window[0], window[1], window[2], window[3], window[4]);
+            windows++;
+        }
+    }
+    return total / windows;
+}
+
+} // namespace
+
+double ImageMetrics::mse(const QImage& a, const QImage& b) {
+    if (a.isNull() || a.size() != b.size()) {
+        return -1.0;
+    }
+    const QImage first = toRgb32(a);
+    const QImage second = toRgb32(b);
+
+    double total = 0.0;
+    for (int y = 0; y < first.height(); ++y) {
+        const QRgb* p = reinterpret_cast<const QRgb*>(first.constScanLine(y));
+        const QRgb* q = reinterpret_cast<const QRgb*>(second.constScanLine(y));
+        total += static_cast<double>(rowSquaredError(p, q, first.width()));
+    }
+    return total / (3.0 * first.width() * first.height());
+}
+
+double ImageMetrics::psnr(const QImage& a, const QImage& b) {
+    const double error = mse(a, b);
+    if (error < 0.0) {
+        return -1.0;
+    }
+    if (error == 0.0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return 10.0 * std::log10(255.0 * 255.0 / error);
+}
+
+double ImageMetrics::ssim(const QImage& a, const QImage& b) {
+    if (a.isNull() || a.size() != b.size()) {
+        return -1.0;
+    }
+    const QImage first = a.format() == QImage::Format_Grayscale8 ? a : toRgb32(a);
+    const QImage second = b.format() == QImage::Format_Grayscale8 ? b : toRgb32(b);
+    const int width = first.width();
+    const int height = first.height();
+    if (width < 8 || height < 8) {
+        return smallImageSsim(first, second);
+    }
+
+    // Окна 8x8 с шагом 4 складываются из четырёх блоков 4x4, поэтому каждый
+    // пиксель читается один раз. Хранятся суммы двух последних рядов блоков
+    const int columns = width / 4;
+    const int rows = height / 4;
+    const int pairs = columns * 2;
+    QVector<quint8> lumaA(width);
+    QVector<quint8> lumaB(width);
+    QVector<quint32> pairSums(5 * pairs);
+    QVector<quint32> previous(5 * columns);
+    QVector<quint32> current(5 * columns);
+
+    double total = 0.0;
+    for (int row = 0; row < rows; ++row) {
+        std::fill(pairSums.begin(), pairSums.end(), 0);
+        for (int y = row * 4; y < row * 4 + 4; ++y) {
+            accumulatePairs(lumaRow(first, y, lumaA.data()), lumaRow(second, y, lumaB.data()), pairs,
+                            pairSums.data());
+        }
+        for (int k = 0; k < 5; ++k) {
+            for (int column = 0; column < columns; ++column) {
+                current[k * columns + column] = pairSums[k * pairs + 2 * column] + pairSums[k * pairs + 2 * column + 1];
+            }
+        }
+
+        if (row > 0) {
+            for (int column = 0; column + 1 < columns; ++column) {
+                double window[5];
+                for (int k = 0; k < 5; ++k) {
+                    const int i = k * columns + column;
+                    window[k] = static_cast<double>(previous[i]) + previous[i + 1] + current[i] + current[i + 1];
+                }
+                total += windowSsim(64, window[0], window[1], window[2], window[3], window[4]);
+            }
+        }
+        std::swap(previous, current);
+    }
+    return total / (static_cast<double>(rows - 1) * (columns - 1));
+}
+
+const char* ImageMetrics::simdName() {
+#if defined(__SSE2__) || defined(_M_X64)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
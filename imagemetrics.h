@@ -0,0 +1,20 @@
+#ifndef IMAGEMETRICS_H
+#define IMAGEMETRICS_H
+
+#include <QtGui/QImage>
+
+// Метрики расхождения двух изображений одного размера по каналам R, G, B.
+// Изображения других форматов сравниваются после перевода в RGB32.
+class ImageMetrics {
+public:
+    // -1, если размеры различаются или изображение пустое
+    static double mse(const QImage& a, const QImage& b);
+    // PSNR в дБ; для совпадающих изображений - бесконечность
+    static double psnr(const QImage& a, const QImage& b);
+    // Средний SSIM по яркости в окнах 8x8 с шагом 4; 1 - совпадение, -1 - как у mse()
+    static double ssim(const QImage& a, const QImage& b);
+
+    static const char* simdName();
+};
+
+#endif // IMAGEMETRICS_H
@@ -0,0 +1,258 @@
+#include "imageview.h"
+#include "tracing.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtGui/QPainter>
+#include <QtGui/QPaintEvent>
+#include <QtCore/QtGlobal>
+#include <cstring>
+
+namespace {
+
+const int BorderWidth = 2;
+
+// Формат, в который можно рисовать QPainter'ом и который быстро выводится
+QImage toDisplayFormat(const QImage& image) {
+    if (image.format() == QImage::Format_RGB32 || image.format() == QImage::Format_ARGB32_Premultiplied) {
+        return image;
+    }
+    TRACE_SCOPE("convert_format");
+    return image.convertToFormat(image.hasAlphaChannel() ? QImage::Format_ARGB32_Premultiplied
+                                                         : QImage::Format_RGB32);
+}
+
+QImage scaleTo(const QImage& image, const QSize& size, Qt::TransformationMode mode) {
+    if (image.size() == size) {
+        return toDisplayFormat(image);
+    }
+    TRACE_SCOPE(mode == Qt::SmoothTransformation ? "scale_smooth" : "scale_fast");
+    return toDisplayFormat(image.scaled(size, Qt::IgnoreAspectRatio, mode));
+}
+
+bool sameGeometry(const QImage& a, const QImage& b) {
+    return !a.isNull() && a.size() == b.size() && a.format() == b.format();
+}
+
+// Ограничивающий прямоугольник различающихся пикселей двух изображений
+// одного размера и формата
+QRect changedRect(const QImage& before, const QImage& after) {
+    const int width = after.width();
+    const size_t rowBytes = static_cast<size_t>(width) * 4;
+    int left = width;
+    int right = -1;
+    int top = -1;
+    int bottom = -1;
+    for (int y = 0; y < after.height(); ++y) {
+        const QRgb* a = reinterpret_cast<const QRgb*>(before.constScanLine(y));
+        const QRgb* b = reinterpret_cast<const QRgb*>(after.constScanLine(y));
+        if (std::memcmp(a, b, rowBytes) == 0) {
+            continue;
+        }
+        if (top < 0) {
+            top = y;
+        }
+        bottom = y;
+        int x = 0;
+        while (x < left && a[x] == b[x]) {
+            ++x;
+        }
+        left = qMin(left, x);
+        x = width - 1;
+        while (x > right && a[x] == b[x]) {
+            --x;
+        }
+        right = qMax(right, x);
+    }
+    if (top < 0) {
+        return QRect();
+    }
+    return QRect(left, top, right - left + 1, bottom - top + 1);
+}
+
+} // namespace
+
+ImageView::ImageView(QWidget *parent)
+    : QWidget(parent)
+    , placeholder("No image loaded")
+{
+    scalePool.setMaxThreadCount(1);
+    // При перетаскивании края окна плавное масштабирование откладывается
+    smoothTimer.setSingleShot(true);
+    smoothTimer.setInterval(80);
+    connect(&smoothTimer, &QTimer::timeout, this, &ImageView::startSmoothScale);
+    setAttribute(Qt::WA_OpaquePaintEvent);
+}
+
+ImageView::~ImageView()
+{
+    generation++;
+    scaleFuture.waitForFinished();
+}
+
+void ImageView::setPlaceholderText(const QString& text)
+{
+    placeholder = text;
+    if (source.isNull()) {
+        update();
+    }
+}
+
+void ImageView::clear()
+{
+    setImage(QImage());
+}
+
+QRect ImageView::contentRect() const
+{
+    return rect().adjusted(BorderWidth, BorderWidth, -BorderWidth, -BorderWidth);
+}
+
+QSize ImageView::fittedSize() const
+{
+    if (source.isNull() || contentRect().isEmpty()) {
+        return QSize();
+    }
+    return source.size().scaled(contentRect().size(), Qt::KeepAspectRatio);
+}
+
+QPoint ImageView::displayOrigin() const
+{
+    const QRect content = contentRect();
+    return QPoint(content.x() + (content.width() - display.width()) / 2,
+                  content.y() + (content.height() - display.height()) / 2);
+}
+
+void ImageView::setImage(const QImage& image)
+{
+    generation++;
+    smoothTimer.stop();
+    source = image;
+
+    const QSize target = fittedSize();
+    if (target.isEmpty()) {
+        resetDisplay(QImage());
+        return;
+    }
+
+    const QImage fast = scaleTo(source, target, Qt::FastTransformation);
+    if (!sameGeometry(fastCopy, fast) || !sameGeometry(display, fast)) {
+        resetDisplay(fast);
+        startSmoothScale();
+        return;
+    }
+
+    // Новый скан того же изображения: заплатка только там, где кадр изменился
+    const QRect changed = changedRect(fastCopy, fast);
+    fastCopy = fast;
+    if (!changed.isEmpty()) {
+        QPainter painter(&display);
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawImage(changed.topLeft(), fast, changed);
+        painter.end();
+        patchedRect |= changed;
+        update(changed.translated(displayOrigin()));
+    }
+    updateMemoryCharge();
+    startSmoothScale();
+}
+
+void ImageView::resetDisplay(const QImage& fast)
+{
+    fastCopy = fast;
+    display = fast;
+    smoothCopy = QImage();
+    patchedRect = fast.isNull() ? QRect() : QRect(QPoint(0, 0), fast.size());
+    updateMemoryCharge();
+    update();
+}
+
+void ImageView::updateMemoryCharge()
+{
+    // Копии часто делят один буфер: он считается один раз
+    qint64 bytes = display.sizeInBytes();
+    if (fastCopy.cacheKey() != display.cacheKey()) {
+        bytes += fastCopy.sizeInBytes();
+    }
+    if (smoothCopy.cacheKey() != display.cacheKey() && smoothCopy.cacheKey() != fastCopy.cacheKey()) {
+        bytes += smoothCopy.sizeInBytes();
+    }
+    displayCharge.set(bytes);
+}
+
+void ImageView::startSmoothScale()
+{
+    const QSize target = fittedSize();
+    if (target.isEmpty() || patchedRect.isEmpty()) {
+        return;
+    }
+    if (source.size() == target) {
+        applySmooth(generation.load(), fastCopy);
+        return;
+    }
+
+    const int forGeneration = generation.load();
+    const QImage image = source;
+    scaleFuture = QtConcurrent::run(&scalePool, [this, forGeneration, image, target]() {
+        // Пока задача ждала очереди, могло прийти новое изображение
+        if (forGeneration != generation.load()) {
+            return;
+        }
+        const QImage smooth = scaleTo(image, target, Qt::SmoothTransformation);
+        QMetaObject::invokeMethod(this, [this, forGeneration, smooth]() {
+            applySmooth(forGeneration, smooth);
+        }, Qt::QueuedConnection);
+    });
+}
+
+void ImageView::applySmooth(int forGeneration, const QImage& smooth)
+{
+    if (forGeneration != generation.load() || !sameGeometry(display, smooth)) {
+        return;
+    }
+
+    QRect changed = patchedRect;
+    if (sameGeometry(smoothCopy, smooth)) {
+        changed |= changedRect(smoothCopy, smooth);
+    } else {
+        changed = QRect(QPoint(0, 0), smooth.size());
+    }
+    display = smooth;
+    smoothCopy = smooth;
+    patchedRect = QRect();
+    updateMemoryCharge();
+    if (!changed.isEmpty()) {
+        update(changed.translated(displayOrigin()));
+    }
+}
+
+void ImageView::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    if (source.isNull()) {
+        return;
+    }
+    const QSize target = fittedSize();
+    if (target == display.size()) {
+        return;
+    }
+
+    // Сразу - быстрая копия, плавная - когда размер перестанет меняться
+    generation++;
+    resetDisplay(target.isEmpty() ? QImage() : scaleTo(source, target, Qt::FastTransformation));
+    smoothTimer.start();
+}
+
+void ImageView::paintEvent(QPaintEvent *event)
+{
+    TRACE_SCOPE("paint");
+    QPainter painter(this);
+    painter.setClipRect(event->rect());
+    painter.fillRect(rect(), Qt::gray);
+    painter.fillRect(contentRect(), QColor(0x2b, 0x2b, 0x2b));
+
+    if (display.isNull()) {
+        painter.setPen(Qt::lightGray);
+        painter.drawText(contentRect(), Qt::AlignCenter, placeholder);
+        return;
+    }
+    painter.drawImage(displayOrigin(), display);
+}
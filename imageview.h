@@ -0,0 +1,60 @@
+#ifndef IMAGEVIEW_H
+#define IMAGEVIEW_H
+
+#include "memoryaccountant.h"
+#include <QtWidgets/QWidget>
+#include <QtGui/QImage>
+#include <QtCore/QFuture>
+#include <QtCore/QRect>
+#include <QtCore/QString>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTimer>
+#include <atomic>
+
+// Просмотр изображения, вписанного в окно. Копия в разрешении экрана
+// пересчитывается только при смене изображения или размера окна: сначала
+// быстрое масштабирование, затем в фоне плавное. При обновлении скана
+// перерисовывается только изменившаяся часть.
+class ImageView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    explicit ImageView(QWidget *parent = nullptr);
+    ~ImageView();
+
+    void setImage(const QImage& image);
+    void clear();
+    QImage image() const { return source; }
+
+    void setPlaceholderText(const QString& text);
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+
+private:
+    QImage source;
+    QImage display;         // то, что рисуется: плавная копия с быстрыми заплатками
+    QImage fastCopy;        // быстрая копия текущего изображения, для сравнения со следующей
+    QImage smoothCopy;      // последняя плавная копия, для сравнения со следующей
+    QRect patchedRect;      // часть display, пока заполненная быстрой копией
+    QString placeholder;
+    // Копии в разрешении экрана; source учитывает его владелец
+    MemoryCharge displayCharge{MemoryAccountant::Display};
+
+    QThreadPool scalePool;
+    QFuture<void> scaleFuture;
+    std::atomic_int generation{0};
+    QTimer smoothTimer;
+
+    QRect contentRect() const;
+    QSize fittedSize() const;
+    QPoint displayOrigin() const;
+    void resetDisplay(const QImage& fast);
+    void startSmoothScale();
+    void applySmooth(int forGeneration, const QImage& smooth);
+    void updateMemoryCharge();
+};
+
+#endif // IMAGEVIEW_H
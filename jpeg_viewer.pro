@@ -1,7 +1,14 @@
-QT += core gui widgets
+QT += core gui widgets concurrent
 
 CONFIG += c++17
 
+LIBS += -ljpeg
+
+# qmake CONFIG+=tracing: таймеры этапов и выгрузка Chrome trace
+tracing {
+    DEFINES += JPEG_VIEWER_TRACING
+}
+
 TARGET = jpeg_viewer
 TEMPLATE = app
 
@@ -11,12 +18,60 @@ SOURCES += \
     jpegloader.cpp \
     jpegsaver.cpp \
     imagehandler.cpp \
-    jpegstrategy.cpp
+    jpegstrategy.cpp \
+    jpegdecoder.cpp \
+    jpegcommon.cpp \
+    scancache.cpp \
+    jpegindex.cpp \
+    jpegencoder.cpp \
+    batchtranscoder.cpp \
+    jpegregiondecoder.cpp \
+    tilecache.cpp \
+    tiledimageview.cpp \
+    imageview.cpp \
+    imagecache.cpp \
+    tracing.cpp \
+    imagemetrics.cpp \
+    trialencoder.cpp \
+    framepool.cpp \
+    jpegstreamdecoder.cpp \
+    jpegrestartdecoder.cpp \
+    jpegtransform.cpp \
+    jpegprobe.cpp \
+    thumbnailpack.cpp \
+    thumbnailview.cpp \
+    jpegstripencoder.cpp \
+    memoryaccountant.cpp \
+    qualitysearch.cpp
 
 HEADERS += \
     mainwindow.h \
     jpegloader.h \
     jpegsaver.h \
     imagehandler.h \
-    jpegstrategy.h
+    jpegstrategy.h \
+    jpegdecoder.h \
+    jpegcommon.h \
+    scancache.h \
+    jpegindex.h \
+    jpegencoder.h \
+    batchtranscoder.h \
+    jpegregiondecoder.h \
+    tilecache.h \
+    tiledimageview.h \
+    imageview.h \
+    imagecache.h \
+    tracing.h \
+    imagemetrics.h \
+    trialencoder.h \
+    framepool.h \
+    jpegstreamdecoder.h \
+    jpegrestartdecoder.h \
+    jpegtransform.h \
+    jpegprobe.h \
+    thumbnailpack.h \
+    thumbnailview.h \
+    jpegstripencoder.h \
+    memoryaccountant.h \
+    qualitysearch.h
 
@@ -0,0 +1,194 @@
+#include "jpegcommon.h"
+#include <QtGui/QTransform>
+#include <QtCore/QByteArray>
+#include <cstring>
+
+namespace {
+
+void errorExit(j_common_ptr cinfo) {
+    JpegErrorManager* error = reinterpret_cast<JpegErrorManager*>(cinfo->err);
+    (*cinfo->err->format_message)(cinfo, error->message);
+    longjmp(error->jump, 1);
+}
+
+void outputMessage(j_common_ptr cinfo) {
+    Q_UNUSED(cinfo);
+}
+
+void initDestination(j_compress_ptr cinfo) {
+    ByteArrayDestination* dest = reinterpret_cast<ByteArrayDestination*>(cinfo->dest);
+    dest->output->resize(dest->initialSize);
+    dest->pub.next_output_byte = reinterpret_cast<JOCTET*>(dest->output->data());
+    dest->pub.free_in_buffer = static_cast<size_t>(dest->output->size());
+}
+
+boolean emptyOutputBuffer(j_compress_ptr cinfo) {
+    ByteArrayDestination* dest = reinterpret_cast<ByteArrayDestination*>(cinfo->dest);
+    const qsizetype used = dest->output->size();
+    dest->output->resize(used * 2);
+    dest->pub.next_output_byte = reinterpret_cast<JOCTET*>(dest->output->data()) + used;
+    dest->pub.free_in_buffer = static_cast<size_t>(dest->output->size() - used);
+    return TRUE;
+}
+
+void termDestination(j_compress_ptr cinfo) {
+    ByteArrayDestination* dest = reinterpret_cast<ByteArrayDestination*>(cinfo->dest);
+    dest->output->resize(dest->output->size() - static_cast<qsizetype>(dest->pub.free_in_buffer));
+}
+
+J_DCT_METHOD toLibjpegDct(int dctMethod) {
+    switch (dctMethod) {
+        case JpegEncodeOptions::DctFast:
+            return JDCT_IFAST;
+        case JpegEncodeOptions::DctFloat:
+            return JDCT_FLOAT;
+        default:
+            return JDCT_ISLOW;
+    }
+}
+
+} // namespace
+
+jpeg_error_mgr* JpegErrorManager::attach() {
+    jpeg_std_error(&pub);
+    pub.error_exit = errorExit;
+    pub.output_message = outputMessage;
+    return &pub;
+}
+
+void JpegErrorManager::fail(const char* text) {
+    qstrncpy(message, text, sizeof(message));
+    longjmp(jump, 1);
+}
+
+jpeg_destination_mgr* ByteArrayDestination::attach(QByteArray* target, qsizetype initialBytes) {
+    pub.init_destination = initDestination;
+    pub.empty_output_buffer = emptyOutputBuffer;
+    pub.term_destination = termDestination;
+    output = target;
+    initialSize = initialBytes;
+    return &pub;
+}
+
+void convertRow(const JSAMPLE* in, QRgb* out, int count, OutputMode mode, bool invertedCmyk) {
+    switch (mode) {
+    case OutputDirect:
+        std::memcpy(out, in, static_cast<size_t>(count) * 4);
+        break;
+    case OutputRgb:
+        for (int x = 0; x < count; ++x, in += 3) {
+            out[x] = qRgb(in[0], in[1], in[2]);
+        }
+        break;
+    case OutputGray:
+        for (int x = 0; x < count; ++x) {
+            out[x] = qRgb(in[x], in[x], in[x]);
+        }
+        break;
+    case OutputCmyk:
+        for (int x = 0; x < count; ++x, in += 4) {
+            int c = in[0], m = in[1], y = in[2], k = in[3];
+            if (!invertedCmyk) {
+                c = 255 - c; m = 255 - m; y = 255 - y; k = 255 - k;
+            }
+            out[x] = qRgb(c * k / 255, m * k / 255, y * k / 255);
+        }
+        break;
+    }
+}
+
+QImage applyTransformation(const QImage& image, QImageIOHandler::Transformations transformation) {
+    if (transformation == QImageIOHandler::TransformationNone) {
+        return image;
+    }
+    if (transformation == QImageIOHandler::TransformationRotate270) {
+        return image.transformed(QTransform().rotate(270));
+    }
+    QImage result = image.mirrored(transformation.testFlag(QImageIOHandler::TransformationMirror),
+                                   transformation.testFlag(QImageIOHandler::TransformationFlip));
+    if (transformation.testFlag(QImageIOHandler::TransformationRotate90)) {
+        result = result.transformed(QTransform().rotate(90));
+    }
+    return result;
+}
+
+unsigned int chooseScaleDenominator(const QSize& imageSize, QSize target, bool transposed) {
+    if (target.isEmpty() || imageSize.isEmpty()) {
+        return 1;
+    }
+    if (transposed) {
+        target.transpose();
+    }
+    const QSize needed = imageSize.scaled(target, Qt::KeepAspectRatio);
+    for (unsigned int denominator = 8; denominator > 1; denominator /= 2) {
+        const int width = (imageSize.width() + denominator - 1) / denominator;
+        const int height = (imageSize.height() + denominator - 1) / denominator;
+        if (width >= needed.width() && height >= needed.height()) {
+            return denominator;
+        }
+    }
+    return 1;
+}
+
+bool setupCompressor(jpeg_compress_struct& cinfo, const JpegEncodeOptions& options, const QImage& image, int height) {
+    const bool grayscale = image.format() == QImage::Format_Grayscale8;
+    cinfo.image_width = static_cast<JDIMENSION>(image.width());
+    cinfo.image_height = static_cast<JDIMENSION>(height);
+    if (grayscale) {
+        cinfo.input_components = 1;
+        cinfo.in_color_space = JCS_GRAYSCALE;
+    } else {
+#ifdef JCS_EXTENSIONS
+        cinfo.input_components = 4;
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        cinfo.in_color_space = JCS_EXT_BGRX;
+#else
+        cinfo.in_color_space = JCS_EXT_XRGB;
+#endif
+#else
+        cinfo.input_components = 3;
+        cinfo.in_color_space = JCS_RGB;
+#endif
+    }
+
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, qBound(0, options.quality, 100), TRUE);
+    cinfo.dct_method = toLibjpegDct(options.dctMethod);
+    cinfo.optimize_coding = options.optimizeHuffman ? TRUE : FALSE;
+    if (cinfo.num_components == 3) {
+        cinfo.comp_info[0].h_samp_factor = options.subsampling == JpegEncodeOptions::Subsampling444 ? 1 : 2;
+        cinfo.comp_info[0].v_samp_factor = options.subsampling == JpegEncodeOptions::Subsampling420 ? 2 : 1;
+    }
+    cinfo.restart_in_rows = qMax(0, options.restartRows);
+    if (options.progressive) {
+        jpeg_simple_progression(&cinfo);
+    }
+
+    const int dpiX = qRound(image.dotsPerMeterX() * 0.0254);
+    const int dpiY = qRound(image.dotsPerMeterY() * 0.0254);
+    if (dpiX > 0 && dpiY > 0 && dpiX <= 0xFFFF && dpiY <= 0xFFFF) {
+        cinfo.density_unit = 1;
+        cinfo.X_density = static_cast<UINT16>(dpiX);
+        cinfo.Y_density = static_cast<UINT16>(dpiY);
+    }
+
+#ifdef JCS_EXTENSIONS
+    return true;
+#else
+    return grayscale;
+#endif
+}
+
+JSAMPROW compressorRow(const QImage& image, int y, JSAMPLE* rgbRow) {
+    if (!rgbRow) {
+        return const_cast<JSAMPROW>(image.constScanLine(y));
+    }
+    const QRgb* in = reinterpret_cast<const QRgb*>(image.constScanLine(y));
+    JSAMPLE* out = rgbRow;
+    for (int x = 0; x < image.width(); ++x) {
+        *out++ = static_cast<JSAMPLE>(qRed(in[x]));
+        *out++ = static_cast<JSAMPLE>(qGreen(in[x]));
+        *out++ = static_cast<JSAMPLE>(qBlue(in[x]));
+    }
+    return rgbRow;
+}
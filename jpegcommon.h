@@ -0,0 +1,74 @@
+#ifndef JPEGCOMMON_H
+#define JPEGCOMMON_H
+
+#include "jpegencoder.h"
+#include <QtGui/QImage>
+#include <QtGui/QImageIOHandler>
+#include <QtCore/QSize>
+#include <QtCore/QtGlobal>
+#include <csetjmp>
+#include <cstdio>
+
+extern "C" {
+#include <jpeglib.h>
+}
+
+// Общее для обёрток над libjpeg (декодеры, кодировщики, преобразования).
+// Внутренний заголовок: подключает jpeglib.h, поэтому включается только
+// из .cpp.
+
+// Ошибка libjpeg не завершает процесс: error_exit переходит в setjmp(jump),
+// текст ошибки - в message. Предупреждения не печатаются.
+struct JpegErrorManager {
+    jpeg_error_mgr pub;
+    jmp_buf jump;
+    char message[JMSG_LENGTH_MAX];
+
+    // Для cinfo.err; у менеджера, привязанного к cinfo, pub - первое поле
+    jpeg_error_mgr* attach();
+    // Ошибка от вызывающего (отмена, нехватка памяти) по тому же пути,
+    // что и ошибка libjpeg
+    [[noreturn]] void fail(const char* text);
+};
+
+// Как libjpeg пишет строки в QImage::Format_RGB32
+enum OutputMode {
+    OutputDirect,   // JCS_EXT_BGRX / JCS_EXT_XRGB (или JCS_GRAYSCALE в Format_Grayscale8) прямо в scanLine()
+    OutputRgb,      // JCS_RGB через промежуточную строку
+    OutputGray,     // JCS_GRAYSCALE через промежуточную строку
+    OutputCmyk      // JCS_CMYK через промежуточную строку
+};
+
+// Строка из промежуточного буфера libjpeg в строку Format_RGB32;
+// invertedCmyk - CMYK из файла с маркером Adobe (Photoshop пишет инвертированным)
+void convertRow(const JSAMPLE* in, QRgb* out, int count, OutputMode mode, bool invertedCmyk = false);
+
+// Ориентация EXIF, которую libjpeg не применяет
+QImage applyTransformation(const QImage& image, QImageIOHandler::Transformations transformation);
+
+// Наименьший масштаб DCT (1/8..1), при котором изображение ещё покрывает
+// target с сохранением пропорций; transposed - target задан для повёрнутого
+// на 90 градусов изображения. Пустой target - полное разрешение.
+unsigned int chooseScaleDenominator(const QSize& imageSize, QSize target, bool transposed = false);
+
+// Приёмник libjpeg, пишущий прямо в QByteArray: буфер растёт вдвое,
+// в конце обрезается по записанному
+struct ByteArrayDestination {
+    jpeg_destination_mgr pub;
+    QByteArray* output;
+    qsizetype initialSize;
+
+    // Для cinfo.dest
+    jpeg_destination_mgr* attach(QByteArray* target, qsizetype initialBytes);
+};
+
+// Общая настройка кодирования image (height первых строк - для полосы):
+// цветовое пространство входа, качество, DCT, Хаффман, прореживание,
+// интервал рестарта, прогрессивный режим и плотность. true - строки
+// QImage передаются в libjpeg как есть, иначе через compressorRow()
+bool setupCompressor(jpeg_compress_struct& cinfo, const JpegEncodeOptions& options, const QImage& image, int height);
+
+// Строка y для jpeg_write_scanlines; rgbRow (3 * width) - когда setupCompressor вернул false
+JSAMPROW compressorRow(const QImage& image, int y, JSAMPLE* rgbRow);
+
+#endif // JPEGCOMMON_H
@@ -0,0 +1,310 @@
+#include "jpegdecoder.h"
+#include "jpegstrategy.h"
+#include "framepool.h"
+#include "jpegcommon.h"
+#include <QtGui/QImageReader>
+#include <QtCore/QBuffer>
+#include <QtCore/QtGlobal>
+#include <utility>
+
+struct JpegDecoder::Private {
+    struct Progress {
+        jpeg_progress_mgr pub;
+        Private* owner;
+    };
+
+    jpeg_decompress_struct cinfo;
+    JpegErrorManager error;
+    Progress progress;
+    LoadMonitor* monitor = nullptr;
+    int lastPercent = -1;
+    QByteArray data;
+    JSAMPARRAY rowBuffer = nullptr;
+    OutputMode outputMode = OutputDirect;
+    QImage::Format frameFormat = QImage::Format_RGB32;
+    bool buffered = true;
+    bool created = false;
+    bool started = false;
+    bool inputComplete = false;
+    bool failed = false;
+    bool invertedCmyk = false;
+
+    static void onProgress(j_common_ptr cinfo);
+};
+
+// Прогресс считается по доле прочитанного файла: для прогрессивного JPEG
+// каждый следующий скан продвигает его дальше, последний доводит до 100%
+void JpegDecoder::Private::onProgress(j_common_ptr cinfo) {
+    Private* d = reinterpret_cast<Progress*>(cinfo->progress)->owner;
+    if (!d->monitor) {
+        return;
+    }
+    if (d->monitor->isCancelled()) {
+        d->error.fail("Cancelled");
+    }
+
+    const jpeg_source_mgr* src = d->cinfo.src;
+    if (!src || d->data.isEmpty()) {
+        return;
+    }
+    const qsizetype consumed = reinterpret_cast<const char*>(src->next_input_byte) - d->data.constData();
+    const int percent = static_cast<int>(qBound<qint64>(0, consumed * 100 / d->data.size(), 100));
+    if (percent != d->lastPercent) {
+        d->lastPercent = percent;
+        d->monitor->progress(percent);
+    }
+}
+
+JpegDecoder::JpegDecoder()
+    : d(new Private)
+{
+    d->progress.pub.progress_monitor = Private::onProgress;
+    d->progress.owner = d;
+}
+
+JpegDecoder::~JpegDecoder() {
+    close();
+    delete d;
+}
+
+void JpegDecoder::close() {
+    if (d->created) {
+        jpeg_destroy_decompress(&d->cinfo);
+    }
+    d->data.clear();
+    d->rowBuffer = nullptr;
+    d->created = false;
+    d->started = false;
+    d->inputComplete = false;
+    d->failed = false;
+    transformation = QImageIOHandler::TransformationNone;
+    fileIndex = JpegFileIndex();
+    outputScans = 0;
+}
+
+void JpegDecoder::setLoadMonitor(LoadMonitor* monitor) {
+    d->monitor = monitor;
+}
+
+bool JpegDecoder::open(const QByteArray& data) {
+    JpegFileIndex index;
+    index.build(reinterpret_cast<const uchar*>(data.constData()), data.size());
+    return open(data, index);
+}
+
+bool JpegDecoder::open(const QByteArray& data, const JpegFileIndex& index) {
+    close();
+    lastError.clear();
+    if (!index.isValid()) {
+        lastError = index.errorString.isEmpty() ? QString("Not a JPEG file") : index.errorString;
+        return false;
+    }
+
+    d->data = data;
+    fileIndex = index;
+
+    if (autoTransform) {
+        QBuffer buffer(&d->data);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader reader(&buffer, "jpeg");
+        transformation = reader.transformation();
+    }
+
+    jpeg_decompress_struct* cinfo = &d->cinfo;
+    cinfo->err = d->error.attach();
+
+    if (setjmp(d->error.jump)) {
+        lastError = QString::fromLatin1(d->error.message);
+        close();
+        return false;
+    }
+
+    jpeg_create_decompress(cinfo);
+    d->created = true;
+    cinfo->progress = &d->progress.pub;
+    d->lastPercent = -1;
+    jpeg_mem_src(cinfo, const_cast<unsigned char*>(reinterpret_cast<const unsigned char*>(d->data.constData())),
+                 static_cast<unsigned long>(d->data.size()));
+    jpeg_read_header(cinfo, TRUE);
+    // Один скан читается обычным проходом: без буфера коэффициентов на
+    // всё изображение, строки сразу идут в кадр
+    d->buffered = jpeg_has_multiple_scans(cinfo);
+    cinfo->buffered_image = d->buffered ? TRUE : FALSE;
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = qMax(static_cast<unsigned int>(minDenominator), chooseScaleDenominator(
+        QSize(static_cast<int>(cinfo->image_width), static_cast<int>(cinfo->image_height)), targetSize,
+        autoTransform && transformation.testFlag(QImageIOHandler::TransformationRotate90)));
+
+    d->frameFormat = QImage::Format_RGB32;
+    if (cinfo->jpeg_color_space == JCS_CMYK || cinfo->jpeg_color_space == JCS_YCCK) {
+        cinfo->out_color_space = JCS_CMYK;
+        d->outputMode = OutputCmyk;
+        d->invertedCmyk = cinfo->saw_Adobe_marker;
+    } else if ((grayscaleOutput && cinfo->jpeg_color_space == JCS_GRAYSCALE) || forceGrayscale) {
+        cinfo->out_color_space = JCS_GRAYSCALE;
+        d->outputMode = OutputDirect;
+        d->frameFormat = QImage::Format_Grayscale8;
+    } else {
+#ifdef JCS_EXTENSIONS
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        cinfo->out_color_space = JCS_EXT_BGRX;
+#else
+        cinfo->out_color_space = JCS_EXT_XRGB;
+#endif
+        d->outputMode = OutputDirect;
+#else
+        if (cinfo->jpeg_color_space == JCS_GRAYSCALE) {
+            cinfo->out_color_space = JCS_GRAYSCALE;
+            d->outputMode = OutputGray;
+        } else {
+            cinfo->out_color_space = JCS_RGB;
+            d->outputMode = OutputRgb;
+        }
+#endif
+    }
+
+    jpeg_start_decompress(cinfo);
+    d->started = true;
+
+    if (d->outputMode != OutputDirect) {
+        d->rowBuffer = (*cinfo->mem->alloc_sarray)(reinterpret_cast<j_common_ptr>(cinfo), JPOOL_IMAGE,
+                                                   cinfo->output_width * cinfo->output_components, 1);
+    }
+    return true;
+}
+
+bool JpegDecoder::isOpen() const {
+    return d->started && !d->failed;
+}
+
+bool JpegDecoder::isProgressive() const {
+    return d->created && d->cinfo.progressive_mode;
+}
+
+QSize JpegDecoder::size() const {
+    if (!d->started) {
+        return QSize();
+    }
+    return QSize(static_cast<int>(d->cinfo.output_width), static_cast<int>(d->cinfo.output_height));
+}
+
+QSize JpegDecoder::fullSize() const {
+    if (!d->created) {
+        return QSize();
+    }
+    return QSize(static_cast<int>(d->cinfo.image_width), static_cast<int>(d->cinfo.image_height));
+}
+
+int JpegDecoder::scaleDenominator() const {
+    return d->started ? static_cast<int>(d->cinfo.scale_denom / qMax(1u, d->cinfo.scale_num)) : 1;
+}
+
+bool JpegDecoder::hasMoreScans() const {
+    if (!isOpen()) {
+        return false;
+    }
+    if (!d->buffered) {
+        return outputScans == 0;
+    }
+    if (d->inputComplete) {
+        return outputScans == 0 || d->cinfo.output_scan_number < d->cinfo.input_scan_number;
+    }
+    return outputScans == 0 || outputScans < fileIndex.scanCount();
+}
+
+bool JpegDecoder::decodeNextScan(QImage& image) {
+    if (!hasMoreScans()) {
+        return false;
+    }
+    if (!consumeScan()) {
+        return false;
+    }
+    return outputFrame(image);
+}
+
+bool JpegDecoder::decodeFinal(QImage& image) {
+    if (!isOpen()) {
+        return false;
+    }
+    // Однопроходное декодирование повторить нельзя
+    if (!d->buffered && outputScans > 0) {
+        lastError = "Image has already been decoded";
+        return false;
+    }
+    while (!d->inputComplete) {
+        if (!consumeScan()) {
+            return false;
+        }
+    }
+    return outputFrame(image);
+}
+
+bool JpegDecoder::outputFrame(QImage& image) {
+    QImage frame = framePool ? framePool->acquire(size(), d->frameFormat) : QImage(size(), d->frameFormat);
+    if (frame.isNull()) {
+        lastError = "Out of memory";
+        d->failed = true;
+        return false;
+    }
+    if (!readOutput(frame)) {
+        return false;
+    }
+
+    outputScans++;
+    image = autoTransform ? applyTransformation(frame, transformation) : std::move(frame);
+    return true;
+}
+
+// Дочитывает вход до конца очередного скана (или до EOI)
+bool JpegDecoder::consumeScan() {
+    // Без буферизации вход читается вместе с выходом в readOutput()
+    if (!d->buffered) {
+        d->inputComplete = true;
+        return true;
+    }
+    jpeg_decompress_struct* cinfo = &d->cinfo;
+    if (setjmp(d->error.jump)) {
+        lastError = QString::fromLatin1(d->error.message);
+        d->failed = true;
+        return false;
+    }
+
+    while (!d->inputComplete) {
+        const int result = jpeg_consume_input(cinfo);
+        if (result == JPEG_REACHED_EOI || result == JPEG_SUSPENDED) {
+            d->inputComplete = true;
+        } else if (result == JPEG_SCAN_COMPLETED) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool JpegDecoder::readOutput(QImage& frame) {
+    jpeg_decompress_struct* cinfo = &d->cinfo;
+    if (setjmp(d->error.jump)) {
+        lastError = QString::fromLatin1(d->error.message);
+        d->failed = true;
+        return false;
+    }
+
+    if (d->buffered) {
+        jpeg_start_output(cinfo, cinfo->input_scan_number);
+    }
+    while (cinfo->output_scanline < cinfo->output_height) {
+        uchar* line = frame.scanLine(static_cast<int>(cinfo->output_scanline));
+        if (d->outputMode == OutputDirect) {
+            JSAMPROW row = line;
+            jpeg_read_scanlines(cinfo, &row, 1);
+            continue;
+        }
+
+        jpeg_read_scanlines(cinfo, d->rowBuffer, 1);
+        convertRow(d->rowBuffer[0], reinterpret_cast<QRgb*>(line), static_cast<int>(cinfo->output_width),
+                   d->outputMode, d->invertedCmyk);
+    }
+    if (d->buffered) {
+        jpeg_finish_output(cinfo);
+    }
+    return true;
+}
@@ -0,0 +1,82 @@
+#ifndef JPEGDECODER_H
+#define JPEGDECODER_H
+
+#include <QtGui/QImage>
+#include <QtGui/QImageIOHandler>
+#include <QtCore/QByteArray>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include "jpegindex.h"
+
+class LoadMonitor;
+class FramePool;
+
+// Обёртка над libjpeg в режиме buffered-image: каждый вызов decodeNextScan()
+// дочитывает из файла очередной скан (SOS) и выдаёт изображение после него.
+// Файл из одного скана декодируется обычным проходом. Строки пишутся прямо
+// в кадр нужного формата (JCS_EXT_BGRX или JCS_GRAYSCALE), цвет и
+// интерполяция цветности - SIMD-кодом libjpeg-turbo.
+class JpegDecoder {
+public:
+    JpegDecoder();
+    ~JpegDecoder();
+
+    JpegDecoder(const JpegDecoder&) = delete;
+    JpegDecoder& operator=(const JpegDecoder&) = delete;
+
+    void setAutoTransform(bool enabled) { autoTransform = enabled; }
+    // Наименьший масштаб DCT (1/8, 1/4, 1/2), при котором кадр всё ещё
+    // не меньше вписанного в targetSize; пустой размер - полное разрешение
+    void setTargetSize(const QSize& size) { targetSize = size; }
+    void setLoadMonitor(LoadMonitor* monitor);
+    // Одноканальные файлы - в Format_Grayscale8 (байт на пиксель вместо четырёх)
+    void setGrayscaleOutput(bool enabled) { grayscaleOutput = enabled; }
+    // Режим нехватки памяти: не крупнее 1/denominator при любом targetSize,
+    // цветные файлы - только яркость в Format_Grayscale8
+    void setMinScaleDenominator(int denominator) { minDenominator = qBound(1, denominator, 8); }
+    void setForceGrayscale(bool enabled) { forceGrayscale = enabled; }
+    // Кадры берутся из пула; без пула каждый кадр - новое выделение
+    void setFramePool(FramePool* pool) { framePool = pool; }
+
+    // data должен оставаться действительным, пока декодер открыт
+    bool open(const QByteArray& data);
+    bool open(const QByteArray& data, const JpegFileIndex& index);
+    void close();
+
+    bool isOpen() const;
+    bool isProgressive() const;
+    QSize size() const;
+    QSize fullSize() const;
+    int scaleDenominator() const;
+    int scanCount() const { return fileIndex.scanCount(); }
+    const JpegFileIndex& index() const { return fileIndex; }
+    int decodedScans() const { return outputScans; }
+    bool hasMoreScans() const;
+
+    bool decodeNextScan(QImage& image);
+    // Дочитывает весь файл и выдаёт окончательное изображение
+    bool decodeFinal(QImage& image);
+
+    QString errorString() const { return lastError; }
+
+private:
+    struct Private;
+    Private* d;
+
+    bool autoTransform = false;
+    bool grayscaleOutput = false;
+    bool forceGrayscale = false;
+    int minDenominator = 1;
+    QSize targetSize;
+    FramePool* framePool = nullptr;
+    QImageIOHandler::Transformations transformation = QImageIOHandler::TransformationNone;
+    JpegFileIndex fileIndex;
+    int outputScans = 0;
+    QString lastError;
+
+    bool consumeScan();
+    bool outputFrame(QImage& image);
+    bool readOutput(QImage& frame);
+};
+
+#endif // JPEGDECODER_H
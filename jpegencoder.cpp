@@ -0,0 +1,162 @@
+#include "jpegencoder.h"
+#include "jpegcommon.h"
+#include "jpegstrategy.h"
+#include "jpegstripencoder.h"
+#include "memoryaccountant.h"
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSaveFile>
+#include <QtCore/QVector>
+
+namespace {
+
+struct Progress {
+    jpeg_progress_mgr pub;
+    JpegErrorManager* error;
+    LoadMonitor* monitor;
+    int lastPercent;
+};
+
+// Прогресс по всем проходам: при оптимизации Хаффмана и прогрессивном
+// режиме основная работа идёт в jpeg_finish_compress
+void onProgress(j_common_ptr cinfo) {
+    Progress* progress = reinterpret_cast<Progress*>(cinfo->progress);
+    if (progress->monitor->isCancelled()) {
+        progress->error->fail("Cancelled");
+    }
+    const jpeg_progress_mgr& pub = progress->pub;
+    if (pub.pass_limit <= 0 || pub.total_passes <= 0) {
+        return;
+    }
+    const double done = pub.completed_passes + static_cast<double>(pub.pass_counter) / pub.pass_limit;
+    const int percent = qBound(0, static_cast<int>(done * 100 / pub.total_passes), 100);
+    if (percent != progress->lastPercent) {
+        progress->lastPercent = percent;
+        progress->monitor->progress(percent);
+    }
+}
+
+bool compress(const QImage& image, const JpegEncodeOptions& options, LoadMonitor* monitor,
+              QByteArray& output, QString& error) {
+    jpeg_compress_struct cinfo;
+    JpegErrorManager errorManager;
+    ByteArrayDestination destination;
+    Progress progress;
+    // Объявлен до setjmp, чтобы longjmp не пропустил деструктор
+    QVector<JSAMPLE> rowBuffer;
+
+    cinfo.err = errorManager.attach();
+
+    if (setjmp(errorManager.jump)) {
+        error = QString::fromLatin1(errorManager.message);
+        jpeg_destroy_compress(&cinfo);
+        output.clear();
+        return false;
+    }
+
+    jpeg_create_compress(&cinfo);
+
+    if (monitor) {
+        progress.pub.progress_monitor = onProgress;
+        progress.error = &errorManager;
+        progress.monitor = monitor;
+        progress.lastPercent = -1;
+        cinfo.progress = &progress.pub;
+    }
+
+    cinfo.dest = destination.attach(
+        &output, qMax<qsizetype>(64 * 1024, static_cast<qsizetype>(image.width()) * image.height() / 8));
+    if (!setupCompressor(cinfo, options, image, image.height())) {
+        rowBuffer.resize(image.width() * 3);
+    }
+
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = compressorRow(image, static_cast<int>(cinfo.next_scanline),
+                                     rowBuffer.isEmpty() ? nullptr : rowBuffer.data());
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return true;
+}
+
+} // namespace
+
+bool JpegEncoder::encode(const QImage& image, QByteArray& output) {
+    lastStats = JpegEncodeStats();
+    lastError.clear();
+    if (image.isNull()) {
+        lastError = "No image to encode";
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // Преобразованная копия и выходной буфер; само изображение учитывает его владелец
+    MemoryCharge charge(MemoryAccountant::Save);
+    QImage source = image;
+    if (source.format() != QImage::Format_RGB32 && source.format() != QImage::Format_ARGB32 &&
+        source.format() != QImage::Format_Grayscale8) {
+        source = source.convertToFormat(QImage::Format_RGB32);
+        charge.set(source.sizeInBytes());
+    }
+
+    if (options.threads != 1 && JpegStripEncoder::canEncode(source, options)) {
+        JpegStripEncoder stripEncoder(options);
+        stripEncoder.setThreadCount(options.threads);
+        stripEncoder.setLoadMonitor(loadMonitor);
+        if (!stripEncoder.encode(source, output)) {
+            lastError = stripEncoder.errorString();
+            return false;
+        }
+        lastStats.strips = stripEncoder.stripCount();
+    } else if (!compress(source, options, loadMonitor, output, lastError)) {
+        return false;
+    }
+
+    charge.set(charge.bytes() + output.capacity());
+    lastStats.outputBytes = output.size();
+    lastStats.encodeMs = timer.nsecsElapsed() / 1e6;
+    lastStats.imageSize = image.size();
+    return true;
+}
+
+bool JpegEncoder::encodeToFile(const QImage& image, const QString& filename) {
+    QByteArray output;
+    if (!encode(image, output)) {
+        return false;
+    }
+
+    return writeToFile(output, filename, &lastError, loadMonitor);
+}
+
+bool JpegEncoder::writeToFile(const QByteArray& jpeg, const QString& filename, QString* error,
+                              LoadMonitor* monitor) {
+    // Запись кусками: отмена во время записи большого файла не даёт
+    // commit() заменить прежний файл
+    const qsizetype chunkBytes = 4 * 1024 * 1024;
+    QSaveFile file(filename);
+    bool written = file.open(QIODevice::WriteOnly);
+    for (qsizetype pos = 0; written && pos < jpeg.size(); pos += chunkBytes) {
+        if (monitor && monitor->isCancelled()) {
+            break;
+        }
+        const qsizetype bytes = qMin(chunkBytes, jpeg.size() - pos);
+        written = file.write(jpeg.constData() + pos, bytes) == bytes;
+    }
+    if (written && monitor && monitor->isCancelled()) {
+        file.cancelWriting();
+        if (error) {
+            *error = "Cancelled";
+        }
+        return false;
+    }
+    if (!written || !file.commit()) {
+        if (error) {
+            *error = file.errorString();
+        }
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+#ifndef JPEGENCODER_H
+#define JPEGENCODER_H
+
+#include <QtGui/QImage>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+
+class LoadMonitor;
+
+struct JpegEncodeOptions {
+    enum DctMethod {
+        DctInteger = 0,     // JDCT_ISLOW
+        DctFast = 1,        // JDCT_IFAST
+        DctFloat = 2        // JDCT_FLOAT
+    };
+
+    // Прореживание цветности для трёхкомпонентных изображений
+    enum Subsampling {
+        Subsampling420,
+        Subsampling422,
+        Subsampling444
+    };
+
+    int quality = 75;
+    bool progressive = false;
+    int dctMethod = DctInteger;
+    bool optimizeHuffman = false;
+    int subsampling = Subsampling420;
+    // Маркер RSTn через каждые restartRows строк MCU, 0 - без интервалов рестарта
+    // (при кодировании полосами - на каждой строке MCU)
+    int restartRows = 0;
+    // Кроме 1 - большие последовательные изображения кодируются полосами
+    // в этом числе потоков (0 - по числу ядер), см. JpegStripEncoder
+    int threads = 1;
+};
+
+struct JpegEncodeStats {
+    qint64 outputBytes = 0;
+    double encodeMs = 0.0;
+    QSize imageSize;
+    int strips = 0;         // 0 - закодировано целиком в одном потоке
+};
+
+// Кодирование QImage в JPEG средствами libjpeg с учётом метода DCT,
+// прогрессивного режима и оптимизации таблиц Хаффмана
+class JpegEncoder {
+public:
+    explicit JpegEncoder(const JpegEncodeOptions& options = JpegEncodeOptions()) : options(options) {}
+
+    void setOptions(const JpegEncodeOptions& newOptions) { options = newOptions; }
+    const JpegEncodeOptions& encodeOptions() const { return options; }
+    // Прогресс по проходам libjpeg; отмена прерывает кодирование с ошибкой "Cancelled"
+    void setLoadMonitor(LoadMonitor* monitor) { loadMonitor = monitor; }
+
+    bool encode(const QImage& image, QByteArray& output);
+    bool encodeToFile(const QImage& image, const QString& filename);
+    // Атомарная запись уже закодированного файла (например, найденного QualitySearch);
+    // при отмене через monitor прежний файл остаётся нетронутым
+    static bool writeToFile(const QByteArray& jpeg, const QString& filename, QString* error = nullptr,
+                            LoadMonitor* monitor = nullptr);
+
+    const JpegEncodeStats& stats() const { return lastStats; }
+    QString errorString() const { return lastError; }
+
+private:
+    JpegEncodeOptions options;
+    LoadMonitor* loadMonitor = nullptr;
+    JpegEncodeStats lastStats;
+    QString lastError;
+};
+
+#endif // JPEGENCODER_H
@@ -0,0 +1,214 @@
+#include "jpegindex.h"
+#include "tracing.h"
+
+namespace {
+
+inline int readWord(const uchar* p) {
+    return (p[0] << 8) | p[1];
+}
+
+inline bool isStartOfFrame(uchar marker) {
+    return marker >= 0xC0 && marker <= 0xCF &&
+           marker != 0xC4 && marker != 0xC8 && marker != 0xCC;
+}
+
+inline bool isRestart(uchar marker) {
+    return marker >= 0xD0 && marker <= 0xD7;
+}
+
+} // namespace
+
+bool JpegFileIndex::build(const uchar* data, qint64 dataSize, bool headerOnly) {
+    *this = JpegFileIndex();
+
+    if (!data || dataSize < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        errorString = "Not a JPEG file";
+        return false;
+    }
+
+    qint64 pos = 2;
+    while (pos + 1 < dataSize) {
+        // Мусор между сегментами пропускается, как это делает libjpeg
+        if (data[pos] != 0xFF) {
+            ++pos;
+            continue;
+        }
+        // Байты-заполнители 0xFF перед маркером
+        while (pos + 1 < dataSize && data[pos + 1] == 0xFF) {
+            ++pos;
+        }
+        if (pos + 1 >= dataSize) {
+            break;
+        }
+
+        const qint64 markerOffset = pos;
+        const uchar marker = data[pos + 1];
+        pos += 2;
+
+        if (marker == 0xD9) {
+            eoiOffset = markerOffset;
+            break;
+        }
+        if (marker == 0x01 || isRestart(marker)) {
+            continue;
+        }
+        if (pos + 2 > dataSize) {
+            errorString = "Truncated marker segment";
+            break;
+        }
+
+        const int length = readWord(data + pos);
+        if (length < 2 || pos + length > dataSize) {
+            errorString = QString("Invalid length of marker 0x%1").arg(static_cast<int>(marker), 2, 16, QChar('0'));
+            break;
+        }
+        const uchar* payload = data + pos + 2;
+        const int payloadLength = length - 2;
+
+        if (marker >= 0xE0 && marker <= 0xEF) {
+            JpegSegment segment;
+            segment.marker = marker;
+            segment.offset = markerOffset;
+            segment.length = length;
+            appSegments.append(segment);
+        } else if (isStartOfFrame(marker) && sofMarker == 0) {
+            if (payloadLength < 6) {
+                errorString = "Truncated SOF segment";
+                break;
+            }
+            sofMarker = marker;
+            sofOffset = markerOffset;
+            precision = payload[0];
+            size = QSize(readWord(payload + 3), readWord(payload + 1));
+            const int count = payload[5];
+            if (payloadLength < 6 + count * 3) {
+                errorString = "Truncated SOF segment";
+                sofMarker = 0;
+                break;
+            }
+            for (int i = 0; i < count; ++i) {
+                const uchar* c = payload + 6 + i * 3;
+                JpegComponent component;
+                component.id = c[0];
+                component.horizontalSampling = qMax(1, c[1] >> 4);
+                component.verticalSampling = qMax(1, c[1] & 0x0F);
+                component.quantTable = c[2];
+                components.append(component);
+            }
+        } else if (marker == 0xDD && payloadLength >= 2) {
+            restartInterval = readWord(payload);
+        }
+
+        pos += length;
+
+        if (marker == 0xDA) {
+            scanOffsets.append(markerOffset);
+            if (headerOnly) {
+                break;
+            }
+            // Энтропийно-кодированные данные тянутся до первого маркера,
+            // не являющегося RSTn или байтом-вставкой 0xFF00
+            while (pos + 1 < dataSize) {
+                if (data[pos] == 0xFF && data[pos + 1] != 0x00 && !isRestart(data[pos + 1])) {
+                    break;
+                }
+                ++pos;
+            }
+        }
+    }
+
+    if (sofMarker == 0 && errorString.isEmpty()) {
+        errorString = "No SOF marker found";
+    }
+    return isValid();
+}
+
+bool JpegFileIndex::isProgressive() const {
+    return sofMarker == 0xC2 || sofMarker == 0xC6 || sofMarker == 0xCA || sofMarker == 0xCE;
+}
+
+QString JpegFileIndex::subsampling() const {
+    if (components.size() == 1) {
+        return "4:0:0";
+    }
+    if (components.size() < 3) {
+        return QString();
+    }
+    const JpegComponent& luma = components[0];
+    const JpegComponent& chroma = components[1];
+    const int h = luma.horizontalSampling / chroma.horizontalSampling;
+    const int v = luma.verticalSampling / chroma.verticalSampling;
+    if (h == 1 && v == 1) {
+        return "4:4:4";
+    }
+    if (h == 2 && v == 1) {
+        return "4:2:2";
+    }
+    if (h == 2 && v == 2) {
+        return "4:2:0";
+    }
+    if (h == 1 && v == 2) {
+        return "4:4:0";
+    }
+    if (h == 4 && v == 1) {
+        return "4:1:1";
+    }
+    return QString("%1x%2").arg(h).arg(v);
+}
+
+QSize JpegFileIndex::mcuSize() const {
+    if (components.size() == 1) {
+        return QSize(8, 8);
+    }
+    int maxH = 1;
+    int maxV = 1;
+    for (const JpegComponent& component : components) {
+        maxH = qMax(maxH, component.horizontalSampling);
+        maxV = qMax(maxV, component.verticalSampling);
+    }
+    return QSize(8 * maxH, 8 * maxV);
+}
+
+bool MappedJpegFile::open(const QString& filename) {
+    TRACE_SCOPE("open_file");
+    close();
+
+    file.setFileName(filename);
+    if (!file.open(QFile::ReadOnly)) {
+        return false;
+    }
+
+    byteCount = file.size();
+    mapping = byteCount > 0 ? file.map(0, byteCount) : nullptr;
+    if (mapping) {
+        bytesBegin = mapping;
+    } else {
+        fallback = file.readAll();
+        bytesBegin = reinterpret_cast<const uchar*>(fallback.constData());
+        byteCount = fallback.size();
+    }
+
+    TRACE_COUNTER("bytes_read", byteCount);
+
+    TRACE_SCOPE("marker_scan");
+    fileIndex.build(bytesBegin, byteCount);
+    return true;
+}
+
+void MappedJpegFile::close() {
+    if (mapping) {
+        file.unmap(mapping);
+        mapping = nullptr;
+    }
+    if (file.isOpen()) {
+        file.close();
+    }
+    fallback.clear();
+    bytesBegin = nullptr;
+    byteCount = 0;
+    fileIndex = JpegFileIndex();
+}
+
+QByteArray MappedJpegFile::bytes() const {
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(bytesBegin), byteCount);
+}
@@ -0,0 +1,82 @@
+#ifndef JPEGINDEX_H
+#define JPEGINDEX_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+
+struct JpegSegment {
+    quint8 marker = 0;
+    qint64 offset = 0;     // позиция байта 0xFF маркера
+    qint64 length = 0;     // длина сегмента вместе с полем длины
+};
+
+struct JpegComponent {
+    int id = 0;
+    int horizontalSampling = 1;
+    int verticalSampling = 1;
+    int quantTable = 0;
+};
+
+// Индекс маркеров JPEG, построенный за один проход по данным без копирования
+class JpegFileIndex {
+public:
+    // headerOnly - остановиться на первом SOS: размеры, режим и сегменты APPn
+    // без прохода по энтропийным данным, scanCount() тогда равен 1
+    bool build(const uchar* data, qint64 size, bool headerOnly = false);
+
+    bool isValid() const { return sofMarker != 0 && !scanOffsets.isEmpty(); }
+    bool isProgressive() const;
+    bool isBaseline() const { return sofMarker == 0xC0; }
+    int scanCount() const { return scanOffsets.size(); }
+
+    QString subsampling() const;
+    QSize mcuSize() const;
+
+    quint8 sofMarker = 0;
+    qint64 sofOffset = -1;
+    int precision = 0;
+    QSize size;
+    QVector<JpegComponent> components;
+    int restartInterval = 0;
+    QVector<JpegSegment> appSegments;
+    QVector<qint64> scanOffsets;   // позиции маркеров SOS
+    qint64 eoiOffset = -1;
+    QString errorString;
+};
+
+// Файл, отображённый в память, вместе с его индексом. Если отобразить файл
+// не удалось, он читается целиком.
+class MappedJpegFile {
+public:
+    MappedJpegFile() = default;
+    ~MappedJpegFile() { close(); }
+
+    MappedJpegFile(const MappedJpegFile&) = delete;
+    MappedJpegFile& operator=(const MappedJpegFile&) = delete;
+
+    bool open(const QString& filename);
+    void close();
+
+    QString fileName() const { return file.fileName(); }
+    const uchar* data() const { return bytesBegin; }
+    qint64 size() const { return byteCount; }
+
+    // Данные без копирования; действительны, пока открыт MappedJpegFile
+    QByteArray bytes() const;
+
+    const JpegFileIndex& index() const { return fileIndex; }
+
+private:
+    QFile file;
+    uchar* mapping = nullptr;
+    QByteArray fallback;
+    const uchar* bytesBegin = nullptr;
+    qint64 byteCount = 0;
+    JpegFileIndex fileIndex;
+};
+
+#endif // JPEGINDEX_H
@@ -1,2 +1,333 @@
 #include "jpegloader.h"
+#include "jpegstreamdecoder.h"
+#include "tracing.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QFileDevice>
+#include <QtCore/QIODevice>
+#include <QtCore/QMetaObject>
+#include <QtCore/QMutex>
+#include <atomic>
+#include <utility>
 
+class LoadImageCommand::AsyncState : public LoadMonitor,
+                                     public std::enable_shared_from_this<LoadImageCommand::AsyncState> {
+public:
+    explicit AsyncState(ImageLoadObserver* observer) : observer(observer) {}
+
+    void progress(int percent) override {
+        post([this, percent]() {
+            if (observer) {
+                observer->onLoadProgress(percent);
+            }
+        });
+    }
+
+    bool isCancelled() const override { return cancelled.load(); }
+
+    // Выполняет functor в GUI-потоке, если к тому моменту загрузку не отменили
+    template <typename Functor>
+    void post(Functor functor) {
+        std::shared_ptr<AsyncState> self = shared_from_this();
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, functor = std::move(functor)]() {
+            if (!self->cancelled.load()) {
+                functor();
+            }
+        }, Qt::QueuedConnection);
+    }
+
+    ImageLoadObserver* observer;
+    std::atomic_bool cancelled{false};
+    std::atomic_bool running{false};
+};
+
+LoadImageCommand::~LoadImageCommand() {
+    cancel();
+}
+
+void LoadImageCommand::executeAsync() {
+    start(Image);
+}
+
+void LoadImageCommand::executeNextScanAsync() {
+    start(NextScan);
+}
+
+void LoadImageCommand::executeFullResolutionAsync() {
+    start(FullResolution);
+}
+
+void LoadImageCommand::cancel() {
+    if (!state) {
+        return;
+    }
+    state->cancelled = true;
+    future.waitForFinished();
+    state->running = false;
+    handler->setLoadMonitor(nullptr);
+}
+
+bool LoadImageCommand::isRunning() const {
+    return state && state->running.load();
+}
+
+void LoadImageCommand::start(Mode mode) {
+    cancel();
+
+    state = std::make_shared<AsyncState>(observer);
+    state->running = true;
+    handler->setLoadMonitor(state.get());
+
+    std::shared_ptr<AsyncState> job = state;
+    ImageHandler* targetHandler = handler;
+    const QString file = filename;
+    future = QtConcurrent::run([job, targetHandler, file, mode]() {
+        TRACE_SCOPE(mode == NextScan ? "load_next_scan" :
+                    mode == FullResolution ? "load_full_resolution" : "load_image");
+        QImage image;
+        bool loaded = false;
+        if (mode == NextScan) {
+            ProgressiveImageHandler* progHandler = dynamic_cast<ProgressiveImageHandler*>(targetHandler);
+            loaded = progHandler && progHandler->loadNextScan(image);
+        } else if (mode == FullResolution) {
+            loaded = targetHandler->loadFullResolution(file, image);
+        } else {
+            loaded = targetHandler->loadImage(file, image);
+        }
+
+        // Кадр переезжает в уведомление без копирования; наблюдатель получает
+        // ссылку на тот же буфер
+        job->post([job, loaded, image = std::move(image), file, mode]() {
+            job->running = false;
+            if (!job->observer) {
+                return;
+            }
+            if (loaded) {
+                job->observer->onImageLoaded(image);
+            } else if (mode == NextScan) {
+                job->observer->onLoadError("No more scans available");
+            } else if (mode == FullResolution) {
+                job->observer->onLoadError("Failed to decode full resolution image: " + file);
+            } else {
+                job->observer->onLoadError("Failed to load image: " + file);
+            }
+        });
+    });
+}
+
+namespace {
+
+// Порция блокирующего чтения: с канала read() вернётся, только набрав её
+// целиком, поэтому для медленных источников она маленькая
+const qint64 SequentialChunk = 4 * 1024;
+const qint64 FileChunk = 256 * 1024;
+
+} // namespace
+
+class StreamLoadCommand::StreamState : public std::enable_shared_from_this<StreamLoadCommand::StreamState> {
+public:
+    StreamState(ImageLoadObserver* observer, const QSize& targetSize, bool queued)
+        : observer(observer), queued(queued)
+    {
+        decoder.setAutoTransform(true);
+        decoder.setTargetSize(targetSize);
+        decoder.setFrameConsumer([this](const QImage& frame, bool final) {
+            notify([this, frame, final]() {
+                if (final) {
+                    running = false;
+                }
+                if (observer) {
+                    observer->onImageLoaded(frame);
+                }
+            });
+        });
+    }
+
+    // Синхронный режим вызывает наблюдателя сразу, асинхронный - в GUI-потоке,
+    // если к тому моменту загрузку не отменили
+    template <typename Functor>
+    void notify(Functor functor) {
+        if (!queued) {
+            functor();
+            return;
+        }
+        std::shared_ptr<StreamState> self = shared_from_this();
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, functor = std::move(functor)]() {
+            if (!self->cancelled.load()) {
+                functor();
+            }
+        }, Qt::QueuedConnection);
+    }
+
+    bool readBlocking(QIODevice* device) {
+        TRACE_SCOPE("load_stream");
+        expectedBytes = device->isSequential() ? 0 : device->size();
+        const qint64 chunkSize = device->isSequential() ? SequentialChunk : FileChunk;
+        while (!cancelled.load()) {
+            const QByteArray chunk = device->read(chunkSize);
+            if (chunk.isEmpty()) {
+                return finish();
+            }
+            if (!feed(chunk)) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+    // true - рабочего потока нет и его должен запустить вызывающий
+    bool enqueue(const QByteArray& chunk, bool endOfInput) {
+        QMutexLocker locker(&mutex);
+        pending.append(chunk);
+        inputEnded = inputEnded || endOfInput;
+        if (draining) {
+            return false;
+        }
+        draining = true;
+        return true;
+    }
+
+    void drain() {
+        TRACE_SCOPE("load_stream");
+        for (;;) {
+            QByteArray chunk;
+            bool endOfInput = false;
+            {
+                QMutexLocker locker(&mutex);
+                if (cancelled.load() || stopped || (pending.isEmpty() && !inputEnded)) {
+                    draining = false;
+                    return;
+                }
+                chunk.swap(pending);
+                endOfInput = inputEnded;
+            }
+            if (!chunk.isEmpty() && !feed(chunk)) {
+                stopped = true;
+            } else if (endOfInput) {
+                finish();
+                stopped = true;
+            }
+        }
+    }
+
+    ImageLoadObserver* observer;
+    std::atomic_bool cancelled{false};
+    std::atomic_bool running{false};
+
+private:
+    bool feed(const QByteArray& chunk) {
+        if (!decoder.feed(chunk)) {
+            fail();
+            return false;
+        }
+        if (expectedBytes > 0) {
+            const int percent = static_cast<int>(qBound<qint64>(0, decoder.bytesReceived() * 100 / expectedBytes, 100));
+            if (percent != lastPercent) {
+                lastPercent = percent;
+                notify([this, percent]() {
+                    if (observer) {
+                        observer->onLoadProgress(percent);
+                    }
+                });
+            }
+        }
+        return true;
+    }
+
+    // Оборванный поток не ошибка: последний кадр уже у наблюдателя
+    bool finish() {
+        if (!decoder.finish()) {
+            fail();
+            return false;
+        }
+        return true;
+    }
+
+    void fail() {
+        const QString error = decoder.errorString();
+        notify([this, error]() {
+            running = false;
+            if (observer) {
+                observer->onLoadError("Failed to decode stream: " + error);
+            }
+        });
+    }
+
+    bool queued;
+    JpegStreamDecoder decoder;
+    qint64 expectedBytes = 0;
+    int lastPercent = -1;
+
+    QMutex mutex;
+    QByteArray pending;
+    bool inputEnded = false;
+    bool draining = false;
+    bool stopped = false;   // только из рабочего потока
+};
+
+StreamLoadCommand::~StreamLoadCommand() {
+    cancel();
+}
+
+bool StreamLoadCommand::execute() {
+    cancel();
+    state = std::make_shared<StreamState>(observer, targetSize, false);
+    state->running = true;
+    const bool loaded = state->readBlocking(device);
+    state->running = false;
+    return loaded;
+}
+
+void StreamLoadCommand::executeAsync() {
+    cancel();
+    state = std::make_shared<StreamState>(observer, targetSize, true);
+    state->running = true;
+
+    if (qobject_cast<QFileDevice*>(device)) {
+        std::shared_ptr<StreamState> job = state;
+        QIODevice* source = device;
+        future = QtConcurrent::run([job, source]() {
+            job->readBlocking(source);
+        });
+        return;
+    }
+
+    connections << QObject::connect(device, &QIODevice::readyRead, device, [this]() {
+        readAvailable(false);
+    });
+    connections << QObject::connect(device, &QIODevice::readChannelFinished, device, [this]() {
+        readAvailable(true);
+    });
+    // Пришедшее до подключения; устройство с произвольным доступом (QBuffer)
+    // новых данных не ждёт и отдаёт всё сразу
+    readAvailable(!device->isSequential());
+}
+
+void StreamLoadCommand::readAvailable(bool endOfInput) {
+    if (!state) {
+        return;
+    }
+    if (state->enqueue(device->readAll(), endOfInput)) {
+        std::shared_ptr<StreamState> job = state;
+        future = QtConcurrent::run([job]() {
+            job->drain();
+        });
+    }
+}
+
+void StreamLoadCommand::cancel() {
+    for (const QMetaObject::Connection& connection : connections) {
+        QObject::disconnect(connection);
+    }
+    connections.clear();
+    if (!state) {
+        return;
+    }
+    state->cancelled = true;
+    future.waitForFinished();
+    state->running = false;
+}
+
+bool StreamLoadCommand::isRunning() const {
+    return state && state->running.load();
+}
@@ -3,22 +3,34 @@
 
 #include "imagehandler.h"
 #include <QtCore/QObject>
+#include <QtCore/QFuture>
+#include <QtCore/QList>
 #include <QtGui/QImage>
+#include <QtCore/QSize>
 #include <QtCore/QString>
+#include <memory>
+
+class QIODevice;
 
 class ImageLoadObserver {
 public:
     virtual ~ImageLoadObserver() = default;
     virtual void onImageLoaded(const QImage& image) = 0;
     virtual void onLoadError(const QString& error) = 0;
+    virtual void onLoadProgress(int percent) { Q_UNUSED(percent); }
 };
 
 class LoadImageCommand {
 public:
     LoadImageCommand(ImageHandler* handler, const QString& filename, ImageLoadObserver* observer)
         : handler(handler), filename(filename), observer(observer) {}
+    ~LoadImageCommand();
+
+    LoadImageCommand(const LoadImageCommand&) = delete;
+    LoadImageCommand& operator=(const LoadImageCommand&) = delete;
     
     void execute() {
+        handler->setLoadMonitor(nullptr);
         QImage image;
         if (handler->loadImage(filename, image)) {
             if (observer) {
@@ -32,6 +44,7 @@ public:
     }
     
     void executeNextScan() {
+        handler->setLoadMonitor(nullptr);
         QImage image;
         ProgressiveImageHandler* progHandler = dynamic_cast<ProgressiveImageHandler*>(handler);
         if (progHandler && progHandler->loadNextScan(image)) {
@@ -44,17 +57,92 @@ public:
             }
         }
     }
+
+    // Асинхронные варианты: работа идёт в пуле потоков, вызовы наблюдателя
+    // доставляются в GUI-поток. Пока команда выполняется, обработчик трогать нельзя.
+    void executeAsync();
+    void executeNextScanAsync();
+    // Полное разрешение через ImageHandler::loadFullResolution (например,
+    // перед сохранением уменьшенной копии); прогресс и отмена - как у загрузки
+    void executeFullResolutionAsync();
+
+    // Отменяет текущую загрузку и дожидается остановки рабочего потока;
+    // отложенные уведомления наблюдателю после этого не доставляются
+    void cancel();
+
+    bool isRunning() const;
     
     bool canLoadNextScan() const {
+        if (isRunning()) {
+            return false;
+        }
         ProgressiveImageHandler* progHandler = dynamic_cast<ProgressiveImageHandler*>(handler);
         return progHandler && progHandler->hasMoreScans();
     }
 
 private:
+    class AsyncState;
+
+    enum Mode {
+        Image,
+        NextScan,
+        FullResolution
+    };
+
     ImageHandler* handler;
     QString filename;
     ImageLoadObserver* observer;
+
+    std::shared_ptr<AsyncState> state;
+    QFuture<void> future;
+
+    void start(Mode mode);
 };
 
-#endif // JPEGLOADER_H
+// Загрузка из произвольного QIODevice (канал, QLocalSocket, stdin) по мере
+// прихода данных через JpegStreamDecoder: наблюдатель получает onImageLoaded
+// на каждый пришедший скан прогрессивного файла и на каждую полосу строк
+// последовательного; onLoadProgress - только если размер устройства известен.
+class StreamLoadCommand {
+public:
+    StreamLoadCommand(QIODevice* device, ImageLoadObserver* observer)
+        : device(device), observer(observer) {}
+    ~StreamLoadCommand();
+
+    StreamLoadCommand(const StreamLoadCommand&) = delete;
+    StreamLoadCommand& operator=(const StreamLoadCommand&) = delete;
 
+    void setTargetSize(const QSize& size) { targetSize = size; }
+
+    // Читает устройство до конца в вызывающем потоке, наблюдатель вызывается
+    // оттуда же. Нужно устройство, чей read() ждёт данных: QFile на канале
+    // или stdin, открытый с QIODevice::Unbuffered - буферизованный QFile
+    // отдаёт данные только заполнив свой буфер
+    bool execute();
+
+    // Сокеты, процессы и другие устройства с readyRead читаются в их потоке
+    // по сигналу, QFile - блокирующим чтением в пуле. Декодирование идёт
+    // в пуле, вызовы наблюдателя доставляются в GUI-поток.
+    void executeAsync();
+
+    // Блокирующее чтение QFile прерывается только с приходом следующей
+    // порции данных или конца потока
+    void cancel();
+
+    bool isRunning() const;
+
+private:
+    class StreamState;
+
+    QIODevice* device;
+    ImageLoadObserver* observer;
+    QSize targetSize;
+
+    std::shared_ptr<StreamState> state;
+    QFuture<void> future;
+    QList<QMetaObject::Connection> connections;
+
+    void readAvailable(bool endOfInput);
+};
+
+#endif // JPEGLOADER_H
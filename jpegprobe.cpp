@@ -0,0 +1,180 @@
+#include "jpegprobe.h"
+#include "jpegcommon.h"
+#include "jpegdecoder.h"
+#include "tracing.h"
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <cstring>
+
+namespace {
+
+// Обычно заголовок вместе с EXIF укладывается в первую порцию
+const qint64 InitialChunk = 16 * 1024;
+
+const int TagOrientation = 0x0112;
+const int TagThumbnailOffset = 0x0201;
+const int TagThumbnailLength = 0x0202;
+
+inline quint32 readExif16(const uchar* p, bool bigEndian) {
+    return bigEndian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+inline quint32 readExif32(const uchar* p, bool bigEndian) {
+    return bigEndian ? (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | p[3]
+                     : (quint32(p[3]) << 24) | (quint32(p[2]) << 16) | (quint32(p[1]) << 8) | p[0];
+}
+
+// Значение записи IFD типа SHORT или LONG
+inline quint32 readEntryValue(const uchar* entry, bool bigEndian) {
+    return readExif16(entry + 2, bigEndian) == 3 ? readExif16(entry + 8, bigEndian)
+                                                 : readExif32(entry + 8, bigEndian);
+}
+
+// IFD0 - ориентация, IFD1 - миниатюра. Все смещения TIFF отсчитываются
+// от его заголовка и проверяются на выход за сегмент.
+bool parseExif(const uchar* data, const JpegSegment& segment, JpegProbeInfo& info) {
+    const uchar* payload = data + segment.offset + 4;
+    const qint64 length = segment.length - 2;
+    if (length < 14 || std::memcmp(payload, "Exif\0\0", 6) != 0) {
+        return false;
+    }
+    const uchar* tiff = payload + 6;
+    const quint32 size = static_cast<quint32>(length - 6);
+    if (tiff[0] != tiff[1] || (tiff[0] != 'M' && tiff[0] != 'I')) {
+        return false;
+    }
+    const bool bigEndian = tiff[0] == 'M';
+
+    quint32 ifd = readExif32(tiff + 4, bigEndian);
+    quint32 thumbnailOffset = 0;
+    quint32 thumbnailLength = 0;
+    for (int directory = 0; directory < 2 && ifd >= 8 && ifd <= size - 2; ++directory) {
+        const quint32 count = readExif16(tiff + ifd, bigEndian);
+        const quint32 end = ifd + 2 + count * 12;
+        if (end > size) {
+            break;
+        }
+        for (quint32 entry = ifd + 2; entry < end; entry += 12) {
+            const int tag = static_cast<int>(readExif16(tiff + entry, bigEndian));
+            if (directory == 0 && tag == TagOrientation) {
+                const int orientation = static_cast<int>(readEntryValue(tiff + entry, bigEndian));
+                info.orientation = orientation >= 1 && orientation <= 8 ? orientation : 1;
+            } else if (directory == 1 && tag == TagThumbnailOffset) {
+                thumbnailOffset = readEntryValue(tiff + entry, bigEndian);
+            } else if (directory == 1 && tag == TagThumbnailLength) {
+                thumbnailLength = readEntryValue(tiff + entry, bigEndian);
+            }
+        }
+        ifd = end + 4 <= size ? readExif32(tiff + end, bigEndian) : 0;
+    }
+
+    if (thumbnailOffset > 0 && thumbnailLength > 0 && thumbnailOffset <= size &&
+        thumbnailLength <= size - thumbnailOffset) {
+        JpegFileIndex thumbnailIndex;
+        if (thumbnailIndex.build(tiff + thumbnailOffset, thumbnailLength, true)) {
+            info.thumbnailOffset = (tiff - data) + thumbnailOffset;
+            info.thumbnailLength = thumbnailLength;
+            info.thumbnailSize = thumbnailIndex.size;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+QImageIOHandler::Transformations JpegProbeInfo::transformation() const {
+    // Так же, как теги переводит в QImageIOHandler::Transformations qjpeg
+    switch (orientation) {
+    case 2:
+        return QImageIOHandler::TransformationMirror;
+    case 3:
+        return QImageIOHandler::TransformationRotate180;
+    case 4:
+        return QImageIOHandler::TransformationFlip;
+    case 5:
+        return QImageIOHandler::TransformationFlipAndRotate90;
+    case 6:
+        return QImageIOHandler::TransformationRotate90;
+    case 7:
+        return QImageIOHandler::TransformationMirrorAndRotate90;
+    case 8:
+        return QImageIOHandler::TransformationRotate270;
+    default:
+        return QImageIOHandler::TransformationNone;
+    }
+}
+
+QSize JpegProbeInfo::orientedSize() const {
+    return orientation >= 5 ? index.size.transposed() : index.size;
+}
+
+bool JpegProbe::probe(const uchar* data, qint64 size, JpegProbeInfo& info) {
+    info = JpegProbeInfo();
+    info.fileSize = size;
+    info.bytesRead = size;
+    if (!info.index.build(data, size, true)) {
+        return false;
+    }
+    for (const JpegSegment& segment : info.index.appSegments) {
+        if (segment.marker == 0xE1 && parseExif(data, segment, info)) {
+            break;
+        }
+    }
+    return true;
+}
+
+bool JpegProbe::probeFile(const QString& filename, JpegProbeInfo& info) {
+    TRACE_SCOPE("probe");
+    QFile file(filename);
+    if (!file.open(QIODevice::ReadOnly)) {
+        info = JpegProbeInfo();
+        info.index.errorString = file.errorString();
+        return false;
+    }
+
+    // Заголовок с EXIF может не поместиться в первую порцию: тогда
+    // дочитывается ещё столько же, пока не найдётся SOS
+    QByteArray header;
+    qint64 chunk = InitialChunk;
+    while (true) {
+        const QByteArray more = file.read(chunk);
+        header.append(more);
+        const uchar* bytes = reinterpret_cast<const uchar*>(header.constData());
+        if (probe(bytes, header.size(), info) || more.isEmpty() || file.atEnd()) {
+            break;
+        }
+        if (header.size() >= 2 && (bytes[0] != 0xFF || bytes[1] != 0xD8)) {
+            break;
+        }
+        chunk = header.size();
+    }
+    info.fileSize = file.size();
+    info.bytesRead = header.size();
+    TRACE_COUNTER("bytes_read", info.bytesRead);
+    return info.isValid();
+}
+
+QImage JpegProbe::thumbnail(const uchar* data, qint64 size, const JpegProbeInfo& info) {
+    if (!info.hasThumbnail() || info.thumbnailOffset + info.thumbnailLength > size) {
+        return QImage();
+    }
+    TRACE_SCOPE("decode_thumbnail");
+    // Ориентация берётся из EXIF основного изображения, не миниатюры
+    const QByteArray bytes = QByteArray::fromRawData(reinterpret_cast<const char*>(data + info.thumbnailOffset),
+                                                     info.thumbnailLength);
+    JpegDecoder decoder;
+    QImage image;
+    if (!decoder.open(bytes) || !decoder.decodeFinal(image)) {
+        return QImage();
+    }
+
+    const QSize fullSize = info.index.size;
+    if (!fullSize.isEmpty()) {
+        const QSize visible = fullSize.scaled(image.size(), Qt::KeepAspectRatio);
+        if (!visible.isEmpty() && visible != image.size()) {
+            image = image.copy((image.width() - visible.width()) / 2, (image.height() - visible.height()) / 2,
+                               visible.width(), visible.height());
+        }
+    }
+    return applyTransformation(image, info.transformation());
+}
@@ -0,0 +1,41 @@
+#ifndef JPEGPROBE_H
+#define JPEGPROBE_H
+
+#include <QtGui/QImage>
+#include <QtGui/QImageIOHandler>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+#include "jpegindex.h"
+
+// Заголовок JPEG и EXIF без декодирования пикселей
+struct JpegProbeInfo {
+    JpegFileIndex index;            // до первого SOS, см. JpegFileIndex::build(headerOnly)
+    int orientation = 1;            // тег EXIF Orientation, 1-8
+    qint64 thumbnailOffset = -1;    // миниатюра EXIF (JPEG) от начала файла
+    qint64 thumbnailLength = 0;
+    QSize thumbnailSize;
+    qint64 fileSize = 0;
+    qint64 bytesRead = 0;           // сколько файла понадобилось прочитать
+
+    bool isValid() const { return index.isValid(); }
+    bool hasThumbnail() const { return thumbnailOffset >= 0; }
+    QImageIOHandler::Transformations transformation() const;
+    // Размер после поворота по EXIF
+    QSize orientedSize() const;
+};
+
+class JpegProbe {
+public:
+    // data может заканчиваться сразу после заголовка
+    static bool probe(const uchar* data, qint64 size, JpegProbeInfo& info);
+    // Читает файл порциями, пока не встретится первый SOS
+    static bool probeFile(const QString& filename, JpegProbeInfo& info);
+
+    // Миниатюра EXIF, повёрнутая по ориентации изображения и обрезанная до
+    // его пропорций (миниатюры 160x120 часто дополнены чёрными полосами);
+    // пустая, если миниатюры нет
+    static QImage thumbnail(const uchar* data, qint64 size, const JpegProbeInfo& info);
+};
+
+#endif // JPEGPROBE_H
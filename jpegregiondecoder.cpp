@@ -0,0 +1,169 @@
+#include "jpegregiondecoder.h"
+#include "jpegcommon.h"
+#include "jpegindex.h"
+#include <QtCore/QtGlobal>
+
+// jpeg_crop_scanline и jpeg_skip_scanlines есть в libjpeg-turbo начиная с 1.5;
+// JCS_EXTENSIONS (1.1) о них ничего не говорит
+#if defined(LIBJPEG_TURBO_VERSION_NUMBER) && LIBJPEG_TURBO_VERSION_NUMBER >= 1005000
+#define JPEG_REGION_API 1
+#endif
+
+namespace {
+
+// libjpeg вызывает монитор прогресса на каждом скане при чтении коэффициентов
+// и на каждой строке вывода: отмена прерывает проход через longjmp
+struct CancelProgress {
+    jpeg_progress_mgr pub;
+    const JpegRegionDecoder::CancelCheck* cancelled;
+    JpegErrorManager* error;
+};
+
+void checkCancelled(j_common_ptr cinfo) {
+    CancelProgress* progress = reinterpret_cast<CancelProgress*>(cinfo->progress);
+    if (*progress->cancelled && (*progress->cancelled)()) {
+        progress->error->fail("Cancelled");
+    }
+}
+
+const int CropMargin = 2;
+// Строки над областью пропускаются порциями, между которыми проверяется отмена
+const JDIMENSION SkipChunkRows = 256;
+
+} // namespace
+
+bool JpegRegionDecoder::open(const QByteArray& bytes) {
+    data = bytes;
+    imageSize = QSize();
+    lastError.clear();
+
+    JpegFileIndex index;
+    if (!index.build(reinterpret_cast<const uchar*>(data.constData()), data.size())) {
+        lastError = index.errorString;
+        data.clear();
+        return false;
+    }
+    imageSize = index.size;
+    return true;
+}
+
+QSize JpegRegionDecoder::scaledSize(int scale) const {
+    scale = qMax(1, scale);
+    return QSize((imageSize.width() + scale - 1) / scale, (imageSize.height() + scale - 1) / scale);
+}
+
+bool JpegRegionDecoder::decodeRegion(const QRect& region, int scale, int bandHeight, const BandConsumer& consumer) {
+    lastError.clear();
+    if (data.isEmpty()) {
+        lastError = "Decoder is not open";
+        return false;
+    }
+    const QRect area = region & QRect(QPoint(0, 0), scaledSize(scale));
+    if (area.isEmpty()) {
+        lastError = "Region is outside the image";
+        return false;
+    }
+    bandHeight = qMax(1, bandHeight);
+
+    jpeg_decompress_struct cinfo;
+    JpegErrorManager error;
+    CancelProgress progress;
+    QImage band;    // объявлена до setjmp, чтобы longjmp не пропустил деструктор
+    cinfo.err = error.attach();
+    progress.pub.progress_monitor = checkCancelled;
+    progress.cancelled = &cancelled;
+    progress.error = &error;
+
+    if (setjmp(error.jump)) {
+        lastError = QString::fromLatin1(error.message);
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    cinfo.progress = &progress.pub;
+    jpeg_mem_src(&cinfo, const_cast<unsigned char*>(reinterpret_cast<const unsigned char*>(data.constData())),
+                 static_cast<unsigned long>(data.size()));
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = static_cast<unsigned int>(qMax(1, scale));
+
+    OutputMode mode = OutputDirect;
+    bool invertedCmyk = false;
+    if (cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK) {
+        cinfo.out_color_space = JCS_CMYK;
+        mode = OutputCmyk;
+        invertedCmyk = cinfo.saw_Adobe_marker;
+    } else {
+#ifdef JCS_EXTENSIONS
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        cinfo.out_color_space = JCS_EXT_BGRX;
+#else
+        cinfo.out_color_space = JCS_EXT_XRGB;
+#endif
+#else
+        if (cinfo.jpeg_color_space == JCS_GRAYSCALE) {
+            cinfo.out_color_space = JCS_GRAYSCALE;
+            mode = OutputGray;
+        } else {
+            cinfo.out_color_space = JCS_RGB;
+            mode = OutputRgb;
+        }
+#endif
+    }
+
+    jpeg_start_decompress(&cinfo);
+
+    // Обрезка по горизонтали выравнивается по iMCU, поэтому строка
+    // может начинаться левее области. Края обрезки libjpeg считает краями
+    // изображения при интерполяции цветности, поэтому берётся запас
+    // в CropMargin пикселей с обеих сторон.
+    const int cropLeft = qMax(0, area.x() - CropMargin);
+    const int cropRight = qMin(static_cast<int>(cinfo.output_width), area.x() + area.width() + CropMargin);
+    JDIMENSION xoffset = static_cast<JDIMENSION>(cropLeft);
+    JDIMENSION cropWidth = static_cast<JDIMENSION>(cropRight - cropLeft);
+#ifdef JPEG_REGION_API
+    jpeg_crop_scanline(&cinfo, &xoffset, &cropWidth);
+#else
+    xoffset = 0;
+#endif
+    const int skipLeft = area.x() - static_cast<int>(xoffset);
+
+    JSAMPARRAY row = (*cinfo.mem->alloc_sarray)(reinterpret_cast<j_common_ptr>(&cinfo), JPOOL_IMAGE,
+                                                cinfo.output_width * cinfo.output_components, 1);
+
+    const JDIMENSION skipTo = static_cast<JDIMENSION>(area.y());
+    while (cinfo.output_scanline < skipTo) {
+        checkCancelled(reinterpret_cast<j_common_ptr>(&cinfo));
+        const JDIMENSION chunk = qMin(SkipChunkRows, skipTo - cinfo.output_scanline);
+#ifdef JPEG_REGION_API
+        jpeg_skip_scanlines(&cinfo, chunk);
+#else
+        for (JDIMENSION skipped = 0; skipped < chunk; ++skipped) {
+            jpeg_read_scanlines(&cinfo, row, 1);
+        }
+#endif
+    }
+
+    const JSAMPLE* const rowStart = row[0] + skipLeft * cinfo.output_components;
+    for (int bandTop = 0; bandTop < area.height(); bandTop += bandHeight) {
+        band = QImage(area.width(), qMin(bandHeight, area.height() - bandTop), QImage::Format_RGB32);
+        if (band.isNull()) {
+            error.fail("Out of memory");
+        }
+        for (int y = 0; y < band.height(); ++y) {
+            jpeg_read_scanlines(&cinfo, row, 1);
+            convertRow(rowStart, reinterpret_cast<QRgb*>(band.scanLine(y)), area.width(), mode, invertedCmyk);
+        }
+        if (!consumer(band, bandTop)) {
+            jpeg_destroy_decompress(&cinfo);
+            lastError = "Cancelled";
+            return false;
+        }
+    }
+
+    // Строки ниже области не нужны
+    jpeg_abort_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
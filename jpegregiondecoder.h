@@ -0,0 +1,45 @@
+#ifndef JPEGREGIONDECODER_H
+#define JPEGREGIONDECODER_H
+
+#include <QtGui/QImage>
+#include <QtCore/QByteArray>
+#include <QtCore/QRect>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <functional>
+
+// Декодирование прямоугольной области JPEG без кадра во всё изображение:
+// строки выше области пропускаются (jpeg_skip_scanlines), по горизонтали
+// декодируются только нужные iMCU (jpeg_crop_scanline). Каждый вызов
+// decodeRegion - отдельный проход libjpeg, поэтому объект можно использовать
+// из любого потока, но не из нескольких сразу.
+class JpegRegionDecoder {
+public:
+    // Полоса декодированной области: band.width() == region.width(),
+    // y - смещение полосы от верха области. false - прервать декодирование.
+    typedef std::function<bool(const QImage& band, int y)> BandConsumer;
+    // Проверяется и внутри прохода libjpeg: при пропуске строк над областью
+    // и при чтении коэффициентов прогрессивного файла
+    typedef std::function<bool()> CancelCheck;
+
+    // data должен оставаться действительным, пока объект используется
+    bool open(const QByteArray& data);
+    void setCancelCheck(const CancelCheck& check) { cancelled = check; }
+
+    QSize fullSize() const { return imageSize; }
+    // Размер изображения при уменьшении в scale раз (1, 2, 4, 8), как его считает libjpeg
+    QSize scaledSize(int scale) const;
+
+    // region задаётся в координатах изображения, уменьшенного в scale раз
+    bool decodeRegion(const QRect& region, int scale, int bandHeight, const BandConsumer& consumer);
+
+    QString errorString() const { return lastError; }
+
+private:
+    QByteArray data;
+    QSize imageSize;
+    QString lastError;
+    CancelCheck cancelled;
+};
+
+#endif // JPEGREGIONDECODER_H
@@ -0,0 +1,319 @@
+#include "jpegrestartdecoder.h"
+#include "jpegcommon.h"
+#include "jpegstrategy.h"
+#include "tracing.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtGui/QImageReader>
+#include <QtCore/QBuffer>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <atomic>
+#include <cstring>
+#include <numeric>
+
+namespace {
+
+// Полоса не уже стольких групп строк MCU: перекрытие на стыках - две группы
+const int MinGroupsPerBand = 8;
+
+inline int readWord(const uchar* p) {
+    return (p[0] << 8) | p[1];
+}
+
+// Разметка единственного скана: интервал k начинается сразу после маркера
+// restarts[k - 1] (или после SOS) и покрывает MCU с k * interval
+struct ScanLayout {
+    QByteArray header;          // от SOI до конца сегмента SOS
+    int heightOffset = 0;       // высота изображения в SOF внутри header
+    qint64 entropyStart = 0;
+    qint64 entropyEnd = 0;
+    QVector<qint64> restarts;   // позиции байта 0xFF маркеров RSTn
+    QSize imageSize;
+    QSize mcuSize;
+    int mcusPerRow = 0;
+    int mcuRows = 0;
+    int interval = 0;
+    int intervals = 0;
+    int groupRows = 0;          // строк MCU между соседними точками разреза
+};
+
+struct Band {
+    int firstRow = 0;           // строки MCU, которые полоса пишет в кадр
+    int lastRow = 0;
+};
+
+struct BandJob {
+    const uchar* data = nullptr;
+    const ScanLayout* layout = nullptr;
+    unsigned int denominator = 1;
+    uchar* bits = nullptr;
+    qsizetype bytesPerLine = 0;
+    bool grayscale = false;         // кадр Format_Grayscale8
+    LoadMonitor* monitor = nullptr;
+    int bandCount = 0;
+    std::atomic_int finishedBands{0};
+    std::atomic_bool failed{false};
+    QMutex errorMutex;
+    QString error;
+
+    void fail(const QString& message) {
+        QMutexLocker locker(&errorMutex);
+        if (!failed.exchange(true)) {
+            error = message;
+        }
+    }
+};
+
+bool buildLayout(const uchar* data, qint64 size, const JpegFileIndex& index, ScanLayout& layout, QString& error) {
+    const qint64 sos = index.scanOffsets.first();
+    if (sos + 5 > size || index.sofOffset < 0) {
+        error = "Truncated SOS segment";
+        return false;
+    }
+    if (data[sos + 4] != index.components.size()) {
+        error = "Scan is not interleaved";
+        return false;
+    }
+    layout.entropyStart = sos + 2 + readWord(data + sos + 2);
+    layout.header = QByteArray(reinterpret_cast<const char*>(data), static_cast<qsizetype>(layout.entropyStart));
+    layout.heightOffset = static_cast<int>(index.sofOffset + 5);
+
+    // Тот же проход, что и в JpegFileIndex, но с запоминанием RSTn
+    qint64 pos = layout.entropyStart;
+    while (pos + 1 < size) {
+        const void* found = std::memchr(data + pos, 0xFF, static_cast<size_t>(size - pos - 1));
+        if (!found) {
+            pos = size;
+            break;
+        }
+        pos = static_cast<const uchar*>(found) - data;
+        const uchar marker = data[pos + 1];
+        if (marker == 0x00 || marker == 0xFF) {
+            pos += marker == 0x00 ? 2 : 1;
+        } else if (marker >= 0xD0 && marker <= 0xD7) {
+            layout.restarts.append(pos);
+            pos += 2;
+        } else {
+            break;
+        }
+    }
+    layout.entropyEnd = qMin(pos, size);
+
+    layout.imageSize = index.size;
+    layout.mcuSize = index.mcuSize();
+    layout.mcusPerRow = (index.size.width() + layout.mcuSize.width() - 1) / layout.mcuSize.width();
+    layout.mcuRows = (index.size.height() + layout.mcuSize.height() - 1) / layout.mcuSize.height();
+    layout.interval = index.restartInterval;
+    const qint64 totalMcus = static_cast<qint64>(layout.mcusPerRow) * layout.mcuRows;
+    layout.intervals = static_cast<int>((totalMcus + layout.interval - 1) / layout.interval);
+    if (layout.restarts.size() != layout.intervals - 1) {
+        error = "Restart markers do not match the restart interval";
+        return false;
+    }
+    // Разрез возможен там, где начало интервала совпадает с началом строки MCU
+    layout.groupRows = layout.interval / std::gcd(layout.interval, layout.mcusPerRow);
+    return true;
+}
+
+void decodeBand(BandJob& job, const Band& band) {
+    if (job.failed.load()) {
+        return;
+    }
+    if (job.monitor && job.monitor->isCancelled()) {
+        job.fail("Cancelled");
+        return;
+    }
+
+    // Перекрытие в группу строк с каждой стороны, кроме краёв изображения
+    const ScanLayout& layout = *job.layout;
+    const int top = band.firstRow > 0 ? band.firstRow - layout.groupRows : 0;
+    const int bottom = qMin(layout.mcuRows, band.lastRow + layout.groupRows);
+    const int mcuHeight = layout.mcuSize.height();
+    const int firstInterval = static_cast<int>(static_cast<qint64>(top) * layout.mcusPerRow / layout.interval);
+    const int endInterval = bottom == layout.mcuRows
+        ? layout.intervals
+        : static_cast<int>(static_cast<qint64>(bottom) * layout.mcusPerRow / layout.interval);
+    const qint64 start = firstInterval == 0 ? layout.entropyStart : layout.restarts[firstInterval - 1] + 2;
+    const qint64 end = endInterval == layout.intervals ? layout.entropyEnd : layout.restarts[endInterval - 1];
+    const int bandHeight = qMin(layout.imageSize.height(), bottom * mcuHeight) - top * mcuHeight;
+
+    // Полоса как отдельный JPEG: высота в SOF, RSTn с нуля, EOI в конце
+    QByteArray stream;
+    stream.reserve(layout.header.size() + static_cast<qsizetype>(end - start) + 2);
+    stream.append(layout.header);
+    stream.append(reinterpret_cast<const char*>(job.data + start), static_cast<qsizetype>(end - start));
+    stream.append(char(0xFF));
+    stream.append(char(0xD9));
+    uchar* bytes = reinterpret_cast<uchar*>(stream.data());
+    bytes[layout.heightOffset] = static_cast<uchar>(bandHeight >> 8);
+    bytes[layout.heightOffset + 1] = static_cast<uchar>(bandHeight & 0xFF);
+    for (int k = firstInterval; k < endInterval - 1; ++k) {
+        const qint64 offset = layout.header.size() + layout.restarts[k] - start;
+        bytes[offset + 1] = static_cast<uchar>(0xD0 + (k - firstInterval) % 8);
+    }
+
+    jpeg_decompress_struct cinfo;
+    JpegErrorManager error;
+    cinfo.err = error.attach();
+    if (setjmp(error.jump)) {
+        jpeg_destroy_decompress(&cinfo);
+        job.fail(QString::fromLatin1(error.message));
+        return;
+    }
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, bytes, static_cast<unsigned long>(stream.size()));
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = job.denominator;
+
+    OutputMode mode = OutputDirect;
+    if (job.grayscale) {
+        cinfo.out_color_space = JCS_GRAYSCALE;
+    } else {
+#ifdef JCS_EXTENSIONS
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        cinfo.out_color_space = JCS_EXT_BGRX;
+#else
+        cinfo.out_color_space = JCS_EXT_XRGB;
+#endif
+#else
+        if (cinfo.jpeg_color_space == JCS_GRAYSCALE) {
+            cinfo.out_color_space = JCS_GRAYSCALE;
+            mode = OutputGray;
+        } else {
+            cinfo.out_color_space = JCS_RGB;
+            mode = OutputRgb;
+        }
+#endif
+    }
+    jpeg_start_decompress(&cinfo);
+
+    // Строки перекрытия декодируются в черновую строку и отбрасываются
+    const int scaledMcuHeight = mcuHeight / static_cast<int>(job.denominator);
+    const int outputTop = top * scaledMcuHeight;
+    const int keepFrom = (band.firstRow - top) * scaledMcuHeight;
+    const int keepTo = band.lastRow == layout.mcuRows
+        ? static_cast<int>(cinfo.output_height)
+        : (band.lastRow - top) * scaledMcuHeight;
+    const int width = static_cast<int>(cinfo.output_width);
+    JSAMPARRAY rowBuffer = (*cinfo.mem->alloc_sarray)(reinterpret_cast<j_common_ptr>(&cinfo), JPOOL_IMAGE,
+                                                      cinfo.output_width * cinfo.output_components, 1);
+    while (static_cast<int>(cinfo.output_scanline) < keepTo) {
+        const int y = static_cast<int>(cinfo.output_scanline);
+        if (y < keepFrom) {
+            jpeg_read_scanlines(&cinfo, rowBuffer, 1);
+            continue;
+        }
+        uchar* line = job.bits + static_cast<qsizetype>(outputTop + y) * job.bytesPerLine;
+        if (mode == OutputDirect) {
+            JSAMPROW row = line;
+            jpeg_read_scanlines(&cinfo, &row, 1);
+        } else {
+            jpeg_read_scanlines(&cinfo, rowBuffer, 1);
+            convertRow(rowBuffer[0], reinterpret_cast<QRgb*>(line), width, mode);
+        }
+        if ((y & 63) == 0 && job.monitor && job.monitor->isCancelled()) {
+            jpeg_destroy_decompress(&cinfo);
+            job.fail("Cancelled");
+            return;
+        }
+    }
+    // Нижнее перекрытие нужно только как контекст интерполяции
+    jpeg_destroy_decompress(&cinfo);
+
+    const int finished = ++job.finishedBands;
+    if (job.monitor) {
+        job.monitor->progress(finished * 100 / job.bandCount);
+    }
+}
+
+} // namespace
+
+bool JpegRestartDecoder::canDecode(const JpegFileIndex& index) {
+    const int count = index.components.size();
+    return (index.sofMarker == 0xC0 || index.sofMarker == 0xC1) && index.precision == 8 &&
+           index.scanCount() == 1 && index.restartInterval > 0 && (count == 1 || count == 3) &&
+           static_cast<qint64>(index.size.width()) * index.size.height() >= MinPixels &&
+           QThread::idealThreadCount() > 1;
+}
+
+bool JpegRestartDecoder::decode(const QByteArray& data, const JpegFileIndex& index, QImage& image) {
+    bands = 0;
+    lastError.clear();
+    if (!canDecode(index)) {
+        lastError = "Not a single-scan JPEG with restart intervals";
+        return false;
+    }
+
+    const uchar* bytes = reinterpret_cast<const uchar*>(data.constData());
+    ScanLayout layout;
+    {
+        TRACE_SCOPE("restart_scan");
+        if (!buildLayout(bytes, data.size(), index, layout, lastError)) {
+            return false;
+        }
+    }
+
+    const int groups = (layout.mcuRows + layout.groupRows - 1) / layout.groupRows;
+    const int threads = threadCount > 0 ? threadCount : QThread::idealThreadCount();
+    const int count = qBound(1, groups / MinGroupsPerBand, threads);
+    if (count < 2) {
+        lastError = "Too few restart points to split the image";
+        return false;
+    }
+    QVector<Band> bandList;
+    bandList.reserve(count);
+    for (int b = 0; b < count; ++b) {
+        Band band;
+        band.firstRow = groups * b / count * layout.groupRows;
+        band.lastRow = qMin(layout.mcuRows, groups * (b + 1) / count * layout.groupRows);
+        bandList.append(band);
+    }
+
+    QImageIOHandler::Transformations transformation = QImageIOHandler::TransformationNone;
+    if (autoTransform) {
+        QByteArray header = layout.header;
+        QBuffer buffer(&header);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader reader(&buffer, "jpeg");
+        transformation = reader.transformation();
+    }
+    const unsigned int denominator = qMax(static_cast<unsigned int>(minDenominator), chooseScaleDenominator(
+        index.size, targetSize, autoTransform && transformation.testFlag(QImageIOHandler::TransformationRotate90)));
+
+    const bool grayscale = (grayscaleOutput && index.components.size() == 1) || forceGrayscale;
+    QImage frame((index.size.width() + static_cast<int>(denominator) - 1) / static_cast<int>(denominator),
+                 (index.size.height() + static_cast<int>(denominator) - 1) / static_cast<int>(denominator),
+                 grayscale ? QImage::Format_Grayscale8 : QImage::Format_RGB32);
+    if (frame.isNull()) {
+        lastError = "Out of memory";
+        return false;
+    }
+
+    // Полосы пишут в непересекающиеся строки одного буфера; bits() здесь,
+    // чтобы QImage не отделял копию из рабочих потоков
+    BandJob job;
+    job.data = bytes;
+    job.layout = &layout;
+    job.denominator = denominator;
+    job.bits = frame.bits();
+    job.bytesPerLine = frame.bytesPerLine();
+    job.grayscale = grayscale;
+    job.monitor = loadMonitor;
+    job.bandCount = bandList.size();
+    {
+        TRACE_SCOPE("decode_bands");
+        QtConcurrent::blockingMap(bandList, [&job](const Band& band) { decodeBand(job, band); });
+    }
+    if (job.failed.load()) {
+        lastError = job.error;
+        return false;
+    }
+
+    bands = bandList.size();
+    TRACE_COUNTER("restart_bands", bands);
+    image = autoTransform ? applyTransformation(frame, transformation) : frame;
+    return true;
+}
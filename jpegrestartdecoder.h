@@ -0,0 +1,60 @@
+#ifndef JPEGRESTARTDECODER_H
+#define JPEGRESTARTDECODER_H
+
+#include <QtGui/QImage>
+#include <QtCore/QByteArray>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+#include "jpegindex.h"
+
+class LoadMonitor;
+
+// Параллельное декодирование последовательного JPEG с интервалами рестарта
+// (DRI). Энтропийные данные режутся по маркерам RSTn на границах строк MCU:
+// после RSTn предсказание DC сбрасывается, поэтому каждая полоса - это
+// самостоятельное изображение (заголовок с высотой полосы, её интервалы
+// с перенумерованными RSTn и EOI), которое свой libjpeg декодирует в своём
+// потоке прямо в общий кадр. Полоса захватывает по группе строк MCU сверху
+// и снизу: интерполяция цветности на стыках получается той же, что и при
+// декодировании целиком.
+class JpegRestartDecoder {
+public:
+    // Меньшие изображения быстрее декодировать целиком в одном потоке
+    static const qint64 MinPixels = 2 * 1024 * 1024;
+
+    // Baseline или extended Huffman, 8 бит, один скан, DRI, 1 или 3 компоненты
+    static bool canDecode(const JpegFileIndex& index);
+
+    void setAutoTransform(bool enabled) { autoTransform = enabled; }
+    // Как у JpegDecoder: наименьший масштаб DCT, не меньше вписанного в size
+    void setTargetSize(const QSize& size) { targetSize = size; }
+    void setLoadMonitor(LoadMonitor* monitor) { loadMonitor = monitor; }
+    // Одноканальные файлы - в Format_Grayscale8 вместо RGB32
+    void setGrayscaleOutput(bool enabled) { grayscaleOutput = enabled; }
+    // Как у JpegDecoder: режим нехватки памяти
+    void setMinScaleDenominator(int denominator) { minDenominator = qBound(1, denominator, 8); }
+    void setForceGrayscale(bool enabled) { forceGrayscale = enabled; }
+    // 0 - QThread::idealThreadCount()
+    void setThreadCount(int count) { threadCount = qMax(0, count); }
+
+    // false - файл не разрезается по рестартам или повреждён; тогда
+    // декодировать его нужно обычным путём
+    bool decode(const QByteArray& data, const JpegFileIndex& index, QImage& image);
+
+    int bandCount() const { return bands; }
+    QString errorString() const { return lastError; }
+
+private:
+    bool autoTransform = false;
+    bool grayscaleOutput = false;
+    bool forceGrayscale = false;
+    int minDenominator = 1;
+    QSize targetSize;
+    LoadMonitor* loadMonitor = nullptr;
+    int threadCount = 0;
+    int bands = 0;
+    QString lastError;
+};
+
+#endif // JPEGRESTARTDECODER_H
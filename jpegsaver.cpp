@@ -1,2 +1,80 @@
 #include "jpegsaver.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QMetaObject>
+#include <atomic>
 
+// Как у LoadImageCommand: монитор для обработчика и доставка в GUI-поток
+class SaveImageCommand::AsyncState : public LoadMonitor,
+                                     public std::enable_shared_from_this<SaveImageCommand::AsyncState> {
+public:
+    explicit AsyncState(ImageSaveObserver* observer) : observer(observer) {}
+
+    void progress(int percent) override {
+        post([this, percent]() {
+            if (observer) {
+                observer->onSaveProgress(percent);
+            }
+        });
+    }
+
+    bool isCancelled() const override { return cancelled.load(); }
+
+    // Выполняет functor в GUI-потоке, если к тому моменту сохранение не отменили
+    template <typename Functor>
+    void post(Functor functor) {
+        std::shared_ptr<AsyncState> self = shared_from_this();
+        QMetaObject::invokeMethod(QCoreApplication::instance(), [self, functor = std::move(functor)]() {
+            if (!self->cancelled.load()) {
+                functor();
+            }
+        }, Qt::QueuedConnection);
+    }
+
+    ImageSaveObserver* observer;
+    std::atomic_bool cancelled{false};
+    std::atomic_bool running{false};
+};
+
+SaveImageCommand::~SaveImageCommand() {
+    cancel();
+}
+
+void SaveImageCommand::executeAsync(ImageSaveObserver* observer) {
+    cancel();
+
+    state = std::make_shared<AsyncState>(observer);
+    state->running = true;
+    handler->setLoadMonitor(state.get());
+
+    std::shared_ptr<AsyncState> job = state;
+    future = QtConcurrent::run([this, job]() {
+        const bool encoded = execute();
+        const QString error = encoded ? QString() : errorString();
+        job->post([job, encoded, error]() {
+            job->running = false;
+            if (!job->observer) {
+                return;
+            }
+            if (encoded) {
+                job->observer->onImageEncoded();
+            } else {
+                job->observer->onSaveError(error);
+            }
+        });
+    });
+}
+
+void SaveImageCommand::cancel() {
+    if (!state) {
+        return;
+    }
+    state->cancelled = true;
+    future.waitForFinished();
+    state->running = false;
+    handler->setLoadMonitor(nullptr);
+}
+
+bool SaveImageCommand::isRunning() const {
+    return state && state->running.load();
+}
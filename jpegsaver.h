@@ -2,29 +2,101 @@
 #define JPEGSAVER_H
 
 #include "imagehandler.h"
+#include "qualitysearch.h"
+#include "tracing.h"
 #include <QtCore/QObject>
+#include <QtCore/QFuture>
 #include <QtGui/QImage>
 #include <QtCore/QString>
+#include <memory>
+#include <utility>
+
+class ImageSaveObserver {
+public:
+    virtual ~ImageSaveObserver() = default;
+    // Кодирование закончено: с фиксированным качеством файл уже записан,
+    // при подборе качества победитель ждёт writeSearchResult()
+    virtual void onImageEncoded() = 0;
+    virtual void onSaveError(const QString& error) = 0;
+    virtual void onSaveProgress(int percent) { Q_UNUSED(percent); }
+};
 
 class SaveImageCommand {
 public:
-    SaveImageCommand(ImageHandler* handler, const QString& filename, const QImage& image,
-                    int quality, bool progressive, int dctMethod)
-        : handler(handler), filename(filename), image(image),
-          quality(quality), progressive(progressive), dctMethod(dctMethod) {}
+    // Изображение передаётся по значению: вызывающий может отдать его через
+    // std::move, команда хранит ссылку на тот же буфер и только читает его
+    SaveImageCommand(ImageHandler* handler, const QString& filename, QImage image,
+                    int quality, bool progressive, int dctMethod, bool optimizeHuffman = false)
+        : handler(handler), filename(filename), image(std::move(image)),
+          quality(quality), progressive(progressive), dctMethod(dctMethod),
+          optimizeHuffman(optimizeHuffman) {}
+    ~SaveImageCommand();
+
+    SaveImageCommand(const SaveImageCommand&) = delete;
+    SaveImageCommand& operator=(const SaveImageCommand&) = delete;
     
+    // По умолчанию большие изображения кодируются полосами на всех ядрах;
+    // 1 - в одном потоке (например, когда параллельны сами файлы)
+    void setEncodeThreads(int threads) { encodeThreads = threads; }
+    // Качество подбирается под цель (QualitySearch); execute() только ищет,
+    // файл записывает writeSearchResult()
+    void setQualityTarget(const QualityTarget& target) {
+        qualityTarget = target;
+        searchTarget = true;
+    }
+    bool hasQualityTarget() const { return searchTarget; }
+
     bool execute() {
-        return handler->saveImage(filename, image, quality, progressive, dctMethod);
+        TRACE_SCOPE("save_command");
+        if (searchTarget) {
+            return handler->searchQuality(image, encodeOptions(), qualityTarget, result);
+        }
+        return handler->encodeImage(filename, image, encodeOptions());
     }
 
+    // То же в пуле потоков с прогрессом и отменой через LoadMonitor
+    // обработчика; вызовы наблюдателя доставляются в GUI-поток. Пока команда
+    // выполняется, обработчик трогать нельзя.
+    void executeAsync(ImageSaveObserver* observer);
+    // Отменяет кодирование и дожидается рабочего потока; отложенные
+    // уведомления наблюдателю после этого не доставляются
+    void cancel();
+    bool isRunning() const;
+
+    const QualitySearchResult& searchResult() const { return result; }
+    // Победитель поиска записывается как есть, без повторного кодирования
+    bool writeSearchResult() { return handler->writeEncoded(filename, result.jpeg); }
+
+    const JpegEncodeStats& stats() const { return handler->lastEncodeStats(); }
+    QString errorString() const { return handler->lastEncodeError(); }
+
 private:
+    class AsyncState;
+
     ImageHandler* handler;
     QString filename;
     QImage image;
     int quality;
     bool progressive;
     int dctMethod;
+    bool optimizeHuffman;
+    int encodeThreads = 0;
+    QualityTarget qualityTarget;
+    bool searchTarget = false;
+    QualitySearchResult result;
+
+    std::shared_ptr<AsyncState> state;
+    QFuture<void> future;
+
+    JpegEncodeOptions encodeOptions() const {
+        JpegEncodeOptions options;
+        options.quality = quality;
+        options.progressive = progressive;
+        options.dctMethod = dctMethod;
+        options.optimizeHuffman = optimizeHuffman;
+        options.threads = encodeThreads;
+        return options;
+    }
 };
 
 #endif // JPEGSAVER_H
-
@@ -1,5 +1,8 @@
 #include "jpegstrategy.h"
-#include <QtGui/QImageReader>
+#include "jpegdecoder.h"
+#include "jpegrestartdecoder.h"
+#include "tracing.h"
+#include <QtConcurrent/QtConcurrent>
 #include <QtGui/QImageWriter>
 #include <QtGui/QColor>
 #include <QtGui/QRgb>
@@ -10,155 +13,374 @@
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
 #include <QtCore/QtGlobal>
+#include <utility>
+
+QSharedPointer<MappedJpegFile> JPEGStrategy::openMappedFile(const QString& filename) {
+    if (!mappedFile || mappedFile->fileName() != filename) {
+        QSharedPointer<MappedJpegFile> file(new MappedJpegFile());
+        if (!file->open(filename)) {
+            return QSharedPointer<MappedJpegFile>();
+        }
+        mappedFile = file;
+    }
+    return mappedFile;
+}
+
+bool JPEGStrategy::planMemory(const JpegFileIndex& index) {
+    if (!budgetEnabled) {
+        memoryPlan = MemoryDecodePlan();
+        return true;
+    }
+    memoryPlan = MemoryAccountant::instance().planDecode(index, targetSize, grayscaleOutput);
+    if (!memoryPlan.fits) {
+        qWarning() << "Image does not fit the memory budget:" << index.size << memoryPlan.toString();
+        return false;
+    }
+    if (memoryPlan.fallback) {
+        qWarning() << "Low memory, decoding at" << memoryPlan.toString();
+    }
+    return true;
+}
+
+bool JPEGStrategy::loadFullResolution(const QString& filename, QImage& image) {
+    const QSize savedTargetSize = targetSize;
+    const bool savedReduced = reducedResolution;
+    const MemoryDecodePlan savedPlan = memoryPlan;
+    // Запрошено явно: бюджет проверяет вызывающий, уменьшать нельзя
+    targetSize = QSize();
+    budgetEnabled = false;
+    const bool loaded = loadImage(filename, image);
+    budgetEnabled = true;
+    targetSize = savedTargetSize;
+    reducedResolution = savedReduced;
+    memoryPlan = savedPlan;
+    return loaded;
+}
+
+bool JPEGStrategy::encodeImage(const QString& filename, const QImage& image, const JpegEncodeOptions& options) {
+    TRACE_SCOPE("encode");
+    JpegEncoder encoder(options);
+    encoder.setLoadMonitor(loadMonitor);
+    const bool saved = encoder.encodeToFile(image, filename);
+    encodeStats = encoder.stats();
+    TRACE_COUNTER("pixels", static_cast<qint64>(image.width()) * image.height());
+    TRACE_COUNTER("bytes_written", encodeStats.outputBytes);
+    encodeError = encoder.errorString();
+    return saved;
+}
+
+bool JPEGStrategy::searchQuality(const QImage& image, const JpegEncodeOptions& options, const QualityTarget& target,
+                                 QualitySearchResult& result) {
+    TRACE_SCOPE("encode");
+    QualitySearch search(options);
+    search.setLoadMonitor(loadMonitor);
+    const bool found = search.search(image, target, result);
+    encodeStats = JpegEncodeStats();
+    if (found) {
+        encodeStats.outputBytes = result.jpeg.size();
+        encodeStats.encodeMs = result.searchMs;
+        encodeStats.imageSize = image.size();
+    }
+    TRACE_COUNTER("pixels", static_cast<qint64>(image.width()) * image.height());
+    encodeError = search.errorString();
+    return found;
+}
+
+bool JPEGStrategy::writeEncoded(const QString& filename, const QByteArray& jpeg) {
+    TRACE_SCOPE("write");
+    encodeError.clear();
+    const bool saved = JpegEncoder::writeToFile(jpeg, filename, &encodeError, loadMonitor);
+    TRACE_COUNTER("bytes_written", saved ? jpeg.size() : 0);
+    return saved;
+}
+
+bool JPEGStrategy::transformFile(const QString& filename, const QString& outputFilename,
+                                 const JpegTransformOptions& options) {
+    // Текущий отображённый файл не подменяется: идущая загрузка его читает
+    QSharedPointer<MappedJpegFile> file = mappedFile;
+    if (!file || file->fileName() != filename) {
+        file.reset(new MappedJpegFile());
+        if (!file->open(filename)) {
+            transformError = QString("Cannot open %1").arg(filename);
+            return false;
+        }
+    }
+
+    JpegTransformer transformer(options);
+    const bool saved = transformer.transformToFile(file->bytes(), outputFilename);
+    transformStats = transformer.stats();
+    transformError = transformer.errorString();
+    return saved;
+}
 
 bool StandardJPEGStrategy::loadImage(const QString& filename, QImage& image) {
-    QImageReader reader(filename);
-    reader.setAutoTransform(true);
-    if (reader.canRead()) {
-        image = reader.read();
-        return !image.isNull();
+    QSharedPointer<MappedJpegFile> file = openMappedFile(filename);
+    if (!file) {
+        return false;
+    }
+    if (loadMonitor && loadMonitor->isCancelled()) {
+        return false;
+    }
+    if (!planMemory(file->index())) {
+        return false;
     }
-    return false;
+    const QByteArray data = file->bytes();
+
+    // Крупный baseline с интервалами рестарта - полосами на всех ядрах
+    if (decodeThreads != 1 && JpegRestartDecoder::canDecode(file->index())) {
+        TRACE_SCOPE("decode_restart_bands");
+        JpegRestartDecoder restartDecoder;
+        restartDecoder.setAutoTransform(true);
+        restartDecoder.setGrayscaleOutput(grayscaleOutput);
+        restartDecoder.setTargetSize(targetSize);
+        restartDecoder.setLoadMonitor(loadMonitor);
+        restartDecoder.setThreadCount(decodeThreads);
+        applyMemoryPlan(restartDecoder);
+        if (restartDecoder.decode(data, file->index(), image)) {
+            const QSize fullSize = file->index().size;
+            reducedResolution = static_cast<qint64>(image.width()) * image.height() <
+                                static_cast<qint64>(fullSize.width()) * fullSize.height() ||
+                                memoryPlan.grayscale;
+            TRACE_COUNTER("pixels", static_cast<qint64>(image.width()) * image.height());
+            return true;
+        }
+        if (loadMonitor && loadMonitor->isCancelled()) {
+            return false;
+        }
+        qWarning() << "Restart-interval decode failed, using the sequential path:" << restartDecoder.errorString();
+    }
+
+    // Один проход libjpeg прямо в кадр нужного формата, без convertToFormat
+    // и без масштабирования до точного размера после декодирования
+    TRACE_SCOPE("decode");
+    JpegDecoder sequentialDecoder;
+    sequentialDecoder.setAutoTransform(true);
+    sequentialDecoder.setGrayscaleOutput(grayscaleOutput);
+    sequentialDecoder.setTargetSize(targetSize);
+    sequentialDecoder.setLoadMonitor(loadMonitor);
+    applyMemoryPlan(sequentialDecoder);
+    if (!sequentialDecoder.open(data, file->index()) || !sequentialDecoder.decodeFinal(image)) {
+        qWarning() << "Failed to decode" << filename << sequentialDecoder.errorString();
+        return false;
+    }
+    reducedResolution = sequentialDecoder.scaleDenominator() > 1 || memoryPlan.grayscale;
+    TRACE_COUNTER("pixels", static_cast<qint64>(image.width()) * image.height());
+    if (loadMonitor) {
+        loadMonitor->progress(100);
+    }
+    return true;
 }
 
 bool StandardJPEGStrategy::saveImage(const QString& filename, const QImage& image, 
                                      int quality, bool progressive, int dctMethod) {
-    
-    Q_UNUSED(progressive);
-    Q_UNUSED(dctMethod);
-    
-    return image.save(filename, "JPEG", quality);
+    JpegEncodeOptions options;
+    options.quality = quality;
+    options.progressive = progressive;
+    options.dctMethod = dctMethod;
+    return encodeImage(filename, image, options);
+}
+
+ProgressiveJPEGStrategy::~ProgressiveJPEGStrategy() {
+    reset();
 }
 
 bool ProgressiveJPEGStrategy::loadImage(const QString& filename, QImage& image) {
+    reset();
+
+    QSharedPointer<MappedJpegFile> file = openMappedFile(filename);
+    if (!file) {
+        return false;
+    }
+
+    if (!planMemory(file->index())) {
+        return false;
+    }
+
+    TRACE_SCOPE("decode_first_scan");
+    decoder = new JpegDecoder();
+    decoder->setAutoTransform(true);
+    decoder->setGrayscaleOutput(grayscaleOutput);
+    decoder->setLoadMonitor(loadMonitor);
+    decoder->setFramePool(&framePool);
+    decoder->setTargetSize(targetSize);
+    applyMemoryPlan(*decoder);
+    if (!decoder->open(file->bytes(), file->index()) || !decoder->decodeNextScan(image)) {
+        qWarning() << "Failed to decode" << filename << decoder->errorString();
+        reset();
+        return false;
+    }
+    TRACE_COUNTER("pixels", static_cast<qint64>(image.width()) * image.height());
+
     currentFilename = filename;
-    currentScan = 0;
-    
-    QImageReader reader(filename);
-    reader.setAutoTransform(true);
-    
-    QFile file(filename);
-    isProgressive = false;
-    if (file.open(QFile::ReadOnly)) {
-        QByteArray header = file.read(2048);
-        for (int i = 0; i < header.size() - 1; ++i) {
-            if (static_cast<unsigned char>(header[i]) == 0xFF && 
-                static_cast<unsigned char>(header[i+1]) == 0xC2) {
-                isProgressive = true;
-                break;
-            }
-        }
-        file.close();
-    }
-    
-    QByteArray format = reader.format();
-    if (format == "jpeg" || format == "jpg") {
-        if (reader.canRead()) {
-            originalImage = reader.read();
-            if (!originalImage.isNull()) {
-                if (!isProgressive) {
-                    isProgressive = true;
-                }
-                
-                if (originalImage.format() != QImage::Format_RGB32 &&
-                    originalImage.format() != QImage::Format_ARGB32) {
-                    originalImage = originalImage.convertToFormat(QImage::Format_RGB32);
-                }
-
-                currentScan = 1;
-                image = applyBlur(originalImage, 8);
-                
-                return true;
-            }
+    isProgressive = decoder->isProgressive();
+    currentScan = 1;
+    reducedResolution = decoder->scaleDenominator() > 1 || memoryPlan.grayscale;
+    frameBytes = image.sizeInBytes();
+    coefficientCharge.set(MemoryAccountant::coefficientBytes(file->index()));
+    startPrecompute();
+    return true;
+}
+
+bool ProgressiveJPEGStrategy::loadFullResolution(const QString& filename, QImage& image) {
+    // Отдельный декодер: фоновое предвычисление сканов продолжает работать
+    QSharedPointer<MappedJpegFile> file = mappedFile;
+    if (!file || file->fileName() != filename) {
+        file.reset(new MappedJpegFile());
+        if (!file->open(filename)) {
+            return false;
         }
     }
-    
-    return false;
+
+    TRACE_SCOPE("decode_full_resolution");
+    JpegDecoder fullDecoder;
+    fullDecoder.setAutoTransform(true);
+    fullDecoder.setGrayscaleOutput(grayscaleOutput);
+    fullDecoder.setLoadMonitor(loadMonitor);
+    if (!fullDecoder.open(file->bytes(), file->index()) || !fullDecoder.decodeFinal(image)) {
+        qWarning() << "Failed to decode" << filename << fullDecoder.errorString();
+        return false;
+    }
+    TRACE_COUNTER("pixels", static_cast<qint64>(image.width()) * image.height());
+    return true;
 }
 
 bool ProgressiveJPEGStrategy::loadNextScan(QImage& image) {
-    if (!isProgressive || currentFilename.isEmpty() || originalImage.isNull()) {
+    if (currentFilename.isEmpty() || !decoder) {
         return false;
     }
-    
-    currentScan++;
-    
-    int blurRadius = qMax(0, 8 - (currentScan - 1) * 2);
-    
-    if (blurRadius > 0) {
-        image = applyBlur(originalImage, blurRadius);
+
+    TRACE_SCOPE("wait_next_scan");
+    const int target = currentScan + 1;
+    QMutexLocker locker(&cacheMutex);
+    if (scanCache.contains(target)) {
+        cacheHits++;
     } else {
-        image = originalImage;
+        cacheMisses++;
+        while (!scanCache.contains(target) && !precomputeDone) {
+            if (loadMonitor && loadMonitor->isCancelled()) {
+                return false;
+            }
+            cacheChanged.wait(&cacheMutex, 50);
+        }
+    }
+
+    if (!scanCache.take(target, image)) {
+        return false;
     }
-    
-    return !image.isNull();
+    cacheChanged.wakeAll();
+    currentScan = target;
+    return true;
 }
 
 bool ProgressiveJPEGStrategy::hasMoreScans() const {
-    if (!currentFilename.isEmpty() && isProgressive && currentScan < 5) {
-        return true;
+    if (currentFilename.isEmpty() || !decoder) {
+        return false;
     }
-    return false;
+    QMutexLocker locker(&cacheMutex);
+    return scanCache.contains(currentScan + 1) || !precomputeDone;
+}
+
+int ProgressiveJPEGStrategy::scanCount() const {
+    return decoder ? decoder->scanCount() : 0;
+}
+
+void ProgressiveJPEGStrategy::setScanCacheBudget(qint64 bytes) {
+    QMutexLocker locker(&cacheMutex);
+    scanCache.setBudget(bytes);
+    cacheChanged.wakeAll();
+}
+
+ScanCacheStats ProgressiveJPEGStrategy::scanCacheStats() const {
+    QMutexLocker locker(&cacheMutex);
+    ScanCacheStats stats = scanCache.stats();
+    stats.hits = cacheHits;
+    stats.misses = cacheMisses;
+    stats.precomputedScans = precomputedScans;
+    return stats;
 }
 
 void ProgressiveJPEGStrategy::reset() {
+    stopPrecompute();
+
     currentFilename.clear();
     currentScan = 0;
     isProgressive = false;
-    originalImage = QImage();
-}
-
-QImage ProgressiveJPEGStrategy::applyBlur(const QImage& image, int radius) {
-    if (radius <= 0 || image.isNull()) {
-        return image;
-    }
-
-    QImage result = QImage(image.size(), image.format());
-    
-    int step = qMax(1, radius / 2);
-    
-    for (int y = 0; y < result.height(); y += step) {
-        for (int x = 0; x < result.width(); x += step) {
-            int r = 0, g = 0, b = 0, count = 0;
-            
-            int yStart = qMax(0, y - radius);
-            int yEnd = qMin(result.height() - 1, y + radius);
-            int xStart = qMax(0, x - radius);
-            int xEnd = qMin(result.width() - 1, x + radius);
-            
-            for (int py = yStart; py <= yEnd; py++) {
-                for (int px = xStart; px <= xEnd; px++) {
-                    QColor c = image.pixelColor(px, py);
-                    r += c.red();
-                    g += c.green();
-                    b += c.blue();
-                    count++;
-                }
+    reducedResolution = false;
+    frameBytes = 0;
+    delete decoder;
+    decoder = nullptr;
+    coefficientCharge.set(0);
+
+    QMutexLocker locker(&cacheMutex);
+    scanCache.clear();
+}
+
+// После первого скана декодер принадлежит фоновой задаче: loadNextScan()
+// только забирает готовые кадры из кэша
+void ProgressiveJPEGStrategy::startPrecompute() {
+    {
+        QMutexLocker locker(&cacheMutex);
+        stopRequested = false;
+        precomputeDone = !decoder->hasMoreScans();
+        if (precomputeDone) {
+            return;
+        }
+    }
+    precomputeMonitor.stopped = false;
+    decoder->setLoadMonitor(&precomputeMonitor);
+    precomputePool.setMaxThreadCount(1);
+    precomputeFuture = QtConcurrent::run(&precomputePool, [this]() { precomputeScans(); });
+}
+
+void ProgressiveJPEGStrategy::stopPrecompute() {
+    {
+        QMutexLocker locker(&cacheMutex);
+        stopRequested = true;
+        cacheChanged.wakeAll();
+    }
+    precomputeMonitor.stopped = true;
+    precomputeFuture.waitForFinished();
+
+    QMutexLocker locker(&cacheMutex);
+    precomputeDone = true;
+}
+
+void ProgressiveJPEGStrategy::precomputeScans() {
+    for (;;) {
+        {
+            QMutexLocker locker(&cacheMutex);
+            while (!stopRequested && !scanCache.canInsert(frameBytes)) {
+                cacheChanged.wait(&cacheMutex);
             }
-            
-            if (count > 0) {
-                r /= count;
-                g /= count;
-                b /= count;
-                QColor avgColor(r, g, b);
-                
-                for (int py = y; py < qMin(result.height(), y + step); py++) {
-                    for (int px = x; px < qMin(result.width(), x + step); px++) {
-                        result.setPixelColor(px, py, avgColor);
-                    }
-                }
+            if (stopRequested) {
+                break;
             }
         }
+
+        QImage frame;
+        {
+            TRACE_SCOPE("precompute_scan");
+            if (!decoder->hasMoreScans() || !decoder->decodeNextScan(frame)) {
+                break;
+            }
+        }
+
+        QMutexLocker locker(&cacheMutex);
+        scanCache.insert(decoder->decodedScans(), std::move(frame));
+        precomputedScans++;
+        cacheChanged.wakeAll();
     }
-    
-    return result;
+
+    QMutexLocker locker(&cacheMutex);
+    precomputeDone = true;
+    cacheChanged.wakeAll();
 }
 
 bool ProgressiveJPEGStrategy::saveImage(const QString& filename, const QImage& image, 
                                         int quality, bool progressive, int dctMethod) {
-    
-    Q_UNUSED(progressive);
-    Q_UNUSED(dctMethod);
-    
-    return image.save(filename, "JPEG", quality);
+    JpegEncodeOptions options;
+    options.quality = quality;
+    options.progressive = progressive;
+    options.dctMethod = dctMethod;
+    return encodeImage(filename, image, options);
 }
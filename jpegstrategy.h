@@ -1,8 +1,31 @@
 #ifndef JPEGSTRATEGY_H
 #define JPEGSTRATEGY_H
 
+#include "scancache.h"
+#include "jpegindex.h"
+#include "jpegencoder.h"
+#include "jpegtransform.h"
+#include "qualitysearch.h"
+#include "framepool.h"
+#include "memoryaccountant.h"
 #include <QtGui/QImage>
 #include <QtCore/QString>
+#include <QtCore/QFuture>
+#include <QtCore/QMutex>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QThreadPool>
+#include <QtCore/QWaitCondition>
+#include <atomic>
+
+class JpegDecoder;
+
+// Прогресс и отмена загрузки; вызывается из потока, в котором идёт декодирование
+class LoadMonitor {
+public:
+    virtual ~LoadMonitor() = default;
+    virtual void progress(int percent) = 0;
+    virtual bool isCancelled() const = 0;
+};
 
 class JPEGStrategy {
 public:
@@ -10,6 +33,75 @@ public:
     virtual bool loadImage(const QString& filename, QImage& image) = 0;
     virtual bool saveImage(const QString& filename, const QImage& image, 
                           int quality, bool progressive, int dctMethod) = 0;
+
+    virtual void setLoadMonitor(LoadMonitor* monitor) { loadMonitor = monitor; }
+
+    // Размер области просмотра: декодирование идёт в наименьшем разрешении,
+    // которое её ещё покрывает. Пустой размер - полное разрешение.
+    void setTargetSize(const QSize& size) { targetSize = size; }
+    bool isReducedResolution() const { return reducedResolution; }
+    // Масштаб и цветность последней загрузки с учётом бюджета MemoryAccountant;
+    // fallback - пришлось уменьшить масштаб или отказаться от цвета, такой
+    // кадр тоже считается уменьшенным
+    const MemoryDecodePlan& lastMemoryPlan() const { return memoryPlan; }
+
+    // Одноканальные JPEG остаются Format_Grayscale8 на всём пути до экрана
+    void setGrayscaleOutput(bool enabled) { grayscaleOutput = enabled; }
+    // Потоки декодирования полосами по интервалам рестарта (0 - по числу
+    // ядер); 1 - только последовательный JpegDecoder, когда файлы и так
+    // декодируются параллельно
+    void setDecodeThreads(int count) { decodeThreads = qMax(0, count); }
+
+    // Полное разрешение по требованию (сохранение, увеличение), не меняя
+    // состояние текущей загрузки
+    virtual bool loadFullResolution(const QString& filename, QImage& image);
+
+    // Уже открытый файл (например, после выбора обработчика по индексу),
+    // чтобы не отображать его в память повторно
+    void setMappedFile(const QSharedPointer<MappedJpegFile>& file) { mappedFile = file; }
+
+    // Сохранение через libjpeg с заданными методом DCT, прогрессивным режимом
+    // и оптимизацией Хаффмана; время и размер последнего кодирования - в lastEncodeStats()
+    bool encodeImage(const QString& filename, const QImage& image, const JpegEncodeOptions& options);
+    // Подбор качества под цель вместо options.quality; файл не пишется,
+    // победитель записывается writeEncoded(). lastEncodeStats() - размер
+    // победителя и время всего поиска
+    bool searchQuality(const QImage& image, const JpegEncodeOptions& options, const QualityTarget& target,
+                       QualitySearchResult& result);
+    bool writeEncoded(const QString& filename, const QByteArray& jpeg);
+    const JpegEncodeStats& lastEncodeStats() const { return encodeStats; }
+    QString lastEncodeError() const { return encodeError; }
+
+    // Поворот, отражение, обрезка и смена режима без декодирования пикселей;
+    // outputFilename может совпадать с filename
+    bool transformFile(const QString& filename, const QString& outputFilename, const JpegTransformOptions& options);
+    const JpegTransformStats& lastTransformStats() const { return transformStats; }
+    QString lastTransformError() const { return transformError; }
+
+protected:
+    LoadMonitor* loadMonitor = nullptr;
+    QSharedPointer<MappedJpegFile> mappedFile;
+    QSize targetSize;
+    bool reducedResolution = false;
+    bool grayscaleOutput = false;
+    int decodeThreads = 0;
+    MemoryDecodePlan memoryPlan;
+    bool budgetEnabled = true;
+    JpegEncodeStats encodeStats;
+    QString encodeError;
+    JpegTransformStats transformStats;
+    QString transformError;
+
+    QSharedPointer<MappedJpegFile> openMappedFile(const QString& filename);
+    // false - кадр не помещается в бюджет даже в 1/8 и без цвета
+    bool planMemory(const JpegFileIndex& index);
+    template <typename Decoder>
+    void applyMemoryPlan(Decoder& decoder) const {
+        if (memoryPlan.fallback) {
+            decoder.setMinScaleDenominator(memoryPlan.scaleDenominator);
+            decoder.setForceGrayscale(memoryPlan.grayscale);
+        }
+    }
 };
 
 class StandardJPEGStrategy : public JPEGStrategy {
@@ -21,23 +113,67 @@ public:
 
 class ProgressiveJPEGStrategy : public JPEGStrategy {
 public:
+    ProgressiveJPEGStrategy() = default;
+    ~ProgressiveJPEGStrategy() override;
+
+    ProgressiveJPEGStrategy(const ProgressiveJPEGStrategy&) = delete;
+    ProgressiveJPEGStrategy& operator=(const ProgressiveJPEGStrategy&) = delete;
+
     bool loadImage(const QString& filename, QImage& image) override;
     bool saveImage(const QString& filename, const QImage& image, 
                   int quality, bool progressive, int dctMethod) override;
 
+    bool loadFullResolution(const QString& filename, QImage& image) override;
+
     bool loadNextScan(QImage& image);
 
     bool hasMoreScans() const;
 
+    int scanCount() const;
+    int currentScanIndex() const { return currentScan; }
+
+    // Оставшиеся сканы декодируются в фоне сразу после первого и ждут
+    // в ScanCache; при заполнении бюджета фоновое декодирование приостанавливается
+    void setScanCacheBudget(qint64 bytes);
+    ScanCacheStats scanCacheStats() const;
+    FramePoolStats framePoolStats() const { return framePool.stats(); }
+
     void reset();
 
 private:
+    class PrecomputeMonitor : public LoadMonitor {
+    public:
+        void progress(int percent) override { Q_UNUSED(percent); }
+        bool isCancelled() const override { return stopped.load(); }
+        std::atomic_bool stopped{false};
+    };
+
     QString currentFilename;
     int currentScan = 0;
     bool isProgressive = false;
-    QImage originalImage;
+    JpegDecoder* decoder = nullptr;
+    // Кадры сканов: буфер показанного и вытесненного кадра достаётся следующему скану
+    FramePool framePool;
+    // Коэффициенты всего изображения, которые libjpeg держит между сканами
+    MemoryCharge coefficientCharge{MemoryAccountant::Scans};
+
+    mutable QMutex cacheMutex;
+    QWaitCondition cacheChanged;
+    ScanCache scanCache;
+    qint64 frameBytes = 0;
+    bool precomputeDone = true;
+    bool stopRequested = false;
+    int cacheHits = 0;
+    int cacheMisses = 0;
+    int precomputedScans = 0;
+
+    PrecomputeMonitor precomputeMonitor;
+    QThreadPool precomputePool;
+    QFuture<void> precomputeFuture;
 
-    QImage applyBlur(const QImage& image, int radius);
+    void startPrecompute();
+    void stopPrecompute();
+    void precomputeScans();
 };
 
 #endif // JPEGSTRATEGY_H
@@ -0,0 +1,464 @@
+#include "jpegstreamdecoder.h"
+#include "jpegcommon.h"
+#include "tracing.h"
+#include <QtGui/QImageReader>
+#include <QtCore/QBuffer>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <cstring>
+
+namespace {
+
+// Фон ещё не пришедших строк - как у области изображения в ImageView
+const QRgb PendingRowColor = 0xff2b2b2b;
+// Буферы кадра по кругу: выданный потребителю и тот, в который пишутся строки;
+// третий - на случай, когда потребитель ещё не отпустил предыдущий кадр
+const int MaxFrameBuffers = 3;
+
+} // namespace
+
+struct JpegStreamDecoder::Private {
+    // Шаги декодирования; на любом из них libjpeg может приостановиться
+    // до прихода данных, и следующий process() повторит тот же шаг
+    enum Stage {
+        ReadHeader,
+        StartDecompress,
+        ReadRows,           // один скан: строки по мере прихода
+        ConsumeScans,       // несколько сканов: вход поглощается до приостановки
+        StartScanOutput,
+        ReadScanRows,
+        FinishScanOutput,
+        FinishDecompress,
+        Done,
+        Failed
+    };
+
+    struct Source {
+        jpeg_source_mgr pub;
+        Private* owner;
+    };
+
+    jpeg_decompress_struct cinfo;
+    JpegErrorManager error;
+    Source source;
+    // Неразобранные libjpeg байты - всегда хвост buffer длиной bytes_in_buffer
+    QByteArray buffer;
+    // Начало файла до разбора заголовка: из него читается ориентация EXIF
+    QByteArray header;
+    qint64 pendingSkip = 0;
+    bool endOfInput = false;
+    bool truncated = false;
+    bool created = false;
+    Stage stage = ReadHeader;
+    OutputMode outputMode = OutputDirect;
+    bool invertedCmyk = false;
+    JSAMPARRAY rowBuffer = nullptr;
+    struct FrameBuffer {
+        QImage image;
+        int rows = 0;       // верхние строки, совпадающие с декодированными на момент выдачи
+    };
+    QVector<FrameBuffer> buffers;
+    int back = 0;           // буфер, в который пишутся строки
+    bool switchBuffer = false;
+    int emittedRows = 0;
+    int completedScan = 0;
+    bool finalEmitted = false;
+
+    static void initSource(j_decompress_ptr cinfo) { Q_UNUSED(cinfo); }
+    static boolean fillInputBuffer(j_decompress_ptr cinfo);
+    static void skipInputData(j_decompress_ptr cinfo, long count);
+    static void termSource(j_decompress_ptr cinfo) { Q_UNUSED(cinfo); }
+};
+
+// FALSE - приостановка: libjpeg откатывается к последней целой точке и
+// вернёт JPEG_SUSPENDED. После finish() вместо данных - маркер EOI, как
+// делают jpeg_stdio_src и jpeg_mem_src на оборванном файле
+boolean JpegStreamDecoder::Private::fillInputBuffer(j_decompress_ptr cinfo) {
+    Private* d = reinterpret_cast<Source*>(cinfo->src)->owner;
+    if (!d->endOfInput) {
+        return FALSE;
+    }
+    static const JOCTET endOfImage[2] = { 0xFF, JPEG_EOI };
+    d->truncated = true;
+    cinfo->src->next_input_byte = endOfImage;
+    cinfo->src->bytes_in_buffer = sizeof(endOfImage);
+    return TRUE;
+}
+
+// Пропуск дальше пришедших данных (например, длинного APPn) досчитывается в feed()
+void JpegStreamDecoder::Private::skipInputData(j_decompress_ptr cinfo, long count) {
+    if (count <= 0) {
+        return;
+    }
+    Private* d = reinterpret_cast<Source*>(cinfo->src)->owner;
+    jpeg_source_mgr* src = cinfo->src;
+    if (static_cast<size_t>(count) > src->bytes_in_buffer) {
+        d->pendingSkip += static_cast<qint64>(count) - static_cast<qint64>(src->bytes_in_buffer);
+        src->next_input_byte += src->bytes_in_buffer;
+        src->bytes_in_buffer = 0;
+        return;
+    }
+    src->next_input_byte += count;
+    src->bytes_in_buffer -= static_cast<size_t>(count);
+}
+
+JpegStreamDecoder::JpegStreamDecoder()
+    : d(new Private)
+{
+    d->source.owner = d;
+    reset();
+}
+
+JpegStreamDecoder::~JpegStreamDecoder() {
+    if (d->created) {
+        jpeg_destroy_decompress(&d->cinfo);
+    }
+    delete d;
+}
+
+void JpegStreamDecoder::reset() {
+    if (d->created) {
+        jpeg_destroy_decompress(&d->cinfo);
+        d->created = false;
+    }
+    d->buffer.clear();
+    d->header.clear();
+    d->pendingSkip = 0;
+    d->endOfInput = false;
+    d->truncated = false;
+    d->stage = Private::ReadHeader;
+    d->rowBuffer = nullptr;
+    d->buffers.clear();
+    d->back = 0;
+    d->switchBuffer = false;
+    d->emittedRows = 0;
+    d->completedScan = 0;
+    d->finalEmitted = false;
+    transformation = QImageIOHandler::TransformationNone;
+    frames = 0;
+    received = 0;
+    lastError.clear();
+
+    jpeg_decompress_struct* cinfo = &d->cinfo;
+    cinfo->err = d->error.attach();
+    if (setjmp(d->error.jump)) {
+        lastError = QString::fromLatin1(d->error.message);
+        d->stage = Private::Failed;
+        return;
+    }
+    jpeg_create_decompress(cinfo);
+    d->created = true;
+
+    jpeg_source_mgr* src = &d->source.pub;
+    src->init_source = Private::initSource;
+    src->fill_input_buffer = Private::fillInputBuffer;
+    src->skip_input_data = Private::skipInputData;
+    src->resync_to_restart = jpeg_resync_to_restart;
+    src->term_source = Private::termSource;
+    src->next_input_byte = nullptr;
+    src->bytes_in_buffer = 0;
+    cinfo->src = src;
+}
+
+bool JpegStreamDecoder::feed(const QByteArray& chunk) {
+    if (d->stage == Private::Failed) {
+        return false;
+    }
+    if (d->endOfInput) {
+        lastError = "Data after the end of the stream";
+        return false;
+    }
+    TRACE_SCOPE("decode_stream");
+    received += chunk.size();
+    if (autoTransform && d->stage == Private::ReadHeader) {
+        d->header.append(chunk);
+    }
+
+    // Разобранное libjpeg больше не понадобится: при приостановке он сам
+    // откатывает next_input_byte к началу незаконченного сегмента
+    jpeg_source_mgr* src = &d->source.pub;
+    d->buffer.remove(0, d->buffer.size() - static_cast<qsizetype>(src->bytes_in_buffer));
+    const qint64 skipped = qMin<qint64>(d->pendingSkip, chunk.size());
+    d->pendingSkip -= skipped;
+    d->buffer.append(chunk.constData() + skipped, chunk.size() - skipped);
+    src->next_input_byte = reinterpret_cast<const JOCTET*>(d->buffer.constData());
+    src->bytes_in_buffer = static_cast<size_t>(d->buffer.size());
+    return process();
+}
+
+bool JpegStreamDecoder::finish() {
+    if (d->stage == Private::Failed) {
+        return false;
+    }
+    d->endOfInput = true;
+    if (!process()) {
+        return false;
+    }
+    if (d->truncated && lastError.isEmpty()) {
+        lastError = "Premature end of JPEG data";
+    }
+    return d->stage == Private::Done;
+}
+
+bool JpegStreamDecoder::isFinished() const {
+    return d->stage == Private::Done;
+}
+
+bool JpegStreamDecoder::isTruncated() const {
+    return d->truncated;
+}
+
+bool JpegStreamDecoder::isProgressive() const {
+    return d->created && d->stage != Private::ReadHeader && d->cinfo.progressive_mode;
+}
+
+QSize JpegStreamDecoder::size() const {
+    return d->buffers.isEmpty() ? QSize() : d->buffers.first().image.size();
+}
+
+bool JpegStreamDecoder::process() {
+    jpeg_decompress_struct* cinfo = &d->cinfo;
+    if (d->stage == Private::Failed) {
+        return false;
+    }
+    if (setjmp(d->error.jump)) {
+        lastError = QString::fromLatin1(d->error.message);
+        d->stage = Private::Failed;
+        return false;
+    }
+
+    for (;;) {
+        switch (d->stage) {
+        case Private::ReadHeader:
+            if (jpeg_read_header(cinfo, TRUE) == JPEG_SUSPENDED) {
+                return true;
+            }
+            configureOutput();
+            d->stage = Private::StartDecompress;
+            break;
+
+        case Private::StartDecompress:
+            if (!jpeg_start_decompress(cinfo)) {
+                return true;
+            }
+            if (!allocateFrame()) {
+                d->stage = Private::Failed;
+                return false;
+            }
+            d->stage = cinfo->buffered_image ? Private::ConsumeScans : Private::ReadRows;
+            break;
+
+        case Private::ReadRows: {
+            const bool complete = readAvailableRows();
+            const int fresh = static_cast<int>(cinfo->output_scanline) - d->emittedRows;
+            if (complete || fresh >= bandHeight) {
+                emitFrame(complete);
+            }
+            if (!complete) {
+                return true;
+            }
+            d->stage = Private::FinishDecompress;
+            break;
+        }
+
+        case Private::ConsumeScans: {
+            const int result = jpeg_consume_input(cinfo);
+            if (result == JPEG_SCAN_COMPLETED) {
+                d->completedScan = cinfo->input_scan_number;
+                break;
+            }
+            if (result == JPEG_REACHED_SOS || result == JPEG_ROW_COMPLETED) {
+                break;
+            }
+            // Пришедшее разобрано: показывается последний законченный скан
+            if (d->completedScan > cinfo->output_scan_number) {
+                d->stage = Private::StartScanOutput;
+                break;
+            }
+            if (result == JPEG_SUSPENDED) {
+                return true;
+            }
+            // EOI пришёл после того, как последний скан уже показан
+            if (!d->finalEmitted) {
+                emitFrame(true);
+            }
+            d->stage = Private::FinishDecompress;
+            break;
+        }
+
+        case Private::StartScanOutput:
+            if (!jpeg_start_output(cinfo, d->completedScan)) {
+                return true;
+            }
+            d->stage = Private::ReadScanRows;
+            break;
+
+        case Private::ReadScanRows:
+            if (!readAvailableRows()) {
+                return true;
+            }
+            emitFrame(jpeg_input_complete(cinfo) && cinfo->output_scan_number >= cinfo->input_scan_number);
+            d->stage = Private::FinishScanOutput;
+            break;
+
+        case Private::FinishScanOutput:
+            if (!jpeg_finish_output(cinfo)) {
+                return true;
+            }
+            d->stage = Private::ConsumeScans;
+            break;
+
+        case Private::FinishDecompress:
+            if (!jpeg_finish_decompress(cinfo)) {
+                return true;
+            }
+            d->stage = Private::Done;
+            return true;
+
+        case Private::Done:
+            return true;
+
+        case Private::Failed:
+            return false;
+        }
+    }
+}
+
+void JpegStreamDecoder::configureOutput() {
+    jpeg_decompress_struct* cinfo = &d->cinfo;
+    if (autoTransform) {
+        QBuffer buffer(&d->header);
+        buffer.open(QIODevice::ReadOnly);
+        QImageReader reader(&buffer, "jpeg");
+        transformation = reader.transformation();
+    }
+    d->header.clear();
+
+    // Многоскановый файл нельзя выдавать построчно: кадр собирается по сканам
+    cinfo->buffered_image = jpeg_has_multiple_scans(cinfo);
+    cinfo->scale_num = 1;
+    cinfo->scale_denom = chooseScaleDenominator(
+        QSize(static_cast<int>(cinfo->image_width), static_cast<int>(cinfo->image_height)), targetSize,
+        autoTransform && transformation.testFlag(QImageIOHandler::TransformationRotate90));
+
+    if (cinfo->jpeg_color_space == JCS_CMYK || cinfo->jpeg_color_space == JCS_YCCK) {
+        cinfo->out_color_space = JCS_CMYK;
+        d->outputMode = OutputCmyk;
+        d->invertedCmyk = cinfo->saw_Adobe_marker;
+    } else {
+#ifdef JCS_EXTENSIONS
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+        cinfo->out_color_space = JCS_EXT_BGRX;
+#else
+        cinfo->out_color_space = JCS_EXT_XRGB;
+#endif
+        d->outputMode = OutputDirect;
+#else
+        if (cinfo->jpeg_color_space == JCS_GRAYSCALE) {
+            cinfo->out_color_space = JCS_GRAYSCALE;
+            d->outputMode = OutputGray;
+        } else {
+            cinfo->out_color_space = JCS_RGB;
+            d->outputMode = OutputRgb;
+        }
+#endif
+    }
+}
+
+bool JpegStreamDecoder::allocateFrame() {
+    jpeg_decompress_struct* cinfo = &d->cinfo;
+    Private::FrameBuffer buffer;
+    buffer.image = QImage(static_cast<int>(cinfo->output_width), static_cast<int>(cinfo->output_height),
+                          QImage::Format_RGB32);
+    if (buffer.image.isNull()) {
+        lastError = "Out of memory";
+        return false;
+    }
+    buffer.image.fill(PendingRowColor);
+    d->buffers.append(buffer);
+    d->back = 0;
+    if (d->outputMode != OutputDirect) {
+        d->rowBuffer = (*cinfo->mem->alloc_sarray)(reinterpret_cast<j_common_ptr>(cinfo), JPOOL_IMAGE,
+                                                   cinfo->output_width * cinfo->output_components, 1);
+    }
+    return true;
+}
+
+// true - проход вывода закончен; false - libjpeg ждёт данных
+bool JpegStreamDecoder::readAvailableRows() {
+    jpeg_decompress_struct* cinfo = &d->cinfo;
+    const int width = static_cast<int>(cinfo->output_width);
+    while (cinfo->output_scanline < cinfo->output_height) {
+        if (d->switchBuffer) {
+            switchFrame();
+        }
+        uchar* line = d->buffers[d->back].image.scanLine(static_cast<int>(cinfo->output_scanline));
+        if (d->outputMode == OutputDirect) {
+            JSAMPROW row = line;
+            if (jpeg_read_scanlines(cinfo, &row, 1) == 0) {
+                return false;
+            }
+            continue;
+        }
+        if (jpeg_read_scanlines(cinfo, d->rowBuffer, 1) == 0) {
+            return false;
+        }
+        convertRow(d->rowBuffer[0], reinterpret_cast<QRgb*>(line), width, d->outputMode, d->invertedCmyk);
+    }
+    return true;
+}
+
+// Потребитель получает буфер, в который декодер больше не пишет: следующие
+// строки пойдут в другой буфер (switchFrame)
+void JpegStreamDecoder::emitFrame(bool final) {
+    frames++;
+    d->emittedRows = static_cast<int>(d->cinfo.output_scanline);
+    d->finalEmitted = final;
+    d->switchBuffer = !final;
+    TRACE_COUNTER("stream_frames", 1);
+    Private::FrameBuffer& current = d->buffers[d->back];
+    current.rows = d->emittedRows;
+    if (frameConsumer) {
+        frameConsumer(autoTransform ? applyTransformation(current.image, transformation) : current.image, final);
+    }
+}
+
+// Выбирает для следующих строк буфер, которого нет у потребителя. Он догоняет
+// выданный кадр только на строки, пришедшие после его собственной выдачи;
+// многоскановый файл каждый скан переписывает кадр целиком, там догонять
+// нечего. Если все буферы ещё у потребителя, запись идёт в выданный,
+// и QImage копирует его целиком (copy-on-write).
+void JpegStreamDecoder::switchFrame() {
+    d->switchBuffer = false;
+    const int front = d->back;
+    int next = -1;
+    for (int i = 0; i < d->buffers.size(); ++i) {
+        if (i != front && d->buffers[i].image.isDetached()) {
+            next = i;
+            break;
+        }
+    }
+    if (next < 0 && d->buffers.size() < MaxFrameBuffers) {
+        Private::FrameBuffer buffer;
+        buffer.image = QImage(d->buffers[front].image.size(), QImage::Format_RGB32);
+        if (buffer.image.isNull()) {
+            return;
+        }
+        buffer.image.fill(PendingRowColor);
+        d->buffers.append(buffer);
+        next = d->buffers.size() - 1;
+    }
+    if (next < 0) {
+        return;
+    }
+
+    const Private::FrameBuffer& source = d->buffers[front];
+    Private::FrameBuffer& target = d->buffers[next];
+    if (!d->cinfo.buffered_image && target.rows < source.rows) {
+        TRACE_SCOPE("stream_sync_rows");
+        std::memcpy(target.image.scanLine(target.rows), source.image.constScanLine(target.rows),
+                    static_cast<size_t>(source.image.bytesPerLine()) * (source.rows - target.rows));
+        target.rows = source.rows;
+    }
+    d->back = next;
+}
@@ -0,0 +1,79 @@
+#ifndef JPEGSTREAMDECODER_H
+#define JPEGSTREAMDECODER_H
+
+#include <QtGui/QImage>
+#include <QtGui/QImageIOHandler>
+#include <QtCore/QByteArray>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+#include <functional>
+
+// Декодирование JPEG по мере поступления данных. Источник libjpeg работает
+// с приостановкой: когда пришедшие байты кончились, libjpeg возвращает
+// JPEG_SUSPENDED и продолжает с того же места после следующего feed().
+// Прогрессивный (многоскановый) файл выдаёт кадр после каждого дошедшего
+// до конца скана, последовательный - после каждой полосы строк MCU
+// высотой не меньше bandHeight. Если за один feed() пришло несколько
+// сканов, показывается только последний из них.
+class JpegStreamDecoder {
+public:
+    static const int DefaultBandHeight = 64;
+
+    // Кадр - изображение целиком, ещё не пришедшие строки залиты фоном;
+    // final - кадр окончательный. Вызывается из потока, который вызвал feed().
+    // Пока потребитель держит кадр, декодер в него не пишет: следующие строки
+    // идут в другой из нескольких буферов, так что кадр на полосу стоит
+    // копии последних полос, а не всего изображения
+    typedef std::function<void(const QImage& frame, bool final)> FrameConsumer;
+
+    JpegStreamDecoder();
+    ~JpegStreamDecoder();
+
+    JpegStreamDecoder(const JpegStreamDecoder&) = delete;
+    JpegStreamDecoder& operator=(const JpegStreamDecoder&) = delete;
+
+    void setAutoTransform(bool enabled) { autoTransform = enabled; }
+    // Как у JpegDecoder: наименьший масштаб DCT, не меньше вписанного в size
+    void setTargetSize(const QSize& size) { targetSize = size; }
+    void setBandHeight(int rows) { bandHeight = qMax(1, rows); }
+    void setFrameConsumer(const FrameConsumer& consumer) { frameConsumer = consumer; }
+
+    // false - ошибка в данных; дальнейшие вызовы ничего не делают
+    bool feed(const QByteArray& chunk);
+    // Данных больше не будет. Оборванный файл дочитывается так же, как это
+    // делает libjpeg для файлов: недостающее заменяется маркером EOI
+    bool finish();
+    void reset();
+
+    bool isFinished() const;
+    bool isTruncated() const;
+    bool isProgressive() const;
+    QSize size() const;
+    int framesEmitted() const { return frames; }
+    qint64 bytesReceived() const { return received; }
+
+    QString errorString() const { return lastError; }
+
+private:
+    struct Private;
+    Private* d;
+
+    bool autoTransform = false;
+    QSize targetSize;
+    int bandHeight = DefaultBandHeight;
+    FrameConsumer frameConsumer;
+    QImageIOHandler::Transformations transformation = QImageIOHandler::TransformationNone;
+    int frames = 0;
+    qint64 received = 0;
+    QString lastError;
+
+    bool process();
+    void configureOutput();
+    bool allocateFrame();
+    bool readAvailableRows();
+    void emitFrame(bool final);
+    void switchFrame();
+};
+
+#endif // JPEGSTREAMDECODER_H
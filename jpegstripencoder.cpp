@@ -0,0 +1,270 @@
+#include "jpegstripencoder.h"
+#include "jpegcommon.h"
+#include "jpegindex.h"
+#include "jpegstrategy.h"
+#include "tracing.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QMutex>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <atomic>
+#include <cstring>
+
+namespace {
+
+// Полоса не тоньше стольких строк MCU: на стыке теряется пара байт
+// маркера и дополнение последнего байта
+const int MinMcuRowsPerStrip = 16;
+// Полос больше, чем потоков: неравномерно сжимаемые полосы выравниваются
+const int StripsPerThread = 2;
+
+// Общий для всех JpegStripEncoder: кодировщик создаётся на каждый вызов,
+// а потоки пула переживают его. Не глобальный пул, чтобы полосы не
+// вставали в очередь за чужими задачами QtConcurrent
+Q_GLOBAL_STATIC(QThreadPool, stripPool)
+
+struct Strip {
+    int firstRow = 0;       // в пикселях, кратно высоте MCU
+    int rows = 0;
+    QByteArray output;      // отдельный JPEG полосы
+};
+
+struct StripJob {
+    const QImage* image = nullptr;
+    JpegEncodeOptions options;
+    LoadMonitor* monitor = nullptr;
+    QVector<Strip>* strips = nullptr;
+    int stripCount = 0;
+    std::atomic_int nextStrip{0};
+    std::atomic_int finishedStrips{0};
+    std::atomic_bool failed{false};
+    QMutex errorMutex;
+    QString error;
+
+    void fail(const QString& message) {
+        QMutexLocker locker(&errorMutex);
+        if (!failed.exchange(true)) {
+            error = message;
+        }
+    }
+};
+
+int mcuHeight(const QImage& image, const JpegEncodeOptions& options) {
+    return image.format() != QImage::Format_Grayscale8 && options.subsampling == JpegEncodeOptions::Subsampling420
+        ? 16 : 8;
+}
+
+// Стык полос - всегда маркер RSTn, поэтому без интервала рестарта
+// полосы получают его на каждой строке MCU
+int restartInterval(const JpegEncodeOptions& options) {
+    return qMax(1, options.restartRows);
+}
+
+// Полоса - целое число интервалов рестарта, не меньше MinMcuRowsPerStrip строк MCU
+int minMcuRowsPerStrip(const JpegEncodeOptions& options) {
+    const int interval = restartInterval(options);
+    return (MinMcuRowsPerStrip + interval - 1) / interval * interval;
+}
+
+// Настройки те же, что у JpegEncoder (setupCompressor), кроме высоты
+void encodeStrip(StripJob& job, Strip& strip) {
+    if (job.failed.load()) {
+        return;
+    }
+    if (job.monitor && job.monitor->isCancelled()) {
+        job.fail("Cancelled");
+        return;
+    }
+
+    const QImage& image = *job.image;
+    jpeg_compress_struct cinfo;
+    JpegErrorManager error;
+    ByteArrayDestination destination;
+    // Объявлен до setjmp, чтобы longjmp не пропустил деструктор
+    QVector<JSAMPLE> rowBuffer;
+    cinfo.err = error.attach();
+    if (setjmp(error.jump)) {
+        jpeg_destroy_compress(&cinfo);
+        job.fail(QString::fromLatin1(error.message));
+        return;
+    }
+    jpeg_create_compress(&cinfo);
+
+    cinfo.dest = destination.attach(
+        &strip.output, qMax<qsizetype>(16 * 1024, static_cast<qsizetype>(image.width()) * strip.rows / 8));
+    if (!setupCompressor(cinfo, job.options, image, strip.rows)) {
+        rowBuffer.resize(image.width() * 3);
+    }
+
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const int y = strip.firstRow + static_cast<int>(cinfo.next_scanline);
+        JSAMPROW row = compressorRow(image, y, rowBuffer.isEmpty() ? nullptr : rowBuffer.data());
+        jpeg_write_scanlines(&cinfo, &row, 1);
+        if ((y & 63) == 0 && job.monitor && job.monitor->isCancelled()) {
+            jpeg_destroy_compress(&cinfo);
+            job.fail("Cancelled");
+            return;
+        }
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    const int finished = ++job.finishedStrips;
+    if (job.monitor) {
+        job.monitor->progress(finished * 100 / job.stripCount);
+    }
+}
+
+// Исполнитель одного encode(): берёт полосы по очереди, пока они есть
+void encodeStrips(StripJob& job) {
+    for (int s = job.nextStrip++; s < job.stripCount; s = job.nextStrip++) {
+        encodeStrip(job, (*job.strips)[s]);
+    }
+}
+
+// Начало энтропийных данных: сразу за сегментом SOS
+bool entropyStart(const QByteArray& jpeg, JpegFileIndex& index, qint64& start) {
+    const uchar* data = reinterpret_cast<const uchar*>(jpeg.constData());
+    if (!index.build(data, jpeg.size(), true) || index.scanOffsets.isEmpty()) {
+        return false;
+    }
+    const qint64 sos = index.scanOffsets.first();
+    if (sos + 4 > jpeg.size()) {
+        return false;
+    }
+    start = sos + 2 + ((data[sos + 2] << 8) | data[sos + 3]);
+    return start <= jpeg.size() - 2;
+}
+
+// Энтропийные данные полосы с перенумерованными RSTn; restarts - сколько
+// маркеров уже записано
+void appendEntropy(QByteArray& output, const QByteArray& strip, qint64 start, int& restarts) {
+    const qsizetype from = output.size();
+    const qint64 end = strip.size() - 2;    // без EOI
+    output.append(strip.constData() + start, static_cast<qsizetype>(end - start));
+
+    uchar* data = reinterpret_cast<uchar*>(output.data());
+    qsizetype pos = from;
+    const qsizetype size = output.size();
+    while (pos + 1 < size) {
+        const void* found = std::memchr(data + pos, 0xFF, static_cast<size_t>(size - pos - 1));
+        if (!found) {
+            break;
+        }
+        pos = static_cast<const uchar*>(found) - data;
+        if (data[pos + 1] >= 0xD0 && data[pos + 1] <= 0xD7) {
+            data[pos + 1] = static_cast<uchar>(0xD0 + (restarts++ & 7));
+        }
+        pos += 2;
+    }
+}
+
+} // namespace
+
+bool JpegStripEncoder::canEncode(const QImage& image, const JpegEncodeOptions& options) {
+    const QImage::Format format = image.format();
+    return !options.progressive && !options.optimizeHuffman &&
+           (format == QImage::Format_RGB32 || format == QImage::Format_ARGB32 ||
+            format == QImage::Format_Grayscale8) &&
+           static_cast<qint64>(image.width()) * image.height() >= MinPixels &&
+           image.height() >= 2 * minMcuRowsPerStrip(options) * mcuHeight(image, options);
+}
+
+bool JpegStripEncoder::encode(const QImage& image, QByteArray& output) {
+    strips = 0;
+    lastError.clear();
+    output.clear();
+    if (!canEncode(image, options)) {
+        lastError = "Image cannot be encoded in strips with these options";
+        return false;
+    }
+
+    const int threads = threadCount > 0 ? threadCount : QThread::idealThreadCount();
+    const int rowHeight = mcuHeight(image, options);
+    // Границы полос совпадают с границами интервалов рестарта: маркер на
+    // стыке продолжает разметку, заданную options.restartRows
+    const int interval = restartInterval(options);
+    const int mcuRows = (image.height() + rowHeight - 1) / rowHeight;
+    const int intervals = (mcuRows + interval - 1) / interval;
+    const int count = qBound(1, mcuRows / minMcuRowsPerStrip(options), threads * StripsPerThread);
+    QVector<Strip> stripList(count);
+    for (int s = 0; s < count; ++s) {
+        const int firstMcuRow = intervals * s / count * interval;
+        const int endMcuRow = intervals * (s + 1) / count * interval;
+        stripList[s].firstRow = firstMcuRow * rowHeight;
+        stripList[s].rows = qMin(image.height(), endMcuRow * rowHeight) - stripList[s].firstRow;
+    }
+
+    StripJob job;
+    job.image = &image;
+    job.options = options;
+    job.options.restartRows = interval;
+    job.monitor = loadMonitor;
+    job.strips = &stripList;
+    job.stripCount = count;
+    {
+        TRACE_SCOPE("encode_strips");
+        // Вызывающий поток - один из исполнителей
+        const int workers = qMin(threads, count);
+        if (stripPool()->maxThreadCount() < workers - 1) {
+            stripPool()->setMaxThreadCount(workers - 1);
+        }
+        QVector<QFuture<void>> futures;
+        for (int i = 1; i < workers; ++i) {
+            futures.append(QtConcurrent::run(stripPool(), [&job] { encodeStrips(job); }));
+        }
+        encodeStrips(job);
+        for (QFuture<void>& future : futures) {
+            future.waitForFinished();
+        }
+    }
+    if (job.failed.load()) {
+        lastError = job.error;
+        return false;
+    }
+
+    TRACE_SCOPE("join_strips");
+    JpegFileIndex index;
+    qint64 start = 0;
+    if (!entropyStart(stripList.first().output, index, start)) {
+        lastError = "Malformed strip";
+        return false;
+    }
+    qsizetype total = 2;
+    for (const Strip& strip : stripList) {
+        total += strip.output.size() + 2;
+    }
+    output.reserve(total);
+
+    // Заголовок первой полосы с высотой всего изображения
+    output.append(stripList.first().output.constData(), static_cast<qsizetype>(start));
+    uchar* header = reinterpret_cast<uchar*>(output.data());
+    header[index.sofOffset + 5] = static_cast<uchar>(image.height() >> 8);
+    header[index.sofOffset + 6] = static_cast<uchar>(image.height() & 0xFF);
+
+    int restarts = 0;
+    for (int s = 0; s < count; ++s) {
+        if (s > 0) {
+            JpegFileIndex stripIndex;
+            if (!entropyStart(stripList[s].output, stripIndex, start)) {
+                lastError = "Malformed strip";
+                output.clear();
+                return false;
+            }
+            output.append(char(0xFF));
+            output.append(static_cast<char>(0xD0 + (restarts++ & 7)));
+        }
+        appendEntropy(output, stripList[s].output, start, restarts);
+        // Полосы больше не нужны: память освобождается по ходу склейки
+        stripList[s].output = QByteArray();
+    }
+    output.append(char(0xFF));
+    output.append(char(0xD9));
+
+    strips = count;
+    TRACE_COUNTER("encode_strips", strips);
+    return true;
+}
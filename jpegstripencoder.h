@@ -0,0 +1,52 @@
+#ifndef JPEGSTRIPENCODER_H
+#define JPEGSTRIPENCODER_H
+
+#include "jpegencoder.h"
+#include <QtGui/QImage>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+
+class LoadMonitor;
+
+// Параллельное кодирование большого изображения полосами из целых строк
+// MCU. Каждая полоса - отдельный проход libjpeg в своём потоке (перевод
+// цвета, DCT, квантование, Хаффман) с интервалом рестарта restartRows
+// (без него - на каждой строке MCU), полосы режутся по границам интервалов.
+// Полосы склеиваются в один последовательный JPEG: заголовок первой
+// полосы с полной высотой в SOF, энтропийные данные всех полос подряд
+// с маркерами RSTn на стыках и сквозной нумерацией. Прореживание цветности
+// не выходит за MCU, а рестарт меняет только кодирование DC, поэтому
+// любой декодер получает те же пиксели, что и из файла, закодированного
+// целиком. Обратная операция - JpegRestartDecoder.
+class JpegStripEncoder {
+public:
+    // Меньшие изображения быстрее закодировать целиком в одном потоке
+    static const qint64 MinPixels = 2 * 1024 * 1024;
+
+    // Последовательный режим со стандартными таблицами Хаффмана: таблицы
+    // оптимизируются по всему изображению, а прогрессивные сканы не режутся
+    // по строкам
+    static bool canEncode(const QImage& image, const JpegEncodeOptions& options);
+
+    explicit JpegStripEncoder(const JpegEncodeOptions& options = JpegEncodeOptions()) : options(options) {}
+
+    // 0 - QThread::idealThreadCount(); потоки берутся из общего пула полос
+    void setThreadCount(int count) { threadCount = qMax(0, count); }
+    void setLoadMonitor(LoadMonitor* monitor) { loadMonitor = monitor; }
+
+    // image - Format_RGB32, Format_ARGB32 или Format_Grayscale8
+    bool encode(const QImage& image, QByteArray& output);
+
+    int stripCount() const { return strips; }
+    QString errorString() const { return lastError; }
+
+private:
+    JpegEncodeOptions options;
+    LoadMonitor* loadMonitor = nullptr;
+    int threadCount = 0;
+    int strips = 0;
+    QString lastError;
+};
+
+#endif // JPEGSTRIPENCODER_H
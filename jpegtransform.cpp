@@ -0,0 +1,426 @@
+#include "jpegtransform.h"
+#include "jpegcommon.h"
+#include "tracing.h"
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QSaveFile>
+#include <QtCore/QtGlobal>
+#include <cstring>
+
+namespace {
+
+// Любое из восьми преобразований - транспонирование (или нет), затем
+// отражения по горизонтали и по вертикали в координатах результата
+struct Geometry {
+    bool transpose = false;
+    bool flipHorizontal = false;
+    bool flipVertical = false;
+};
+
+Geometry geometryOf(int transform) {
+    Geometry g;
+    switch (transform) {
+    case JpegTransformOptions::FlipHorizontal:
+        g.flipHorizontal = true;
+        break;
+    case JpegTransformOptions::FlipVertical:
+        g.flipVertical = true;
+        break;
+    case JpegTransformOptions::Transpose:
+        g.transpose = true;
+        break;
+    case JpegTransformOptions::Transverse:
+        g.transpose = g.flipHorizontal = g.flipVertical = true;
+        break;
+    case JpegTransformOptions::Rotate90:
+        g.transpose = g.flipHorizontal = true;
+        break;
+    case JpegTransformOptions::Rotate180:
+        g.flipHorizontal = g.flipVertical = true;
+        break;
+    case JpegTransformOptions::Rotate270:
+        g.transpose = g.flipVertical = true;
+        break;
+    default:
+        break;
+    }
+    return g;
+}
+
+int transformOf(const Geometry& g) {
+    for (int transform = JpegTransformOptions::None; transform <= JpegTransformOptions::Rotate270; ++transform) {
+        const Geometry candidate = geometryOf(transform);
+        if (candidate.transpose == g.transpose && candidate.flipHorizontal == g.flipHorizontal &&
+            candidate.flipVertical == g.flipVertical) {
+            return transform;
+        }
+    }
+    return JpegTransformOptions::None;
+}
+
+// Матрица 2x2 со знаками, действующая на координаты относительно центра
+struct Matrix {
+    int m[2][2];
+};
+
+Matrix matrixOf(const Geometry& g) {
+    Matrix result = {{{g.transpose ? 0 : 1, g.transpose ? 1 : 0}, {g.transpose ? 1 : 0, g.transpose ? 0 : 1}}};
+    if (g.flipHorizontal) {
+        result.m[0][0] = -result.m[0][0];
+        result.m[0][1] = -result.m[0][1];
+    }
+    if (g.flipVertical) {
+        result.m[1][0] = -result.m[1][0];
+        result.m[1][1] = -result.m[1][1];
+    }
+    return result;
+}
+
+Geometry geometryOf(const Matrix& matrix) {
+    Geometry g;
+    g.transpose = matrix.m[0][0] == 0;
+    g.flipHorizontal = (g.transpose ? matrix.m[0][1] : matrix.m[0][0]) < 0;
+    g.flipVertical = (g.transpose ? matrix.m[1][0] : matrix.m[1][1]) < 0;
+    return g;
+}
+
+inline unsigned int readExif16(const JOCTET* p, bool bigEndian) {
+    return bigEndian ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+}
+
+inline quint32 readExif32(const JOCTET* p, bool bigEndian) {
+    return bigEndian ? (quint32(p[0]) << 24) | (quint32(p[1]) << 16) | (quint32(p[2]) << 8) | p[3]
+                     : (quint32(p[3]) << 24) | (quint32(p[2]) << 16) | (quint32(p[1]) << 8) | p[0];
+}
+
+// Тег Orientation (0x0112) в IFD0 сегмента APP1 "Exif"; value - место
+// значения внутри marker->data, чтобы его можно было переписать
+int exifOrientation(jpeg_saved_marker_ptr markers, JOCTET** value, bool* bigEndian) {
+    for (jpeg_saved_marker_ptr marker = markers; marker; marker = marker->next) {
+        if (marker->marker != JPEG_APP0 + 1 || marker->data_length < 14 ||
+            std::memcmp(marker->data, "Exif\0\0", 6) != 0) {
+            continue;
+        }
+        JOCTET* tiff = marker->data + 6;
+        const quint32 size = marker->data_length - 6;
+        if (tiff[0] != tiff[1] || (tiff[0] != 'M' && tiff[0] != 'I')) {
+            return 1;
+        }
+        *bigEndian = tiff[0] == 'M';
+        const quint32 ifd = readExif32(tiff + 4, *bigEndian);
+        if (ifd > size - 2) {
+            return 1;
+        }
+        const unsigned int count = readExif16(tiff + ifd, *bigEndian);
+        for (unsigned int i = 0; i < count; ++i) {
+            const quint32 entry = ifd + 2 + i * 12;
+            if (entry + 12 > size) {
+                break;
+            }
+            if (readExif16(tiff + entry, *bigEndian) == 0x0112 && readExif16(tiff + entry + 2, *bigEndian) == 3) {
+                *value = tiff + entry + 8;
+                const int orientation = static_cast<int>(readExif16(*value, *bigEndian));
+                return orientation >= 1 && orientation <= 8 ? orientation : 1;
+            }
+        }
+        return 1;
+    }
+    return 1;
+}
+
+// Перестановка коэффициентов блока: транспонирование меняет местами
+// частоты, отражение меняет знак нечётных частот по своей оси
+void transformBlock(const JCOEF* in, JCOEF* out, const Geometry& g) {
+    for (int v = 0; v < DCTSIZE; ++v) {
+        for (int u = 0; u < DCTSIZE; ++u) {
+            JCOEF coefficient = g.transpose ? in[u * DCTSIZE + v] : in[v * DCTSIZE + u];
+            if ((g.flipHorizontal && (u & 1)) != (g.flipVertical && (v & 1))) {
+                coefficient = static_cast<JCOEF>(-coefficient);
+            }
+            out[v * DCTSIZE + u] = coefficient;
+        }
+    }
+}
+
+inline int roundUp(int value, int multiple) {
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+inline double elapsedMs(const QElapsedTimer& timer) {
+    return timer.nsecsElapsed() / 1e6;
+}
+
+} // namespace
+
+int JpegTransformer::transformForOrientation(int orientation) {
+    switch (orientation) {
+    case 2:
+        return JpegTransformOptions::FlipHorizontal;
+    case 3:
+        return JpegTransformOptions::Rotate180;
+    case 4:
+        return JpegTransformOptions::FlipVertical;
+    case 5:
+        return JpegTransformOptions::Transpose;
+    case 6:
+        return JpegTransformOptions::Rotate90;
+    case 7:
+        return JpegTransformOptions::Transverse;
+    case 8:
+        return JpegTransformOptions::Rotate270;
+    default:
+        return JpegTransformOptions::None;
+    }
+}
+
+int JpegTransformer::combine(int first, int second) {
+    const Matrix a = matrixOf(geometryOf(first));
+    const Matrix b = matrixOf(geometryOf(second));
+    Matrix product;
+    for (int i = 0; i < 2; ++i) {
+        for (int j = 0; j < 2; ++j) {
+            product.m[i][j] = b.m[i][0] * a.m[0][j] + b.m[i][1] * a.m[1][j];
+        }
+    }
+    return transformOf(geometryOf(product));
+}
+
+bool JpegTransformer::transform(const QByteArray& input, QByteArray& output) {
+    TRACE_SCOPE("lossless_transform");
+    lastStats = JpegTransformStats();
+    lastError.clear();
+    output.clear();
+
+    // Нулевые структуры можно безопасно уничтожать, даже если они не созданы
+    jpeg_decompress_struct src;
+    jpeg_compress_struct dst;
+    std::memset(&src, 0, sizeof(src));
+    std::memset(&dst, 0, sizeof(dst));
+    JpegErrorManager errorManager;
+    ByteArrayDestination destination;
+    src.err = errorManager.attach();
+    dst.err = &errorManager.pub;
+
+    if (setjmp(errorManager.jump)) {
+        lastError = QString::fromLatin1(errorManager.message);
+        jpeg_destroy_compress(&dst);
+        jpeg_destroy_decompress(&src);
+        output.clear();
+        return false;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    jpeg_create_decompress(&src);
+    jpeg_mem_src(&src, reinterpret_cast<const unsigned char*>(input.constData()),
+                 static_cast<unsigned long>(input.size()));
+    if (options.copyMetadata || options.normalizeOrientation) {
+        jpeg_save_markers(&src, JPEG_COM, 0xFFFF);
+        for (int m = 0; m < 16; ++m) {
+            jpeg_save_markers(&src, JPEG_APP0 + m, 0xFFFF);
+        }
+    }
+    jpeg_read_header(&src, TRUE);
+
+    int transform = options.transform;
+    JOCTET* orientationValue = nullptr;
+    bool bigEndian = false;
+    if (options.normalizeOrientation) {
+        const int orientation = exifOrientation(src.marker_list, &orientationValue, &bigEndian);
+        transform = combine(transformForOrientation(orientation), transform);
+    }
+    const Geometry g = geometryOf(transform);
+
+    // Отражаемая ось источника обрезается до целых iMCU
+    const int mcuWidth = src.max_h_samp_factor * DCTSIZE;
+    const int mcuHeight = src.max_v_samp_factor * DCTSIZE;
+    const bool reverseX = g.transpose ? g.flipVertical : g.flipHorizontal;
+    const bool reverseY = g.transpose ? g.flipHorizontal : g.flipVertical;
+    int usedWidth = static_cast<int>(src.image_width);
+    int usedHeight = static_cast<int>(src.image_height);
+    if (reverseX) {
+        usedWidth = usedWidth / mcuWidth * mcuWidth;
+    }
+    if (reverseY) {
+        usedHeight = usedHeight / mcuHeight * mcuHeight;
+    }
+    if (usedWidth == 0 || usedHeight == 0) {
+        lastError = "Image is smaller than one MCU and cannot be flipped";
+        jpeg_destroy_decompress(&src);
+        return false;
+    }
+    lastStats.trimmed = usedWidth != static_cast<int>(src.image_width) ||
+                        usedHeight != static_cast<int>(src.image_height);
+
+    // Размеры и iMCU результата до обрезки
+    const int rotatedWidth = g.transpose ? usedHeight : usedWidth;
+    const int rotatedHeight = g.transpose ? usedWidth : usedHeight;
+    const int outMaxH = g.transpose ? src.max_v_samp_factor : src.max_h_samp_factor;
+    const int outMaxV = g.transpose ? src.max_h_samp_factor : src.max_v_samp_factor;
+    const int outMcuWidth = outMaxH * DCTSIZE;
+    const int outMcuHeight = outMaxV * DCTSIZE;
+
+    QRect area(0, 0, rotatedWidth, rotatedHeight);
+    if (!options.crop.isEmpty()) {
+        const int left = qMax(0, options.crop.x()) / outMcuWidth * outMcuWidth;
+        const int top = qMax(0, options.crop.y()) / outMcuHeight * outMcuHeight;
+        const int right = qMin(rotatedWidth, options.crop.x() + options.crop.width());
+        const int bottom = qMin(rotatedHeight, options.crop.y() + options.crop.height());
+        if (right <= left || bottom <= top) {
+            lastError = "Crop rectangle is outside the image";
+            jpeg_destroy_decompress(&src);
+            return false;
+        }
+        area = QRect(left, top, right - left, bottom - top);
+    }
+
+    // Массивы результата выделяются в пуле источника до чтения коэффициентов,
+    // как это делает jpegtran
+    const int componentCount = src.num_components;
+    jvirt_barray_ptr* dstArrays = static_cast<jvirt_barray_ptr*>(
+        (*src.mem->alloc_small)(reinterpret_cast<j_common_ptr>(&src), JPOOL_IMAGE,
+                                sizeof(jvirt_barray_ptr) * componentCount));
+    for (int c = 0; c < componentCount; ++c) {
+        const jpeg_component_info* component = src.comp_info + c;
+        const int h = g.transpose ? component->v_samp_factor : component->h_samp_factor;
+        const int v = g.transpose ? component->h_samp_factor : component->v_samp_factor;
+        const int widthInBlocks = (area.width() * h + outMaxH * DCTSIZE - 1) / (outMaxH * DCTSIZE);
+        const int heightInBlocks = (area.height() * v + outMaxV * DCTSIZE - 1) / (outMaxV * DCTSIZE);
+        dstArrays[c] = (*src.mem->request_virt_barray)(reinterpret_cast<j_common_ptr>(&src), JPOOL_IMAGE, FALSE,
+                                                       static_cast<JDIMENSION>(roundUp(widthInBlocks, h)),
+                                                       static_cast<JDIMENSION>(roundUp(heightInBlocks, v)),
+                                                       static_cast<JDIMENSION>(v));
+    }
+
+    jvirt_barray_ptr* srcArrays = jpeg_read_coefficients(&src);
+    lastStats.readMs = elapsedMs(timer);
+    timer.restart();
+
+    JBLOCK emptyBlock;
+    std::memset(emptyBlock, 0, sizeof(emptyBlock));
+    for (int c = 0; c < componentCount; ++c) {
+        const jpeg_component_info* component = src.comp_info + c;
+        const int h = g.transpose ? component->v_samp_factor : component->h_samp_factor;
+        const int v = g.transpose ? component->h_samp_factor : component->v_samp_factor;
+        // Блоки источника, участвующие в результате: на отражаемой оси -
+        // только целые iMCU, на остальной - вместе с дополнением до iMCU
+        const int srcBlocksX = reverseX ? usedWidth / mcuWidth * component->h_samp_factor
+                                        : roundUp(static_cast<int>(component->width_in_blocks), component->h_samp_factor);
+        const int srcBlocksY = reverseY ? usedHeight / mcuHeight * component->v_samp_factor
+                                        : roundUp(static_cast<int>(component->height_in_blocks), component->v_samp_factor);
+        const int rotatedBlocksX = g.transpose ? srcBlocksY : srcBlocksX;
+        const int rotatedBlocksY = g.transpose ? srcBlocksX : srcBlocksY;
+        const int offsetX = area.x() * h / outMcuWidth;
+        const int offsetY = area.y() * v / outMcuHeight;
+        const int widthInBlocks = roundUp((area.width() * h + outMcuWidth - 1) / outMcuWidth, h);
+        const int heightInBlocks = roundUp((area.height() * v + outMcuHeight - 1) / outMcuHeight, v);
+
+        for (int by = 0; by < heightInBlocks; ++by) {
+            JBLOCKROW outRow = (*src.mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&src), dstArrays[c],
+                                                               static_cast<JDIMENSION>(by), 1, TRUE)[0];
+            for (int bx = 0; bx < widthInBlocks; ++bx) {
+                int x = bx + offsetX;
+                int y = by + offsetY;
+                // За краем изображения - дополнение до iMCU, его не видно
+                if (x >= rotatedBlocksX || y >= rotatedBlocksY) {
+                    std::memcpy(outRow[bx], emptyBlock, sizeof(JBLOCK));
+                    continue;
+                }
+                if (g.flipHorizontal) {
+                    x = rotatedBlocksX - 1 - x;
+                }
+                if (g.flipVertical) {
+                    y = rotatedBlocksY - 1 - y;
+                }
+                const int sourceX = g.transpose ? y : x;
+                const int sourceY = g.transpose ? x : y;
+                JBLOCKROW inRow = (*src.mem->access_virt_barray)(reinterpret_cast<j_common_ptr>(&src), srcArrays[c],
+                                                                  static_cast<JDIMENSION>(sourceY), 1, FALSE)[0];
+                transformBlock(inRow[sourceX], outRow[bx], g);
+            }
+        }
+    }
+    lastStats.transformMs = elapsedMs(timer);
+    timer.restart();
+
+    jpeg_create_compress(&dst);
+    dst.dest = destination.attach(&output, qMax<qsizetype>(64 * 1024, input.size()));
+
+    jpeg_copy_critical_parameters(&src, &dst);
+    dst.image_width = static_cast<JDIMENSION>(area.width());
+    dst.image_height = static_cast<JDIMENSION>(area.height());
+    if (g.transpose) {
+        for (int c = 0; c < componentCount; ++c) {
+            jpeg_component_info* component = dst.comp_info + c;
+            qSwap(component->h_samp_factor, component->v_samp_factor);
+        }
+        // Коэффициенты транспонированы - таблицы квантования тоже
+        for (int t = 0; t < NUM_QUANT_TBLS; ++t) {
+            JQUANT_TBL* table = dst.quant_tbl_ptrs[t];
+            if (!table) {
+                continue;
+            }
+            for (int i = 0; i < DCTSIZE; ++i) {
+                for (int j = i + 1; j < DCTSIZE; ++j) {
+                    qSwap(table->quantval[i * DCTSIZE + j], table->quantval[j * DCTSIZE + i]);
+                }
+            }
+        }
+    }
+    // Интервал рестарта сохраняется в строках MCU: после поворота строка другая
+    if (src.restart_interval > 0) {
+        const int mcusPerRow = (static_cast<int>(src.image_width) + mcuWidth - 1) / mcuWidth;
+        dst.restart_in_rows = qMax(1, static_cast<int>(src.restart_interval) / mcusPerRow);
+    }
+    if (options.mode == JpegTransformOptions::Progressive ||
+        (options.mode == JpegTransformOptions::KeepMode && src.progressive_mode)) {
+        jpeg_simple_progression(&dst);
+    }
+    dst.optimize_coding = options.optimizeHuffman ? TRUE : FALSE;
+
+    jpeg_write_coefficients(&dst, dstArrays);
+
+    // JFIF и Adobe libjpeg пишет сам, остальные сегменты копируются как есть
+    if (options.copyMetadata) {
+        for (jpeg_saved_marker_ptr marker = src.marker_list; marker; marker = marker->next) {
+            if (dst.write_JFIF_header && marker->marker == JPEG_APP0 && marker->data_length >= 5 &&
+                std::memcmp(marker->data, "JFIF", 5) == 0) {
+                continue;
+            }
+            if (dst.write_Adobe_marker && marker->marker == JPEG_APP0 + 14 && marker->data_length >= 5 &&
+                std::memcmp(marker->data, "Adobe", 5) == 0) {
+                continue;
+            }
+            if (orientationValue && orientationValue >= marker->data &&
+                orientationValue < marker->data + marker->data_length) {
+                orientationValue[0] = bigEndian ? 0 : 1;
+                orientationValue[1] = bigEndian ? 1 : 0;
+            }
+            jpeg_write_marker(&dst, marker->marker, marker->data, marker->data_length);
+        }
+    }
+
+    jpeg_finish_compress(&dst);
+    jpeg_destroy_compress(&dst);
+    jpeg_finish_decompress(&src);
+    jpeg_destroy_decompress(&src);
+
+    lastStats.encodeMs = elapsedMs(timer);
+    lastStats.outputSize = area.size();
+    lastStats.outputBytes = output.size();
+    TRACE_COUNTER("bytes_written", lastStats.outputBytes);
+    return true;
+}
+
+bool JpegTransformer::transformToFile(const QByteArray& input, const QString& filename) {
+    QByteArray output;
+    if (!transform(input, output)) {
+        return false;
+    }
+
+    QSaveFile file(filename);
+    if (!file.open(QIODevice::WriteOnly) || file.write(output) != output.size() || !file.commit()) {
+        lastError = file.errorString();
+        return false;
+    }
+    return true;
+}
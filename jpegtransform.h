@@ -0,0 +1,79 @@
+#ifndef JPEGTRANSFORM_H
+#define JPEGTRANSFORM_H
+
+#include <QtCore/QByteArray>
+#include <QtCore/QRect>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+
+struct JpegTransformOptions {
+    // Значения совпадают с порядком jpegtran: -flip, -transpose, -rotate
+    enum Transform {
+        None,
+        FlipHorizontal,
+        FlipVertical,
+        Transpose,      // отражение относительно главной диагонали
+        Transverse,     // отражение относительно побочной диагонали
+        Rotate90,       // по часовой стрелке
+        Rotate180,
+        Rotate270
+    };
+
+    enum Mode {
+        KeepMode,       // как у исходного файла
+        Progressive,
+        Baseline
+    };
+
+    int transform = None;
+    // Сначала поворот по тегу EXIF Orientation (тег затем сбрасывается в 1),
+    // потом transform
+    bool normalizeOrientation = false;
+    // В координатах результата; левый верхний угол сдвигается вниз до
+    // границы iMCU, размер растёт на тот же сдвиг. Пустой - без обрезки
+    QRect crop;
+    int mode = KeepMode;
+    bool optimizeHuffman = false;
+    bool copyMetadata = true;       // сегменты APPn и COM
+};
+
+struct JpegTransformStats {
+    QSize outputSize;
+    qint64 outputBytes = 0;
+    double readMs = 0.0;        // энтропийное декодирование в коэффициенты
+    double transformMs = 0.0;
+    double encodeMs = 0.0;      // энтропийное кодирование и маркеры
+    bool trimmed = false;       // отброшены неполные iMCU на краю
+};
+
+// Преобразования без потерь в области коэффициентов DCT, как у jpegtran:
+// блоки 8x8 переставляются, транспонируются и меняют знак нечётных
+// частот, пиксели не декодируются и не квантуются заново. Неполные iMCU
+// у правого и нижнего края, которые после отражения оказались бы внутри
+// изображения, отбрасываются (jpegtran -trim).
+class JpegTransformer {
+public:
+    explicit JpegTransformer(const JpegTransformOptions& options = JpegTransformOptions()) : options(options) {}
+
+    void setOptions(const JpegTransformOptions& newOptions) { options = newOptions; }
+    const JpegTransformOptions& transformOptions() const { return options; }
+
+    bool transform(const QByteArray& input, QByteArray& output);
+    bool transformToFile(const QByteArray& input, const QString& filename);
+
+    // Преобразование, приводящее изображение с тегом Orientation к 1
+    static int transformForOrientation(int orientation);
+    // Сначала first, затем second
+    static int combine(int first, int second);
+
+    const JpegTransformStats& stats() const { return lastStats; }
+    QString errorString() const { return lastError; }
+
+private:
+    JpegTransformOptions options;
+    JpegTransformStats lastStats;
+    QString lastError;
+};
+
+#endif // JPEGTRANSFORM_H
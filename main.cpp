@@ -1,11 +1,448 @@
 #include "mainwindow.h"
 #include <QtWidgets/QApplication>
+#include <QtCore/QCoreApplication>
+#include <QtCore/QCommandLineParser>
 #include <QtCore/QDebug>
+#include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QRegularExpression>
+#include <QtCore/QTextStream>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#ifdef Q_OS_UNIX
+#include <csignal>
+#include <unistd.h>
+#endif
 #include "imagehandler.h"
+#include "batchtranscoder.h"
+#include "jpegloader.h"
+#include "jpegprobe.h"
+#include "thumbnailpack.h"
+#include "memoryaccountant.h"
+
+// jpeg_viewer --batch in/ out/ [--quality N] [--progressive] [--dct integer|fast|float]
+//             [--optimize-huffman] [--threads N] [--memory-budget MB]
+//             [--lossless [--rotate 90|180|270] [--flip horizontal|vertical] [--transpose]
+//              [--crop WxH+X+Y] [--normalize-orientation] [--baseline] [--strip-metadata]]
+static int runBatch(QCoreApplication& app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless batch JPEG transcoding");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("batch", "Transcode every JPEG of <input> into <output>."));
+    parser.addOption(QCommandLineOption("quality", "JPEG quality 0-100.", "quality", "75"));
+    parser.addOption(QCommandLineOption("progressive", "Write progressive JPEGs."));
+    parser.addOption(QCommandLineOption("dct", "DCT method: integer, fast or float.", "method", "integer"));
+    parser.addOption(QCommandLineOption("optimize-huffman", "Optimize Huffman tables."));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 for all cores.", "count", "0"));
+    parser.addOption(QCommandLineOption("memory-budget", "Memory for images in flight, MB.", "mb", "1024"));
+    parser.addOption(QCommandLineOption("lossless", "Transform DCT coefficients instead of re-encoding pixels."));
+    parser.addOption(QCommandLineOption("rotate", "Lossless clockwise rotation: 90, 180 or 270.", "degrees"));
+    parser.addOption(QCommandLineOption("flip", "Lossless flip: horizontal or vertical.", "direction"));
+    parser.addOption(QCommandLineOption("transpose", "Lossless transpose across the main diagonal."));
+    parser.addOption(QCommandLineOption("crop", "Lossless crop WxH+X+Y, origin snapped to the MCU grid.", "geometry"));
+    parser.addOption(QCommandLineOption("normalize-orientation", "Apply the EXIF orientation losslessly and reset it."));
+    parser.addOption(QCommandLineOption("baseline", "Write baseline JPEGs in lossless mode."));
+    parser.addOption(QCommandLineOption("strip-metadata", "Drop APPn and COM segments in lossless mode."));
+    parser.addPositionalArgument("input", "Directory with source JPEGs.");
+    parser.addPositionalArgument("output", "Directory for transcoded JPEGs.");
+    parser.process(app);
+
+    QTextStream err(stderr);
+    const QStringList directories = parser.positionalArguments();
+    if (directories.size() != 2) {
+        err << "Usage: jpeg_viewer --batch <input> <output> [options]" << Qt::endl;
+        return 2;
+    }
+
+    BatchOptions options;
+    options.inputDir = directories[0];
+    options.outputDir = directories[1];
+    options.encode.quality = qBound(0, parser.value("quality").toInt(), 100);
+    options.encode.progressive = parser.isSet("progressive");
+    options.encode.optimizeHuffman = parser.isSet("optimize-huffman");
+    options.threads = parser.value("threads").toInt();
+    options.memoryBudget = qMax(1LL, parser.value("memory-budget").toLongLong()) * 1024 * 1024;
+
+    const QString dct = parser.value("dct").toLower();
+    if (dct == "fast") {
+        options.encode.dctMethod = JpegEncodeOptions::DctFast;
+    } else if (dct == "float") {
+        options.encode.dctMethod = JpegEncodeOptions::DctFloat;
+    } else if (dct == "integer") {
+        options.encode.dctMethod = JpegEncodeOptions::DctInteger;
+    } else {
+        err << "Unknown DCT method: " << dct << Qt::endl;
+        return 2;
+    }
+
+    options.lossless = parser.isSet("lossless");
+    JpegTransformOptions& transform = options.transform;
+    transform.normalizeOrientation = parser.isSet("normalize-orientation");
+    transform.optimizeHuffman = parser.isSet("optimize-huffman");
+    transform.copyMetadata = !parser.isSet("strip-metadata");
+    if (parser.isSet("progressive")) {
+        transform.mode = JpegTransformOptions::Progressive;
+    } else if (parser.isSet("baseline")) {
+        transform.mode = JpegTransformOptions::Baseline;
+    }
+    // Порядок применения: транспонирование, поворот, отражение
+    if (parser.isSet("transpose")) {
+        transform.transform = JpegTransformOptions::Transpose;
+    }
+    if (parser.isSet("rotate")) {
+        const QString degrees = parser.value("rotate");
+        int rotation = JpegTransformOptions::None;
+        if (degrees == "90") {
+            rotation = JpegTransformOptions::Rotate90;
+        } else if (degrees == "180") {
+            rotation = JpegTransformOptions::Rotate180;
+        } else if (degrees == "270") {
+            rotation = JpegTransformOptions::Rotate270;
+        } else {
+            err << "Unknown rotation: " << degrees << Qt::endl;
+            return 2;
+        }
+        transform.transform = JpegTransformer::combine(transform.transform, rotation);
+    }
+    if (parser.isSet("flip")) {
+        const QString direction = parser.value("flip").toLower();
+        int flip = JpegTransformOptions::None;
+        if (direction == "horizontal") {
+            flip = JpegTransformOptions::FlipHorizontal;
+        } else if (direction == "vertical") {
+            flip = JpegTransformOptions::FlipVertical;
+        } else {
+            err << "Unknown flip direction: " << direction << Qt::endl;
+            return 2;
+        }
+        transform.transform = JpegTransformer::combine(transform.transform, flip);
+    }
+    if (parser.isSet("crop")) {
+        static const QRegularExpression geometry("^(\\d+)x(\\d+)\\+(\\d+)\\+(\\d+)$");
+        const QRegularExpressionMatch match = geometry.match(parser.value("crop"));
+        if (!match.hasMatch()) {
+            err << "Crop geometry must look like WxH+X+Y: " << parser.value("crop") << Qt::endl;
+            return 2;
+        }
+        transform.crop = QRect(match.captured(3).toInt(), match.captured(4).toInt(),
+                               match.captured(1).toInt(), match.captured(2).toInt());
+    }
+
+    BatchTranscoder transcoder(options);
+    const bool ok = transcoder.run();
+    QTextStream out(stdout);
+    transcoder.printReport(out);
+    return ok ? 0 : 1;
+}
+
+// Время до каждого кадра потоковой загрузки
+class StreamReport : public ImageLoadObserver {
+public:
+    explicit StreamReport(QTextStream& out) : out(out) { timer.start(); }
+
+    void onImageLoaded(const QImage& image) override {
+        const double ms = timer.nsecsElapsed() / 1e6;
+        if (frames == 0) {
+            firstFrameMs = ms;
+        }
+        frames++;
+        lastFrame = image;
+        out << "frame " << frames << ": " << image.width() << "x" << image.height()
+            << " at " << QString::number(ms, 'f', 1) << " ms" << Qt::endl;
+    }
+
+    void onLoadError(const QString& error) override {
+        QTextStream(stderr) << error << Qt::endl;
+    }
+
+    QTextStream& out;
+    QElapsedTimer timer;
+    QImage lastFrame;
+    int frames = 0;
+    double firstFrameMs = 0.0;
+};
+
+#ifdef Q_OS_UNIX
+// Подаёт данные в канал со скоростью bytesPerSecond порциями по 50 мс
+static void writeThrottled(int fd, const QByteArray& data, int bytesPerSecond)
+{
+    const qsizetype slice = qMax(1, bytesPerSecond / 20);
+    for (qsizetype offset = 0; offset < data.size(); offset += slice) {
+        const qsizetype count = qMin(slice, data.size() - offset);
+        if (::write(fd, data.constData() + offset, static_cast<size_t>(count)) != count) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    ::close(fd);
+}
+#endif
+
+// jpeg_viewer --stream <file|-> [--throttle KB/s] [--output image.png]
+// Медленный источник: pv -qL 64k photo.jpg | jpeg_viewer --stream -
+// или --throttle 64, который сам подаёт файл через локальный канал
+static int runStream(QCoreApplication& app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Decode a JPEG while it arrives and report time to each frame");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("stream", "Decode <input> as a stream."));
+    parser.addOption(QCommandLineOption("throttle", "Feed the file through a pipe at this rate, KB/s.", "kbps", "0"));
+    parser.addOption(QCommandLineOption("output", "Save the final frame to <file>.", "file"));
+    parser.addPositionalArgument("input", "JPEG file, '-' for stdin.");
+    parser.process(app);
+
+    QTextStream err(stderr);
+    const QStringList inputs = parser.positionalArguments();
+    if (inputs.size() != 1) {
+        err << "Usage: jpeg_viewer --stream <file|-> [options]" << Qt::endl;
+        return 2;
+    }
+    const QString name = inputs[0];
+    const int throttle = parser.value("throttle").toInt();
+
+    // Без Unbuffered QFile отдаёт данные канала, только заполнив свой буфер
+    QFile input;
+    std::thread writer;
+    bool opened = false;
+    if (name == "-") {
+        opened = input.open(stdin, QIODevice::ReadOnly | QIODevice::Unbuffered);
+    } else if (throttle > 0) {
+#ifdef Q_OS_UNIX
+        QFile source(name);
+        int fds[2];
+        if (!source.open(QIODevice::ReadOnly) || ::pipe(fds) != 0) {
+            err << "Cannot read " << name << Qt::endl;
+            return 1;
+        }
+        // Если декодер бросит чтение, запись в канал вернёт ошибку вместо SIGPIPE
+        std::signal(SIGPIPE, SIG_IGN);
+        writer = std::thread(writeThrottled, fds[1], source.readAll(), throttle * 1024);
+        opened = input.open(fds[0], QIODevice::ReadOnly | QIODevice::Unbuffered, QFileDevice::AutoCloseHandle);
+#else
+        err << "--throttle needs POSIX pipes" << Qt::endl;
+        return 2;
+#endif
+    } else {
+        input.setFileName(name);
+        opened = input.open(QIODevice::ReadOnly);
+    }
+    if (!opened) {
+        err << "Cannot open " << name << ": " << input.errorString() << Qt::endl;
+        if (writer.joinable()) {
+            writer.join();
+        }
+        return 1;
+    }
+
+    QTextStream out(stdout);
+    StreamReport report(out);
+    StreamLoadCommand command(&input, &report);
+    const bool loaded = command.execute();
+    const double totalMs = report.timer.nsecsElapsed() / 1e6;
+    input.close();
+    if (writer.joinable()) {
+        writer.join();
+    }
+
+    out << report.frames << " frames, first at " << QString::number(report.firstFrameMs, 'f', 1)
+        << " ms, complete at " << QString::number(totalMs, 'f', 1) << " ms" << Qt::endl;
+    if (loaded && parser.isSet("output") && !report.lastFrame.save(parser.value("output"))) {
+        err << "Cannot write " << parser.value("output") << Qt::endl;
+        return 1;
+    }
+    return loaded ? 0 : 1;
+}
+
+// jpeg_viewer --probe <file|directory>...
+// Только заголовки и EXIF: размеры, ориентация, режим и миниатюра без
+// декодирования пикселей; из каждого файла читается несколько килобайт
+static int runProbe(QCoreApplication& app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("List JPEG headers without decoding any pixels");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("probe", "Probe every <input>."));
+    parser.addPositionalArgument("inputs", "JPEG files or directories.", "<inputs...>");
+    parser.process(app);
+
+    QStringList files;
+    for (const QString& input : parser.positionalArguments()) {
+        if (QFileInfo(input).isDir()) {
+            const QDir dir(input);
+            const QStringList names = dir.entryList(QStringList() << "*.jpg" << "*.jpeg",
+                                                    QDir::Files | QDir::Readable, QDir::Name | QDir::IgnoreCase);
+            for (const QString& name : names) {
+                files.append(dir.filePath(name));
+            }
+        } else {
+            files.append(input);
+        }
+    }
+    if (files.isEmpty()) {
+        QTextStream(stderr) << "Usage: jpeg_viewer --probe <file|directory>..." << Qt::endl;
+        return 2;
+    }
+
+    QTextStream out(stdout);
+    QElapsedTimer timer;
+    timer.start();
+    int failed = 0;
+    qint64 bytesRead = 0;
+    qint64 bytesTotal = 0;
+    for (const QString& file : files) {
+        JpegProbeInfo info;
+        if (!JpegProbe::probeFile(file, info)) {
+            out << file << "\terror: " << info.index.errorString << "\n";
+            failed++;
+            continue;
+        }
+        bytesRead += info.bytesRead;
+        bytesTotal += info.fileSize;
+        const QSize size = info.orientedSize();
+        const char* mode = info.index.isProgressive() ? "progressive"
+                                                      : info.index.isBaseline() ? "baseline" : "extended";
+        out << file << "\t" << size.width() << "x" << size.height()
+            << "\torientation " << info.orientation
+            << "\t" << mode
+            << "\t" << info.index.subsampling()
+            << "\trestart " << info.index.restartInterval
+            << "\tthumbnail ";
+        if (info.hasThumbnail()) {
+            out << info.thumbnailSize.width() << "x" << info.thumbnailSize.height();
+        } else {
+            out << "-";
+        }
+        out << "\n";
+    }
+    out << QString("Probed %1 files (%2 failed) in %3 ms, read %4 KB of %5 MB")
+               .arg(files.size()).arg(failed)
+               .arg(timer.nsecsElapsed() / 1e6, 0, 'f', 1)
+               .arg(bytesRead / 1024)
+               .arg(bytesTotal / (1024.0 * 1024.0), 0, 'f', 1) << Qt::endl;
+    return failed == 0 ? 0 : 1;
+}
+
+// jpeg_viewer --thumbnails <directory>... [--threads N] [--pack file]
+// Заполняет пакет миниатюр заранее; повторный запуск показывает, сколько
+// стоит открыть уже известный каталог
+static int runThumbnails(QCoreApplication& app)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Generate folder thumbnails into the thumbnail pack");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("thumbnails", "Generate thumbnails for every JPEG of <directories>."));
+    parser.addOption(QCommandLineOption("threads", "Worker threads, 0 for all cores.", "count", "0"));
+    parser.addOption(QCommandLineOption("pack", "Thumbnail pack file.", "file", ThumbnailPack::defaultFileName()));
+    parser.addPositionalArgument("directories", "Directories with JPEGs.", "<directories...>");
+    parser.process(app);
+
+    QTextStream out(stdout);
+    QTextStream err(stderr);
+    if (parser.positionalArguments().isEmpty()) {
+        err << "Usage: jpeg_viewer --thumbnails <directory>... [--threads N] [--pack file]" << Qt::endl;
+        return 2;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    ThumbnailPack pack;
+    if (!pack.open(parser.value("pack"))) {
+        err << "Cannot open thumbnail pack: " << pack.errorString() << Qt::endl;
+        return 1;
+    }
+    const double openMs = timer.nsecsElapsed() / 1e6;
+
+    timer.restart();
+    QVector<ImageCacheKey> missing;
+    int files = 0;
+    for (const QString& input : parser.positionalArguments()) {
+        const QFileInfoList entries = QDir(input).entryInfoList(QStringList() << "*.jpg" << "*.jpeg",
+                                                                QDir::Files | QDir::Readable, QDir::Name | QDir::IgnoreCase);
+        for (const QFileInfo& info : entries) {
+            ImageCacheKey key;
+            key.path = info.absoluteFilePath();
+            key.size = info.size();
+            key.modified = info.lastModified().toMSecsSinceEpoch();
+            files++;
+            if (!pack.contains(key)) {
+                missing.append(key);
+            }
+        }
+    }
+    const double lookupMs = timer.nsecsElapsed() / 1e6;
+
+    timer.restart();
+    QThreadPool pool;
+    const int threads = parser.value("threads").toInt();
+    if (threads > 0) {
+        pool.setMaxThreadCount(threads);
+    }
+    std::atomic_int failed{0};
+    for (const ImageCacheKey& key : missing) {
+        pool.start([&pack, &failed, key]() {
+            QImage thumbnail;
+            QByteArray jpeg;
+            if (!ThumbnailPack::generate(key.path, thumbnail, jpeg) || !pack.insert(key, jpeg)) {
+                failed++;
+            }
+        });
+    }
+    pool.waitForDone();
+    const double generateMs = timer.nsecsElapsed() / 1e6;
+
+    const ThumbnailPackStats stats = pack.stats();
+    out << QString("Opened pack with %1 entries in %2 ms, looked up %3 files in %4 ms")
+               .arg(stats.entries - stats.appended).arg(openMs, 0, 'f', 2)
+               .arg(files).arg(lookupMs, 0, 'f', 2) << Qt::endl;
+    out << QString("Generated %1 thumbnails (%2 failed) in %3 ms on %4 threads; pack %5 MB, %6 KB stale")
+               .arg(missing.size() - failed.load()).arg(failed.load())
+               .arg(generateMs, 0, 'f', 1).arg(pool.maxThreadCount())
+               .arg(stats.fileBytes / (1024.0 * 1024.0), 0, 'f', 1)
+               .arg(stats.staleBytes / 1024) << Qt::endl;
+    return failed.load() == 0 ? 0 : 1;
+}
 
 int main(int argc, char *argv[])
 {
+    // Пакетный, потоковый режимы, --probe и --thumbnails не требуют дисплея, поэтому QApplication не создаётся
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--batch") == 0) {
+            QCoreApplication app(argc, argv);
+            return runBatch(app);
+        }
+        if (std::strcmp(argv[i], "--stream") == 0) {
+            QCoreApplication app(argc, argv);
+            return runStream(app);
+        }
+        if (std::strcmp(argv[i], "--probe") == 0) {
+            QCoreApplication app(argc, argv);
+            return runProbe(app);
+        }
+        if (std::strcmp(argv[i], "--thumbnails") == 0) {
+            QCoreApplication app(argc, argv);
+            return runThumbnails(app);
+        }
+    }
+
     QApplication app(argc, argv);
+
+    // jpeg_viewer [--memory-budget MB]
+    // Для машин с малой памятью: загрузка, не помещающаяся в бюджет, сначала
+    // сбрасывает кэши, затем идёт в уменьшенном масштабе или без цвета
+    const QStringList arguments = app.arguments();
+    const int budgetIndex = arguments.indexOf("--memory-budget");
+    if (budgetIndex > 0 && budgetIndex + 1 < arguments.size()) {
+        MemoryAccountant::instance().setBudget(qMax(0LL, arguments[budgetIndex + 1].toLongLong()) * 1024 * 1024);
+    }
     
     qDebug() << "=== JPEG Viewer Application ===";
     qDebug() << "Demonstrating design patterns:";
@@ -1,21 +1,47 @@
 #include "mainwindow.h"
+#include "tracing.h"
+#include "jpegprobe.h"
 #include <QtWidgets/QApplication>
+#include <QtCore/QDir>
 #include <QtCore/QFileInfo>
 #include <QtCore/QTimer>
+#include <cmath>
+#include <utility>
+
+// Начиная с этого числа пикселей изображение открывается в тайловом просмотре
+static const qint64 TiledViewThresholdPixels = 64LL * 1024 * 1024;
+// Сколько файлов в каждую сторону декодируется заранее
+static const int PrefetchDistance = 2;
+// Меньшие изображения декодируются быстрее, чем имеет смысл показывать миниатюру
+static const qint64 PreviewMinPixels = 2LL * 1024 * 1024;
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , imageHandler(nullptr)
     , loadCommand(nullptr)
+    , prefetcher(&imageCache)
 {
+    prefetcher.setMaxPixels(TiledViewThresholdPixels);
+    // С бюджетом памяти кэш соседних файлов не должен вытеснять текущий
+    const qint64 memoryBudget = MemoryAccountant::instance().budget();
+    if (memoryBudget > 0) {
+        imageCache.setBudget(qMin(ImageCache::DefaultBudget, memoryBudget / 4));
+    }
+    trialEncoder = new TrialEncoder(this);
     setupUI();
+    trialEncoder->request(encodeOptions());
     imageHandler = ImageHandler::createHandler(ImageHandler::Progressive);
+    encodeHandler = ImageHandler::createHandler(ImageHandler::Standard);
 }
 
 MainWindow::~MainWindow()
 {
-    delete imageHandler;
+    delete saveCommand;
+    delete encodeHandler;
+    delete fullResolutionCommand;
+    delete saveHandler;
     delete loadCommand;
+    delete imageHandler;
 }
 
 void MainWindow::setupUI()
@@ -25,6 +51,30 @@ void MainWindow::setupUI()
     resize(1200, 900);
 
     statusBar()->showMessage("Ready");
+
+    loadProgressBar = new QProgressBar(this);
+    loadProgressBar->setRange(0, 100);
+    loadProgressBar->setMaximumWidth(200);
+    loadProgressBar->setVisible(false);
+    statusBar()->addPermanentWidget(loadProgressBar);
+    // Прерывает сохранение на любом этапе: полное разрешение, подбор качества, кодирование
+    cancelSaveButton = new QPushButton("Cancel Save", this);
+    cancelSaveButton->setVisible(false);
+    statusBar()->addPermanentWidget(cancelSaveButton);
+    connect(cancelSaveButton, &QPushButton::clicked, this, &MainWindow::onCancelSaveClicked);
+
+    memoryLabel = new QLabel(this);
+    statusBar()->addPermanentWidget(memoryLabel);
+#ifdef JPEG_VIEWER_TRACING
+    // Сводка трассировки отдельно от сообщений о загрузке и сохранении
+    traceLabel = new QLabel(this);
+    statusBar()->addPermanentWidget(traceLabel);
+#endif
+    QTimer* memoryTimer = new QTimer(this);
+    memoryTimer->setInterval(1000);
+    connect(memoryTimer, &QTimer::timeout, this, &MainWindow::updateMemoryStatus);
+    memoryTimer->start();
+    updateMemoryStatus();
     
     QWidget* centralWidget = new QWidget(this);
     setCentralWidget(centralWidget);
@@ -33,30 +83,58 @@ void MainWindow::setupUI()
 
     QHBoxLayout* buttonLayout = new QHBoxLayout();
     loadButton = new QPushButton("Load JPEG", this);
+    browseButton = new QPushButton("Browse Folder", this);
+    browseButton->setToolTip("Thumbnails of every JPEG in a folder; double click to open");
     saveButton = new QPushButton("Save JPEG", this);
     nextScanButton = new QPushButton(">", this);
     nextScanButton->setEnabled(false);
     nextScanButton->setMaximumWidth(50);
+    previousButton = new QPushButton("Previous", this);
+    previousButton->setShortcut(QKeySequence(Qt::Key_PageUp));
+    previousButton->setEnabled(false);
+    nextButton = new QPushButton("Next", this);
+    nextButton->setShortcut(QKeySequence(Qt::Key_PageDown));
+    nextButton->setEnabled(false);
     
     buttonLayout->addWidget(loadButton);
+    buttonLayout->addWidget(browseButton);
     buttonLayout->addWidget(saveButton);
     buttonLayout->addWidget(nextScanButton);
+    buttonLayout->addWidget(previousButton);
+    buttonLayout->addWidget(nextButton);
+    grayscaleCheckBox = new QCheckBox("Keep Grayscale", this);
+    grayscaleCheckBox->setToolTip("Keep grayscale JPEGs at one byte per pixel instead of RGB32");
+    buttonLayout->addWidget(grayscaleCheckBox);
+#ifdef JPEG_VIEWER_TRACING
+    QPushButton* saveTraceButton = new QPushButton("Save Trace", this);
+    saveTraceButton->setToolTip("Write collected timings as Chrome trace_event JSON");
+    buttonLayout->addWidget(saveTraceButton);
+    connect(saveTraceButton, &QPushButton::clicked, this, &MainWindow::onSaveTraceButtonClicked);
+#endif
     buttonLayout->addStretch();
     
     mainLayout->addLayout(buttonLayout);
 
-    imageLabel = new QLabel(this);
-    imageLabel->setAlignment(Qt::AlignCenter);
-    imageLabel->setStyleSheet("QLabel { border: 2px solid gray; background-color: #2b2b2b; }");
-    imageLabel->setMinimumSize(1000, 700);
-    imageLabel->setText("No image loaded");
-    imageLabel->setScaledContents(false);
-    mainLayout->addWidget(imageLabel);
+    imageView = new ImageView(this);
+    imageView->setMinimumSize(1000, 700);
+
+    tiledView = new TiledImageView(this);
+    thumbnailView = new ThumbnailView(this);
+
+    imageStack = new QStackedWidget(this);
+    imageStack->addWidget(imageView);
+    imageStack->addWidget(tiledView);
+    imageStack->addWidget(thumbnailView);
+    mainLayout->addWidget(imageStack);
 
     QHBoxLayout* saveOptionsLayout = new QHBoxLayout();
     
     progressiveCheckBox = new QCheckBox("Progressive", this);
     saveOptionsLayout->addWidget(progressiveCheckBox);
+
+    optimizeHuffmanCheckBox = new QCheckBox("Optimize Huffman", this);
+    optimizeHuffmanCheckBox->setToolTip("Smaller files at the cost of a second pass over the image");
+    saveOptionsLayout->addWidget(optimizeHuffmanCheckBox);
     
     saveOptionsLayout->addWidget(new QLabel("DCT Method:", this));
     dctComboBox = new QComboBox(this);
@@ -75,6 +153,26 @@ void MainWindow::setupUI()
     qualitySpinBox->setRange(0, 100);
     qualitySpinBox->setValue(75);
     saveOptionsLayout->addWidget(qualitySpinBox);
+
+    // Вместо ручного качества - подбор при сохранении
+    targetComboBox = new QComboBox(this);
+    targetComboBox->addItem("Fixed quality", -1);
+    targetComboBox->addItem("Max size", QualityTarget::MaxBytes);
+    targetComboBox->addItem("Min SSIM", QualityTarget::MinSsim);
+    targetComboBox->setToolTip("Search for the quality setting when saving");
+    saveOptionsLayout->addWidget(targetComboBox);
+
+    targetSpinBox = new QDoubleSpinBox(this);
+    targetSpinBox->setVisible(false);
+    saveOptionsLayout->addWidget(targetSpinBox);
+
+    previewCheckBox = new QCheckBox("Preview", this);
+    previewCheckBox->setToolTip("Show the image as it will look after saving with these settings");
+    saveOptionsLayout->addWidget(previewCheckBox);
+
+    trialLabel = new QLabel(this);
+    trialLabel->setMinimumWidth(360);
+    saveOptionsLayout->addWidget(trialLabel);
     
     saveOptionsLayout->addStretch();
     
@@ -82,9 +180,25 @@ void MainWindow::setupUI()
     mainLayout->addStretch();
 
     connect(loadButton, &QPushButton::clicked, this, &MainWindow::onLoadButtonClicked);
+    connect(browseButton, &QPushButton::clicked, this, &MainWindow::onBrowseButtonClicked);
+    connect(thumbnailView, &ThumbnailView::fileActivated, this, &MainWindow::onThumbnailActivated);
+    connect(thumbnailView, &ThumbnailView::statsChanged, this, &MainWindow::onThumbnailStatsChanged);
     connect(saveButton, &QPushButton::clicked, this, &MainWindow::onSaveButtonClicked);
     connect(nextScanButton, &QPushButton::clicked, this, &MainWindow::onNextScanButtonClicked);
+    connect(previousButton, &QPushButton::clicked, this, &MainWindow::onPreviousButtonClicked);
+    connect(nextButton, &QPushButton::clicked, this, &MainWindow::onNextButtonClicked);
     connect(qualitySlider, &QSlider::valueChanged, this, &MainWindow::onQualityChanged);
+    connect(progressiveCheckBox, &QCheckBox::toggled, this, &MainWindow::onEncodeOptionsChanged);
+    connect(optimizeHuffmanCheckBox, &QCheckBox::toggled, this, &MainWindow::onEncodeOptionsChanged);
+    connect(dctComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::onEncodeOptionsChanged);
+    connect(targetComboBox, QOverload<int>::of(&QComboBox::currentIndexChanged),
+            this, &MainWindow::onTargetModeChanged);
+    connect(previewCheckBox, &QCheckBox::toggled, this, &MainWindow::onPreviewToggled);
+    connect(trialEncoder, &TrialEncoder::finished, this, &MainWindow::onTrialEncodeFinished);
+    connect(trialEncoder, &TrialEncoder::failed, this, &MainWindow::onTrialEncodeFailed);
+    connect(tiledView, &TiledImageView::viewChanged, this, &MainWindow::onTiledViewChanged);
+    connect(grayscaleCheckBox, &QCheckBox::toggled, this, &MainWindow::onGrayscaleToggled);
     connect(qualitySpinBox, QOverload<int>::of(&QSpinBox::valueChanged), 
             qualitySlider, &QSlider::setValue);
     connect(qualitySlider, &QSlider::valueChanged, 
@@ -100,29 +214,192 @@ void MainWindow::onLoadButtonClicked()
         return;
     }
 
+    openFile(filename);
+}
+
+void MainWindow::onBrowseButtonClicked()
+{
+    const QString start = pendingFilename.isEmpty() ? QString() : QFileInfo(pendingFilename).absolutePath();
+    const QString directory = QFileDialog::getExistingDirectory(this, "Browse Folder", start);
+    if (directory.isEmpty()) {
+        return;
+    }
+
+    // Тот же каталог не перечитывается: готовые миниатюры остаются на месте
+    if (QDir(directory).absolutePath() != thumbnailView->directory()) {
+        thumbnailView->setDirectory(directory);
+    }
+    if (!pendingFilename.isEmpty()) {
+        thumbnailView->setCurrentFile(pendingFilename);
+    }
+    imageStack->setCurrentWidget(thumbnailView);
+    thumbnailView->setFocus();
+    onThumbnailStatsChanged();
+}
+
+void MainWindow::onThumbnailActivated(const QString& filename)
+{
+    openFile(filename);
+}
+
+void MainWindow::onThumbnailStatsChanged()
+{
+    if (imageStack->currentWidget() != thumbnailView) {
+        return;
+    }
+    const ThumbnailViewStats stats = thumbnailView->stats();
+    const ThumbnailPackStats pack = thumbnailView->packStats();
+    statusBar()->showMessage(QString("%1 files: %2 thumbnails from pack, %3 generated, %4 pending, %5 failed. "
+                                     "Thumbnail pack: %6 entries, %7 MB")
+                                 .arg(stats.files).arg(stats.fromPack).arg(stats.generated)
+                                 .arg(stats.pending).arg(stats.failed)
+                                 .arg(pack.entries)
+                                 .arg(pack.fileBytes / (1024.0 * 1024.0), 0, 'f', 1));
+}
+
+void MainWindow::onPreviousButtonClicked()
+{
+    navigate(-1);
+}
+
+void MainWindow::onNextButtonClicked()
+{
+    navigate(1);
+}
+
+void MainWindow::openFile(const QString& filename)
+{
     QFileInfo fileInfo(filename);
-    ImageHandler::HandlerType handlerType = ImageHandler::Progressive;
+    TRACE_OPERATION("load " + fileInfo.fileName());
+
+    // Незавершённая загрузка отменяется до того, как будет удалён её обработчик
+    if (loadCommand) {
+        delete loadCommand;
+        loadCommand = nullptr;
+    }
 
     if (imageHandler) {
         delete imageHandler;
     }
-    imageHandler = ImageHandler::createHandler(handlerType);
+    QSharedPointer<MappedJpegFile> file(new MappedJpegFile());
+    file->open(filename);
+    imageHandler = ImageHandler::createHandler(file);
+    imageHandler->setTargetSize(imageView->size());
+    imageHandler->setGrayscaleOutput(grayscaleCheckBox->isChecked());
 
-    if (loadCommand) {
-        delete loadCommand;
+    // Очень большие изображения целиком не декодируются: тайловый просмотр
+    // декодирует только видимую область
+    const JpegFileIndex& index = file->index();
+    if (index.isValid() &&
+        static_cast<qint64>(index.size.width()) * index.size.height() >= TiledViewThresholdPixels) {
+        currentImage = QImage();
+        updateImageDisplay(QImage());
+        currentFilename = filename;
+        pendingFilename = filename;
+        currentImageReduced = false;
+        tiledView->setFile(file);
+        imageStack->setCurrentWidget(tiledView);
+        loadProgressBar->setVisible(isSaving());
+        updateNextScanButton();
+        updateNavigation();
+        return;
     }
+    tiledView->clear();
+    imageStack->setCurrentWidget(imageView);
+
+    pendingFilename = filename;
+
+    // Уже декодированное (в том числе заранее) показывается сразу
+    CachedImage cached;
+    if (imageCache.find(ImageCacheKey::forFile(filename), imageView->size(), cached)) {
+        loadProgressBar->setVisible(isSaving());
+        currentImage = cached.image;
+        currentFilename = filename;
+        currentImageReduced = cached.reduced;
+        updateImageDisplay(currentImage);
+        updateNextScanButton();
+        const ImageCacheStats stats = imageCache.stats();
+        statusBar()->showMessage(QString("%1 from cache. Image cache: %2 hits, %3 misses, %4 of %5 MB")
+                                     .arg(fileInfo.fileName())
+                                     .arg(stats.hits).arg(stats.misses)
+                                     .arg(stats.bytesInUse / (1024 * 1024))
+                                     .arg(stats.budget / (1024 * 1024)), 4000);
+        updateNavigation();
+        return;
+    }
+
     loadCommand = new LoadImageCommand(imageHandler, filename, this);
-    loadCommand->execute();
+    loadProgressBar->setValue(0);
+    loadProgressBar->setVisible(true);
+    statusBar()->showMessage("Loading " + fileInfo.fileName() + "...");
+    showPreview(file, fileInfo.fileName());
+    loadCommand->executeAsync();
     
     updateNextScanButton();
+    updateNavigation();
+}
+
+QStringList MainWindow::directoryFiles() const
+{
+    if (pendingFilename.isEmpty()) {
+        return QStringList();
+    }
+    const QDir dir = QFileInfo(pendingFilename).absoluteDir();
+    QStringList files;
+    const QStringList names = dir.entryList(QStringList() << "*.jpg" << "*.jpeg",
+                                            QDir::Files | QDir::Readable, QDir::Name | QDir::IgnoreCase);
+    for (const QString& name : names) {
+        files.append(dir.absoluteFilePath(name));
+    }
+    return files;
+}
+
+void MainWindow::navigate(int step)
+{
+    const QStringList files = directoryFiles();
+    const int index = files.indexOf(QFileInfo(pendingFilename).absoluteFilePath());
+    const int target = index + step;
+    if (index < 0 || target < 0 || target >= files.size()) {
+        return;
+    }
+    openFile(files[target]);
+}
+
+void MainWindow::updateNavigation()
+{
+    const QStringList files = directoryFiles();
+    const int index = files.indexOf(QFileInfo(pendingFilename).absoluteFilePath());
+    previousButton->setEnabled(index > 0);
+    nextButton->setEnabled(index >= 0 && index + 1 < files.size());
+    if (index < 0) {
+        prefetcher.cancelAll();
+        return;
+    }
+
+    // Ближние раньше дальних, вперёд раньше назад
+    QStringList neighbours;
+    for (int distance = 1; distance <= PrefetchDistance; ++distance) {
+        if (index + distance < files.size()) {
+            neighbours.append(files[index + distance]);
+        }
+        if (index - distance >= 0) {
+            neighbours.append(files[index - distance]);
+        }
+    }
+    prefetcher.setTargetSize(imageView->size());
+    prefetcher.prefetch(neighbours);
 }
 
 void MainWindow::onSaveButtonClicked()
 {
-    if (currentImage.isNull()) {
+    if (currentImage.isNull() && !isTiledView()) {
         QMessageBox::warning(this, "Warning", "No image to save");
         return;
     }
+    if (isSaving()) {
+        QMessageBox::warning(this, "Warning", "Wait until the previous save has finished");
+        return;
+    }
     
     QString filename = QFileDialog::getSaveFileName(this, 
         "Save JPEG Image", "", "JPEG Images (*.jpg *.jpeg)");
@@ -131,70 +408,432 @@ void MainWindow::onSaveButtonClicked()
         return;
     }
     
+    TRACE_OPERATION("save " + QFileInfo(filename).fileName());
+    saveFilename = filename;
+    saveButton->setEnabled(false);
+    cancelSaveButton->setVisible(true);
+    loadProgressBar->setValue(0);
+    loadProgressBar->setVisible(true);
+
+    // На экране может быть уменьшенная копия; сохраняется полное разрешение
+    if ((isTiledView() || currentImageReduced) && !currentFilename.isEmpty()) {
+        // Полное разрешение проверяется по бюджету отдельно: загрузка могла
+        // уложиться только в уменьшенном виде
+        qint64 fullBytes = 0;
+        {
+            MappedJpegFile file;
+            file.open(currentFilename);
+            fullBytes = static_cast<qint64>(file.index().size.width()) * file.index().size.height() * 4;
+        }
+        if (MemoryAccountant::instance().makeRoom(fullBytes)) {
+            // Место занимается сразу: иначе до прихода кадра его заберут
+            // упреждающая загрузка или открытие другого файла. saveImage()
+            // заменит заряд настоящим, finishSave() вернёт
+            saveCharge.set(fullBytes);
+            // Декодирование идёт в пуле потоков, сохранение начнётся по его окончании
+            saveHandler = ImageHandler::createHandler(currentFilename);
+            saveHandler->setGrayscaleOutput(grayscaleCheckBox->isChecked());
+            fullResolutionCommand = new LoadImageCommand(saveHandler, currentFilename, &fullResolutionObserver);
+            statusBar()->showMessage("Decoding full resolution...");
+            fullResolutionCommand->executeFullResolutionAsync();
+            return;
+        }
+        if (isTiledView() || currentImage.isNull() ||
+            QMessageBox::question(this, "Low Memory",
+                                  QString("Full resolution needs %1 MB, more than the memory budget allows "
+                                          "(%2). Save the displayed %3x%4 image instead?")
+                                      .arg(fullBytes / (1024 * 1024))
+                                      .arg(MemoryAccountant::instance().summary())
+                                      .arg(currentImage.width()).arg(currentImage.height())) !=
+                QMessageBox::Yes) {
+            finishSave();
+            statusBar()->showMessage("Save cancelled: not enough memory for full resolution", 4000);
+            return;
+        }
+    }
+    saveImage(currentImage);
+}
+
+void MainWindow::onFullResolutionLoaded(const QImage& image)
+{
+    cancelFullResolution();
+    saveImage(image);
+}
+
+void MainWindow::onFullResolutionError(const QString& error)
+{
+    finishSave();
+    QMessageBox::critical(this, "Error", error);
+}
+
+void MainWindow::cancelFullResolution()
+{
+    // Удаление команды дожидается рабочего потока, только потом - обработчика
+    delete fullResolutionCommand;
+    fullResolutionCommand = nullptr;
+    delete saveHandler;
+    saveHandler = nullptr;
+}
+
+void MainWindow::saveImage(QImage imageToSave)
+{
+    saveCharge.set(imageToSave.cacheKey() == currentImage.cacheKey() ? 0 : imageToSave.sizeInBytes());
+
     int quality = qualitySlider->value();
     bool progressive = progressiveCheckBox->isChecked();
     int dctMethod = dctComboBox->currentData().toInt();
-    
-    SaveImageCommand saveCommand(imageHandler, filename, currentImage, 
-                                 quality, progressive, dctMethod);
-    
-    if (saveCommand.execute()) {
-        QMessageBox::information(this, "Success", "Image saved successfully");
+    bool optimizeHuffman = optimizeHuffmanCheckBox->isChecked();
+    saveCommand = new SaveImageCommand(encodeHandler, saveFilename, std::move(imageToSave),
+                                       quality, progressive, dctMethod, optimizeHuffman);
+    if (targetComboBox->currentData().toInt() >= 0) {
+        QualityTarget target;
+        target.mode = static_cast<QualityTarget::Mode>(targetComboBox->currentData().toInt());
+        if (target.mode == QualityTarget::MinSsim) {
+            target.minSsim = targetSpinBox->value();
+        } else {
+            target.maxBytes = static_cast<qint64>(targetSpinBox->value() * 1024);
+        }
+        saveCommand->setQualityTarget(target);
+        statusBar()->showMessage("Searching for the quality setting...");
     } else {
-        QMessageBox::critical(this, "Error", "Failed to save image");
+        statusBar()->showMessage("Saving " + QFileInfo(saveFilename).fileName() + "...");
+    }
+    loadProgressBar->setValue(0);
+    saveCommand->executeAsync(&saveObserver);
+}
+
+void MainWindow::onSaveEncoded()
+{
+    // Кодирование закончено, отменять дальше нечего (вопрос ниже - свой цикл событий)
+    cancelSaveButton->setVisible(false);
+    const QString name = QFileInfo(saveFilename).fileName();
+    if (!saveCommand->hasQualityTarget()) {
+        const JpegEncodeStats stats = saveCommand->stats();
+        finishSave();
+        statusBar()->showMessage(QString("Saved %1: %2 KB in %3 ms")
+                                     .arg(name)
+                                     .arg(stats.outputBytes / 1024.0, 0, 'f', 1)
+                                     .arg(stats.encodeMs, 0, 'f', 1));
+#ifdef JPEG_VIEWER_TRACING
+        traceLabel->setText(Tracer::instance().lastOperationSummary());
+#endif
+        QMessageBox::information(this, "Success", "Image saved successfully");
+        return;
+    }
+
+    const QualitySearchResult result = saveCommand->searchResult();
+    const QString summary = QString("quality %1, %2 KB, SSIM %3")
+                                .arg(result.options.quality)
+                                .arg(result.jpeg.size() / 1024.0, 0, 'f', 1)
+                                .arg(result.ssim, 0, 'f', 4);
+    if (!result.targetMet &&
+        QMessageBox::question(this, "Target Not Reached",
+                              QString("No quality setting reaches the target. The closest is %1. Save it anyway?")
+                                  .arg(summary)) != QMessageBox::Yes) {
+        finishSave();
+        statusBar()->showMessage("Save cancelled", 4000);
+        return;
+    }
+
+    // Победитель уже закодирован при поиске: записывается как есть
+    if (!saveCommand->writeSearchResult()) {
+        const QString error = saveCommand->errorString();
+        finishSave();
+        QMessageBox::critical(this, "Error", "Failed to save image: " + error);
+        return;
     }
+    const int quality = result.options.quality;
+    const QString message = QString("Saved %1: %2 (%3 trials in %4 ms)")
+                                .arg(name, summary)
+                                .arg(result.trials)
+                                .arg(result.searchMs, 0, 'f', 0);
+    finishSave();
+    qualitySlider->setValue(quality);
+    statusBar()->showMessage(message);
+#ifdef JPEG_VIEWER_TRACING
+    traceLabel->setText(Tracer::instance().lastOperationSummary());
+#endif
+    QMessageBox::information(this, "Success", "Image saved successfully");
+}
+
+void MainWindow::onSaveError(const QString& error)
+{
+    const bool search = saveCommand->hasQualityTarget();
+    finishSave();
+    QMessageBox::critical(this, "Error", (search ? "Quality search failed: " : "Failed to save image: ") + error);
+}
+
+void MainWindow::onCancelSaveClicked()
+{
+    finishSave();
+    statusBar()->showMessage("Save cancelled", 4000);
+}
+
+void MainWindow::finishSave()
+{
+    // Удаление команд дожидается рабочих потоков
+    delete saveCommand;
+    saveCommand = nullptr;
+    cancelFullResolution();
+    saveCharge.set(0);
+    saveFilename.clear();
+    cancelSaveButton->setVisible(false);
+    loadProgressBar->setVisible(loadCommand && loadCommand->isRunning());
+    saveButton->setEnabled(true);
 }
 
 void MainWindow::onNextScanButtonClicked()
 {
     if (loadCommand && loadCommand->canLoadNextScan()) {
-        loadCommand->executeNextScan();
+        TRACE_OPERATION("next scan");
+        loadProgressBar->setVisible(true);
+        loadCommand->executeNextScanAsync();
         updateNextScanButton();
-        statusBar()->showMessage(QString("Loaded next scan. Click '>' to load more."), 2000);
     } else {
         statusBar()->showMessage("No more scans available", 2000);
     }
 }
 
+#ifdef JPEG_VIEWER_TRACING
+void MainWindow::onSaveTraceButtonClicked()
+{
+    QString filename = QFileDialog::getSaveFileName(this,
+        "Save Trace", "jpeg_viewer_trace.json", "Chrome trace (*.json)");
+    if (filename.isEmpty()) {
+        return;
+    }
+    QString error;
+    if (Tracer::instance().writeChromeTrace(filename, &error)) {
+        statusBar()->showMessage("Trace written to " + filename + " (open in chrome://tracing)", 4000);
+    } else {
+        QMessageBox::critical(this, "Error", "Failed to write trace: " + error);
+    }
+}
+#endif
+
 void MainWindow::onQualityChanged(int value)
 {
     Q_UNUSED(value);
+    onEncodeOptionsChanged();
+}
+
+void MainWindow::onEncodeOptionsChanged()
+{
+    trialEncoder->request(encodeOptions());
+}
+
+void MainWindow::onTargetModeChanged(int index)
+{
+    const int mode = targetComboBox->itemData(index).toInt();
+    qualitySlider->setEnabled(mode < 0);
+    qualitySpinBox->setEnabled(mode < 0);
+    targetSpinBox->setVisible(mode >= 0);
+    if (mode == QualityTarget::MaxBytes) {
+        targetSpinBox->setDecimals(0);
+        targetSpinBox->setRange(1, 1024 * 1024);
+        targetSpinBox->setSingleStep(50);
+        targetSpinBox->setSuffix(" KB");
+        targetSpinBox->setValue(500);
+    } else if (mode == QualityTarget::MinSsim) {
+        targetSpinBox->setDecimals(3);
+        targetSpinBox->setRange(0.5, 1.0);
+        targetSpinBox->setSingleStep(0.005);
+        targetSpinBox->setSuffix(QString());
+        targetSpinBox->setValue(0.95);
+    }
+}
+
+void MainWindow::onPreviewToggled(bool checked)
+{
+    trialEncoder->setPreviewEnabled(checked);
+    if (!checked) {
+        imageView->setImage(currentImage);
+    }
+}
+
+void MainWindow::onTrialEncodeFinished(const TrialEncodeResult& result)
+{
+    QString text = QString("%1 KB, %2 ms, PSNR %3")
+                       .arg(result.outputBytes / 1024.0, 0, 'f', 1)
+                       .arg(result.encodeMs, 0, 'f', 1)
+                       .arg(std::isinf(result.psnr) ? QString("lossless")
+                                                : QString("%1 dB").arg(result.psnr, 0, 'f', 2));
+    // Пробуется то, что на экране; при уменьшенной копии размер файла будет больше
+    if (currentImageReduced) {
+        text = QString("At %1x%2 preview: ").arg(result.imageSize.width()).arg(result.imageSize.height()) + text;
+    }
+    trialLabel->setText(text);
+    if (previewCheckBox->isChecked() && !result.preview.isNull()) {
+        imageView->setImage(result.preview);
+    }
+}
+
+void MainWindow::onTrialEncodeFailed(const QString& error)
+{
+    trialLabel->setText("Trial encode failed: " + error);
+}
+
+void MainWindow::onTiledViewChanged()
+{
+    const TileCacheStats stats = tiledView->cacheStats();
+    statusBar()->showMessage(QString("%1x%2, zoom %3%, decoding at 1/%4. Tile cache: %5 of %6 MB. "
+                                     "Wheel to zoom, drag to pan, right click to fit.")
+                                 .arg(tiledView->imageSize().width())
+                                 .arg(tiledView->imageSize().height())
+                                 .arg(tiledView->zoom() * 100, 0, 'f', 1)
+                                 .arg(1 << tiledView->currentLevel())
+                                 .arg(stats.bytesInUse / (1024 * 1024))
+                                 .arg(stats.budget / (1024 * 1024)));
+}
+
+void MainWindow::showPreview(const QSharedPointer<MappedJpegFile>& file, const QString& name)
+{
+    // Только заголовок и EXIF: размеры и режим видны до первого кадра
+    JpegProbeInfo info;
+    if (!JpegProbe::probe(file->data(), file->size(), info)) {
+        return;
+    }
+    const QSize size = info.orientedSize();
+    statusBar()->showMessage(QString("Loading %1: %2x%3, %4...")
+                                 .arg(name).arg(size.width()).arg(size.height())
+                                 .arg(info.index.isProgressive() ? "progressive" : "baseline"));
+
+    // Миниатюру заменит первый декодированный кадр
+    if (static_cast<qint64>(size.width()) * size.height() < PreviewMinPixels || !info.hasThumbnail()) {
+        return;
+    }
+    const QImage thumbnail = JpegProbe::thumbnail(file->data(), file->size(), info);
+    if (!thumbnail.isNull()) {
+        TRACE_SCOPE("display_thumbnail");
+        imageView->setImage(thumbnail);
+    }
+}
+
+void MainWindow::onGrayscaleToggled(bool checked)
+{
+    // Кадры в прежнем формате из кэша не берутся, соседи декодируются заново
+    prefetcher.cancelAll();
+    prefetcher.setGrayscaleOutput(checked);
+    imageCache.clear();
+    updateNavigation();
 }
 
 void MainWindow::onImageLoaded(const QImage& image)
 {
+    loadProgressBar->setVisible(isSaving());
     currentImage = image;
-    updateImageDisplay(image);
+    currentFilename = pendingFilename;
+    currentImageReduced = imageHandler && imageHandler->isReducedResolution();
+    {
+        TRACE_SCOPE("display");
+        updateImageDisplay(image);
+    }
     updateNextScanButton();
+
+    // В кэш попадает только окончательный кадр, и не кадр, урезанный ради бюджета
+    const bool memoryFallback = imageHandler && imageHandler->lastMemoryPlan().fallback;
+    if (imageHandler && !imageHandler->hasMoreScans() && !memoryFallback) {
+        CachedImage entry;
+        entry.image = image;
+        entry.reduced = currentImageReduced;
+        imageCache.insert(ImageCacheKey::forFile(currentFilename), entry);
+    }
+
+    if (imageHandler && imageHandler->scanCount() > 1) {
+        QString message = QString("Loaded scan %1 of %2. Click '>' to load more.")
+                              .arg(imageHandler->currentScan()).arg(imageHandler->scanCount());
+        ProgressiveImageHandler* progHandler = dynamic_cast<ProgressiveImageHandler*>(imageHandler);
+        if (progHandler) {
+            const ScanCacheStats stats = progHandler->scanCacheStats();
+            message += QString(" Scan cache: %1 hits, %2 misses, %3 of %4 MB (peak %5 MB)")
+                           .arg(stats.hits).arg(stats.misses)
+                           .arg(stats.bytesInUse / (1024 * 1024))
+                           .arg(stats.budget / (1024 * 1024))
+                           .arg(stats.peakBytes / (1024 * 1024));
+            const FramePoolStats frames = progHandler->framePoolStats();
+            message += QString(", frames: %1 allocated, %2 reused")
+                           .arg(frames.allocations).arg(frames.reuses);
+        }
+        statusBar()->showMessage(message, 4000);
+    } else {
+        statusBar()->showMessage("Image loaded", 2000);
+    }
+    if (memoryFallback) {
+        statusBar()->showMessage("Low memory: decoded at " + imageHandler->lastMemoryPlan().toString() +
+                                 ". Saving still uses full resolution.", 6000);
+    }
+    updateMemoryStatus();
+#ifdef JPEG_VIEWER_TRACING
+    traceLabel->setText(Tracer::instance().lastOperationSummary());
+#endif
 }
 
 void MainWindow::onLoadError(const QString& error)
 {
-    QMessageBox::critical(this, "Error", error);
+    loadProgressBar->setVisible(isSaving());
+    if (imageHandler && !imageHandler->lastMemoryPlan().fits) {
+        QMessageBox::critical(this, "Error", error + "\nThe image does not fit the memory budget (" +
+                              MemoryAccountant::instance().summary() + ").");
+    } else {
+        QMessageBox::critical(this, "Error", error);
+    }
     currentImage = QImage();
+    currentFilename.clear();
     updateImageDisplay(QImage());
     updateNextScanButton();
 }
 
+void MainWindow::onLoadProgress(int percent)
+{
+    loadProgressBar->setValue(percent);
+}
+
 void MainWindow::updateImageDisplay(const QImage& image)
 {
+    // Сюда приходит каждое новое currentImage
+    currentImageCharge.set(currentImage.sizeInBytes());
+    imageView->setImage(image);
     if (image.isNull()) {
-        imageLabel->setText("No image loaded");
-        imageLabel->setPixmap(QPixmap());
-        return;
+        trialLabel->clear();
     }
-    
-    QPixmap pixmap = QPixmap::fromImage(image);
-    QSize labelSize = imageLabel->size();
-    QSize scaledSize = pixmap.size();
-    scaledSize.scale(labelSize, Qt::KeepAspectRatio);
-    
-    if (scaledSize != pixmap.size()) {
-        pixmap = pixmap.scaled(scaledSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    trialEncoder->setImage(image);
+}
+
+JpegEncodeOptions MainWindow::encodeOptions() const
+{
+    JpegEncodeOptions options;
+    options.quality = qualitySlider->value();
+    options.progressive = progressiveCheckBox->isChecked();
+    options.dctMethod = dctComboBox->currentData().toInt();
+    options.optimizeHuffman = optimizeHuffmanCheckBox->isChecked();
+    // Как при сохранении: размер пробного файла совпадает с итоговым
+    options.threads = 0;
+    return options;
+}
+
+void MainWindow::updateMemoryStatus()
+{
+    const MemoryStats memory = MemoryAccountant::instance().stats();
+    memoryLabel->setText("Memory: " + MemoryAccountant::instance().summary());
+    QString details;
+    for (int category = 0; category < MemoryAccountant::CategoryCount; ++category) {
+        details += QString("%1: %2 MB (peak %3 MB)\n")
+                       .arg(MemoryAccountant::categoryName(category))
+                       .arg(memory.current[category] / (1024 * 1024))
+                       .arg(memory.peak[category] / (1024 * 1024));
     }
-    
-    imageLabel->setPixmap(pixmap);
-    imageLabel->setText("");
+    details += QString("Low-memory loads: %1, cache drops: %2").arg(memory.fallbacks).arg(memory.trims);
+    memoryLabel->setToolTip(details);
+}
+
+bool MainWindow::isSaving() const
+{
+    return !saveFilename.isEmpty();
+}
+
+bool MainWindow::isTiledView() const
+{
+    return imageStack->currentWidget() == tiledView;
 }
 
 void MainWindow::updateNextScanButton()
@@ -8,15 +8,25 @@
 #include <QtWidgets/QComboBox>
 #include <QtWidgets/QSlider>
 #include <QtWidgets/QSpinBox>
+#include <QtWidgets/QDoubleSpinBox>
 #include <QtWidgets/QVBoxLayout>
 #include <QtWidgets/QHBoxLayout>
 #include <QtWidgets/QFileDialog>
 #include <QtWidgets/QMessageBox>
 #include <QtWidgets/QStatusBar>
+#include <QtWidgets/QProgressBar>
+#include <QtWidgets/QStackedWidget>
 #include <QtGui/QImage>
 #include "jpegloader.h"
 #include "jpegsaver.h"
 #include "imagehandler.h"
+#include "tiledimageview.h"
+#include "thumbnailview.h"
+#include "imageview.h"
+#include "imagecache.h"
+#include "trialencoder.h"
+#include "qualitysearch.h"
+#include "memoryaccountant.h"
 
 class MainWindow : public QMainWindow, public ImageLoadObserver
 {
@@ -29,31 +39,126 @@ public:
     // Реализация ImageLoadObserver
     void onImageLoaded(const QImage& image) override;
     void onLoadError(const QString& error) override;
+    void onLoadProgress(int percent) override;
 
 private slots:
     void onLoadButtonClicked();
+    void onBrowseButtonClicked();
+    void onThumbnailActivated(const QString& filename);
+    void onThumbnailStatsChanged();
+    void onPreviousButtonClicked();
+    void onNextButtonClicked();
     void onSaveButtonClicked();
+    void onCancelSaveClicked();
     void onNextScanButtonClicked();
     void onQualityChanged(int value);
+    void onEncodeOptionsChanged();
+    void onTargetModeChanged(int index);
+    void onPreviewToggled(bool checked);
+    void onTrialEncodeFinished(const TrialEncodeResult& result);
+    void onTrialEncodeFailed(const QString& error);
+    void onTiledViewChanged();
+    void onGrayscaleToggled(bool checked);
+    void updateMemoryStatus();
+#ifdef JPEG_VIEWER_TRACING
+    void onSaveTraceButtonClicked();
+#endif
 
 private:
+    // Полное разрешение для сохранения приходит сюда, а не в onImageLoaded
+    class FullResolutionObserver : public ImageLoadObserver {
+    public:
+        explicit FullResolutionObserver(MainWindow* window) : window(window) {}
+        void onImageLoaded(const QImage& image) override { window->onFullResolutionLoaded(image); }
+        void onLoadError(const QString& error) override { window->onFullResolutionError(error); }
+        void onLoadProgress(int percent) override { window->onLoadProgress(percent); }
+
+    private:
+        MainWindow* window;
+    };
+
+    class SaveObserver : public ImageSaveObserver {
+    public:
+        explicit SaveObserver(MainWindow* window) : window(window) {}
+        void onImageEncoded() override { window->onSaveEncoded(); }
+        void onSaveError(const QString& error) override { window->onSaveError(error); }
+        void onSaveProgress(int percent) override { window->onLoadProgress(percent); }
+
+    private:
+        MainWindow* window;
+    };
     
-    QLabel* imageLabel;
+    QStackedWidget* imageStack;
+    ImageView* imageView;
+    TiledImageView* tiledView;
+    ThumbnailView* thumbnailView;
     QPushButton* loadButton;
+    QPushButton* browseButton;
     QPushButton* saveButton;
     QPushButton* nextScanButton;
+    QPushButton* previousButton;
+    QPushButton* nextButton;
+    QCheckBox* grayscaleCheckBox;
     QCheckBox* progressiveCheckBox;
+    QCheckBox* optimizeHuffmanCheckBox;
     QComboBox* dctComboBox;
     QSlider* qualitySlider;
     QSpinBox* qualitySpinBox;
+    QComboBox* targetComboBox;
+    QDoubleSpinBox* targetSpinBox;
+    QCheckBox* previewCheckBox;
+    QLabel* trialLabel;
+    TrialEncoder* trialEncoder;
+    QProgressBar* loadProgressBar;
+    QPushButton* cancelSaveButton;
+    QLabel* memoryLabel;
+#ifdef JPEG_VIEWER_TRACING
+    QLabel* traceLabel;
+#endif
     
     QImage currentImage;
+    MemoryCharge currentImageCharge{MemoryAccountant::Original};
+    QString currentFilename;
+    QString pendingFilename;
     ImageHandler* imageHandler;
     LoadImageCommand* loadCommand;
+    bool currentImageReduced = false;
+
+    // Сохранение в saveFilename: сначала, если нужно, полное разрешение,
+    // затем кодирование в пуле потоков. У декодирования и кодирования свои
+    // обработчики: открытие другого файла не трогает их на середине
+    FullResolutionObserver fullResolutionObserver{this};
+    ImageHandler* saveHandler = nullptr;
+    LoadImageCommand* fullResolutionCommand = nullptr;
+    SaveObserver saveObserver{this};
+    ImageHandler* encodeHandler = nullptr;
+    SaveImageCommand* saveCommand = nullptr;
+    MemoryCharge saveCharge{MemoryAccountant::Save};
+    QString saveFilename;
+
+    // Декодированные изображения каталога; соседние файлы декодируются заранее
+    ImageCache imageCache;
+    ImagePrefetcher prefetcher;
     
     void setupUI();
+    void openFile(const QString& filename);
+    void showPreview(const QSharedPointer<MappedJpegFile>& file, const QString& name);
+    void navigate(int step);
+    QStringList directoryFiles() const;
+    void updateNavigation();
     void updateImageDisplay(const QImage& image);
+    JpegEncodeOptions encodeOptions() const;
+    void onFullResolutionLoaded(const QImage& image);
+    void onFullResolutionError(const QString& error);
+    void cancelFullResolution();
+    void saveImage(QImage imageToSave);
+    void onSaveEncoded();
+    void onSaveError(const QString& error);
+    void finishSave();
+    // Полоса прогресса общая с загрузкой и не прячется, пока идёт сохранение
+    bool isSaving() const;
     void updateNextScanButton();
+    bool isTiledView() const;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,213 @@
+#include "memoryaccountant.h"
+#include "jpegcommon.h"
+#include "jpegindex.h"
+
+namespace {
+
+// Кадр Format_RGB32 или Format_Grayscale8 (строки выровнены по 4 байта)
+qint64 frameBytes(const QSize& size, int denominator, bool grayscale) {
+    const qint64 width = (size.width() + denominator - 1) / denominator;
+    const qint64 height = (size.height() + denominator - 1) / denominator;
+    const qint64 bytesPerLine = grayscale ? (width + 3) / 4 * 4 : width * 4;
+    return bytesPerLine * height;
+}
+
+QString megabytes(qint64 bytes) {
+    return QString::number((bytes + 512 * 1024) / (1024 * 1024));
+}
+
+} // namespace
+
+QString MemoryDecodePlan::toString() const {
+    QString result = scaleDenominator > 1 ? QString("1/%1 scale").arg(scaleDenominator) : QString("full scale");
+    if (grayscale) {
+        result += ", grayscale";
+    }
+    return result + QString(", %1 MB").arg(megabytes(bytes));
+}
+
+MemoryAccountant& MemoryAccountant::instance() {
+    // Не удаляется: статические владельцы снимают свои заряды уже после main()
+    static MemoryAccountant* accountant = new MemoryAccountant();
+    return *accountant;
+}
+
+void MemoryAccountant::setBudget(qint64 bytes) {
+    QMutexLocker locker(&mutex);
+    maxBytes = qMax<qint64>(0, bytes);
+}
+
+qint64 MemoryAccountant::budget() const {
+    QMutexLocker locker(&mutex);
+    return maxBytes;
+}
+
+void MemoryAccountant::add(Category category, qint64 bytes) {
+    QMutexLocker locker(&mutex);
+    current[category] += bytes;
+    total += bytes;
+    peak[category] = qMax(peak[category], current[category]);
+    peakTotal = qMax(peakTotal, total);
+}
+
+bool MemoryAccountant::fitsLocked(qint64 bytes, int exclude) const {
+    if (maxBytes <= 0) {
+        return true;
+    }
+    const qint64 used = total - (exclude >= 0 && exclude < CategoryCount ? current[exclude] : 0);
+    return used + bytes <= maxBytes;
+}
+
+bool MemoryAccountant::fits(qint64 bytes) const {
+    QMutexLocker locker(&mutex);
+    return fitsLocked(bytes, CategoryCount);
+}
+
+bool MemoryAccountant::makeRoom(qint64 bytes, int exclude) {
+    {
+        QMutexLocker locker(&mutex);
+        if (fitsLocked(bytes, exclude)) {
+            return true;
+        }
+        trims++;
+    }
+
+    // Обработчики вызываются без mutex: сброс кэша возвращает его заряд через add()
+    {
+        QMutexLocker locker(&trimMutex);
+        for (const TrimHandler& trim : trimHandlers) {
+            trim.handler();
+        }
+    }
+
+    QMutexLocker locker(&mutex);
+    return fitsLocked(bytes, exclude);
+}
+
+int MemoryAccountant::addTrimHandler(const std::function<void()>& handler) {
+    QMutexLocker locker(&trimMutex);
+    const int id = nextTrimId++;
+    trimHandlers.append({id, handler});
+    return id;
+}
+
+void MemoryAccountant::removeTrimHandler(int id) {
+    // Ждёт идущего сброса: после возврата обработчик больше не вызывается
+    QMutexLocker locker(&trimMutex);
+    for (int i = 0; i < trimHandlers.size(); ++i) {
+        if (trimHandlers[i].id == id) {
+            trimHandlers.remove(i);
+            return;
+        }
+    }
+}
+
+qint64 MemoryAccountant::coefficientBytes(const JpegFileIndex& index) {
+    if (!index.isValid() || index.scanCount() <= 1) {
+        return 0;
+    }
+    int maxHorizontal = 1;
+    int maxVertical = 1;
+    for (const JpegComponent& component : index.components) {
+        maxHorizontal = qMax(maxHorizontal, component.horizontalSampling);
+        maxVertical = qMax(maxVertical, component.verticalSampling);
+    }
+    // Блок 8x8 коэффициентов по 2 байта на каждую компоненту с её прореживанием
+    qint64 bytes = 0;
+    for (const JpegComponent& component : index.components) {
+        const qint64 width = (static_cast<qint64>(index.size.width()) * component.horizontalSampling +
+                              8 * maxHorizontal - 1) / (8 * maxHorizontal);
+        const qint64 height = (static_cast<qint64>(index.size.height()) * component.verticalSampling +
+                               8 * maxVertical - 1) / (8 * maxVertical);
+        bytes += width * height * 64 * 2;
+    }
+    return bytes;
+}
+
+MemoryDecodePlan MemoryAccountant::planDecode(const JpegFileIndex& index, const QSize& targetSize,
+                                              bool grayscaleOutput) {
+    MemoryDecodePlan plan;
+    if (!index.isValid()) {
+        return plan;
+    }
+    const QSize size = index.size;
+    const bool singleChannel = index.components.size() == 1;
+    const qint64 fixedBytes = coefficientBytes(index);
+
+    plan.scaleDenominator = static_cast<int>(chooseScaleDenominator(size, targetSize));
+    plan.bytes = fixedBytes + frameBytes(size, plan.scaleDenominator, grayscaleOutput && singleChannel);
+    if (makeRoom(plan.bytes, Original)) {
+        return plan;
+    }
+
+    // Кэши уже сброшены: сначала меньше масштаб, затем без цветности.
+    // CMYK в оттенки серого libjpeg не переводит
+    QMutexLocker locker(&mutex);
+    fallbacks++;
+    plan.fallback = true;
+    for (int denominator = plan.scaleDenominator * 2; denominator <= 8; denominator *= 2) {
+        plan.scaleDenominator = denominator;
+        plan.bytes = fixedBytes + frameBytes(size, denominator, grayscaleOutput && singleChannel);
+        if (fitsLocked(plan.bytes, Original)) {
+            return plan;
+        }
+    }
+    if (index.components.size() == 4) {
+        plan.fits = false;
+        return plan;
+    }
+    plan.scaleDenominator = 8;
+    plan.grayscale = true;
+    plan.bytes = fixedBytes + frameBytes(size, 8, true);
+    plan.fits = fitsLocked(plan.bytes, Original);
+    return plan;
+}
+
+MemoryStats MemoryAccountant::stats() const {
+    QMutexLocker locker(&mutex);
+    MemoryStats result;
+    for (int category = 0; category < CategoryCount; ++category) {
+        result.current[category] = current[category];
+        result.peak[category] = peak[category];
+    }
+    result.total = total;
+    result.peakTotal = peakTotal;
+    result.budget = maxBytes;
+    result.fallbacks = fallbacks;
+    result.trims = trims;
+    return result;
+}
+
+void MemoryAccountant::resetPeaks() {
+    QMutexLocker locker(&mutex);
+    for (int category = 0; category < CategoryCount; ++category) {
+        peak[category] = current[category];
+    }
+    peakTotal = total;
+}
+
+const char* MemoryAccountant::categoryName(int category) {
+    switch (category) {
+        case Original:
+            return "original";
+        case Scans:
+            return "scans";
+        case Display:
+            return "display";
+        case Save:
+            return "save";
+        case Caches:
+            return "caches";
+        default:
+            return "unknown";
+    }
+}
+
+QString MemoryAccountant::summary() const {
+    const MemoryStats memory = stats();
+    QString result = QString("%1 MB (peak %2 MB)").arg(megabytes(memory.total)).arg(megabytes(memory.peakTotal));
+    if (memory.budget > 0) {
+        result += QString(" of %1 MB").arg(megabytes(memory.budget));
+    }
+    return result;
+}
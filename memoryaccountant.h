@@ -0,0 +1,135 @@
+#ifndef MEMORYACCOUNTANT_H
+#define MEMORYACCOUNTANT_H
+
+#include <QtCore/QMutex>
+#include <QtCore/QSize>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <functional>
+
+class JpegFileIndex;
+struct MemoryStats;
+
+// Масштаб и цветность декодирования, при которых кадр укладывается в бюджет
+struct MemoryDecodePlan {
+    int scaleDenominator = 1;   // не крупнее 1/scaleDenominator
+    bool grayscale = false;     // цветной файл декодируется только по яркости
+    bool fallback = false;      // запрошенное декодирование в бюджет не поместилось
+    bool fits = true;           // false - не помещается даже 1/8 в оттенках серого
+    qint64 bytes = 0;
+
+    QString toString() const;
+};
+
+// Учёт памяти под пиксели: исходное изображение, кадры сканов, копии
+// для экрана, буферы сохранения и кэши. Владельцы буферов сообщают размер
+// через MemoryCharge; бюджет (0 - без ограничения) проверяется перед
+// загрузкой: сначала сбрасываются кэши, затем уменьшается масштаб,
+// в последнюю очередь цвет. Потокобезопасен.
+class MemoryAccountant {
+public:
+    enum Category {
+        Original,   // декодированное изображение открытого файла
+        Scans,      // кадры сканов, ожидающие показа, и свободные буферы кадров
+        Display,    // копии в разрешении экрана
+        Save,       // изображение и буферы идущего сохранения
+        Caches      // кэши изображений, тайлов и миниатюр - сбрасываются первыми
+    };
+    static const int CategoryCount = Caches + 1;
+
+    static MemoryAccountant& instance();
+
+    void setBudget(qint64 bytes);
+    qint64 budget() const;
+
+    void add(Category category, qint64 bytes);
+
+    // Поместятся ли ещё bytes, не трогая кэши
+    bool fits(qint64 bytes) const;
+    // То же, но при нехватке сбрасывает кэши; exclude не считается занятым
+    // (например, исходное изображение, которое новый кадр заменит).
+    // Ничего не учитывает: место занимает MemoryCharge вызывающего
+    bool makeRoom(qint64 bytes, int exclude = CategoryCount);
+
+    // Кэш, который можно сбросить при нехватке памяти. Обработчик вызывается
+    // из любого потока и не должен ждать потока, снимающего обработчик
+    int addTrimHandler(const std::function<void()>& handler);
+    void removeTrimHandler(int id);
+
+    // Масштаб и цветность кадра файла для targetSize и исходного режима;
+    // при нехватке бюджета кэши сбрасываются. Кадр заменит исходное
+    // изображение, поэтому оно не считается занятым
+    MemoryDecodePlan planDecode(const JpegFileIndex& index, const QSize& targetSize, bool grayscaleOutput);
+    // Буфер коэффициентов libjpeg для многоскановых файлов: на всё
+    // изображение в полном разрешении при любом масштабе вывода
+    static qint64 coefficientBytes(const JpegFileIndex& index);
+
+    MemoryStats stats() const;
+    void resetPeaks();
+
+    static const char* categoryName(int category);
+    // "412 MB (peak 530 MB) of 512 MB"
+    QString summary() const;
+
+private:
+    struct TrimHandler {
+        int id;
+        std::function<void()> handler;
+    };
+
+    MemoryAccountant() = default;
+
+    mutable QMutex mutex;
+    qint64 current[CategoryCount] = {};
+    qint64 peak[CategoryCount] = {};
+    qint64 total = 0;
+    qint64 peakTotal = 0;
+    qint64 maxBytes = 0;
+    int fallbacks = 0;
+    int trims = 0;
+
+    // Отдельный мьютекс: обработчики сами вызывают add()
+    QMutex trimMutex;
+    QVector<TrimHandler> trimHandlers;
+    int nextTrimId = 1;
+
+    bool fitsLocked(qint64 bytes, int exclude) const;
+};
+
+struct MemoryStats {
+    qint64 current[MemoryAccountant::CategoryCount] = {};
+    qint64 peak[MemoryAccountant::CategoryCount] = {};
+    qint64 total = 0;
+    qint64 peakTotal = 0;
+    qint64 budget = 0;
+    int fallbacks = 0;      // загрузок в уменьшенном масштабе или в оттенках серого из-за бюджета
+    int trims = 0;          // сбросов кэшей
+};
+
+// Учтённые байты одного владельца; деструктор их возвращает.
+// Синхронизацию обеспечивает владелец.
+class MemoryCharge {
+public:
+    explicit MemoryCharge(MemoryAccountant::Category category, qint64 bytes = 0)
+        : category(category) { set(bytes); }
+    ~MemoryCharge() { set(0); }
+
+    MemoryCharge(const MemoryCharge&) = delete;
+    MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+    void set(qint64 bytes) {
+        bytes = qMax<qint64>(0, bytes);
+        if (bytes != charged) {
+            MemoryAccountant::instance().add(category, bytes - charged);
+            charged = bytes;
+        }
+    }
+    qint64 bytes() const { return charged; }
+
+private:
+    MemoryAccountant::Category category;
+    qint64 charged = 0;
+};
+
+#endif // MEMORYACCOUNTANT_H
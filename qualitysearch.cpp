@@ -0,0 +1,188 @@
+#include "qualitysearch.h"
+#include "imagemetrics.h"
+#include "jpegdecoder.h"
+#include "jpegstrategy.h"
+#include "memoryaccountant.h"
+#include "tracing.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QThread>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+#include <utility>
+
+namespace {
+
+struct Trial {
+    int quality = 0;
+    QByteArray jpeg;
+    bool measured = false;
+    double ssim = 0.0;
+    double psnr = 0.0;
+    QString error;
+};
+
+// Пробы видят только отмену: прогресс отдельных кодирований из разных
+// потоков вызывающему не нужен
+class CancelMonitor : public LoadMonitor {
+public:
+    explicit CancelMonitor(LoadMonitor* outer) : outer(outer) {}
+    void progress(int percent) override { Q_UNUSED(percent); }
+    bool isCancelled() const override { return outer && outer->isCancelled(); }
+
+private:
+    LoadMonitor* outer;
+};
+
+// Декодирует пробу и сравнивает с тем, что кодировалось
+bool measure(const QImage& image, Trial& trial, LoadMonitor* monitor) {
+    JpegDecoder decoder;
+    decoder.setLoadMonitor(monitor);
+    QImage decoded;
+    if (!decoder.open(trial.jpeg) || !decoder.decodeFinal(decoded)) {
+        trial.error = decoder.errorString();
+        return false;
+    }
+    MemoryCharge charge(MemoryAccountant::Save, decoded.sizeInBytes());
+    trial.ssim = ImageMetrics::ssim(image, decoded);
+    trial.psnr = ImageMetrics::psnr(image, decoded);
+    trial.measured = true;
+    return true;
+}
+
+} // namespace
+
+bool QualitySearch::search(const QImage& image, const QualityTarget& target, QualitySearchResult& result) {
+    result = QualitySearchResult();
+    lastError.clear();
+    if (image.isNull()) {
+        lastError = "No image to encode";
+        return false;
+    }
+    if (target.mode == QualityTarget::MaxBytes && target.maxBytes <= 0) {
+        lastError = "The size target must be positive";
+        return false;
+    }
+
+    TRACE_SCOPE("quality_search");
+    QElapsedTimer timer;
+    timer.start();
+
+    // Формат переводится один раз, а не в каждой пробе
+    QImage source = image;
+    MemoryCharge sourceCharge(MemoryAccountant::Save);
+    if (source.format() != QImage::Format_RGB32 && source.format() != QImage::Format_ARGB32 &&
+        source.format() != QImage::Format_Grayscale8) {
+        source = source.convertToFormat(QImage::Format_RGB32);
+        sourceCharge.set(source.sizeInBytes());
+    }
+
+    // Проба держит выходной буфер, а при поиске по SSIM ещё и декодированный кадр
+    const bool measureEach = target.mode == QualityTarget::MinSsim;
+    const qint64 pixels = static_cast<qint64>(source.width()) * source.height();
+    const qint64 trialBytes = pixels / 2 + (measureEach ? source.sizeInBytes() : 0);
+    int parallel = qMax(1, threadCount > 0 ? threadCount : QThread::idealThreadCount());
+    while (parallel > 1 && !MemoryAccountant::instance().fits(parallel * trialBytes)) {
+        parallel--;
+    }
+
+    // Пробы параллельны между собой, поэтому каждая кодируется в одном потоке;
+    // записывается ровно тот поток байт, который был измерен
+    JpegEncodeOptions trialOptions = options;
+    trialOptions.threads = 1;
+
+    CancelMonitor cancelMonitor(loadMonitor);
+    QThreadPool pool;
+    pool.setMaxThreadCount(parallel);
+    int low = 1;
+    int high = 100;
+    Trial best;
+    Trial fallback;
+    bool found = false;
+    while (low <= high) {
+        if (loadMonitor && loadMonitor->isCancelled()) {
+            lastError = "Cancelled";
+            return false;
+        }
+
+        // Точки делят оставшийся интервал на равные части; малый интервал проверяется целиком
+        const int remaining = high - low + 1;
+        QVector<Trial> trials(qMin(parallel, remaining));
+        for (int i = 0; i < trials.size(); ++i) {
+            trials[i].quality = remaining <= parallel ? low + i : low - 1 + remaining * (i + 1) / (parallel + 1);
+        }
+        {
+            TRACE_SCOPE("quality_search_round");
+            QtConcurrent::blockingMap(&pool, trials, [&](Trial& trial) {
+                JpegEncodeOptions encodeOptions = trialOptions;
+                encodeOptions.quality = trial.quality;
+                JpegEncoder encoder(encodeOptions);
+                encoder.setLoadMonitor(&cancelMonitor);
+                if (!encoder.encode(source, trial.jpeg)) {
+                    trial.error = encoder.errorString();
+                    return;
+                }
+                if (measureEach) {
+                    measure(source, trial, &cancelMonitor);
+                }
+            });
+        }
+        result.rounds++;
+        result.trials += trials.size();
+        if (cancelMonitor.isCancelled()) {
+            lastError = "Cancelled";
+            return false;
+        }
+
+        for (Trial& trial : trials) {
+            if (!trial.error.isEmpty()) {
+                lastError = QString("Quality %1: %2").arg(trial.quality).arg(trial.error);
+                return false;
+            }
+            const int quality = trial.quality;
+            if (measureEach ? trial.ssim >= target.minSsim : trial.jpeg.size() <= target.maxBytes) {
+                // По SSIM нужна наименьшая подходящая quality, по размеру - наибольшая
+                if (measureEach) {
+                    high = qMin(high, quality - 1);
+                } else {
+                    low = qMax(low, quality + 1);
+                }
+                if (!found || (measureEach ? quality < best.quality : quality > best.quality)) {
+                    best = std::move(trial);
+                    found = true;
+                    fallback = Trial();
+                }
+            } else {
+                if (measureEach) {
+                    low = qMax(low, quality + 1);
+                } else {
+                    high = qMin(high, quality - 1);
+                }
+                // Пока цель не достигнута, ближе всех к ней крайняя quality
+                if (!found && (fallback.quality == 0 ||
+                               (measureEach ? quality > fallback.quality : quality < fallback.quality))) {
+                    fallback = std::move(trial);
+                }
+            }
+        }
+        if (loadMonitor) {
+            loadMonitor->progress(qBound(0, 100 - qMax(0, high - low + 1), 100));
+        }
+    }
+
+    Trial& winner = found ? best : fallback;
+    if (!winner.measured && !measure(source, winner, &cancelMonitor)) {
+        lastError = winner.error;
+        return false;
+    }
+    result.options = trialOptions;
+    result.options.quality = winner.quality;
+    result.jpeg = std::move(winner.jpeg);
+    result.ssim = winner.ssim;
+    result.psnr = winner.psnr;
+    result.targetMet = found;
+    result.searchMs = timer.nsecsElapsed() / 1e6;
+    TRACE_COUNTER("quality_trials", result.trials);
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef QUALITYSEARCH_H
+#define QUALITYSEARCH_H
+
+#include "jpegencoder.h"
+#include <QtGui/QImage>
+#include <QtCore/QByteArray>
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+
+class LoadMonitor;
+
+// Что должно получиться вместо заданного вручную качества
+struct QualityTarget {
+    enum Mode {
+        MaxBytes,   // наибольшее качество, при котором файл не больше maxBytes
+        MinSsim     // наименьшее качество, при котором SSIM не ниже minSsim
+    };
+
+    Mode mode = MaxBytes;
+    qint64 maxBytes = 0;
+    double minSsim = 0.95;
+};
+
+struct QualitySearchResult {
+    JpegEncodeOptions options;  // с найденным quality
+    QByteArray jpeg;            // файл победителя, записывается без повторного кодирования
+    double ssim = 0.0;          // относительно исходного изображения
+    double psnr = 0.0;
+    bool targetMet = false;     // false - цель недостижима, jpeg - ближайший к ней вариант
+    int trials = 0;
+    int rounds = 0;
+    double searchMs = 0.0;
+};
+
+// Подбор качества под размер файла или SSIM. Каждый раунд кодирует в память
+// несколько значений quality из оставшегося интервала параллельно (по одному
+// потоку libjpeg на пробу) и сужает интервал, считая размер и SSIM
+// монотонными по quality. Число одновременных проб ограничено бюджетом памяти.
+class QualitySearch {
+public:
+    explicit QualitySearch(const JpegEncodeOptions& options = JpegEncodeOptions()) : options(options) {}
+
+    // 0 - QThread::idealThreadCount()
+    void setThreadCount(int count) { threadCount = qMax(0, count); }
+    // Отмена прерывает идущие пробы, прогресс - доля отброшенных значений quality.
+    // progress() вызывается из потока search()
+    void setLoadMonitor(LoadMonitor* monitor) { loadMonitor = monitor; }
+
+    bool search(const QImage& image, const QualityTarget& target, QualitySearchResult& result);
+
+    QString errorString() const { return lastError; }
+
+private:
+    JpegEncodeOptions options;
+    LoadMonitor* loadMonitor = nullptr;
+    int threadCount = 0;
+    QString lastError;
+};
+
+#endif // QUALITYSEARCH_H
@@ -0,0 +1,38 @@
+#include "scancache.h"
+#include <utility>
+
+void ScanCache::insert(int scan, QImage image) {
+    QImage& slot = entries[scan];
+    bytesInUse -= slot.sizeInBytes();
+    slot = std::move(image);
+    bytesInUse += slot.sizeInBytes();
+    peakBytes = qMax(peakBytes, bytesInUse);
+    charge.set(bytesInUse);
+}
+
+bool ScanCache::take(int scan, QImage& image) {
+    auto it = entries.find(scan);
+    if (it == entries.end()) {
+        return false;
+    }
+    image = std::move(it.value());
+    bytesInUse -= image.sizeInBytes();
+    entries.erase(it);
+    charge.set(bytesInUse);
+    return true;
+}
+
+void ScanCache::clear() {
+    entries.clear();
+    bytesInUse = 0;
+    charge.set(0);
+}
+
+ScanCacheStats ScanCache::stats() const {
+    ScanCacheStats result;
+    result.entries = entries.size();
+    result.bytesInUse = bytesInUse;
+    result.peakBytes = peakBytes;
+    result.budget = maxBytes;
+    return result;
+}
@@ -0,0 +1,51 @@
+#ifndef SCANCACHE_H
+#define SCANCACHE_H
+
+#include "memoryaccountant.h"
+#include <QtGui/QImage>
+#include <QtCore/QMap>
+#include <QtCore/QtGlobal>
+
+struct ScanCacheStats {
+    int hits = 0;
+    int misses = 0;
+    int entries = 0;
+    int precomputedScans = 0;
+    qint64 bytesInUse = 0;
+    qint64 peakBytes = 0;
+    qint64 budget = 0;
+};
+
+// Готовые кадры сканов по номеру скана с ограничением по памяти.
+// Синхронизацию обеспечивает владелец кэша.
+class ScanCache {
+public:
+    static const qint64 DefaultBudget = 256LL * 1024 * 1024;
+
+    explicit ScanCache(qint64 budget = DefaultBudget) : maxBytes(budget) {}
+
+    void setBudget(qint64 bytes) { maxBytes = qMax<qint64>(0, bytes); }
+    qint64 budget() const { return maxBytes; }
+
+    // Хотя бы один кадр помещается всегда, иначе предвычисление остановится;
+    // следующие - в пределах и своего бюджета, и общего бюджета памяти
+    bool canInsert(qint64 bytes) const {
+        return entries.isEmpty() || (bytesInUse + bytes <= maxBytes && MemoryAccountant::instance().fits(bytes));
+    }
+
+    void insert(int scan, QImage image);
+    bool contains(int scan) const { return entries.contains(scan); }
+    bool take(int scan, QImage& image);
+    void clear();
+
+    ScanCacheStats stats() const;
+
+private:
+    QMap<int, QImage> entries;
+    qint64 bytesInUse = 0;
+    qint64 peakBytes = 0;
+    qint64 maxBytes;
+    MemoryCharge charge{MemoryAccountant::Scans};
+};
+
+#endif // SCANCACHE_H
@@ -0,0 +1,350 @@
+#include "thumbnailpack.h"
+#include "jpegdecoder.h"
+#include "jpegencoder.h"
+#include "jpegindex.h"
+#include "jpegprobe.h"
+#include "jpegstrategy.h"
+#include "tracing.h"
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QLockFile>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QtEndian>
+#include <cstring>
+
+namespace {
+
+const char FileMagic[] = "JVTPACK1";
+const qint64 FileHeaderSize = 8;
+
+// Заголовок записи, числа в little-endian:
+// магия, длина пути, размер файла, время изменения, длина JPEG
+const quint32 RecordMagic = 0x5254564A;     // "JVTR"
+const qint64 RecordHeaderSize = 4 + 4 + 8 + 8 + 4;
+// Защита от мусора вместо заголовка
+const quint32 MaxPathBytes = 64 * 1024;
+const quint32 MaxJpegBytes = 16 * 1024 * 1024;
+
+// Сколько ждать блокировку, которую держит другой процесс
+const int LockTimeoutMs = 5000;
+
+QString lockFileName(const QString& packFileName) {
+    return packFileName + ".lock";
+}
+
+} // namespace
+
+ThumbnailPack::~ThumbnailPack() {
+    close();
+}
+
+QString ThumbnailPack::defaultFileName() {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/thumbnails.pack";
+}
+
+bool ThumbnailPack::open(const QString& filename, qint64 maxBytes) {
+    TRACE_SCOPE("open_thumbnail_pack");
+    close();
+    QMutexLocker locker(&mutex);
+
+    QDir().mkpath(QFileInfo(filename).absolutePath());
+    // Разбор, обрезка и начало заново - под блокировкой: другой процесс
+    // может в это время дописывать тот же пакет
+    QLockFile lock(lockFileName(filename));
+    if (!lock.tryLock(LockTimeoutMs)) {
+        lastError = "Thumbnail pack is locked by another process";
+        return false;
+    }
+    file.setFileName(filename);
+    if (!file.open(QIODevice::ReadWrite)) {
+        lastError = file.errorString();
+        return false;
+    }
+
+    const qint64 size = file.size();
+    if (size < FileHeaderSize || size > maxBytes || file.read(FileHeaderSize) != QByteArray(FileMagic)) {
+        // Чужой, повреждённый или разросшийся файл: начинаем заново
+        if (!file.resize(0) || !file.seek(0) || file.write(FileMagic, FileHeaderSize) != FileHeaderSize ||
+            !file.flush()) {
+            lastError = file.errorString();
+            file.close();
+            return false;
+        }
+    }
+    endOffset = FileHeaderSize;
+    if (!syncWithFile()) {
+        unmap();
+        entries.clear();
+        file.close();
+        return false;
+    }
+    TRACE_COUNTER("thumbnail_pack_entries", entries.size());
+    return true;
+}
+
+void ThumbnailPack::close() {
+    QMutexLocker locker(&mutex);
+    unmap();
+    if (file.isOpen()) {
+        file.close();
+    }
+    entries.clear();
+    endOffset = 0;
+    staleBytes = 0;
+}
+
+bool ThumbnailPack::isOpen() const {
+    QMutexLocker locker(&mutex);
+    return mapping != nullptr;
+}
+
+bool ThumbnailPack::remap() {
+    unmap();
+    mappedBytes = file.size();
+    mapping = mappedBytes > 0 ? file.map(0, mappedBytes) : nullptr;
+    if (!mapping) {
+        lastError = file.errorString();
+        mappedBytes = 0;
+        return false;
+    }
+    return true;
+}
+
+// Записи от endOffset до конца отображения; endOffset - конец последней целой
+void ThumbnailPack::readRecords() {
+    qint64 pos = endOffset;
+    while (pos + RecordHeaderSize <= mappedBytes) {
+        const uchar* header = mapping + pos;
+        const quint32 pathBytes = qFromLittleEndian<quint32>(header + 4);
+        const quint32 jpegBytes = qFromLittleEndian<quint32>(header + 24);
+        if (qFromLittleEndian<quint32>(header) != RecordMagic || pathBytes > MaxPathBytes ||
+            jpegBytes > MaxJpegBytes || pos + RecordHeaderSize + pathBytes + jpegBytes > mappedBytes) {
+            break;
+        }
+        const QString path = QString::fromUtf8(reinterpret_cast<const char*>(header + RecordHeaderSize),
+                                               static_cast<qsizetype>(pathBytes));
+        Entry entry;
+        entry.size = qFromLittleEndian<qint64>(header + 8);
+        entry.modified = qFromLittleEndian<qint64>(header + 16);
+        entry.offset = pos + RecordHeaderSize + pathBytes;
+        entry.length = jpegBytes;
+        const auto previous = entries.constFind(path);
+        if (previous != entries.constEnd()) {
+            staleBytes += previous->length;
+        }
+        entries.insert(path, entry);
+        pos = entry.offset + entry.length;
+    }
+    endOffset = pos;
+}
+
+// Только под блокировкой файла. Индекс догоняет настоящий конец файла:
+// другой процесс мог дописать записи, начать пакет заново или упасть
+// посреди записи, оставив оборванный хвост
+bool ThumbnailPack::syncWithFile() {
+    const qint64 size = file.size();
+    if (size < endOffset) {
+        entries.clear();
+        staleBytes = 0;
+        endOffset = FileHeaderSize;
+    }
+    if ((!mapping || size != mappedBytes) && !remap()) {
+        return false;
+    }
+    readRecords();
+    if (endOffset < mappedBytes) {
+        unmap();
+        if (!file.resize(endOffset) || !remap()) {
+            lastError = file.errorString();
+            return false;
+        }
+    }
+    return true;
+}
+
+void ThumbnailPack::unmap() {
+    if (mapping) {
+        file.unmap(mapping);
+        mapping = nullptr;
+    }
+    mappedBytes = 0;
+}
+
+bool ThumbnailPack::lookup(const ImageCacheKey& key, Entry& entry) const {
+    if (!mapping || !key.isValid()) {
+        return false;
+    }
+    const auto it = entries.constFind(key.path);
+    if (it == entries.constEnd() || it->size != key.size || it->modified != key.modified) {
+        return false;
+    }
+    entry = *it;
+    return true;
+}
+
+// Заголовок перед JPEG описывает ту же запись, что и индекс
+bool ThumbnailPack::recordMatches(const ImageCacheKey& key, const Entry& entry) const {
+    const QByteArray path = key.path.toUtf8();
+    const qint64 pos = entry.offset - path.size() - RecordHeaderSize;
+    if (pos < FileHeaderSize || entry.offset + entry.length > mappedBytes) {
+        return false;
+    }
+    const uchar* header = mapping + pos;
+    return qFromLittleEndian<quint32>(header) == RecordMagic &&
+           qFromLittleEndian<quint32>(header + 4) == static_cast<quint32>(path.size()) &&
+           qFromLittleEndian<qint64>(header + 8) == entry.size &&
+           qFromLittleEndian<qint64>(header + 16) == entry.modified &&
+           qFromLittleEndian<quint32>(header + 24) == static_cast<quint32>(entry.length) &&
+           std::memcmp(header + RecordHeaderSize, path.constData(), static_cast<size_t>(path.size())) == 0;
+}
+
+bool ThumbnailPack::contains(const ImageCacheKey& key) const {
+    QMutexLocker locker(&mutex);
+    Entry entry;
+    return lookup(key, entry);
+}
+
+bool ThumbnailPack::find(const ImageCacheKey& key, QImage& thumbnail) {
+    QByteArray jpeg;
+    {
+        QMutexLocker locker(&mutex);
+        if (!mapping) {
+            misses++;
+            return false;
+        }
+        // Проверка и копирование - под блокировкой файла: иначе другой
+        // процесс может между ними начать пакет заново или обрезать его
+        QLockFile lock(lockFileName(file.fileName()));
+        if (!lock.tryLock(LockTimeoutMs)) {
+            lastError = "Thumbnail pack is locked by another process";
+            misses++;
+            return false;
+        }
+        Entry entry;
+        if (!syncWithFile() || !lookup(key, entry) || !recordMatches(key, entry)) {
+            misses++;
+            return false;
+        }
+        // Копия: отображение может смениться, пока JPEG декодируется
+        jpeg = QByteArray(reinterpret_cast<const char*>(mapping + entry.offset), static_cast<qsizetype>(entry.length));
+        hits++;
+    }
+
+    TRACE_SCOPE("decode_packed_thumbnail");
+    JpegDecoder decoder;
+    decoder.setGrayscaleOutput(true);
+    return decoder.open(jpeg) && decoder.decodeFinal(thumbnail);
+}
+
+bool ThumbnailPack::insert(const ImageCacheKey& key, const QByteArray& jpeg) {
+    if (!key.isValid() || jpeg.isEmpty() || jpeg.size() > static_cast<qsizetype>(MaxJpegBytes)) {
+        return false;
+    }
+    const QByteArray path = key.path.toUtf8();
+    if (path.size() > static_cast<qsizetype>(MaxPathBytes)) {
+        return false;
+    }
+
+    // Запись собирается целиком и пишется одним вызовом
+    QByteArray record(RecordHeaderSize, Qt::Uninitialized);
+    uchar* header = reinterpret_cast<uchar*>(record.data());
+    qToLittleEndian<quint32>(RecordMagic, header);
+    qToLittleEndian<quint32>(static_cast<quint32>(path.size()), header + 4);
+    qToLittleEndian<qint64>(key.size, header + 8);
+    qToLittleEndian<qint64>(key.modified, header + 16);
+    qToLittleEndian<quint32>(static_cast<quint32>(jpeg.size()), header + 24);
+    record.append(path);
+    record.append(jpeg);
+
+    QMutexLocker locker(&mutex);
+    if (!mapping) {
+        return false;
+    }
+    QLockFile lock(lockFileName(file.fileName()));
+    if (!lock.tryLock(LockTimeoutMs)) {
+        lastError = "Thumbnail pack is locked by another process";
+        return false;
+    }
+    // endOffset мог устареть: запись идёт в настоящий конец файла
+    if (!syncWithFile()) {
+        return false;
+    }
+    if (!file.seek(endOffset) || file.write(record) != record.size() || !file.flush()) {
+        lastError = file.errorString();
+        // Недописанная запись будет отрезана при следующем открытии
+        return false;
+    }
+    Entry entry;
+    entry.size = key.size;
+    entry.modified = key.modified;
+    entry.offset = endOffset + RecordHeaderSize + path.size();
+    entry.length = jpeg.size();
+    const auto previous = entries.constFind(key.path);
+    if (previous != entries.constEnd()) {
+        staleBytes += previous->length;
+    }
+    entries.insert(key.path, entry);
+    endOffset += record.size();
+    appended++;
+    TRACE_COUNTER("bytes_written", record.size());
+    return true;
+}
+
+ThumbnailPackStats ThumbnailPack::stats() const {
+    QMutexLocker locker(&mutex);
+    ThumbnailPackStats result;
+    result.entries = entries.size();
+    result.hits = hits;
+    result.misses = misses;
+    result.appended = appended;
+    result.fileBytes = endOffset;
+    result.staleBytes = staleBytes;
+    return result;
+}
+
+QString ThumbnailPack::errorString() const {
+    QMutexLocker locker(&mutex);
+    return lastError;
+}
+
+bool ThumbnailPack::generate(const QString& filename, QImage& thumbnail, QByteArray& jpeg, LoadMonitor* monitor) {
+    if (monitor && monitor->isCancelled()) {
+        return false;
+    }
+    TRACE_SCOPE("generate_thumbnail");
+    MappedJpegFile file;
+    if (!file.open(filename) || !file.index().isValid()) {
+        return false;
+    }
+
+    // Встроенная миниатюра EXIF обходится без декодирования основного изображения
+    const QSize box(ThumbnailSize, ThumbnailSize);
+    QImage image;
+    JpegProbeInfo info;
+    if (JpegProbe::probe(file.data(), file.size(), info) && info.hasThumbnail() &&
+        qMax(info.thumbnailSize.width(), info.thumbnailSize.height()) >= ThumbnailSize) {
+        image = JpegProbe::thumbnail(file.data(), file.size(), info);
+    }
+    if (image.isNull()) {
+        JpegDecoder decoder;
+        decoder.setAutoTransform(true);
+        decoder.setGrayscaleOutput(true);
+        decoder.setLoadMonitor(monitor);
+        decoder.setTargetSize(box);
+        if (!decoder.open(file.bytes(), file.index()) || !decoder.decodeFinal(image)) {
+            return false;
+        }
+    }
+    if (image.width() > ThumbnailSize || image.height() > ThumbnailSize) {
+        image = image.scaled(box, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+
+    JpegEncodeOptions options;
+    options.quality = ThumbnailQuality;
+    JpegEncoder encoder(options);
+    if (!encoder.encode(image, jpeg)) {
+        return false;
+    }
+    thumbnail = image;
+    return true;
+}
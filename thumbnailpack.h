@@ -0,0 +1,95 @@
+#ifndef THUMBNAILPACK_H
+#define THUMBNAILPACK_H
+
+#include "imagecache.h"
+#include <QtGui/QImage>
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QtGlobal>
+
+class LoadMonitor;
+
+struct ThumbnailPackStats {
+    int entries = 0;
+    int hits = 0;
+    int misses = 0;
+    int appended = 0;
+    qint64 fileBytes = 0;
+    qint64 staleBytes = 0;      // записи, заменённые более новыми для того же пути
+};
+
+// Миниатюры всех просмотренных каталогов в одном файле, который только
+// дописывается: заголовок записи, путь в UTF-8 и миниатюра в JPEG. Файл
+// отображается в память; индекс по пути строится при открытии проходом
+// по заголовкам записей, сами миниатюры при этом не читаются. Запись
+// находится, только если размер и время изменения файла совпадают с
+// ключом. Оборванная последняя запись (сбой при дописывании) отрезается
+// при открытии. Потокобезопасен; открытие и дописывание из разных
+// процессов (просмотрщик и --thumbnails) разделяет QLockFile рядом
+// с пакетом; под ним же читается миниатюра, записи другого процесса
+// подхватываются при чтении и дописывании.
+class ThumbnailPack {
+public:
+    static const int ThumbnailSize = 160;       // по длинной стороне
+    static const int ThumbnailQuality = 85;
+    static const qint64 DefaultMaxBytes = 256LL * 1024 * 1024;
+
+    ThumbnailPack() = default;
+    ~ThumbnailPack();
+
+    ThumbnailPack(const ThumbnailPack&) = delete;
+    ThumbnailPack& operator=(const ThumbnailPack&) = delete;
+
+    // thumbnails.pack в каталоге кэша приложения
+    static QString defaultFileName();
+
+    // Пакет, выросший больше maxBytes, при открытии начинается заново
+    bool open(const QString& filename = defaultFileName(), qint64 maxBytes = DefaultMaxBytes);
+    void close();
+    bool isOpen() const;
+
+    bool contains(const ImageCacheKey& key) const;
+    bool find(const ImageCacheKey& key, QImage& thumbnail);
+    bool insert(const ImageCacheKey& key, const QByteArray& jpeg);
+
+    ThumbnailPackStats stats() const;
+    QString errorString() const;
+
+    // Миниатюра не больше ThumbnailSize, повёрнутая по EXIF: из встроенной
+    // миниатюры EXIF, если её хватает, иначе декодированием в уменьшенном
+    // масштабе DCT. jpeg - то, что кладётся в пакет
+    static bool generate(const QString& filename, QImage& thumbnail, QByteArray& jpeg,
+                         LoadMonitor* monitor = nullptr);
+
+private:
+    struct Entry {
+        qint64 size = 0;
+        qint64 modified = 0;
+        qint64 offset = 0;      // начало JPEG в файле
+        qint64 length = 0;
+    };
+
+    mutable QMutex mutex;
+    QFile file;
+    uchar* mapping = nullptr;
+    qint64 mappedBytes = 0;
+    qint64 endOffset = 0;       // конец последней целой записи
+    QHash<QString, Entry> entries;
+    int hits = 0;
+    int misses = 0;
+    int appended = 0;
+    qint64 staleBytes = 0;
+    QString lastError;
+
+    bool remap();
+    void unmap();
+    void readRecords();
+    bool syncWithFile();
+    bool lookup(const ImageCacheKey& key, Entry& entry) const;
+    bool recordMatches(const ImageCacheKey& key, const Entry& entry) const;
+};
+
+#endif // THUMBNAILPACK_H
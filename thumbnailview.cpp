@@ -0,0 +1,368 @@
+#include "thumbnailview.h"
+#include "tracing.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtWidgets/QScrollBar>
+#include <QtGui/QKeyEvent>
+#include <QtGui/QMouseEvent>
+#include <QtGui/QPainter>
+#include <QtGui/QPaintEvent>
+#include <QtCore/QDateTime>
+#include <QtCore/QDir>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMetaObject>
+#include <QtCore/QThread>
+
+ThumbnailView::ThumbnailView(QWidget *parent)
+    : QAbstractScrollArea(parent)
+{
+    // Без пакета миниатюры всё равно создаются, но не переживут перезапуск
+    pack.open();
+    thumbnails.setMaxCost(DefaultCacheBudget);
+    generatePool.setMaxThreadCount(QThread::idealThreadCount());
+    setFocusPolicy(Qt::StrongFocus);
+    verticalScrollBar()->setSingleStep(cellSize().height() / 4);
+}
+
+ThumbnailView::~ThumbnailView()
+{
+    cancelAll();
+    generatePool.waitForDone();
+}
+
+bool ThumbnailView::setDirectory(const QString& path)
+{
+    TRACE_SCOPE("list_directory");
+    cancelAll();
+    generation++;
+    thumbnails.clear();
+    thumbnailCharge.set(0);
+    failed.clear();
+    files.clear();
+    names.clear();
+    current = -1;
+    counters = ThumbnailViewStats();
+
+    const QDir dir(path);
+    if (!dir.exists()) {
+        currentDirectory.clear();
+        updateScrollBar();
+        viewport()->update();
+        return false;
+    }
+    currentDirectory = dir.absolutePath();
+
+    // Размер и время изменения - ключ записи в пакете; QFileInfo читает их
+    // stat на каждый файл при построении списка, один раз на каталог
+    const QFileInfoList entries = dir.entryInfoList(QStringList() << "*.jpg" << "*.jpeg",
+                                                    QDir::Files | QDir::Readable, QDir::Name | QDir::IgnoreCase);
+    files.reserve(entries.size());
+    for (const QFileInfo& info : entries) {
+        ImageCacheKey key;
+        key.path = info.absoluteFilePath();
+        key.size = info.size();
+        key.modified = info.lastModified().toMSecsSinceEpoch();
+        files.append(key);
+        names.append(info.fileName());
+    }
+    counters.files = files.size();
+
+    verticalScrollBar()->setValue(0);
+    updateScrollBar();
+    requestVisible();
+    viewport()->update();
+    emit statsChanged();
+    return true;
+}
+
+void ThumbnailView::setCurrentFile(const QString& filename)
+{
+    const QString path = QFileInfo(filename).absoluteFilePath();
+    for (int i = 0; i < files.size(); ++i) {
+        if (files[i].path == path) {
+            current = i;
+            ensureVisible(i);
+            viewport()->update();
+            return;
+        }
+    }
+}
+
+ThumbnailViewStats ThumbnailView::stats() const
+{
+    ThumbnailViewStats result = counters;
+    result.pending = tasks.size();
+    return result;
+}
+
+QSize ThumbnailView::cellSize() const
+{
+    return QSize(ThumbnailPack::ThumbnailSize + 2 * Spacing,
+                 ThumbnailPack::ThumbnailSize + LabelHeight + 2 * Spacing);
+}
+
+int ThumbnailView::columnCount() const
+{
+    return qMax(1, viewport()->width() / cellSize().width());
+}
+
+QRect ThumbnailView::cellRect(int index) const
+{
+    const QSize cell = cellSize();
+    const int columns = columnCount();
+    // Сетка по центру, остаток ширины - поровну по краям
+    const int left = qMax(0, (viewport()->width() - columns * cell.width()) / 2);
+    return QRect(left + (index % columns) * cell.width(),
+                 (index / columns) * cell.height() - verticalScrollBar()->value(),
+                 cell.width(), cell.height());
+}
+
+int ThumbnailView::indexAt(const QPoint& pos) const
+{
+    const QSize cell = cellSize();
+    const int columns = columnCount();
+    const int left = qMax(0, (viewport()->width() - columns * cell.width()) / 2);
+    if (pos.x() < left || pos.x() >= left + columns * cell.width()) {
+        return -1;
+    }
+    const int column = (pos.x() - left) / cell.width();
+    const int row = (pos.y() + verticalScrollBar()->value()) / cell.height();
+    const int index = row * columns + column;
+    return index >= 0 && index < files.size() ? index : -1;
+}
+
+void ThumbnailView::visibleRange(int& first, int& last) const
+{
+    const int rowHeight = cellSize().height();
+    const int columns = columnCount();
+    const int top = verticalScrollBar()->value();
+    first = top / rowHeight * columns;
+    last = qMin(static_cast<int>(files.size()),
+                ((top + viewport()->height() + rowHeight - 1) / rowHeight) * columns) - 1;
+}
+
+void ThumbnailView::updateScrollBar()
+{
+    const int rows = (static_cast<int>(files.size()) + columnCount() - 1) / columnCount();
+    verticalScrollBar()->setRange(0, qMax(0, rows * cellSize().height() - viewport()->height()));
+    verticalScrollBar()->setPageStep(viewport()->height());
+}
+
+void ThumbnailView::ensureVisible(int index)
+{
+    const QRect cell = cellRect(index);
+    if (cell.top() < 0) {
+        verticalScrollBar()->setValue(verticalScrollBar()->value() + cell.top());
+    } else if (cell.bottom() >= viewport()->height()) {
+        verticalScrollBar()->setValue(verticalScrollBar()->value() + cell.bottom() - viewport()->height() + 1);
+    }
+}
+
+void ThumbnailView::requestVisible()
+{
+    int first = 0;
+    int last = -1;
+    visibleRange(first, last);
+
+    // Из пакета - сразу: маленький JPEG декодируется за доли миллисекунды
+    QSet<QString> wanted;
+    for (int i = first; i <= last; ++i) {
+        const ImageCacheKey& key = files[i];
+        if (thumbnails.contains(key.path) || failed.contains(key.path)) {
+            continue;
+        }
+        QImage thumbnail;
+        if (pack.find(key, thumbnail)) {
+            thumbnails.insert(key.path, new QImage(thumbnail), qMax<qint64>(1, thumbnail.sizeInBytes()));
+            counters.fromPack++;
+            continue;
+        }
+        wanted.insert(key.path);
+    }
+    thumbnailCharge.set(thumbnails.totalCost());
+
+    // Ушедшие из вида запросы отменяются; начатое декодирование прерывается
+    for (auto it = tasks.begin(); it != tasks.end();) {
+        if (!wanted.contains(it.key())) {
+            it.value()->cancelled = true;
+            it = tasks.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Сверху вниз: пул выполняет задачи в порядке постановки
+    const int forGeneration = generation;
+    for (int i = first; i <= last; ++i) {
+        const ImageCacheKey key = files[i];
+        if (!wanted.contains(key.path) || tasks.contains(key.path)) {
+            continue;
+        }
+        std::shared_ptr<Task> task = std::make_shared<Task>();
+        task->future = QtConcurrent::run(&generatePool, [this, key, task, forGeneration]() {
+            // Пока задача ждала очереди, ячейка могла уйти из вида
+            if (task->isCancelled()) {
+                return;
+            }
+            QImage thumbnail;
+            QByteArray jpeg;
+            if (ThumbnailPack::generate(key.path, thumbnail, jpeg, task.get())) {
+                pack.insert(key, jpeg);
+            } else if (task->isCancelled()) {
+                return;
+            }
+            deliver(forGeneration, task, key.path, thumbnail);
+        });
+        tasks.insert(key.path, task);
+    }
+    emit statsChanged();
+}
+
+void ThumbnailView::cancelAll()
+{
+    for (const std::shared_ptr<Task>& task : tasks) {
+        task->cancelled = true;
+    }
+    tasks.clear();
+}
+
+void ThumbnailView::deliver(int forGeneration, const std::shared_ptr<Task>& task, const QString& path,
+                            const QImage& thumbnail)
+{
+    QMetaObject::invokeMethod(this, [this, forGeneration, task, path, thumbnail]() {
+        if (forGeneration != generation) {
+            return;
+        }
+        if (tasks.value(path) == task) {
+            tasks.remove(path);
+        }
+        // Готовое пригодится, даже если ячейку успели прокрутить
+        if (thumbnail.isNull()) {
+            failed.insert(path);
+            counters.failed++;
+        } else {
+            thumbnails.insert(path, new QImage(thumbnail), qMax<qint64>(1, thumbnail.sizeInBytes()));
+            thumbnailCharge.set(thumbnails.totalCost());
+            counters.generated++;
+        }
+        viewport()->update();
+        emit statsChanged();
+    }, Qt::QueuedConnection);
+}
+
+void ThumbnailView::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(viewport());
+    painter.fillRect(event->rect(), QColor(0x2b, 0x2b, 0x2b));
+    if (files.isEmpty()) {
+        painter.setPen(Qt::lightGray);
+        painter.drawText(viewport()->rect(), Qt::AlignCenter, "No JPEG files in this folder");
+        return;
+    }
+
+    int first = 0;
+    int last = -1;
+    visibleRange(first, last);
+    const int size = ThumbnailPack::ThumbnailSize;
+    for (int i = first; i <= last; ++i) {
+        const QRect cell = cellRect(i);
+        if (!cell.intersects(event->rect())) {
+            continue;
+        }
+        if (i == current) {
+            painter.fillRect(cell.adjusted(2, 2, -2, -2), QColor(0x3d, 0x5a, 0x80));
+        }
+        const QRect box(cell.x() + Spacing, cell.y() + Spacing, size, size);
+        const QImage* thumbnail = thumbnails.object(files[i].path);
+        if (thumbnail) {
+            const QSize fitted = thumbnail->size().scaled(box.size(), Qt::KeepAspectRatio);
+            const QRect target(box.x() + (size - fitted.width()) / 2, box.y() + (size - fitted.height()) / 2,
+                               fitted.width(), fitted.height());
+            painter.drawImage(target, *thumbnail);
+        } else {
+            painter.setPen(QColor(0x55, 0x55, 0x55));
+            painter.drawRect(box.adjusted(0, 0, -1, -1));
+            if (failed.contains(files[i].path)) {
+                painter.setPen(Qt::lightGray);
+                painter.drawText(box, Qt::AlignCenter, "?");
+            }
+        }
+        const QRect label(cell.x() + 2, box.bottom() + 2, cell.width() - 4, LabelHeight);
+        painter.setPen(Qt::lightGray);
+        painter.drawText(label, Qt::AlignCenter,
+                         fontMetrics().elidedText(names[i], Qt::ElideMiddle, label.width()));
+    }
+}
+
+void ThumbnailView::resizeEvent(QResizeEvent *event)
+{
+    QAbstractScrollArea::resizeEvent(event);
+    updateScrollBar();
+    requestVisible();
+}
+
+void ThumbnailView::scrollContentsBy(int dx, int dy)
+{
+    Q_UNUSED(dx);
+    Q_UNUSED(dy);
+    requestVisible();
+    viewport()->update();
+}
+
+void ThumbnailView::mousePressEvent(QMouseEvent *event)
+{
+    const int index = indexAt(event->position().toPoint());
+    if (index >= 0 && index != current) {
+        current = index;
+        viewport()->update();
+    }
+}
+
+void ThumbnailView::mouseDoubleClickEvent(QMouseEvent *event)
+{
+    const int index = indexAt(event->position().toPoint());
+    if (index >= 0 && event->button() == Qt::LeftButton) {
+        emit fileActivated(files[index].path);
+    }
+}
+
+void ThumbnailView::keyPressEvent(QKeyEvent *event)
+{
+    if (files.isEmpty()) {
+        QAbstractScrollArea::keyPressEvent(event);
+        return;
+    }
+    const int columns = columnCount();
+    int index = current < 0 ? 0 : current;
+    switch (event->key()) {
+    case Qt::Key_Left:
+        index--;
+        break;
+    case Qt::Key_Right:
+        index++;
+        break;
+    case Qt::Key_Up:
+        index -= columns;
+        break;
+    case Qt::Key_Down:
+        index += columns;
+        break;
+    case Qt::Key_Home:
+        index = 0;
+        break;
+    case Qt::Key_End:
+        index = static_cast<int>(files.size()) - 1;
+        break;
+    case Qt::Key_Return:
+    case Qt::Key_Enter:
+        if (current >= 0) {
+            emit fileActivated(files[current].path);
+        }
+        return;
+    default:
+        QAbstractScrollArea::keyPressEvent(event);
+        return;
+    }
+    current = qBound(0, index, static_cast<int>(files.size()) - 1);
+    ensureVisible(current);
+    viewport()->update();
+}
@@ -0,0 +1,103 @@
+#ifndef THUMBNAILVIEW_H
+#define THUMBNAILVIEW_H
+
+#include "imagecache.h"
+#include "jpegstrategy.h"
+#include "memoryaccountant.h"
+#include "thumbnailpack.h"
+#include <QtWidgets/QAbstractScrollArea>
+#include <QtGui/QImage>
+#include <QtCore/QCache>
+#include <QtCore/QFuture>
+#include <QtCore/QMap>
+#include <QtCore/QRect>
+#include <QtCore/QSet>
+#include <QtCore/QString>
+#include <QtCore/QStringList>
+#include <QtCore/QThreadPool>
+#include <QtCore/QVector>
+#include <atomic>
+#include <memory>
+
+struct ThumbnailViewStats {
+    int files = 0;
+    int fromPack = 0;       // прочитано из ThumbnailPack
+    int generated = 0;
+    int failed = 0;
+    int pending = 0;        // в очереди или в работе
+};
+
+// Сетка миниатюр каталога. Запрашиваются только видимые ячейки: готовые
+// берутся из ThumbnailPack, недостающие создаются параллельно в уменьшенном
+// масштабе DCT и дописываются в пакет. Запросы ячеек, ушедших из вида при
+// прокрутке, отменяются. Двойной щелчок или Enter открывает файл.
+class ThumbnailView : public QAbstractScrollArea
+{
+    Q_OBJECT
+
+public:
+    static const int Spacing = 8;
+    static const int LabelHeight = 18;
+    static const qint64 DefaultCacheBudget = 64LL * 1024 * 1024;
+
+    explicit ThumbnailView(QWidget *parent = nullptr);
+    ~ThumbnailView();
+
+    bool setDirectory(const QString& path);
+    QString directory() const { return currentDirectory; }
+    // Выделяет файл и прокручивает к нему
+    void setCurrentFile(const QString& filename);
+
+    ThumbnailViewStats stats() const;
+    ThumbnailPackStats packStats() const { return pack.stats(); }
+
+signals:
+    void fileActivated(const QString& filename);
+    void statsChanged();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void scrollContentsBy(int dx, int dy) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseDoubleClickEvent(QMouseEvent *event) override;
+    void keyPressEvent(QKeyEvent *event) override;
+
+private:
+    class Task : public LoadMonitor {
+    public:
+        void progress(int percent) override { Q_UNUSED(percent); }
+        bool isCancelled() const override { return cancelled.load(); }
+        std::atomic_bool cancelled{false};
+        QFuture<void> future;
+    };
+
+    ThumbnailPack pack;
+    QString currentDirectory;
+    QVector<ImageCacheKey> files;
+    QStringList names;
+    int current = -1;
+
+    // Декодированные миниатюры по пути, только в потоке интерфейса; при
+    // нехватке памяти не сбрасываются - их бюджет мал и сброс нужен из любого потока
+    QCache<QString, QImage> thumbnails;
+    MemoryCharge thumbnailCharge{MemoryAccountant::Caches};
+    QSet<QString> failed;
+    QThreadPool generatePool;
+    QMap<QString, std::shared_ptr<Task>> tasks;
+    int generation = 0;     // смена каталога отбрасывает запоздавшие результаты
+    ThumbnailViewStats counters;
+
+    QSize cellSize() const;
+    int columnCount() const;
+    QRect cellRect(int index) const;
+    int indexAt(const QPoint& pos) const;
+    void visibleRange(int& first, int& last) const;
+    void updateScrollBar();
+    void ensureVisible(int index);
+    void requestVisible();
+    void cancelAll();
+    void deliver(int forGeneration, const std::shared_ptr<Task>& task, const QString& path, const QImage& thumbnail);
+};
+
+#endif // THUMBNAILVIEW_H
@@ -0,0 +1,63 @@
+#include "tilecache.h"
+
+TileCache::TileCache(qint64 budget) {
+    tiles.setMaxCost(qMax<qint64>(0, budget));
+    trimHandler = MemoryAccountant::instance().addTrimHandler([this]() { clear(); });
+}
+
+TileCache::~TileCache() {
+    MemoryAccountant::instance().removeTrimHandler(trimHandler);
+}
+
+void TileCache::setBudget(qint64 bytes) {
+    QMutexLocker locker(&mutex);
+    tiles.setMaxCost(qMax<qint64>(0, bytes));
+    charge.set(tiles.totalCost());
+}
+
+qint64 TileCache::budget() const {
+    QMutexLocker locker(&mutex);
+    return tiles.maxCost();
+}
+
+void TileCache::insert(const TileKey& key, const QImage& tile) {
+    QMutexLocker locker(&mutex);
+    tiles.insert(key.pack(), new QImage(tile), qMax<qint64>(1, tile.sizeInBytes()));
+    peakBytes = qMax<qint64>(peakBytes, tiles.totalCost());
+    charge.set(tiles.totalCost());
+}
+
+bool TileCache::find(const TileKey& key, QImage& tile) {
+    QMutexLocker locker(&mutex);
+    const QImage* cached = tiles.object(key.pack());
+    if (!cached) {
+        misses++;
+        return false;
+    }
+    hits++;
+    tile = *cached;
+    return true;
+}
+
+bool TileCache::contains(const TileKey& key) const {
+    QMutexLocker locker(&mutex);
+    return tiles.contains(key.pack());
+}
+
+void TileCache::clear() {
+    QMutexLocker locker(&mutex);
+    tiles.clear();
+    charge.set(0);
+}
+
+TileCacheStats TileCache::stats() const {
+    QMutexLocker locker(&mutex);
+    TileCacheStats result;
+    result.hits = hits;
+    result.misses = misses;
+    result.entries = tiles.count();
+    result.bytesInUse = tiles.totalCost();
+    result.peakBytes = peakBytes;
+    result.budget = tiles.maxCost();
+    return result;
+}
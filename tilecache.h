@@ -0,0 +1,63 @@
+#ifndef TILECACHE_H
+#define TILECACHE_H
+
+#include "memoryaccountant.h"
+#include <QtGui/QImage>
+#include <QtCore/QCache>
+#include <QtCore/QMutex>
+#include <QtCore/QtGlobal>
+
+struct TileKey {
+    int level = 0;      // изображение уменьшено в 2^level раз
+    int column = 0;
+    int row = 0;
+
+    quint64 pack() const {
+        return (static_cast<quint64>(level) << 56) | (static_cast<quint64>(column) << 28) | static_cast<quint64>(row);
+    }
+};
+
+struct TileCacheStats {
+    int hits = 0;
+    int misses = 0;
+    int entries = 0;
+    qint64 bytesInUse = 0;
+    qint64 peakBytes = 0;
+    qint64 budget = 0;
+};
+
+// Тайлы, вытесняемые по давности использования при превышении бюджета.
+// При нехватке общего бюджета MemoryAccountant сбрасывается: видимые тайлы
+// декодируются заново. Потокобезопасен: тайлы добавляются из фонового декодирования.
+class TileCache {
+public:
+    static const qint64 DefaultBudget = 128LL * 1024 * 1024;
+
+    explicit TileCache(qint64 budget = DefaultBudget);
+    ~TileCache();
+
+    TileCache(const TileCache&) = delete;
+    TileCache& operator=(const TileCache&) = delete;
+
+    void setBudget(qint64 bytes);
+    qint64 budget() const;
+
+    void insert(const TileKey& key, const QImage& tile);
+    bool find(const TileKey& key, QImage& tile);
+    // Без учёта в статистике и без изменения порядка вытеснения
+    bool contains(const TileKey& key) const;
+    void clear();
+
+    TileCacheStats stats() const;
+
+private:
+    mutable QMutex mutex;
+    QCache<quint64, QImage> tiles;
+    int hits = 0;
+    int misses = 0;
+    qint64 peakBytes = 0;
+    MemoryCharge charge{MemoryAccountant::Caches};
+    int trimHandler = 0;
+};
+
+#endif // TILECACHE_H
@@ -0,0 +1,436 @@
+#include "tiledimageview.h"
+#include "jpegregiondecoder.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtGui/QMouseEvent>
+#include <QtGui/QPainter>
+#include <QtGui/QPaintEvent>
+#include <QtGui/QWheelEvent>
+#include <QtCore/QtGlobal>
+#include <cmath>
+#include <functional>
+
+namespace {
+
+const double MaximumScale = 16.0;
+
+// Усреднение полосы из factor строк в одну строку шириной ceil(width / factor)
+void downsampleBand(const QImage& band, int factor, QRgb* out, int outWidth) {
+    const int width = band.width();
+    for (int ox = 0; ox < outWidth; ++ox) {
+        const int x0 = ox * factor;
+        const int x1 = qMin(width, x0 + factor);
+        int r = 0, g = 0, b = 0;
+        for (int y = 0; y < band.height(); ++y) {
+            const QRgb* line = reinterpret_cast<const QRgb*>(band.constScanLine(y));
+            for (int x = x0; x < x1; ++x) {
+                r += qRed(line[x]);
+                g += qGreen(line[x]);
+                b += qBlue(line[x]);
+            }
+        }
+        const int count = qMax(1, (x1 - x0) * band.height());
+        out[ox] = qRgb(r / count, g / count, b / count);
+    }
+}
+
+// Декодирует прямоугольник тайлов уровня level одним проходом libjpeg и
+// складывает их в кэш по мере готовности каждой строки тайлов;
+// false - декодирование прервано ошибкой или отменой
+bool decodeTiles(const QByteArray& data, int level, const QRect& tiles, const QSize& levelSize,
+                 TileCache& cache, const std::function<bool()>& cancelled,
+                 const std::function<void()>& rowReady) {
+    const int tileSize = TiledImageView::TileSize;
+    const int denominator = 1 << level;
+    const int jpegScale = qMin(denominator, 8);
+    const int factor = denominator / jpegScale;
+
+    const QRect levelArea = QRect(tiles.left() * tileSize, tiles.top() * tileSize,
+                                  tiles.width() * tileSize, tiles.height() * tileSize)
+                            & QRect(QPoint(0, 0), levelSize);
+    if (levelArea.isEmpty()) {
+        return true;
+    }
+    const QRect jpegArea(levelArea.x() * factor, levelArea.y() * factor,
+                         levelArea.width() * factor, levelArea.height() * factor);
+
+    JpegRegionDecoder decoder;
+    if (cancelled() || !decoder.open(data)) {
+        return false;
+    }
+    decoder.setCancelCheck(cancelled);
+
+    int tileRow = tiles.top();
+    int stripRow = 0;
+    QImage strip;
+    auto newStrip = [&]() {
+        const int rowsLeft = levelArea.y() + levelArea.height() - tileRow * tileSize;
+        strip = QImage(levelArea.width(), qMin(tileSize, rowsLeft), QImage::Format_RGB32);
+        stripRow = 0;
+    };
+    auto flushStrip = [&]() {
+        for (int column = tiles.left(); column <= tiles.right(); ++column) {
+            const int x = column * tileSize - levelArea.x();
+            if (x >= strip.width()) {
+                break;
+            }
+            TileKey key;
+            key.level = level;
+            key.column = column;
+            key.row = tileRow;
+            cache.insert(key, strip.copy(x, 0, qMin(tileSize, strip.width() - x), strip.height()));
+        }
+        tileRow++;
+        rowReady();
+    };
+
+    if (factor == 1) {
+        // Полоса высотой в тайл и есть строка тайлов
+        return decoder.decodeRegion(jpegArea, jpegScale, tileSize, [&](const QImage& band, int) {
+            if (cancelled()) {
+                return false;
+            }
+            strip = band;
+            flushStrip();
+            return true;
+        });
+    }
+
+    newStrip();
+    return decoder.decodeRegion(jpegArea, jpegScale, factor, [&](const QImage& band, int) {
+        if (cancelled()) {
+            return false;
+        }
+        downsampleBand(band, factor, reinterpret_cast<QRgb*>(strip.scanLine(stripRow)), strip.width());
+        if (++stripRow == strip.height()) {
+            flushStrip();
+            if (tileRow * tileSize < levelArea.y() + levelArea.height()) {
+                newStrip();
+            }
+        }
+        return true;
+    });
+}
+
+} // namespace
+
+TiledImageView::TiledImageView(QWidget *parent)
+    : QWidget(parent)
+{
+    decodePool.setMaxThreadCount(1);
+    setCursor(Qt::OpenHandCursor);
+}
+
+TiledImageView::~TiledImageView()
+{
+    cancelDecoding(true);
+}
+
+bool TiledImageView::setFile(const QSharedPointer<MappedJpegFile>& newFile)
+{
+    // Тайлы прежнего файла не должны попасть в кэш после очистки
+    cancelDecoding(true);
+    cache.clear();
+    requestedLevel = -1;
+    requestDone = false;
+
+    if (!newFile || !newFile->index().isValid()) {
+        clear();
+        return false;
+    }
+    file = newFile;
+    fullSize = file->index().size;
+
+    maxLevel = 0;
+    while (maxLevel < 20) {
+        const QSize size = levelSize(maxLevel);
+        if (size.width() <= TileSize && size.height() <= TileSize) {
+            break;
+        }
+        maxLevel++;
+    }
+
+    fitToView();
+    return true;
+}
+
+void TiledImageView::clear()
+{
+    cancelDecoding(true);
+    cache.clear();
+    file.reset();
+    fullSize = QSize();
+    requestedLevel = -1;
+    update();
+}
+
+void TiledImageView::fitToView()
+{
+    if (fullSize.isEmpty() || width() <= 0 || height() <= 0) {
+        return;
+    }
+    scale = qMin(static_cast<double>(width()) / fullSize.width(),
+                 static_cast<double>(height()) / fullSize.height());
+    fitted = true;
+    viewMoved();
+}
+
+int TiledImageView::levelForScale() const
+{
+    if (scale >= 1.0) {
+        return 0;
+    }
+    const int level = static_cast<int>(std::floor(std::log2(1.0 / scale)));
+    return qBound(0, level, maxLevel);
+}
+
+QSize TiledImageView::levelSize(int level) const
+{
+    const int denominator = 1 << level;
+    const int jpegScale = qMin(denominator, 8);
+    const int factor = denominator / jpegScale;
+    const int width = (fullSize.width() + jpegScale - 1) / jpegScale;
+    const int height = (fullSize.height() + jpegScale - 1) / jpegScale;
+    return QSize((width + factor - 1) / factor, (height + factor - 1) / factor);
+}
+
+double TiledImageView::minimumScale() const
+{
+    if (fullSize.isEmpty()) {
+        return 1.0;
+    }
+    const double fitScale = qMin(static_cast<double>(width()) / fullSize.width(),
+                                 static_cast<double>(height()) / fullSize.height());
+    return qMin(fitScale, 1.0);
+}
+
+void TiledImageView::clampOrigin()
+{
+    const double viewWidth = width() / scale;
+    const double viewHeight = height() / scale;
+    if (viewWidth >= fullSize.width()) {
+        origin.setX(-(viewWidth - fullSize.width()) / 2);
+    } else {
+        origin.setX(qBound(0.0, origin.x(), fullSize.width() - viewWidth));
+    }
+    if (viewHeight >= fullSize.height()) {
+        origin.setY(-(viewHeight - fullSize.height()) / 2);
+    } else {
+        origin.setY(qBound(0.0, origin.y(), fullSize.height() - viewHeight));
+    }
+}
+
+void TiledImageView::viewMoved()
+{
+    clampOrigin();
+    requestDone = false;
+    update();
+    emit viewChanged();
+}
+
+void TiledImageView::cancelDecoding(bool wait)
+{
+    if (cancelFlag) {
+        cancelFlag->store(true);
+    }
+    requestGeneration++;
+    if (wait) {
+        decodeFuture.waitForFinished();
+    }
+    requestRunning = false;
+}
+
+bool TiledImageView::tilesCached(int level, const QRect& tiles) const
+{
+    for (int row = tiles.top(); row <= tiles.bottom(); ++row) {
+        for (int column = tiles.left(); column <= tiles.right(); ++column) {
+            TileKey key;
+            key.level = level;
+            key.column = column;
+            key.row = row;
+            if (!cache.contains(key)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void TiledImageView::requestTiles(int level, const QRect& tiles)
+{
+    // Прежний запрос прерывается внутри libjpeg и уступает пул новому сам
+    cancelDecoding(false);
+    requestedLevel = level;
+    requestedTiles = tiles;
+    requestRunning = true;
+    requestDone = false;
+    requestFailed = false;
+
+    std::shared_ptr<std::atomic_bool> cancelled = std::make_shared<std::atomic_bool>(false);
+    cancelFlag = cancelled;
+    const int generation = requestGeneration;
+    const QSharedPointer<MappedJpegFile> source = file;
+    const QSize size = levelSize(level);
+
+    decodeFuture = QtConcurrent::run(&decodePool, [this, source, level, tiles, size, cancelled, generation]() {
+        const bool complete = decodeTiles(
+            source->bytes(), level, tiles, size, cache,
+            [cancelled]() { return cancelled->load(); },
+            [this]() { QMetaObject::invokeMethod(this, [this]() { update(); }, Qt::QueuedConnection); });
+        QMetaObject::invokeMethod(this, [this, cancelled, generation, complete]() {
+            if (cancelled->load() || generation != requestGeneration) {
+                return;
+            }
+            requestRunning = false;
+            // Неудачный запрос не повторяется до сдвига вида; удачный считается
+            // готовым, только пока его тайлы не вытеснены из кэша
+            requestFailed = !complete;
+            requestDone = requestFailed || tilesCached(requestedLevel, requestedTiles);
+            emit viewChanged();
+            update();
+        }, Qt::QueuedConnection);
+    });
+}
+
+bool TiledImageView::drawFromCoarserLevel(QPainter& painter, int level, int column, int row, const QRectF& target)
+{
+    const QSize size = levelSize(level);
+    const QRect tileRect(column * TileSize, row * TileSize,
+                         qMin(TileSize, size.width() - column * TileSize),
+                         qMin(TileSize, size.height() - row * TileSize));
+    for (int coarse = level + 1; coarse <= maxLevel; ++coarse) {
+        const int shift = coarse - level;
+        TileKey key;
+        key.level = coarse;
+        key.column = column >> shift;
+        key.row = row >> shift;
+        QImage tile;
+        if (!cache.contains(key) || !cache.find(key, tile)) {
+            continue;
+        }
+        const double factor = 1 << shift;
+        const QRectF source(tileRect.x() / factor - key.column * TileSize, tileRect.y() / factor - key.row * TileSize,
+                            tileRect.width() / factor, tileRect.height() / factor);
+        painter.drawImage(target, tile, source);
+        return true;
+    }
+    return false;
+}
+
+void TiledImageView::paintEvent(QPaintEvent *event)
+{
+    QPainter painter(this);
+    painter.fillRect(event->rect(), QColor(0x2b, 0x2b, 0x2b));
+    if (!file) {
+        painter.setPen(Qt::lightGray);
+        painter.drawText(rect(), Qt::AlignCenter, "No image loaded");
+        return;
+    }
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+
+    const int level = levelForScale();
+    const int denominator = 1 << level;
+    const QSize size = levelSize(level);
+    const int columns = (size.width() + TileSize - 1) / TileSize;
+    const int rows = (size.height() + TileSize - 1) / TileSize;
+    const double levelScale = scale * denominator;
+
+    // Перерисовываются только тайлы, попадающие в грязную область
+    const QRectF dirty = event->rect();
+    const double left = (origin.x() + dirty.left() / scale) / denominator;
+    const double top = (origin.y() + dirty.top() / scale) / denominator;
+    const double right = (origin.x() + dirty.right() / scale) / denominator;
+    const double bottom = (origin.y() + dirty.bottom() / scale) / denominator;
+    const int firstColumn = qBound(0, static_cast<int>(std::floor(left / TileSize)), columns - 1);
+    const int lastColumn = qBound(0, static_cast<int>(std::floor(right / TileSize)), columns - 1);
+    const int firstRow = qBound(0, static_cast<int>(std::floor(top / TileSize)), rows - 1);
+    const int lastRow = qBound(0, static_cast<int>(std::floor(bottom / TileSize)), rows - 1);
+
+    QRect missing;
+    for (int row = firstRow; row <= lastRow; ++row) {
+        for (int column = firstColumn; column <= lastColumn; ++column) {
+            const int tileWidth = qMin(TileSize, size.width() - column * TileSize);
+            const int tileHeight = qMin(TileSize, size.height() - row * TileSize);
+            const QRectF target((column * TileSize * denominator - origin.x()) * scale,
+                                (row * TileSize * denominator - origin.y()) * scale,
+                                tileWidth * levelScale, tileHeight * levelScale);
+            TileKey key;
+            key.level = level;
+            key.column = column;
+            key.row = row;
+            QImage tile;
+            if (cache.find(key, tile)) {
+                painter.drawImage(target, tile);
+            } else {
+                drawFromCoarserLevel(painter, level, column, row, target);
+                missing |= QRect(column, row, 1, 1);
+            }
+        }
+    }
+
+    if (!missing.isNull()) {
+        // Готовый запрос с недостающими тайлами - их вытеснили из кэша
+        if (requestDone && !requestFailed) {
+            requestDone = false;
+        }
+        const bool sameRequest = level == requestedLevel && requestedTiles.contains(missing);
+        if (!sameRequest || !(requestRunning || requestDone)) {
+            requestTiles(level, missing);
+        }
+    }
+}
+
+void TiledImageView::resizeEvent(QResizeEvent *event)
+{
+    QWidget::resizeEvent(event);
+    if (fitted) {
+        fitToView();
+    } else {
+        viewMoved();
+    }
+}
+
+void TiledImageView::wheelEvent(QWheelEvent *event)
+{
+    if (!file) {
+        return;
+    }
+    const double steps = event->angleDelta().y() / 120.0;
+    const double newScale = qBound(minimumScale(), scale * std::pow(1.25, steps), MaximumScale);
+    const QPointF anchor = event->position();
+    const QPointF imagePoint = origin + anchor / scale;
+    scale = newScale;
+    origin = imagePoint - anchor / scale;
+    fitted = false;
+    viewMoved();
+    event->accept();
+}
+
+void TiledImageView::mousePressEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton) {
+        dragging = true;
+        dragStart = event->position();
+        dragOrigin = origin;
+        setCursor(Qt::ClosedHandCursor);
+    } else if (event->button() == Qt::RightButton) {
+        fitToView();
+    }
+}
+
+void TiledImageView::mouseMoveEvent(QMouseEvent *event)
+{
+    if (!dragging) {
+        return;
+    }
+    origin = dragOrigin - (event->position() - dragStart) / scale;
+    fitted = false;
+    viewMoved();
+}
+
+void TiledImageView::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton) {
+        dragging = false;
+        setCursor(Qt::OpenHandCursor);
+    }
+}
@@ -0,0 +1,91 @@
+#ifndef TILEDIMAGEVIEW_H
+#define TILEDIMAGEVIEW_H
+
+#include "tilecache.h"
+#include "jpegindex.h"
+#include <QtWidgets/QWidget>
+#include <QtCore/QFuture>
+#include <QtCore/QPointF>
+#include <QtCore/QRect>
+#include <QtCore/QSharedPointer>
+#include <QtCore/QThreadPool>
+#include <atomic>
+#include <memory>
+
+// Просмотр очень больших JPEG тайлами: декодируется только видимая область
+// в масштабе DCT, ближайшем к текущему увеличению (1/2..1/8 средствами libjpeg,
+// дальше - усреднением), готовые тайлы хранятся в TileCache. Память растёт
+// с размером окна, а не изображения (кроме прогрессивных файлов, для которых
+// libjpeg держит коэффициенты всего изображения на время прохода).
+// Колесо мыши - масштаб, перетаскивание - прокрутка.
+class TiledImageView : public QWidget
+{
+    Q_OBJECT
+
+public:
+    static const int TileSize = 256;
+
+    explicit TiledImageView(QWidget *parent = nullptr);
+    ~TiledImageView();
+
+    bool setFile(const QSharedPointer<MappedJpegFile>& file);
+    void clear();
+
+    QSize imageSize() const { return fullSize; }
+    double zoom() const { return scale; }
+    int currentLevel() const { return levelForScale(); }
+    void fitToView();
+
+    void setCacheBudget(qint64 bytes) { cache.setBudget(bytes); }
+    TileCacheStats cacheStats() const { return cache.stats(); }
+
+signals:
+    void viewChanged();
+
+protected:
+    void paintEvent(QPaintEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void mouseReleaseEvent(QMouseEvent *event) override;
+
+private:
+    QSharedPointer<MappedJpegFile> file;
+    QSize fullSize;
+    double scale = 1.0;     // пикселей экрана на пиксель изображения
+    QPointF origin;         // точка изображения в левом верхнем углу виджета
+    bool fitted = true;
+    int maxLevel = 0;
+
+    TileCache cache;
+    QThreadPool decodePool;
+    QFuture<void> decodeFuture;
+    std::shared_ptr<std::atomic_bool> cancelFlag;
+    // Номер последнего запроса: окончание отменённого запроса, пришедшее
+    // после нового, не трогает его состояние
+    int requestGeneration = 0;
+    int requestedLevel = -1;
+    QRect requestedTiles;   // столбцы и строки тайлов
+    bool requestRunning = false;
+    bool requestDone = false;   // запрошенное декодировано и ещё лежит в кэше
+    bool requestFailed = false;
+
+    bool dragging = false;
+    QPointF dragStart;
+    QPointF dragOrigin;
+
+    int levelForScale() const;
+    QSize levelSize(int level) const;
+    double minimumScale() const;
+    void clampOrigin();
+    void viewMoved();
+    void requestTiles(int level, const QRect& tiles);
+    // Прерывает текущий запрос; wait - дождаться рабочего потока (смена файла),
+    // иначе запрос доработает сам, не дожидаясь GUI-поток
+    void cancelDecoding(bool wait);
+    bool tilesCached(int level, const QRect& tiles) const;
+    bool drawFromCoarserLevel(QPainter& painter, int level, int column, int row, const QRectF& target);
+};
+
+#endif // TILEDIMAGEVIEW_H
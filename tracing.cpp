@@ -0,0 +1,181 @@
+#include "tracing.h"
+#include <QtCore/QFile>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
+#include <QtCore/QJsonObject>
+#include <QtCore/QStringList>
+#include <QtCore/QThread>
+
+Tracer& Tracer::instance() {
+    static Tracer tracer;
+    return tracer;
+}
+
+Tracer::Tracer() {
+    clock.start();
+}
+
+int Tracer::threadIndex() {
+    const quintptr id = reinterpret_cast<quintptr>(QThread::currentThreadId());
+    int index = threads.indexOf(id);
+    if (index < 0) {
+        index = threads.size();
+        threads.append(id);
+    }
+    return index;
+}
+
+qint64 Tracer::accumulate(QVector<Total>& totals, const char* name, qint64 value) {
+    for (Total& total : totals) {
+        if (total.name == name || qstrcmp(total.name, name) == 0) {
+            total.value += value;
+            total.count++;
+            return total.value;
+        }
+    }
+    totals.append(Total{name, value, 1});
+    return value;
+}
+
+void Tracer::addInterval(const char* name, qint64 startUs, qint64 durationUs) {
+    QMutexLocker locker(&mutex);
+    if (events.size() < MaxEvents) {
+        TraceEvent event;
+        event.name = name;
+        event.phase = 'X';
+        event.startUs = startUs;
+        event.durationUs = durationUs;
+        event.thread = threadIndex();
+        events.append(event);
+    } else {
+        dropped++;
+    }
+    if (startUs >= operationStartUs) {
+        accumulate(stageTotals, name, durationUs);
+        operationEndUs = qMax(operationEndUs, startUs + durationUs);
+    }
+}
+
+void Tracer::addCounter(const char* name, qint64 value) {
+    QMutexLocker locker(&mutex);
+    // В trace_event счётчик - текущее значение, поэтому пишется накопленное
+    const qint64 cumulative = accumulate(counterTotals, name, value);
+    if (events.size() < MaxEvents) {
+        TraceEvent event;
+        event.name = name;
+        event.phase = 'C';
+        event.startUs = nowUs();
+        event.durationUs = cumulative;
+        event.thread = threadIndex();
+        events.append(event);
+    } else {
+        dropped++;
+    }
+}
+
+void Tracer::beginOperation(const QString& name) {
+    QMutexLocker locker(&mutex);
+    operation = name;
+    operationStartUs = nowUs();
+    operationEndUs = operationStartUs;
+    stageTotals.clear();
+    counterTotals.clear();
+}
+
+void Tracer::clear() {
+    QMutexLocker locker(&mutex);
+    events.clear();
+    dropped = 0;
+    operation.clear();
+    stageTotals.clear();
+    counterTotals.clear();
+}
+
+QString Tracer::lastOperationSummary() const {
+    QMutexLocker locker(&mutex);
+    if (operation.isEmpty()) {
+        return QString();
+    }
+
+    QStringList stages;
+    for (const Total& total : stageTotals) {
+        QString stage = QString("%1 %2").arg(QString::fromLatin1(total.name)).arg(total.value / 1000.0, 0, 'f', 1);
+        if (total.count > 1) {
+            stage += QString(" (x%1)").arg(total.count);
+        }
+        stages.append(stage);
+    }
+    QStringList counters;
+    for (const Total& total : counterTotals) {
+        const QString name = QString::fromLatin1(total.name);
+        if (name.endsWith("bytes") || name.startsWith("bytes")) {
+            counters.append(QString("%1 %2 MB").arg(name).arg(total.value / (1024.0 * 1024.0), 0, 'f', 2));
+        } else if (name == "pixels") {
+            counters.append(QString("%1 %2 MP").arg(name).arg(total.value / 1e6, 0, 'f', 2));
+        } else {
+            counters.append(QString("%1 %2").arg(name).arg(total.value));
+        }
+    }
+
+    QString summary = QString("%1 %2 ms: %3").arg(operation)
+                          .arg((operationEndUs - operationStartUs) / 1000.0, 0, 'f', 1)
+                          .arg(stages.join(", "));
+    if (!counters.isEmpty()) {
+        summary += " | " + counters.join(", ");
+    }
+    return summary;
+}
+
+bool Tracer::writeChromeTrace(const QString& filename, QString* error) const {
+    QJsonArray traceEvents;
+    QJsonObject otherData;
+    {
+        QMutexLocker locker(&mutex);
+        // Вызывается из GUI-потока, по нему и узнаётся главный поток
+        const quintptr current = reinterpret_cast<quintptr>(QThread::currentThreadId());
+        for (int thread = 0; thread < threads.size(); ++thread) {
+            QJsonObject args;
+            args["name"] = threads[thread] == current ? QString("main") : QString("worker %1").arg(thread);
+            QJsonObject metadata;
+            metadata["name"] = "thread_name";
+            metadata["ph"] = "M";
+            metadata["pid"] = 1;
+            metadata["tid"] = thread;
+            metadata["args"] = args;
+            traceEvents.append(metadata);
+        }
+        for (const TraceEvent& event : events) {
+            QJsonObject object;
+            object["name"] = QString::fromLatin1(event.name);
+            object["cat"] = "jpeg";
+            object["ph"] = QString(QChar::fromLatin1(event.phase));
+            object["ts"] = static_cast<double>(event.startUs);
+            object["pid"] = 1;
+            object["tid"] = event.thread;
+            if (event.phase == 'X') {
+                object["dur"] = static_cast<double>(event.durationUs);
+            } else {
+                QJsonObject args;
+                args["value"] = static_cast<double>(event.durationUs);
+                object["args"] = args;
+            }
+            traceEvents.append(object);
+        }
+        otherData["dropped_events"] = dropped;
+    }
+
+    QJsonObject root;
+    root["traceEvents"] = traceEvents;
+    root["displayTimeUnit"] = "ms";
+    root["otherData"] = otherData;
+    const QByteArray json = QJsonDocument(root).toJson(QJsonDocument::Compact);
+
+    QFile file(filename);
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size()) {
+        if (error) {
+            *error = file.errorString();
+        }
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,99 @@
+#ifndef TRACING_H
+#define TRACING_H
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+#include <QtCore/QtGlobal>
+
+// Трассировка этапов загрузки и сохранения. Собирается только с
+// DEFINES += JPEG_VIEWER_TRACING (qmake CONFIG+=tracing); без него макросы
+// TRACE_* раскрываются в пустые выражения и ничего не стоят.
+//
+// TRACE_SCOPE("decode")             - время до конца области видимости
+// TRACE_COUNTER("bytes_read", n)    - прибавляет n к счётчику
+// TRACE_OPERATION("load a.jpg")     - начинает новую операцию для сводки
+//
+// Имена - строковые литералы: указатель хранится без копирования.
+
+struct TraceEvent {
+    const char* name = nullptr;
+    char phase = 'X';       // 'X' - интервал, 'C' - счётчик (формат trace_event)
+    qint64 startUs = 0;
+    qint64 durationUs = 0;  // для счётчика - накопленное значение
+    int thread = 0;
+};
+
+class Tracer {
+public:
+    static const int MaxEvents = 1 << 20;
+
+    static Tracer& instance();
+
+    qint64 nowUs() const { return clock.nsecsElapsed() / 1000; }
+
+    void addInterval(const char* name, qint64 startUs, qint64 durationUs);
+    void addCounter(const char* name, qint64 value);
+    void beginOperation(const QString& name);
+    void clear();
+
+    // "load a.jpg 35.2 ms: open_file 0.1, decode 30.1 | bytes_read 1.2 MB"
+    QString lastOperationSummary() const;
+    // Формат Chrome trace_event (chrome://tracing, ui.perfetto.dev)
+    bool writeChromeTrace(const QString& filename, QString* error = nullptr) const;
+
+private:
+    struct Total {
+        const char* name;
+        qint64 value;
+        int count;
+    };
+
+    Tracer();
+
+    QElapsedTimer clock;
+    mutable QMutex mutex;
+    QVector<TraceEvent> events;
+    QVector<quintptr> threads;
+    int dropped = 0;
+
+    QString operation;
+    qint64 operationStartUs = 0;
+    qint64 operationEndUs = 0;
+    QVector<Total> stageTotals;
+    QVector<Total> counterTotals;
+
+    int threadIndex();
+    static qint64 accumulate(QVector<Total>& totals, const char* name, qint64 value);
+};
+
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name(name), startUs(Tracer::instance().nowUs()) {}
+    ~TraceScope() {
+        Tracer& tracer = Tracer::instance();
+        tracer.addInterval(name, startUs, tracer.nowUs() - startUs);
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name;
+    qint64 startUs;
+};
+
+#ifdef JPEG_VIEWER_TRACING
+#define TRACE_CONCAT_IMPL(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_IMPL(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_COUNTER(name, value) Tracer::instance().addCounter(name, static_cast<qint64>(value))
+#define TRACE_OPERATION(name) Tracer::instance().beginOperation(name)
+#else
+#define TRACE_SCOPE(name) static_cast<void>(0)
+#define TRACE_COUNTER(name, value) static_cast<void>(0)
+#define TRACE_OPERATION(name) static_cast<void>(0)
+#endif
+
+#endif // TRACING_H
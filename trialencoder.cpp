@@ -0,0 +1,129 @@
+#include "trialencoder.h"
+#include "imagemetrics.h"
+#include "jpegdecoder.h"
+#include "tracing.h"
+#include <QtConcurrent/QtConcurrent>
+#include <QtCore/QMetaObject>
+
+TrialEncoder::TrialEncoder(QObject *parent)
+    : QObject(parent)
+{
+    encodePool.setMaxThreadCount(1);
+    debounceTimer.setSingleShot(true);
+    debounceTimer.setInterval(DebounceMs);
+    connect(&debounceTimer, &QTimer::timeout, this, &TrialEncoder::start);
+}
+
+TrialEncoder::~TrialEncoder()
+{
+    cancel();
+    encodePool.waitForDone();
+}
+
+void TrialEncoder::setImage(const QImage& image)
+{
+    source = image;
+    if (hasRequest) {
+        request(options);
+    }
+}
+
+void TrialEncoder::setPreviewEnabled(bool enabled)
+{
+    if (previewEnabled == enabled) {
+        return;
+    }
+    previewEnabled = enabled;
+    if (hasRequest) {
+        request(options);
+    }
+}
+
+void TrialEncoder::request(const JpegEncodeOptions& newOptions)
+{
+    options = newOptions;
+    hasRequest = true;
+    // Кодирование старых параметров бросается сразу, не дожидаясь таймера
+    generation++;
+    if (job) {
+        job->cancelled = true;
+    }
+    debounceTimer.start();
+}
+
+void TrialEncoder::cancel()
+{
+    debounceTimer.stop();
+    hasRequest = false;
+    generation++;
+    if (job) {
+        job->cancelled = true;
+        job.reset();
+    }
+}
+
+void TrialEncoder::start()
+{
+    if (source.isNull()) {
+        return;
+    }
+
+    const int forGeneration = generation.load();
+    job = std::make_shared<Job>();
+    std::shared_ptr<Job> current = job;
+    const QImage image = source;
+    const JpegEncodeOptions trialOptions = options;
+    const bool withPreview = previewEnabled;
+    encodeFuture = QtConcurrent::run(&encodePool, [this, current, forGeneration, image, trialOptions, withPreview]() {
+        // Пока задача ждала очереди, параметры могли смениться
+        if (current->isCancelled()) {
+            return;
+        }
+        TRACE_SCOPE("trial_encode");
+        TrialEncodeResult result;
+        result.options = trialOptions;
+        result.imageSize = image.size();
+
+        JpegEncoder encoder(trialOptions);
+        encoder.setLoadMonitor(current.get());
+        QByteArray bytes;
+        if (!encoder.encode(image, bytes)) {
+            if (!current->isCancelled()) {
+                deliver(forGeneration, result, encoder.errorString());
+            }
+            return;
+        }
+        result.outputBytes = encoder.stats().outputBytes;
+        result.encodeMs = encoder.stats().encodeMs;
+
+        QImage decoded;
+        JpegDecoder decoder;
+        decoder.setLoadMonitor(current.get());
+        if (!decoder.open(bytes) || !decoder.decodeFinal(decoded)) {
+            if (!current->isCancelled()) {
+                deliver(forGeneration, result, decoder.errorString());
+            }
+            return;
+        }
+        result.psnr = ImageMetrics::psnr(image, decoded);
+        if (withPreview) {
+            result.preview = decoded;
+        }
+        deliver(forGeneration, result, QString());
+    });
+}
+
+void TrialEncoder::deliver(int forGeneration, const TrialEncodeResult& result, const QString& error)
+{
+    QMetaObject::invokeMethod(this, [this, forGeneration, result, error]() {
+        if (forGeneration != generation.load()) {
+            return;
+        }
+        job.reset();
+        if (error.isEmpty()) {
+            emit finished(result);
+        } else {
+            emit failed(error);
+        }
+    }, Qt::QueuedConnection);
+}
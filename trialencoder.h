@@ -0,0 +1,72 @@
+#ifndef TRIALENCODER_H
+#define TRIALENCODER_H
+
+#include "jpegencoder.h"
+#include "jpegstrategy.h"
+#include <QtCore/QObject>
+#include <QtGui/QImage>
+#include <QtCore/QFuture>
+#include <QtCore/QString>
+#include <QtCore/QThreadPool>
+#include <QtCore/QTimer>
+#include <atomic>
+#include <memory>
+
+struct TrialEncodeResult {
+    JpegEncodeOptions options;
+    QSize imageSize;
+    qint64 outputBytes = 0;
+    double encodeMs = 0.0;
+    double psnr = 0.0;      // дБ, бесконечность - без потерь
+    QImage preview;         // декодированный результат, если включён предпросмотр
+};
+
+// Пробное кодирование текущего изображения в память при каждой смене
+// параметров сохранения. Запросы сглаживаются таймером; новый запрос
+// прерывает кодирование предыдущего, устаревшие результаты не доставляются.
+class TrialEncoder : public QObject
+{
+    Q_OBJECT
+
+public:
+    static const int DebounceMs = 150;
+
+    explicit TrialEncoder(QObject *parent = nullptr);
+    ~TrialEncoder();
+
+    void setImage(const QImage& image);
+    QImage image() const { return source; }
+    void setPreviewEnabled(bool enabled);
+    bool isPreviewEnabled() const { return previewEnabled; }
+
+    void request(const JpegEncodeOptions& options);
+    void cancel();
+
+signals:
+    void finished(const TrialEncodeResult& result);
+    void failed(const QString& error);
+
+private:
+    class Job : public LoadMonitor {
+    public:
+        void progress(int percent) override { Q_UNUSED(percent); }
+        bool isCancelled() const override { return cancelled.load(); }
+        std::atomic_bool cancelled{false};
+    };
+
+    QImage source;
+    JpegEncodeOptions options;
+    bool hasRequest = false;
+    bool previewEnabled = false;
+
+    QTimer debounceTimer;
+    QThreadPool encodePool;
+    QFuture<void> encodeFuture;
+    std::shared_ptr<Job> job;
+    std::atomic_int generation{0};
+
+    void start();
+    void deliver(int forGeneration, const TrialEncodeResult& result, const QString& error);
+};
+
+#endif // TRIALENCODER_H